@@ -348,3 +348,30 @@ core.register_chatcommand("bench_bulk_swap_node", {
 		return true, msg
 	end,
 })
+
+core.register_chatcommand("bench_emerge", {
+	params = "",
+	description = "Benchmark: Generate 3×3×3 mapchunks in a new part of the world",
+	func = function(name, param)
+		-- A different place every time, so that the chunks are generated
+		local csize = tonumber(core.get_mapgen_setting("chunksize"))
+		local chunk = 16 * csize
+		-- Mapchunks are offset so that one is centered on the origin
+		local offset = -16 * math.floor(csize / 2)
+		local pos1 = vector.new(math.random(-300, 300), -1, math.random(-300, 300)) * chunk
+			+ vector.new(offset, offset, offset)
+		local pos2 = (pos1 + vector.new(3, 3, 3) * chunk):offset(-1, -1, -1)
+		local start_time = core.get_us_time()
+		core.emerge_area(pos1, pos2, function(blockpos, action, calls_remaining)
+			if calls_remaining > 0 then
+				return
+			end
+			local result_us = core.get_us_time() - start_time
+			local msg = string.format("Benchmark results: core.emerge_area of 27 mapchunks: %.2f ms, %.2f ms per mapchunk",
+				result_us / 1000, result_us / 27000)
+			print(msg)
+			core.chat_send_player(name, msg)
+		end)
+		return true, "Benchmarking core.emerge_area ..."
+	end,
+})
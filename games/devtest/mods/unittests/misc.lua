@@ -36,6 +36,39 @@ local function test_pcg_random()
 end
 unittests.register("test_pcg_random", test_pcg_random)
 
+local function test_voxel_buffer()
+	local buf = VoxelBuffer({1, 2, 3})
+	assert(#buf == 3)
+	assert(buf[2] == 2 and buf[0] == nil and buf[4] == nil)
+	buf[3] = 7
+	assert(table.concat(buf:to_table(), ",") == "1,2,7")
+	assert(not pcall(function() buf[4] = 1 end))
+	assert(not pcall(function() buf[1] = 65536 end))
+	assert(not pcall(function() buf[1] = -1 end))
+	assert(not pcall(buf.fill, buf, 65536))
+	assert(not pcall(VoxelBuffer, {1, 70000}))
+	buf:replace({[1] = 5, [7] = 8})
+	assert(table.concat(buf:to_table(), ",") == "5,2,8")
+	assert(not pcall(buf.replace, buf, {[1] = 65536}))
+
+	-- Round trip through a VoxelManip
+	local vm = VoxelManip()
+	vm:initialize(vector.zero(), vector.zero(), {name = "air", param2 = 4})
+	local data = vm:get_data(VoxelBuffer())
+	assert(#data == 16 * 16 * 16 and data[1] == core.CONTENT_AIR)
+	data:fill(core.CONTENT_IGNORE)
+	data[2] = core.CONTENT_UNKNOWN
+	vm:set_data(data)
+	assert(vm:get_data()[2] == core.CONTENT_UNKNOWN)
+	assert(vm:get_data()[3] == core.CONTENT_IGNORE)
+	assert(vm:get_param2_data(buf)[1] == 4 and #buf == #data)
+	assert(not pcall(vm.set_light_data, vm, VoxelBuffer(10)))
+	data:fill(256)
+	assert(not pcall(vm.set_light_data, vm, data))
+	assert(not pcall(vm.set_param2_data, vm, data))
+end
+unittests.register("test_voxel_buffer", test_voxel_buffer)
+
 local function test_dynamic_media(cb, player)
 	if core.get_player_information(player:get_player_name()).protocol_version < 40 then
 		core.log("warning", "test_dynamic_media: Client too old, skipping test.")
@@ -0,0 +1,196 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#include "catch.h"
+#include "unittest/mock_server.h"
+#include "server/blockmodifier.h"
+#include "serverenvironment.h"
+#include "servermap.h"
+#include "emerge.h"
+#include "filesys.h"
+#include "nodedef.h"
+#include "noise.h"
+#include <fstream>
+#include <memory>
+
+namespace {
+
+class BenchABM : public ActiveBlockModifier
+{
+public:
+	std::vector<std::string> trigger_contents;
+	std::vector<std::string> required_neighbors;
+	std::vector<std::string> without_neighbors;
+	u32 chance = 1;
+	u32 triggered = 0;
+
+	const std::vector<std::string> &getTriggerContents() const override
+	{ return trigger_contents; }
+	const std::vector<std::string> &getRequiredNeighbors() const override
+	{ return required_neighbors; }
+	const std::vector<std::string> &getWithoutNeighbors() const override
+	{ return without_neighbors; }
+	float getTriggerInterval() override { return 1.0f; }
+	u32 getTriggerChance() override { return chance; }
+	bool getSimpleCatchUp() override { return false; }
+	s16 getMinY() override { return S16_MIN; }
+	s16 getMaxY() override { return S16_MAX; }
+	void trigger(ServerEnvironment *env, v3s16 p, MapNode n,
+		u32 active_object_count, u32 active_object_count_wider) override
+	{ triggered++; }
+};
+
+// Number of node types scattered through the world for ABMs to trigger on
+constexpr int NUM_PLANTS = 40;
+
+// Number of registered ABMs
+constexpr int NUM_ABMS = 300;
+
+}
+
+TEST_CASE("benchmark_abm")
+{
+	const std::string world_path = fs::CreateTempDir();
+	REQUIRE(!world_path.empty());
+	{
+		std::ofstream ofs(world_path + DIR_DELIM "world.mt",
+			std::ios::out | std::ios::binary);
+		ofs << "backend = dummy\n";
+	}
+
+	MockServer server(world_path);
+	NodeDefManager *ndef = server.getWritableNodeDefManager();
+	auto add_node = [&] (const std::string &name) {
+		ContentFeatures f;
+		f.name = name;
+		return ndef->set(name, f);
+	};
+	const content_t c_stone = add_node("bench:stone");
+	const content_t c_dirt = add_node("bench:dirt");
+	const content_t c_water = add_node("bench:water");
+	std::vector<content_t> c_plants;
+	for (int i = 0; i < NUM_PLANTS; i++)
+		c_plants.push_back(add_node("bench:plant_" + std::to_string(i)));
+
+	MetricsBackend mb;
+	EmergeManager emerge(&server, &mb);
+	ServerEnvironment env(std::make_unique<ServerMap>(world_path, &server, &emerge, &mb),
+		&server, &mb);
+	ServerMap &map = env.getServerMap();
+
+	// Synthetic terrain: stone with a dirt surface, a water layer, and
+	// plants scattered on top of the dirt
+	std::vector<MapBlock *> blocks;
+	PcgRandom pr(1234);
+	for (s16 z = 0; z < 8; z++)
+	for (s16 y = -2; y < 2; y++)
+	for (s16 x = 0; x < 8; x++) {
+		MapBlock *block = map.createBlock(v3s16(x, y, z));
+		v3s16 p;
+		for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++)
+		for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++)
+		for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++) {
+			const s16 node_y = y * MAP_BLOCKSIZE + p.Y;
+			content_t c = CONTENT_AIR;
+			if (node_y < -4)
+				c = c_stone;
+			else if (node_y < 0)
+				c = c_dirt;
+			else if (node_y == 0 && pr.range(0, 3) == 0)
+				c = c_plants[pr.range(0, NUM_PLANTS - 1)];
+			else if (node_y < 3 && x < 2)
+				c = c_water;
+			block->setNodeNoCheck(p, MapNode(c));
+		}
+		blocks.push_back(block);
+	}
+
+	// ABMs of different kinds, most trigger on plants
+	std::vector<std::unique_ptr<BenchABM>> abm_defs;
+	std::vector<ABMWithState> abms;
+	for (int i = 0; i < NUM_ABMS; i++) {
+		auto abm = std::make_unique<BenchABM>();
+		switch (i % 4) {
+		case 0:
+			abm->trigger_contents.push_back("bench:dirt");
+			abm->required_neighbors.push_back("air");
+			abm->chance = 50;
+			break;
+		case 1:
+			abm->trigger_contents.push_back("bench:plant_" + std::to_string(i % NUM_PLANTS));
+			abm->required_neighbors.push_back("bench:water");
+			break;
+		case 2:
+			abm->trigger_contents.push_back("bench:plant_" + std::to_string(i % NUM_PLANTS));
+			abm->without_neighbors.push_back("bench:stone");
+			abm->chance = 5;
+			break;
+		default:
+			abm->trigger_contents.push_back("bench:plant_" + std::to_string(i % NUM_PLANTS));
+			abm->trigger_contents.push_back("bench:water");
+			abm->chance = 20;
+			break;
+		}
+		abms.emplace_back(abm.get());
+		abm_defs.push_back(std::move(abm));
+	}
+
+	// ABMs that always trigger find the same nodes with any thread count
+	{
+		std::vector<ABMWithState> exact_abms;
+		for (auto &abm : abm_defs) {
+			if (abm->chance == 1)
+				exact_abms.emplace_back(abm.get());
+		}
+		int expected = -1;
+		for (unsigned int threads : {0, 1, 4}) {
+			ABMHandler handler(&env, threads);
+			handler.step(exact_abms, 1.0f, false);
+			int scanned = 0, cached = 0, run = 0;
+			handler.scan(blocks, scanned, cached);
+			for (size_t i = 0; i < blocks.size(); i++)
+				handler.trigger(i, run);
+			REQUIRE(run > 0);
+			if (expected >= 0)
+				REQUIRE(run == expected);
+			expected = run;
+		}
+	}
+
+#define BENCH_SCAN(_label, _threads) \
+	BENCHMARK_ADVANCED("scan_" _label)(Catch::Benchmark::Chronometer meter) { \
+		ABMHandler handler(&env, _threads); \
+		handler.step(abms, 1.0f, false); \
+		int scanned = 0, cached = 0; \
+		meter.measure([&] { handler.scan(blocks, scanned, cached); }); \
+	};
+
+#define BENCH_INTERVAL(_label, _threads) \
+	BENCHMARK_ADVANCED("interval_" _label)(Catch::Benchmark::Chronometer meter) { \
+		ABMHandler handler(&env, _threads); \
+		int scanned = 0, cached = 0, run = 0; \
+		meter.measure([&] { \
+			handler.step(abms, 1.0f, false); \
+			handler.scan(blocks, scanned, cached); \
+			for (size_t i = 0; i < blocks.size(); i++) \
+				handler.trigger(i, run); \
+			return run; \
+		}); \
+	};
+
+	BENCH_SCAN("serial", 0)
+	BENCH_SCAN("1thread", 1)
+	BENCH_SCAN("2threads", 2)
+	BENCH_SCAN("4threads", 4)
+
+	BENCH_INTERVAL("serial", 0)
+	BENCH_INTERVAL("2threads", 2)
+	BENCH_INTERVAL("4threads", 4)
+
+#undef BENCH_SCAN
+#undef BENCH_INTERVAL
+
+	env.deactivateBlocksAndObjects();
+	fs::RecursiveDelete(world_path);
+}
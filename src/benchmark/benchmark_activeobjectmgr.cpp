@@ -97,6 +97,25 @@ void benchGetObjectsInArea(Catch::Benchmark::Chronometer &meter)
 	mgr.clear(); // implementation expects this
 }
 
+template <size_t N>
+void benchGetAddedActiveObjects(Catch::Benchmark::Chronometer &meter)
+{
+	server::ActiveObjectMgr mgr;
+	std::vector<u16> result;
+	// Like a client that knows nothing yet, every object in range is added
+	const std::set<u16> current_objects;
+
+	fill(mgr, N);
+	meter.measure([&] {
+		result.clear();
+		mgr.getAddedActiveObjectsAroundPos(randpos(), "singleplayer", 300.0f, 0.0f,
+			current_objects, result);
+		return result.size();
+	});
+
+	mgr.clear(); // implementation expects this
+}
+
 #define BENCH_INSIDE_RADIUS(_count) \
 	BENCHMARK_ADVANCED("inside_radius_" #_count)(Catch::Benchmark::Chronometer meter) \
 	{ benchGetObjectsInsideRadius<_count>(meter); };
@@ -105,6 +124,10 @@ void benchGetObjectsInArea(Catch::Benchmark::Chronometer &meter)
 	BENCHMARK_ADVANCED("in_area_" #_count)(Catch::Benchmark::Chronometer meter) \
 	{ benchGetObjectsInArea<_count>(meter); };
 
+#define BENCH_ADDED_AROUND_POS(_count) \
+	BENCHMARK_ADVANCED("added_around_pos_" #_count)(Catch::Benchmark::Chronometer meter) \
+	{ benchGetAddedActiveObjects<_count>(meter); };
+
 TEST_CASE("ActiveObjectMgr") {
 	BENCH_INSIDE_RADIUS(200)
 	BENCH_INSIDE_RADIUS(1450)
@@ -113,6 +136,10 @@ TEST_CASE("ActiveObjectMgr") {
 	BENCH_IN_AREA(200)
 	BENCH_IN_AREA(1450)
 	BENCH_IN_AREA(10000)
+
+	BENCH_ADDED_AROUND_POS(200)
+	BENCH_ADDED_AROUND_POS(1450)
+	BENCH_ADDED_AROUND_POS(10000)
 }
 
 // TODO benchmark active object manager update costs
@@ -0,0 +1,113 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#include "catch.h"
+#include "unittest/mock_server.h"
+#include "scripting_server.h"
+#include "server/luaentity_sao.h"
+#include "serverenvironment.h"
+#include "servermap.h"
+#include "emerge.h"
+#include "filesys.h"
+#include "nodedef.h"
+#include "noise.h"
+#include <fstream>
+#include <memory>
+
+namespace {
+
+constexpr u32 NUM_OBJECTS = 500;
+
+// Size of the pen the objects are in, in nodes
+constexpr s16 PEN_SIZE = 24;
+
+constexpr float DTIME = 0.09f;
+
+}
+
+TEST_CASE("benchmark_collision")
+{
+	const std::string world_path = fs::CreateTempDir();
+	REQUIRE(!world_path.empty());
+	{
+		std::ofstream ofs(world_path + DIR_DELIM "world.mt",
+			std::ios::out | std::ios::binary);
+		ofs << "backend = dummy\n";
+	}
+
+	MockServer server(world_path);
+	server.createScripting();
+	server.getScriptIface()->loadBuiltin();
+
+	NodeDefManager *ndef = server.getWritableNodeDefManager();
+	ContentFeatures f;
+	f.name = "bench:stone";
+	const content_t c_stone = ndef->set(f.name, f);
+	// A fence post with rails
+	f.name = "bench:fence";
+	f.drawtype = NDT_NODEBOX;
+	f.node_box.type = NODEBOX_FIXED;
+	f.node_box.fixed = {
+		aabb3f(-0.1f, -0.5f, -0.1f, 0.1f, 1.0f, 0.1f),
+		aabb3f(-0.5f, 0.2f, -0.05f, 0.5f, 0.3f, 0.05f),
+		aabb3f(-0.05f, 0.2f, -0.5f, 0.05f, 0.3f, 0.5f),
+	};
+	for (aabb3f &box : f.node_box.fixed) {
+		box.MinEdge *= BS;
+		box.MaxEdge *= BS;
+	}
+	const content_t c_fence = ndef->set(f.name, f);
+
+	MetricsBackend mb;
+	EmergeManager emerge(&server, &mb);
+	ServerEnvironment env(std::make_unique<ServerMap>(world_path, &server, &emerge, &mb),
+		&server, &mb);
+	ServerMap &map = env.getServerMap();
+
+	// Flat ground with a fenced pen on it
+	for (s16 z = 0; z < 2; z++)
+	for (s16 y = -1; y < 1; y++)
+	for (s16 x = 0; x < 2; x++)
+		map.createBlock(v3s16(x, y, z));
+	for (s16 z = 0; z <= PEN_SIZE + 1; z++)
+	for (s16 x = 0; x <= PEN_SIZE + 1; x++) {
+		for (s16 y = -MAP_BLOCKSIZE; y < 0; y++)
+			map.setNode(v3s16(x, y, z), MapNode(c_stone));
+		if (x == 0 || z == 0 || x == PEN_SIZE + 1 || z == PEN_SIZE + 1)
+			map.setNode(v3s16(x, 0, z), MapNode(c_fence));
+	}
+
+	// A crowd of mobs walking around in the pen
+	std::vector<LuaEntitySAO *> objects;
+	PcgRandom pr(42);
+	for (u32 i = 0; i < NUM_OBJECTS; i++) {
+		const v3f pos(pr.range(1, PEN_SIZE), 0, pr.range(1, PEN_SIZE));
+		auto obj_u = std::make_unique<LuaEntitySAO>(&env, pos * BS, "bench:mob", "");
+		LuaEntitySAO *obj = obj_u.get();
+		REQUIRE(env.addActiveObject(std::move(obj_u)) != 0);
+		ObjectProperties *prop = obj->accessObjectProperties();
+		prop->physical = true;
+		prop->collisionbox = aabb3f(-0.3f, -0.5f, -0.3f, 0.3f, 0.5f, 0.3f);
+		prop->stepheight = 0.6f;
+		obj->setVelocity(v3f(pr.range(-2, 2), 0, pr.range(-2, 2)) * BS);
+		obj->setAcceleration(v3f(0, -10, 0) * BS);
+		objects.push_back(obj);
+	}
+
+	// Everything is moved against the same state, like in the parallel
+	// phase of the object step
+	BENCHMARK("collision_crowd_prepare") {
+		for (LuaEntitySAO *obj : objects)
+			obj->prepareStep(DTIME);
+	};
+
+	// Each object sees the ones moved before it
+	BENCHMARK("collision_crowd_step") {
+		for (LuaEntitySAO *obj : objects)
+			obj->step(DTIME, false);
+	};
+
+	env.deactivateBlocksAndObjects();
+	fs::RecursiveDelete(world_path);
+}
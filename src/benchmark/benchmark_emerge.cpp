@@ -0,0 +1,71 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#include "catch.h"
+#include "emerge.h"
+#include <atomic>
+#include <thread>
+
+namespace {
+
+constexpr int NUM_BLOCKS = 100000;
+
+// Enqueues NUM_BLOCKS blocks from several producers, like many players
+// exploring at once, while the workers take them out again.
+void emergeStress(int num_producers, int num_workers)
+{
+	EmergeQueue queue(num_workers, NUM_BLOCKS, NUM_BLOCKS, NUM_BLOCKS);
+	std::atomic<int> taken{0};
+
+	std::vector<std::thread> workers;
+	for (int w = 0; w < num_workers; w++) {
+		workers.emplace_back([&, w] {
+			v3s16 pos;
+			BlockEmergeData bedata;
+			while (taken.load(std::memory_order_relaxed) < NUM_BLOCKS) {
+				if (queue.pop(w, true, &pos, &bedata))
+					taken++;
+				else
+					std::this_thread::yield();
+			}
+		});
+	}
+
+	std::vector<std::thread> producers;
+	for (int p = 0; p < num_producers; p++) {
+		producers.emplace_back([&, p] {
+			int worker;
+			const int count = NUM_BLOCKS / num_producers +
+				(p < NUM_BLOCKS % num_producers ? 1 : 0);
+			for (int i = 0; i < count; i++) {
+				// every producer explores its own column of blocks
+				v3s16 pos(p * 64 + i % 64, i / 4096, (i / 64) % 64);
+				queue.push(pos, p + 1, BLOCK_EMERGE_ALLOW_GEN | BLOCK_EMERGE_FORCE_QUEUE,
+					nullptr, nullptr, i % 97, &worker);
+			}
+		});
+	}
+
+	for (auto &t : producers)
+		t.join();
+	for (auto &t : workers)
+		t.join();
+}
+
+}
+
+TEST_CASE("benchmark_emerge")
+{
+#define BENCH_STRESS(_producers, _workers) \
+	BENCHMARK("emerge_" #_producers "producers_" #_workers "workers") { \
+		emergeStress(_producers, _workers); \
+	};
+
+	BENCH_STRESS(1, 1)
+	BENCH_STRESS(4, 1)
+	BENCH_STRESS(4, 4)
+	BENCH_STRESS(8, 4)
+
+#undef BENCH_STRESS
+}
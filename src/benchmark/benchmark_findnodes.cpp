@@ -0,0 +1,105 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#include "catch.h"
+#include "dummygamedef.h"
+#include "dummymap.h"
+#include "noise.h"
+
+namespace {
+
+enum : content_t {
+	C_STONE = 10,
+	C_DIRT,
+	C_GRASS,
+	C_SAND,
+	C_WATER,
+	C_COAL,
+	C_DIAMOND,
+};
+
+// 8x8 columns of 8 blocks, from y = -64 to 63
+const v3s16 BPMIN(0, -4, 0);
+const v3s16 BPMAX(7, 3, 7);
+
+/*
+	Fills the map like a simple mapgen: hilly stone with dirt and grass on
+	top, sand and water below sea level (0), coal everywhere in the stone
+	and diamonds only deep down.
+*/
+void generate(DummyMap &map)
+{
+	PcgRandom pr(42);
+	const v3s16 minp = BPMIN * MAP_BLOCKSIZE;
+	const v3s16 maxp = (BPMAX + 1) * MAP_BLOCKSIZE - 1;
+	for (s16 z = minp.Z; z <= maxp.Z; z++)
+	for (s16 x = minp.X; x <= maxp.X; x++) {
+		s16 height = 20 * noise2d_fractal(x / 50.0f, z / 50.0f, 1234, 3, 0.5f);
+		for (s16 y = minp.Y; y <= maxp.Y; y++) {
+			content_t c;
+			if (y < height - 3) {
+				c = C_STONE;
+				if (pr.range(0, 99) == 0)
+					c = C_COAL;
+				else if (y < -48 && pr.range(0, 1999) == 0)
+					c = C_DIAMOND;
+			} else if (y < height) {
+				c = C_DIRT;
+			} else if (y == height) {
+				c = height >= 0 ? C_GRASS : C_SAND;
+			} else {
+				c = y <= 0 ? C_WATER : CONTENT_AIR;
+			}
+			map.setNode(v3s16(x, y, z), MapNode(c));
+		}
+	}
+}
+
+// Counts the nodes like core.find_nodes_in_area() would find them
+u32 findNodes(DummyMap &map, const std::vector<content_t> &filter, bool skip_blocks)
+{
+	const v3s16 minp = BPMIN * MAP_BLOCKSIZE;
+	const v3s16 maxp = (BPMAX + 1) * MAP_BLOCKSIZE - 1;
+	u32 found = 0;
+	auto callback = [&] (v3s16 p, MapNode n) -> bool {
+		if (CONTAINS(filter, n.getContent()))
+			found++;
+		return true;
+	};
+	if (skip_blocks)
+		map.forEachNodeInArea(minp, maxp, filter, callback);
+	else
+		map.forEachNodeInArea(minp, maxp, callback);
+	return found;
+}
+
+}
+
+TEST_CASE("benchmark_findnodes")
+{
+	DummyGameDef gamedef;
+	DummyMap map(&gamedef, BPMIN, BPMAX);
+	generate(map);
+
+#define BENCH_FIND(_name, ...) \
+	{ \
+		const std::vector<content_t> filter{__VA_ARGS__}; \
+		REQUIRE(findNodes(map, filter, true) == findNodes(map, filter, false)); \
+		BENCHMARK("find_" _name "_all") { \
+			return findNodes(map, filter, false); \
+		}; \
+		BENCHMARK("find_" _name "_skip") { \
+			return findNodes(map, filter, true); \
+		}; \
+	}
+
+	// Only in a few deep blocks
+	BENCH_FIND("diamond", C_DIAMOND)
+	// Only in the blocks around the surface
+	BENCH_FIND("grass", C_GRASS, C_SAND)
+	// Everywhere below the surface, nothing to skip
+	BENCH_FIND("coal", C_COAL)
+
+#undef BENCH_FIND
+}
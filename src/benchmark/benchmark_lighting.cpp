@@ -6,6 +6,102 @@
 #include "voxelalgorithms.h"
 #include "dummygamedef.h"
 #include "dummymap.h"
+#include "mapgen/mapgen.h"
+#include "noise.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Terrain of one mapchunk with the default chunksize and the border of
+// blocks around it that the mapgens light together with it
+class LightingChunk {
+public:
+	LightingChunk(DummyGameDef &gamedef) :
+		m_map(&gamedef, v3s16(-1, -1, -1), v3s16(5, 5, 5)),
+		m_vm(&m_map)
+	{
+		NodeDefManager *ndef = gamedef.getWritableNodeDefManager();
+		auto add_node = [&] (const std::string &name, bool propagates,
+				bool sun_propagates, u8 source) {
+			ContentFeatures f;
+			f.name = name;
+			f.param_type = CPT_LIGHT;
+			f.light_propagates = propagates;
+			f.sunlight_propagates = sun_propagates;
+			f.light_source = source;
+			return ndef->set(f.name, f);
+		};
+		const content_t c_stone = add_node("chunk_stone", false, false, 0);
+		const content_t c_water = add_node("chunk_water", true, false, 0);
+		const content_t c_leaves = add_node("chunk_leaves", true, false, 0);
+		const content_t c_torch = add_node("chunk_torch", true, true, 13);
+		const content_t c_lava = add_node("chunk_lava", true, false, 14);
+
+		m_vm.initialEmerge(v3s16(-1, -1, -1), v3s16(5, 5, 5), false);
+		const VoxelArea &area = m_vm.m_area;
+
+		// Hills around the water level with caves below
+		NoiseParams np_height(20, 16, v3f(60, 60, 60), 1, 3, 0.5, 2.0);
+		NoiseParams np_cave(0, 1, v3f(24, 24, 24), 2, 2, 0.5, 2.0);
+		const v3s32 size = area.getExtent();
+		Noise height(&np_height, 1, size.X, size.Z);
+		Noise cave(&np_cave, 1, size.X, size.Y, size.Z);
+		height.noiseMap2D(area.MinEdge.X, area.MinEdge.Z);
+		cave.noiseMap3D(area.MinEdge.X, area.MinEdge.Y, area.MinEdge.Z);
+
+		PcgRandom pr(42);
+		u32 i = 0;
+		for (s16 z = area.MinEdge.Z; z <= area.MaxEdge.Z; z++)
+		for (s16 y = area.MinEdge.Y; y <= area.MaxEdge.Y; y++)
+		for (s16 x = area.MinEdge.X; x <= area.MaxEdge.X; x++, i++) {
+			const u32 i2d = (z - area.MinEdge.Z) * size.X + (x - area.MinEdge.X);
+			const s16 ground = height.result[i2d];
+			content_t c = CONTENT_AIR;
+			if (y <= ground) {
+				c = c_stone;
+				if (std::fabs(cave.result[i]) < 0.15f)
+					c = pr.range(0, 200) == 0 ? c_torch : CONTENT_AIR;
+				else if (y < -10 && pr.range(0, 5000) == 0)
+					c = c_lava;
+			} else if (y <= WATER_LEVEL) {
+				c = c_water;
+			} else if (y <= ground + 6 && pr.range(0, 30) == 0) {
+				c = c_leaves;
+			}
+			m_initial.emplace_back(c);
+		}
+	}
+
+	// Lights the whole chunk like a mapgen does after generating it
+	void light(Mapgen &mg)
+	{
+		std::copy(m_initial.begin(), m_initial.end(), m_vm.m_data);
+		mg.vm = &m_vm;
+		mg.water_level = WATER_LEVEL;
+		const v3s16 node_min(0, 0, 0);
+		const v3s16 node_max(79, 79, 79);
+		mg.calcLighting(node_min - v3s16(0, 1, 0), node_max + v3s16(0, 1, 0),
+			node_min - MAP_BLOCKSIZE, node_max + MAP_BLOCKSIZE);
+	}
+
+	u32 getLightHash() const
+	{
+		u32 hash = 2166136261U;
+		for (u32 i = 0; i < m_vm.m_area.getVolume(); i++)
+			hash = (hash ^ m_vm.m_data[i].param1) * 16777619U;
+		return hash;
+	}
+
+private:
+	static constexpr s16 WATER_LEVEL = 1;
+
+	DummyMap m_map;
+	MMVManip m_vm;
+	std::vector<MapNode> m_initial;
+};
+
+}
 
 TEST_CASE("benchmark_lighting")
 {
@@ -68,4 +164,35 @@ TEST_CASE("benchmark_lighting")
 			voxalgo::blit_back_with_light(&map, &vm, &modified_blocks);
 		});
 	};
+
+	// Lighting of a freshly generated mapchunk
+	{
+		LightingChunk chunk(gamedef);
+
+		// The result must not depend on the number of threads
+		u32 expected = 0;
+		for (u16 threads : {0, 1, 4}) {
+			Mapgen mg;
+			mg.ndef = ndef;
+			mg.light_threads = threads;
+			chunk.light(mg);
+			if (threads > 0)
+				REQUIRE(chunk.getLightHash() == expected);
+			expected = chunk.getLightHash();
+		}
+
+#define BENCH_CHUNK(_label, _threads) \
+		BENCHMARK_ADVANCED("Mapgen::calcLighting_" _label)(Catch::Benchmark::Chronometer meter) { \
+			Mapgen mg; \
+			mg.ndef = ndef; \
+			mg.light_threads = _threads; \
+			meter.measure([&] { chunk.light(mg); }); \
+		};
+
+		BENCH_CHUNK("serial", 0)
+		BENCH_CHUNK("2threads", 2)
+		BENCH_CHUNK("4threads", 4)
+
+#undef BENCH_CHUNK
+	}
 }
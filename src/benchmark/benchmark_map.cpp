@@ -6,6 +6,7 @@
 #include "dummygamedef.h"
 #include "map.h"
 #include "mapsector.h"
+#include "profiler.h"
 
 namespace {
 class TestMap : public Map {
@@ -30,6 +31,29 @@ class TestMap : public Map {
 		return sector->createBlankBlock(block_y);
 	}
 
+	// How getBlockNoCreateNoEx() used to look up blocks, for comparison
+	MapBlock *getBlockBySector(v3s16 p)
+	{
+		MapSector *sector = getSectorNoGenerate(v2s16(p.X, p.Z));
+		return sector ? sector->getBlockNoCreateNoEx(p.Y) : nullptr;
+	}
+
+	MapBlock *getBlockTest(v3s16 p, bool by_sector)
+	{
+		return by_sector ? getBlockBySector(p) : getBlockNoCreateNoEx(p);
+	}
+
+	bool saveBlock(MapBlock *block) override
+	{
+		block->resetModified();
+		return true;
+	}
+
+	u32 saveTest()
+	{
+		Profiler modprofiler;
+		return saveModifiedBlocks(MOD_STATE_WRITE_NEEDED, modprofiler);
+	}
 };
 }
 
@@ -44,14 +68,23 @@ static void fillMap(TestMap &map, s16 n)
 	}
 }
 
-static int readBlocks(Map &map, s16 n)
+static void modifyBlocks(Map &map, s16 n, u32 count)
+{
+	for (u32 i = 0; i < count; i++) {
+		v3s16 p(i % n, (i / n) % n, (i / n / n) % n);
+		MapBlock *block = map.getBlockNoCreateNoEx(p);
+		block->raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE);
+	}
+}
+
+static int readBlocks(TestMap &map, s16 n, bool by_sector = false)
 {
 	int result = 0;
 	for(s16 z=0; z<n; z++)
 	for(s16 y=0; y<n; y++)
 	for(s16 x=0; x<n; x++) {
 		v3s16 p(x,y,z);
-		MapBlock *block = map.getBlockNoCreateNoEx(p);
+		MapBlock *block = map.getBlockTest(p, by_sector);
 		if (block) {
 			result++;
 		}
@@ -59,12 +92,12 @@ static int readBlocks(Map &map, s16 n)
 	return result;
 }
 
-static int readRandomBlocks(Map &map, s16 n)
+static int readRandomBlocks(TestMap &map, s16 n, bool by_sector = false)
 {
 	int result = 0;
 	for(int i=0; i < n * n * n; i++) {
 		v3s16 p(myrand_range(0, n), myrand_range(0, n), myrand_range(0, n));
-		MapBlock *block = map.getBlockNoCreateNoEx(p);
+		MapBlock *block = map.getBlockTest(p, by_sector);
 		if (block) {
 			result++;
 		}
@@ -73,14 +106,14 @@ static int readRandomBlocks(Map &map, s16 n)
 }
 
 
-static int readYColumn(Map &map, s16 n)
+static int readYColumn(TestMap &map, s16 n, bool by_sector = false)
 {
 	int result = 0;
 	for(s16 z=0; z<n; z++)
 	for(s16 x=0; x<n; x++)
 	for(s16 y=n-1; y>0; y--) {
 		v3s16 p(x,y,z);
-		MapBlock *block = map.getBlockNoCreateNoEx(p);
+		MapBlock *block = map.getBlockTest(p, by_sector);
 		if (block) {
 			result++;
 		}
@@ -88,6 +121,31 @@ static int readYColumn(Map &map, s16 n)
 	return result;
 }
 
+static int readNeighborhoods(TestMap &map, s16 n, bool batch)
+{
+	int result = 0;
+	MapBlock *blocks[27];
+	for(s16 z=1; z<n-1; z++)
+	for(s16 y=1; y<n-1; y++)
+	for(s16 x=1; x<n-1; x++) {
+		v3s16 p(x,y,z);
+		if (batch) {
+			map.getBlockNeighborhood(p, blocks);
+		} else {
+			int i = 0;
+			for (s16 dz = -1; dz <= 1; dz++)
+			for (s16 dy = -1; dy <= 1; dy++)
+			for (s16 dx = -1; dx <= 1; dx++)
+				blocks[i++] = map.getBlockNoCreateNoEx(p + v3s16(dx, dy, dz));
+		}
+		for (MapBlock *block : blocks) {
+			if (block)
+				result++;
+		}
+	}
+	return result;
+}
+
 static int readNodes(Map &map, s16 n)
 {
 	int result = 0;
@@ -126,6 +184,14 @@ static int readNodes(Map &map, s16 n)
 			return readBlocks(map, _count); \
 		}); \
 	}; \
+	BENCHMARK_ADVANCED("readFilledSector_" #_count)(Catch::Benchmark::Chronometer meter) { \
+		DummyGameDef gamedef; \
+		TestMap map(&gamedef); \
+		fillMap(map, _count); \
+		meter.measure([&] { \
+			return readBlocks(map, _count, true); \
+		}); \
+	}; \
 	BENCHMARK_ADVANCED("readEmptyYCol_" #_count)(Catch::Benchmark::Chronometer meter) { \
 		DummyGameDef gamedef; \
 		TestMap map(&gamedef); \
@@ -141,6 +207,14 @@ static int readNodes(Map &map, s16 n)
 			return readYColumn(map, _count); \
 		}); \
 	}; \
+	BENCHMARK_ADVANCED("readFilledYColSector_" #_count)(Catch::Benchmark::Chronometer meter) { \
+		DummyGameDef gamedef; \
+		TestMap map(&gamedef); \
+		fillMap(map, _count); \
+		meter.measure([&] { \
+			return readYColumn(map, _count, true); \
+		}); \
+	}; \
 	BENCHMARK_ADVANCED("readEmptyRandom_" #_count)(Catch::Benchmark::Chronometer meter) { \
 		DummyGameDef gamedef; \
 		TestMap map(&gamedef); \
@@ -156,6 +230,30 @@ static int readNodes(Map &map, s16 n)
 			return readRandomBlocks(map, _count); \
 		}); \
 	}; \
+	BENCHMARK_ADVANCED("readFilledRandomSector_" #_count)(Catch::Benchmark::Chronometer meter) { \
+		DummyGameDef gamedef; \
+		TestMap map(&gamedef); \
+		fillMap(map, _count); \
+		meter.measure([&] { \
+			return readRandomBlocks(map, _count, true); \
+		}); \
+	}; \
+	BENCHMARK_ADVANCED("readFilledNeighborhood_" #_count)(Catch::Benchmark::Chronometer meter) { \
+		DummyGameDef gamedef; \
+		TestMap map(&gamedef); \
+		fillMap(map, _count); \
+		meter.measure([&] { \
+			return readNeighborhoods(map, _count, false); \
+		}); \
+	}; \
+	BENCHMARK_ADVANCED("readFilledNeighborhoodBatch_" #_count)(Catch::Benchmark::Chronometer meter) { \
+		DummyGameDef gamedef; \
+		TestMap map(&gamedef); \
+		fillMap(map, _count); \
+		meter.measure([&] { \
+			return readNeighborhoods(map, _count, true); \
+		}); \
+	}; \
 	BENCHMARK_ADVANCED("readEmptyNodes_" #_count)(Catch::Benchmark::Chronometer meter) { \
 		DummyGameDef gamedef; \
 		TestMap map(&gamedef); \
@@ -177,3 +275,35 @@ TEST_CASE("benchmark_map") {
 	BENCH1(10)
 	BENCH1(40) // 64.000 blocks
 }
+
+// The cost should depend on the number of modified blocks, not loaded blocks
+#define BENCH_SAVE(_count, _modified) \
+	BENCHMARK_ADVANCED("save_" #_count "_" #_modified)(Catch::Benchmark::Chronometer meter) { \
+		DummyGameDef gamedef; \
+		TestMap map(&gamedef); \
+		fillMap(map, _count); \
+		map.saveTest(); \
+		meter.measure([&] { \
+			modifyBlocks(map, _count, _modified); \
+			return map.saveTest(); \
+		}); \
+	};
+
+// Nothing expires (the clock does not advance), this should not depend on the map size
+#define BENCH_TIMER(_count) \
+	BENCHMARK_ADVANCED("timerUpdate_" #_count)(Catch::Benchmark::Chronometer meter) { \
+		DummyGameDef gamedef; \
+		TestMap map(&gamedef); \
+		fillMap(map, _count); \
+		meter.measure([&] { \
+			map.timerUpdate(0.0f, 300.0f, -1); \
+		}); \
+	};
+
+TEST_CASE("benchmark_map_save") {
+	BENCH_SAVE(10, 100)
+	BENCH_SAVE(40, 100)
+	BENCH_SAVE(40, 10000)
+	BENCH_TIMER(10)
+	BENCH_TIMER(40)
+}
@@ -3,7 +3,10 @@
 // Copyright (C) 2023 Minetest Authors
 
 #include "catch.h"
+#include "dummygamedef.h"
 #include "mapblock.h"
+#include "noise.h"
+#include "voxel.h"
 #include <vector>
 
 typedef std::vector<MapBlock*> MBContainer;
@@ -30,6 +33,72 @@ static void freeSome(MBContainer &vec, u32 n)
 
 static inline void freeAll(MBContainer &vec) { freeSome(vec, vec.size()); }
 
+/*
+	Allocates blocks filled like a simple mapgen does: hilly stone with some
+	coal, dirt and grass on top, water below sea level (0) and lit air.
+	With palette, the blocks are written back from a VoxelManipulator like
+	mapgens do, which lets them use a palette. Otherwise they're written
+	node by node and keep the full array.
+*/
+static void generateSome(MBContainer &vec, u32 n, IGameDef *gamedef, bool palette)
+{
+	enum : content_t { C_STONE = 10, C_COAL, C_DIRT, C_GRASS, C_WATER };
+
+	PcgRandom pr(42);
+	VoxelManipulator vm;
+	vec.reserve(vec.size() + n);
+	for (u32 i = 0; i < n; i++) {
+		// Columns of 8 blocks from y = -64 to 63
+		const v3s16 bp(i % 16, (i / 16) % 8 - 4, i / 128);
+		auto *mb = new MapBlock(bp, gamedef);
+		const v3s16 minp = mb->getPosRelative();
+		vm.clear();
+		vm.addArea(VoxelArea(minp, minp + MAP_BLOCKSIZE - 1));
+		for (s16 z = minp.Z; z < minp.Z + MAP_BLOCKSIZE; z++)
+		for (s16 x = minp.X; x < minp.X + MAP_BLOCKSIZE; x++) {
+			const s16 height = 20 * noise2d_fractal(x / 50.0f, z / 50.0f, 1234, 3, 0.5f);
+			for (s16 y = minp.Y; y < minp.Y + MAP_BLOCKSIZE; y++) {
+				MapNode node;
+				if (y < height - 3)
+					node = MapNode(pr.range(0, 99) == 0 ? C_COAL : C_STONE);
+				else if (y < height)
+					node = MapNode(C_DIRT);
+				else if (y == height)
+					node = MapNode(C_GRASS);
+				else if (y <= 0)
+					node = MapNode(C_WATER);
+				else
+					node = MapNode(CONTENT_AIR, 15);
+				vm.setNodeNoEmerge(v3s16(x, y, z), node);
+			}
+		}
+		if (palette) {
+			mb->copyFrom(vm);
+		} else {
+			v3s16 p;
+			for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++)
+			for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++)
+			for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++)
+				mb->setNodeNoCheck(p, vm.getNodeNoExNoEmerge(minp + p));
+		}
+		vec.push_back(mb);
+	}
+}
+
+// Bytes used for the nodes, and how many of that would be used without palettes
+static std::pair<size_t, size_t> getNodeStorageSize(const MBContainer &vec)
+{
+	constexpr size_t dense_size = sizeof(MapNode) * MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE;
+	size_t size = 0, without_palette = 0;
+	for (MapBlock *block : vec) {
+		const size_t block_size = block->getNodeStorageSize();
+		size += block_size;
+		// Monoblocks only store one node
+		without_palette += block_size == sizeof(MapNode) ? block_size : dense_size;
+	}
+	return {size, without_palette};
+}
+
 // usage patterns inspired by ClientMap::updateDrawList()
 static void workOnMetadata(const MBContainer &vec)
 {
@@ -84,7 +153,7 @@ static u32 workOnNodes(const MBContainer &vec)
 	return foo;
 }
 
-// usage patterns inspired by ABMHandler::apply()
+// usage patterns inspired by ABMHandler::scanBlock()
 // touches both metadata and node data at the same time
 static u32 workOnBoth(const MBContainer &vec)
 {
@@ -165,8 +234,43 @@ static u32 workOnBoth(const MBContainer &vec)
 		freeAll(vec); \
 	};
 
+#define BENCH_PALETTE(_count) \
+	{ \
+		MBContainer dense, palette, expanded; \
+		generateSome(dense, _count, &gamedef, false); \
+		generateSome(palette, _count, &gamedef, true); \
+		/* like active blocks */ \
+		generateSome(expanded, _count, &gamedef, true); \
+		for (MapBlock *block : expanded) \
+			block->expandPalette(); \
+		REQUIRE(workOnNodes(dense) == workOnNodes(palette)); \
+		REQUIRE(workOnNodes(dense) == workOnNodes(expanded)); \
+		const auto [size, without_palette] = getNodeStorageSize(palette); \
+		WARN("node storage of " #_count " blocks: " << getNodeStorageSize(dense).first << \
+			" bytes dense, " << without_palette << " with monoblocks, " << \
+			size << " with palettes"); \
+		BENCHMARK("nodes_dense_" #_count) { \
+			return workOnNodes(dense); \
+		}; \
+		BENCHMARK("nodes_palette_" #_count) { \
+			return workOnNodes(palette); \
+		}; \
+		BENCHMARK("nodes_expanded_" #_count) { \
+			return workOnNodes(expanded); \
+		}; \
+		freeAll(dense); \
+		freeAll(palette); \
+		freeAll(expanded); \
+	}
+
 TEST_CASE("benchmark_mapblock") {
 	BENCH1(900)
 	BENCH1(2200)
 	BENCH1(7500) // <- default client_mapblock_limit
 }
+
+TEST_CASE("benchmark_mapblock_palette") {
+	DummyGameDef gamedef;
+	BENCH_PALETTE(900)
+	BENCH_PALETTE(2200)
+}
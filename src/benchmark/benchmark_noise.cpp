@@ -0,0 +1,155 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#include "catch.h"
+#include "noise.h"
+#include "mapgen/mapgen_v7.h"
+#include "mapgen/mapgen_valleys.h"
+#include "mapgen/mapgen_carpathian.h"
+#include <memory>
+
+namespace {
+
+// Side length of a mapchunk with the default chunksize
+constexpr s16 CHUNK_SIZE = 80;
+
+constexpr s32 SEED = 1337;
+
+/*
+	The noise maps a mapgen computes for every mapchunk, with the sizes
+	used by the mapgen constructors and the cave generators.
+*/
+class ChunkNoises {
+public:
+	void add2D(const NoiseParams &np, bool persist_source = false,
+		bool persisted = false)
+	{
+		m_noises.push_back({std::make_unique<Noise>(&np, SEED, CHUNK_SIZE, CHUNK_SIZE),
+			false, persist_source, persisted});
+	}
+
+	void add3D(const NoiseParams &np, s16 extra_y)
+	{
+		m_noises.push_back({std::make_unique<Noise>(&np, SEED,
+			CHUNK_SIZE, CHUNK_SIZE + extra_y, CHUNK_SIZE), true, false, false});
+	}
+
+	void addCaves(const NoiseParams &cave1, const NoiseParams &cave2,
+		const NoiseParams &cavern)
+	{
+		add3D(cave1, 1);
+		add3D(cave2, 1);
+		add3D(cavern, 1);
+	}
+
+	// Returns a sum of the results so that nothing is optimized out
+	float generate(v3s16 chunk)
+	{
+		const v3s16 node_min = chunk * CHUNK_SIZE;
+		float *persistmap = nullptr;
+		float sum = 0;
+		for (auto &entry : m_noises) {
+			float *map;
+			if (entry.is3d)
+				map = entry.noise->noiseMap3D(node_min.X, node_min.Y - 1, node_min.Z);
+			else
+				map = entry.noise->noiseMap2D(node_min.X, node_min.Z,
+					entry.persisted ? persistmap : nullptr);
+			if (entry.persist_source)
+				persistmap = map;
+			sum += map[0];
+		}
+		return sum;
+	}
+
+private:
+	struct Entry {
+		std::unique_ptr<Noise> noise;
+		bool is3d;
+		// the result is the persistence map for the entries below
+		bool persist_source;
+		bool persisted;
+	};
+
+	std::vector<Entry> m_noises;
+};
+
+// Terrain with mountains and ridges, floatlands are off by default
+void setupV7(ChunkNoises &noises)
+{
+	MapgenV7Params params;
+	noises.add2D(params.np_terrain_persist, true);
+	noises.add2D(params.np_terrain_base, false, true);
+	noises.add2D(params.np_terrain_alt, false, true);
+	noises.add2D(params.np_height_select);
+	noises.add2D(params.np_filler_depth);
+	noises.add2D(params.np_mount_height);
+	noises.add3D(params.np_mountain, 2);
+	noises.add3D(params.np_ridge, 2);
+	noises.add2D(params.np_ridge_uwater);
+	noises.addCaves(params.np_cave1, params.np_cave2, params.np_cavern);
+}
+
+void setupValleys(ChunkNoises &noises)
+{
+	MapgenValleysParams params;
+	noises.add2D(params.np_filler_depth);
+	noises.add2D(params.np_inter_valley_slope);
+	noises.add2D(params.np_rivers);
+	noises.add2D(params.np_terrain_height);
+	noises.add2D(params.np_valley_depth);
+	noises.add2D(params.np_valley_profile);
+	noises.add3D(params.np_inter_valley_fill, 2);
+	noises.addCaves(params.np_cave1, params.np_cave2, params.np_cavern);
+}
+
+// Rivers are off by default
+void setupCarpathian(ChunkNoises &noises)
+{
+	MapgenCarpathianParams params;
+	noises.add2D(params.np_filler_depth);
+	noises.add2D(params.np_height1);
+	noises.add2D(params.np_height2);
+	noises.add2D(params.np_height3);
+	noises.add2D(params.np_height4);
+	noises.add2D(params.np_hills_terrain);
+	noises.add2D(params.np_ridge_terrain);
+	noises.add2D(params.np_step_terrain);
+	noises.add2D(params.np_hills);
+	noises.add2D(params.np_ridge_mnt);
+	noises.add2D(params.np_step_mnt);
+	noises.add3D(params.np_mnt_var, 2);
+	noises.addCaves(params.np_cave1, params.np_cave2, params.np_cavern);
+}
+
+}
+
+TEST_CASE("benchmark_noise")
+{
+#define BENCH_MAPGEN(_name, _setup) \
+	BENCHMARK_ADVANCED("noise_chunk_" _name)(Catch::Benchmark::Chronometer meter) { \
+		ChunkNoises noises; \
+		_setup(noises); \
+		s16 x = 0; \
+		meter.measure([&] { return noises.generate(v3s16(x++, 0, 3)); }); \
+	};
+
+	BENCH_MAPGEN("v7", setupV7)
+	BENCH_MAPGEN("valleys", setupValleys)
+	BENCH_MAPGEN("carpathian", setupCarpathian)
+
+#undef BENCH_MAPGEN
+
+	NoiseParams np(0, 1, v3f(100, 100, 100), 42, 4, 0.6, 2.0);
+	BENCHMARK_ADVANCED("noise_map2d_eased")(Catch::Benchmark::Chronometer meter) {
+		np.flags = NOISE_FLAG_EASED;
+		Noise noise(&np, SEED, 256, 256);
+		meter.measure([&] { return noise.noiseMap2D(0, 0)[0]; });
+	};
+	BENCHMARK_ADVANCED("noise_map3d")(Catch::Benchmark::Chronometer meter) {
+		np.flags = 0;
+		Noise noise(&np, SEED, 64, 64, 64);
+		meter.measure([&] { return noise.noiseMap3D(0, 0, 0)[0]; });
+	};
+}
@@ -0,0 +1,147 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#include "catch.h"
+#include "unittest/mock_server.h"
+#include "server/activeobjectmgr.h"
+#include "server/luaentity_sao.h"
+#include "serverenvironment.h"
+#include "servermap.h"
+#include "emerge.h"
+#include "filesys.h"
+#include "nodedef.h"
+#include "noise.h"
+#include "threading/worker_pool.h"
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <thread>
+
+namespace {
+
+constexpr u32 NUM_OBJECTS = 2000;
+
+constexpr float DTIME = 0.09f;
+
+// Number of steps each benchmark run does
+constexpr int NUM_STEPS = 5;
+
+/*
+	Physical entities dropped with random speeds into the world, like items
+	or mobs. They are not registered with the scripting, so stepping them
+	only moves them.
+*/
+void addObjects(ServerEnvironment &env, server::ActiveObjectMgr &mgr)
+{
+	PcgRandom pr(42);
+	for (u32 i = 0; i < NUM_OBJECTS; i++) {
+		const v3f pos(pr.range(2, 125), pr.range(2, 20), pr.range(2, 125));
+		auto obj = std::make_unique<LuaEntitySAO>(&env, pos * BS, "bench:ball", "");
+		ObjectProperties *prop = obj->accessObjectProperties();
+		prop->physical = true;
+		prop->collisionbox = aabb3f(-0.3f, -0.3f, -0.3f, 0.3f, 0.3f, 0.3f);
+		prop->stepheight = 0.6f;
+		obj->setVelocity(v3f(pr.range(-5, 5), 0, pr.range(-5, 5)) * BS);
+		obj->setAcceleration(v3f(0, -10, 0) * BS);
+		REQUIRE(mgr.registerObject(std::move(obj)));
+	}
+}
+
+// Steps the objects the way ServerEnvironment::step() does
+void stepObjects(server::ActiveObjectMgr &mgr, WorkerPool &pool)
+{
+	for (int i = 0; i < NUM_STEPS; i++) {
+		mgr.prepareStep(pool, DTIME);
+		mgr.step(DTIME, [] (ServerActiveObject *obj) {
+			obj->step(DTIME, false);
+		});
+	}
+}
+
+// In the order the objects were added
+std::vector<v3f> getPositions(server::ActiveObjectMgr &mgr)
+{
+	std::vector<v3f> result;
+	mgr.step(0.0f, [&] (ServerActiveObject *obj) {
+		result.push_back(obj->getBasePosition());
+	});
+	return result;
+}
+
+}
+
+TEST_CASE("benchmark_objectstep")
+{
+	const std::string world_path = fs::CreateTempDir();
+	REQUIRE(!world_path.empty());
+	{
+		std::ofstream ofs(world_path + DIR_DELIM "world.mt",
+			std::ios::out | std::ios::binary);
+		ofs << "backend = dummy\n";
+	}
+
+	MockServer server(world_path);
+	NodeDefManager *ndef = server.getWritableNodeDefManager();
+	ContentFeatures f;
+	f.name = "bench:stone";
+	f.walkable = true;
+	const content_t c_stone = ndef->set(f.name, f);
+
+	MetricsBackend mb;
+	EmergeManager emerge(&server, &mb);
+	ServerEnvironment env(std::make_unique<ServerMap>(world_path, &server, &emerge, &mb),
+		&server, &mb);
+	ServerMap &map = env.getServerMap();
+
+	// Hilly stone ground, walled in by the unloaded blocks around it
+	for (s16 z = 0; z < 8; z++)
+	for (s16 y = -1; y < 2; y++)
+	for (s16 x = 0; x < 8; x++) {
+		MapBlock *block = map.createBlock(v3s16(x, y, z));
+		v3s16 p;
+		for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++)
+		for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++)
+		for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++) {
+			const v3s16 np = v3s16(x, y, z) * MAP_BLOCKSIZE + p;
+			const s16 height = 4 * noise2d_fractal(np.X / 20.0f, np.Z / 20.0f, 1234, 2, 0.5f);
+			block->setNodeNoCheck(p, MapNode(np.Y < height ? c_stone : CONTENT_AIR));
+		}
+	}
+
+	// The objects end up in the same place with any thread count
+	{
+		std::vector<v3f> expected;
+		for (unsigned int threads : {0, 1, 4}) {
+			server::ActiveObjectMgr mgr;
+			addObjects(env, mgr);
+			WorkerPool pool("bench", threads);
+			stepObjects(mgr, pool);
+			const std::vector<v3f> positions = getPositions(mgr);
+			if (!expected.empty())
+				REQUIRE(positions == expected);
+			expected = positions;
+			mgr.clear();
+		}
+	}
+
+#define BENCH_STEP(_label, _threads) \
+	BENCHMARK_ADVANCED("objectstep_" _label)(Catch::Benchmark::Chronometer meter) { \
+		server::ActiveObjectMgr mgr; \
+		addObjects(env, mgr); \
+		WorkerPool pool("bench", _threads); \
+		meter.measure([&] { stepObjects(mgr, pool); }); \
+		mgr.clear(); \
+	};
+
+	BENCH_STEP("serial", 0)
+	BENCH_STEP("2threads", 2)
+	BENCH_STEP("4threads", 4)
+	// Every core of the machine
+	BENCH_STEP("allthreads", std::max(1U, std::thread::hardware_concurrency()))
+
+#undef BENCH_STEP
+
+	env.deactivateBlocksAndObjects();
+	fs::RecursiveDelete(world_path);
+}
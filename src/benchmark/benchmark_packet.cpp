@@ -0,0 +1,73 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#include "catch.h"
+#include "network/mtp/internal.h"
+#include "network/networkpacket.h"
+#include "noise.h"
+
+namespace {
+
+// Typical size of a compressed map block
+constexpr u32 BLOCK_SIZE = 12 * 1024;
+
+constexpr u32 NUM_PEERS = 8;
+
+// Default max_packet_size minus the headers
+constexpr u32 CHUNK_SIZE = 512 - BASE_HEADER_SIZE - RELIABLE_HEADER_SIZE;
+
+std::shared_ptr<const std::string> makeBlock()
+{
+	PcgRandom pr(42);
+	std::string data(BLOCK_SIZE, '\0');
+	for (char &c : data)
+		c = pr.range(0, 255);
+	return std::make_shared<const std::string>(std::move(data));
+}
+
+/*
+	Sends a serialized block to NUM_PEERS peers the way Server::SendSerializedBlock()
+	and UDPPeer::processReliableSendCommand() do, down to the datagrams.
+	Returns the number of bytes in the datagrams.
+*/
+u32 sendBlock(const std::shared_ptr<const std::string> &block, bool shared)
+{
+	u32 sent = 0;
+	u16 seqnum = SEQNUM_INITIAL;
+	for (u32 peer = 0; peer < NUM_PEERS; peer++) {
+		NetworkPacket pkt(TOCLIENT_BLOCKDATA, 6, 2 + peer);
+		pkt << v3s16(1, 2, 3);
+		if (shared)
+			pkt.putSharedRawString(block);
+		else
+			pkt.putRawString(*block);
+
+		auto c = con::ConnectionCommand::send(2 + peer, 2, &pkt, true);
+		u16 split_seqnum = SEQNUM_INITIAL;
+		con::PacketSplitter splitter(c->getData(), CHUNK_SIZE, split_seqnum);
+		for (u32 i = 0; i < splitter.getCount(); i++) {
+			auto p = con::makeReliablePacket(Address(), splitter, i, seqnum++,
+				PROTOCOL_ID, PEER_ID_SERVER, 2);
+			sent += p->size();
+		}
+	}
+	return sent;
+}
+
+}
+
+TEST_CASE("benchmark_packet")
+{
+	const auto block = makeBlock();
+	REQUIRE(sendBlock(block, true) == sendBlock(block, false));
+
+	// Divide NUM_PEERS * BLOCK_SIZE by the time for the payload throughput
+	BENCHMARK("send_block_copied") {
+		return sendBlock(block, false);
+	};
+
+	BENCHMARK("send_block_shared") {
+		return sendBlock(block, true);
+	};
+}
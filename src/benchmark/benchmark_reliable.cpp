@@ -0,0 +1,105 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#include "catch.h"
+#include "network/mtp/internal.h"
+#include "noise.h"
+
+namespace {
+
+constexpr u32 NUM_PACKETS = 20000;
+
+con::BufferedPacketPtr makeReliable(u16 seqnum)
+{
+	SharedBuffer<u8> data(16);
+	memset(*data, 0, data.getSize());
+	return con::makePacket(Address(127, 0, 0, 1, 30000),
+		con::makeReliablePacket(data, seqnum), 0x4f457403, 2, 0);
+}
+
+/*
+	Sends NUM_PACKETS reliable packets through a lossy link, with the
+	buffers of both sides: the sender keeps up to `window` packets in
+	flight and resends the lost ones, the receiver buffers packets that
+	arrive early. Returns the number of packets sent over the link.
+*/
+u32 simulateLoss(u32 window, u32 loss_percent)
+{
+	con::ReliablePacketBuffer sent, received;
+	PcgRandom pr(42);
+	u16 next_send = SEQNUM_INITIAL, next_receive = SEQNUM_INITIAL;
+	u32 queued = 0, delivered = 0, transmitted = 0;
+	std::vector<u16> in_flight;
+
+	while (delivered < NUM_PACKETS) {
+		while (sent.size() < window && queued < NUM_PACKETS) {
+			auto p = makeReliable(next_send);
+			in_flight.push_back(next_send);
+			next_send++;
+			// like ConnectionSendThread::sendAsPacketReliable, where the
+			// sequence number was already taken
+			sent.insert(p, (next_send - MAX_RELIABLE_WINDOW_SIZE)
+				% (MAX_RELIABLE_WINDOW_SIZE + 1));
+			queued++;
+		}
+
+		sent.incrementTimeouts(0.1f);
+		for (auto &p : sent.getResend(0.3f, window))
+			in_flight.push_back(p->getSeqnum());
+
+		// The link reorders packets a bit and loses some
+		for (size_t i = 1; i < in_flight.size(); i++) {
+			if (pr.range(0, 3) == 0)
+				std::swap(in_flight[i - 1], in_flight[i]);
+		}
+		for (u16 seqnum : in_flight) {
+			transmitted++;
+			if ((u32)pr.range(0, 99) < loss_percent)
+				continue;
+
+			if (seqnum == next_receive) {
+				next_receive++;
+				delivered++;
+				u16 first;
+				while (received.getFirstSeqnum(first) && first == next_receive) {
+					received.popFirst();
+					next_receive++;
+					delivered++;
+				}
+			} else if (con::seqnum_higher(seqnum, next_receive)) {
+				auto p = makeReliable(seqnum);
+				received.insert(p, next_receive);
+			}
+
+			// the ack
+			try {
+				sent.popSeqnum(seqnum);
+			} catch (con::NotFoundException &e) {
+			}
+		}
+		in_flight.clear();
+	}
+	return transmitted;
+}
+
+}
+
+TEST_CASE("benchmark_reliable")
+{
+	REQUIRE(simulateLoss(64, 0) == NUM_PACKETS);
+	REQUIRE(simulateLoss(1024, 10) > NUM_PACKETS);
+
+#define BENCH_LOSS(_window, _loss) \
+	BENCHMARK("reliable_window" #_window "_loss" #_loss) { \
+		return simulateLoss(_window, _loss); \
+	};
+
+	BENCH_LOSS(64, 0)
+	BENCH_LOSS(64, 10)
+	BENCH_LOSS(1024, 0)
+	BENCH_LOSS(1024, 10)
+	BENCH_LOSS(2048, 30)
+
+#undef BENCH_LOSS
+}
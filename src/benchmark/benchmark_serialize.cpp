@@ -3,9 +3,16 @@
 // Copyright (C) 2022 Minetest Authors
 
 #include "catch.h"
+#include "dummygamedef.h"
+#include "mapblock.h"
+#include "noise.h"
+#include "serialization.h"
+#include "servermap.h"
 #include "util/serialize.h"
 #include <sstream>
 #include <ios>
+#include <memory>
+#include <vector>
 
 // Builds a string of exactly `length` characters by repeating `s` (rest cut off)
 static std::string makeRepeatTo(const std::string &s, size_t length)
@@ -54,3 +61,184 @@ static std::string makeRepeatTo(const std::string &s, size_t length)
 TEST_CASE("benchmark_serialize") {
 	BENCH_ALL()
 }
+
+namespace {
+
+// A layer of 8x8 blocks around the surface, from y = -16 to 15
+constexpr u32 NUM_BLOCKS = 128;
+
+/*
+	Blocks like a simple mapgen makes them: hilly stone with dirt and grass
+	on top, water below sea level (0) and air with some light above.
+	The layer starts at block X coordinate `offset_x`.
+*/
+std::vector<std::unique_ptr<MapBlock>> generateBlocks(DummyGameDef *gamedef,
+	s16 offset_x = 0)
+{
+	NodeDefManager *ndef = gamedef->getWritableNodeDefManager();
+	content_t ids[4];
+	const char *names[4] = {"bench:stone", "bench:dirt", "bench:grass", "bench:water"};
+	for (int i = 0; i < 4; i++) {
+		ContentFeatures f;
+		f.name = names[i];
+		ids[i] = ndef->set(f.name, f);
+	}
+	const auto [c_stone, c_dirt, c_grass, c_water] = ids;
+
+	std::vector<std::unique_ptr<MapBlock>> blocks;
+	for (u32 i = 0; i < NUM_BLOCKS; i++) {
+		const v3s16 bp(offset_x + i % 8, (i / 8) % 2 - 1, i / 16);
+		auto block = std::make_unique<MapBlock>(bp, gamedef);
+		const v3s16 minp = block->getPosRelative();
+		v3s16 p;
+		for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++)
+		for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++) {
+			const v3s16 np = minp + p;
+			const s16 height = 8 * noise2d_fractal(np.X / 30.0f, np.Z / 30.0f, 1234, 3, 0.5f);
+			for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++) {
+				const s16 y = minp.Y + p.Y;
+				MapNode n;
+				if (y < height - 2)
+					n = MapNode(c_stone);
+				else if (y < height)
+					n = MapNode(c_dirt);
+				else if (y == height)
+					n = MapNode(c_grass);
+				else if (y <= 0)
+					n = MapNode(c_water, 15 - std::min(-y, 15));
+				else
+					n = MapNode(CONTENT_AIR, 15);
+				block->setNodeNoCheck(p, n);
+			}
+		}
+		blocks.push_back(std::move(block));
+	}
+	return blocks;
+}
+
+std::vector<std::string> serializeBlocks(
+	const std::vector<std::unique_ptr<MapBlock>> &blocks, bool disk)
+{
+	std::vector<std::string> result;
+	for (auto &block : blocks) {
+		result.emplace_back();
+		block->serialize(result.back(), SER_FMT_VER_HIGHEST_WRITE, disk, -1);
+	}
+	return result;
+}
+
+void deSerializeBlocks(MapBlock &block, const std::vector<std::string> &data, bool disk)
+{
+	for (const std::string &s : data)
+		block.deSerialize(s, SER_FMT_VER_HIGHEST_WRITE, disk);
+}
+
+std::vector<std::string> compressBlocks(const std::vector<std::string> &raw,
+	const ZstdDictionary *dict)
+{
+	std::vector<std::string> result;
+	for (const std::string &s : raw) {
+		result.emplace_back();
+		compress(s, result.back(), SER_FMT_VER_HIGHEST_WRITE, -1, dict);
+	}
+	return result;
+}
+
+void decompressBlocks(const std::vector<std::string> &data, const ZstdDictionary *dict)
+{
+	std::string raw;
+	for (const std::string &s : data) {
+		raw.clear();
+		decompressZstd(s, raw, dict);
+	}
+}
+
+size_t totalSize(const std::vector<std::string> &data)
+{
+	size_t size = 0;
+	for (const std::string &s : data)
+		size += s.size();
+	return size;
+}
+
+}
+
+TEST_CASE("benchmark_serialize_mapblock")
+{
+	DummyGameDef gamedef;
+	const auto blocks = generateBlocks(&gamedef);
+	MapBlock block({}, &gamedef);
+
+	// Divide the times by NUM_BLOCKS for the time per block
+#define BENCH_FORMAT(_label, _disk) \
+	{ \
+		const auto data = serializeBlocks(blocks, _disk); \
+		std::string again; \
+		block.deSerialize(data.back(), SER_FMT_VER_HIGHEST_WRITE, _disk); \
+		block.serialize(again, SER_FMT_VER_HIGHEST_WRITE, _disk, -1); \
+		REQUIRE(again == data.back()); \
+		BENCHMARK("serialize_" _label) { \
+			return serializeBlocks(blocks, _disk); \
+		}; \
+		BENCHMARK("deserialize_" _label) { \
+			deSerializeBlocks(block, data, _disk); \
+		}; \
+	}
+
+	BENCH_FORMAT("disk", true)
+	BENCH_FORMAT("net", false)
+
+#undef BENCH_FORMAT
+}
+
+TEST_CASE("benchmark_map_dictionary")
+{
+	DummyGameDef gamedef;
+
+	const auto blocks = generateBlocks(&gamedef);
+
+	// Divide the times by NUM_BLOCKS for the time per block
+#define BENCH_FORMAT(_label, _disk) \
+	{ \
+		/* Like --train-map-dictionary, from other blocks of the same world */ \
+		std::vector<std::string> samples; \
+		for (s16 offset_x : {8, 16, 24, 32}) { \
+			for (auto &block : generateBlocks(&gamedef, offset_x)) { \
+				samples.emplace_back(); \
+				block->serializeUncompressed(samples.back(), SER_FMT_VER_HIGHEST_WRITE, _disk); \
+			} \
+		} \
+		const std::string dict_data = ServerMap::trainDictionary(samples, -1); \
+		REQUIRE(!dict_data.empty()); \
+		const ZstdDictionary dict(dict_data); \
+		std::vector<std::string> raw; \
+		for (auto &block : blocks) { \
+			raw.emplace_back(); \
+			block->serializeUncompressed(raw.back(), SER_FMT_VER_HIGHEST_WRITE, _disk); \
+		} \
+		const auto plain = compressBlocks(raw, nullptr); \
+		const auto with_dict = compressBlocks(raw, &dict); \
+		std::string decompressed; \
+		decompressZstd(with_dict.back(), decompressed, &dict); \
+		REQUIRE(decompressed == raw.back()); \
+		WARN(_label ": " << totalSize(raw) << " bytes raw, " << totalSize(plain) \
+			<< " compressed, " << totalSize(with_dict) << " with dictionary"); \
+		BENCHMARK("compress_" _label "_plain") { \
+			return compressBlocks(raw, nullptr); \
+		}; \
+		BENCHMARK("compress_" _label "_dictionary") { \
+			return compressBlocks(raw, &dict); \
+		}; \
+		BENCHMARK("decompress_" _label "_plain") { \
+			decompressBlocks(plain, nullptr); \
+		}; \
+		BENCHMARK("decompress_" _label "_dictionary") { \
+			decompressBlocks(with_dict, &dict); \
+		}; \
+	}
+
+	BENCH_FORMAT("disk", true)
+	BENCH_FORMAT("net", false)
+
+#undef BENCH_FORMAT
+}
@@ -0,0 +1,109 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#include "catch.h"
+#include "network/address.h"
+#include "network/socket.h"
+#include <vector>
+
+namespace {
+
+constexpr u16 PORT = 30020;
+
+// Datagrams sent before they are received again, so that the socket buffer
+// never overflows. Matches the batch size of the connection threads.
+constexpr int ROUND = UDPSocket::MAX_BATCH;
+
+// Datagrams per measured run
+constexpr int NUM_PACKETS = ROUND * 16;
+
+// Typical size of a packet with object updates
+constexpr int PACKET_SIZE = 512;
+
+/*
+	Two sockets on the loopback interface. Everything runs in one thread and
+	the kernel delivers the datagrams while sending, so the measured time is
+	the CPU time spent on both ends: divide it by NUM_PACKETS for the cost of
+	one packet.
+*/
+class Loopback {
+public:
+	Loopback() : m_sender(false), m_receiver(false),
+		m_destination(127, 0, 0, 1, PORT)
+	{
+		m_receiver.Bind(Address(0, 0, 0, 0, PORT));
+		m_send_data.resize(ROUND * PACKET_SIZE, 0x42);
+		m_receive_data.resize(ROUND * 1500);
+	}
+
+	// One Send() and Receive() call per datagram
+	int runSingle()
+	{
+		int received = 0;
+		Address sender;
+		for (int r = 0; r < NUM_PACKETS / ROUND; r++) {
+			for (int i = 0; i < ROUND; i++)
+				m_sender.Send(m_destination, &m_send_data[i * PACKET_SIZE], PACKET_SIZE);
+			for (int i = 0; i < ROUND; i++) {
+				if (m_receiver.Receive(sender, &m_receive_data[0], 1500) < 0)
+					break;
+				received++;
+			}
+		}
+		return received;
+	}
+
+	// SendBatch() and ReceiveBatch() for every round of datagrams
+	int runBatch()
+	{
+		int received = 0;
+		UDPSocket::Datagram datagrams[ROUND];
+		for (int r = 0; r < NUM_PACKETS / ROUND; r++) {
+			for (int i = 0; i < ROUND; i++) {
+				datagrams[i].address = m_destination;
+				datagrams[i].data = &m_send_data[i * PACKET_SIZE];
+				datagrams[i].size = PACKET_SIZE;
+			}
+			m_sender.SendBatch(datagrams, ROUND);
+
+			int round_received = 0;
+			while (round_received < ROUND) {
+				for (int i = 0; i < ROUND; i++) {
+					datagrams[i].data = &m_receive_data[i * 1500];
+					datagrams[i].size = 1500;
+				}
+				int count = m_receiver.ReceiveBatch(datagrams, ROUND - round_received);
+				if (count == 0)
+					break;
+				round_received += count;
+			}
+			received += round_received;
+		}
+		return received;
+	}
+
+private:
+	UDPSocket m_sender;
+	UDPSocket m_receiver;
+	Address m_destination;
+	std::vector<u8> m_send_data;
+	std::vector<u8> m_receive_data;
+};
+
+}
+
+TEST_CASE("benchmark_socket")
+{
+	Loopback loopback;
+	REQUIRE(loopback.runSingle() == NUM_PACKETS);
+	REQUIRE(loopback.runBatch() == NUM_PACKETS);
+
+	BENCHMARK("udp_single_512pkts", i) {
+		return loopback.runSingle();
+	};
+
+	BENCHMARK("udp_batch_512pkts", i) {
+		return loopback.runBatch();
+	};
+}
@@ -0,0 +1,171 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#include "catch.h"
+#include "config.h"
+#include "dummygamedef.h"
+#include "dummymap.h"
+#include "lua_api/l_vmanip.h"
+
+extern "C" {
+#if USE_LUAJIT
+	#include <luajit.h>
+#else
+	#include <lua.h>
+#endif
+#include <lauxlib.h>
+#include <lualib.h>
+}
+
+namespace {
+
+// One mapchunk
+constexpr s16 SIZE = 80;
+
+/*
+	Lua state with a VoxelManip of one mapchunk in the global "vm", filled
+	with distinct content IDs.
+*/
+class VoxelManipLua {
+public:
+	VoxelManipLua() :
+		m_map(&m_gamedef, v3s16(0), v3s16(0))
+	{
+		L = luaL_newstate();
+		luaL_openlibs(L);
+		LuaVoxelBuffer::Register(L);
+		LuaVoxelManip::Register(L);
+
+		auto *vm = new MMVManip(&m_map);
+		vm->addArea(VoxelArea(v3s16(0), v3s16(SIZE - 1)));
+		for (u32 i = 0; i < vm->m_area.getVolume(); i++)
+			vm->m_data[i] = MapNode(i % 1000, 0, i % 256);
+		vm->clearFlags(vm->m_area, VOXELFLAG_NO_DATA);
+		LuaVoxelManip::create(L, vm, false);
+		lua_setglobal(L, "vm");
+	}
+
+	~VoxelManipLua() { lua_close(L); }
+
+	// Compiles code that returns a function, which can then be run
+	void load(const char *code)
+	{
+		REQUIRE(luaL_dostring(L, code) == 0);
+		lua_setglobal(L, "run");
+	}
+
+	lua_Integer run()
+	{
+		lua_getglobal(L, "run");
+		lua_call(L, 0, 1);
+		lua_Integer result = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		return result;
+	}
+
+private:
+	DummyGameDef m_gamedef;
+	// The VoxelManip only needs it to exist
+	DummyMap m_map;
+	lua_State *L;
+};
+
+// Like a mapgen that replaces one content ID, e.g. for ores
+const char *REPLACE_TABLE = R"(
+	local data = {}
+	return function()
+		vm:get_data(data)
+		for i = 1, #data do
+			if data[i] == 5 then
+				data[i] = 6
+			end
+		end
+		vm:set_data(data)
+		return data[6]
+	end
+)";
+
+const char *REPLACE_BUFFER = R"(
+	local data = VoxelBuffer()
+	return function()
+		vm:get_data(data)
+		for i = 1, #data do
+			if data[i] == 5 then
+				data[i] = 6
+			end
+		end
+		vm:set_data(data)
+		return data[6]
+	end
+)";
+
+const char *REPLACE_BULK = R"(
+	local data = VoxelBuffer()
+	local mapping = {[5] = 6}
+	return function()
+		vm:get_data(data)
+		data:replace(mapping)
+		vm:set_data(data)
+		return data[6]
+	end
+)";
+
+// Like a mapgen that only looks at some of the nodes, e.g. the surface
+const char *SAMPLE_TABLE = R"(
+	local data = {}
+	return function()
+		vm:get_data(data)
+		local sum = 0
+		for i = 1, #data, 97 do
+			sum = sum + data[i]
+		end
+		vm:set_data(data)
+		return sum
+	end
+)";
+
+const char *SAMPLE_BUFFER = R"(
+	local data = VoxelBuffer()
+	return function()
+		vm:get_data(data)
+		local sum = 0
+		for i = 1, #data, 97 do
+			sum = sum + data[i]
+		end
+		vm:set_data(data)
+		return sum
+	end
+)";
+
+}
+
+TEST_CASE("benchmark_vmanip")
+{
+	VoxelManipLua lua;
+
+	lua.load(REPLACE_TABLE);
+	const lua_Integer replaced_table = lua.run();
+	lua.load(REPLACE_BUFFER);
+	REQUIRE(lua.run() == replaced_table);
+	lua.load(REPLACE_BULK);
+	REQUIRE(lua.run() == replaced_table);
+	lua.load(SAMPLE_TABLE);
+	const lua_Integer sampled_table = lua.run();
+	lua.load(SAMPLE_BUFFER);
+	REQUIRE(lua.run() == sampled_table);
+
+#define BENCH_LUA(_name, _code) \
+	lua.load(_code); \
+	BENCHMARK(_name) { \
+		return lua.run(); \
+	};
+
+	BENCH_LUA("vmanip_replace_table", REPLACE_TABLE)
+	BENCH_LUA("vmanip_replace_buffer", REPLACE_BUFFER)
+	BENCH_LUA("vmanip_replace_bulk", REPLACE_BULK)
+	BENCH_LUA("vmanip_sample_table", SAMPLE_TABLE)
+	BENCH_LUA("vmanip_sample_buffer", SAMPLE_BUFFER)
+
+#undef BENCH_LUA
+}
@@ -1224,7 +1224,7 @@ void Client::sendInit(const std::string &playerName)
 {
 	NetworkPacket pkt(TOSERVER_INIT, 1 + 2 + 2 + (1 + playerName.size()));
 
-	pkt << SER_FMT_VER_HIGHEST_READ << (u16) 0 /* unused */;
+	pkt << SER_FMT_VER_HIGHEST_READ << (u16) NETPROTO_COMPRESSION_MAP_DICTIONARY;
 	pkt << CLIENT_PROTOCOL_VERSION_MIN << LATEST_PROTOCOL_VERSION;
 	pkt << playerName;
 
@@ -47,6 +47,7 @@ class RenderingEngine;
 class SingleMediaDownloader;
 class ClientScripting;
 class SSCSMController;
+class ZstdDictionary;
 struct ChatMessage;
 struct ClientDynamicInfo;
 struct ClientEvent;
@@ -493,6 +494,10 @@ class Client : public con::PeerHandler, public InventoryManager, public IGameDef
 
 	// Server serialization version
 	u8 m_server_ser_ver;
+	// Compression modes deployed in TOCLIENT_HELLO
+	u16 m_compression_modes = 0;
+	// Dictionary the server compresses map blocks with, if any
+	std::unique_ptr<ZstdDictionary> m_map_dictionary;
 
 	// Used version of the protocol with server
 	// If 0, server init hasn't been received yet.
@@ -3,13 +3,16 @@
 // Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
 
 #include "collision.h"
+#include <algorithm>
 #include <cmath>
+#include <unordered_map>
 #include "irr_aabb3d.h"
 #include "mapblock.h"
 #include "map.h"
 #include "nodedef.h"
 #include "gamedef.h"
 #include "util/numeric.h"
+#include "voxel.h"
 #if CHECK_CLIENT_BUILD()
 #include "client/clientenvironment.h"
 #include "client/localplayer.h"
@@ -23,7 +26,7 @@
 #warning "-ffast-math is known to cause bugs in collision code, do not use!"
 #endif
 
-bool g_collision_problems_encountered = false;
+std::atomic<bool> g_collision_problems_encountered{false};
 
 namespace {
 
@@ -82,6 +85,78 @@ inline v3f rangelimv(const v3f vec, const f32 low, const f32 high)
 		rangelim(vec.Z, low, high)
 	);
 }
+
+/*
+	Finds the objects whose position is inside box, sorted by ID.
+
+	While no object is added, removed or moved, e.g. while the objects are
+	prepared for their step, the objects are looked up once per cell of the
+	map. Nearby objects then only filter the cells around them.
+*/
+void get_objects_in_area(ServerEnvironment *env, const aabb3f &box,
+		std::vector<ServerActiveObject *> &result)
+{
+	constexpr f32 CELL_SIZE = 8 * BS;
+	// More cells are looked up directly
+	constexpr s32 MAX_CELLS = 27;
+	// With fewer objects the direct lookup is cheaper
+	constexpr size_t MIN_OBJECTS = 64;
+
+	struct CellCache {
+		ServerEnvironment *env = nullptr;
+		u64 revision = 0;
+		std::unordered_map<v3s16, std::vector<std::pair<ServerActiveObject *, v3f>>> cells;
+	};
+	thread_local CellCache cache;
+
+	const auto get_cell = [] (v3f pos) {
+		return v3s16(std::floor(pos.X / CELL_SIZE), std::floor(pos.Y / CELL_SIZE),
+			std::floor(pos.Z / CELL_SIZE));
+	};
+	const v3s16 cmin = get_cell(box.MinEdge);
+	const v3s16 cmax = get_cell(box.MaxEdge);
+	const u64 revision = env->getActiveObjectRevision();
+	if (env != cache.env || revision != cache.revision ||
+			VoxelArea(cmin, cmax).getVolume() > MAX_CELLS ||
+			env->getActiveObjectCount() < MIN_OBJECTS) {
+		// Not worth caching, or probably not looked up again in this state
+		cache.env = env;
+		cache.revision = revision;
+		if (!cache.cells.empty())
+			cache.cells.clear();
+		env->getObjectsInArea(result, box, nullptr);
+	} else {
+		v3s16 c;
+		for (c.Z = cmin.Z; c.Z <= cmax.Z; c.Z++)
+		for (c.Y = cmin.Y; c.Y <= cmax.Y; c.Y++)
+		for (c.X = cmin.X; c.X <= cmax.X; c.X++) {
+			auto it = cache.cells.find(c);
+			if (it == cache.cells.end()) {
+				const v3f cell_min = v3f::from(c) * CELL_SIZE;
+				std::vector<ServerActiveObject *> objects;
+				env->getObjectsInArea(objects,
+					aabb3f(cell_min, cell_min + v3f(CELL_SIZE)), nullptr);
+				it = cache.cells.emplace(c, decltype(it->second)()).first;
+				for (auto *obj : objects) {
+					// Objects on the border belong to one cell only
+					if (get_cell(obj->getBasePosition()) == c)
+						it->second.emplace_back(obj, obj->getBasePosition());
+				}
+			}
+			for (auto &[obj, pos] : it->second) {
+				if (box.isPointInside(pos))
+					result.push_back(obj);
+			}
+		}
+	}
+
+	// The order of the collisions matters, don't let it depend on the cache
+	std::sort(result.begin(), result.end(),
+		[] (ServerActiveObject *a, ServerActiveObject *b) {
+			return a->getId() < b->getId();
+		});
+}
+
 }
 
 // Helper function:
@@ -217,8 +292,8 @@ bool wouldCollideWithCeiling(
 	return false;
 }
 
-static bool add_area_node_boxes(const v3s16 min, const v3s16 max, IGameDef *gamedef,
-		Environment *env, std::vector<NearbyCollisionInfo> &cinfo)
+static bool collect_area_node_boxes(const v3s16 min, const v3s16 max, IGameDef *gamedef,
+		Environment *env, std::vector<NearbyCollisionInfo> &cinfo, bool &cacheable)
 {
 	const auto *nodedef = gamedef->getNodeDefManager();
 	bool any_position_valid = false;
@@ -276,6 +351,10 @@ static bool add_area_node_boxes(const v3s16 min, const v3s16 max, IGameDef *game
 			if (!f.walkable)
 				continue;
 
+			// Connected node boxes also depend on nodes outside of the area
+			if (f.drawtype == NDT_NODEBOX && f.node_box.type == NODEBOX_CONNECTED)
+				cacheable = false;
+
 			// Negative bouncy may have a meaning, but we need +value here.
 			int n_bouncy_value = abs(itemgroup_get(f.groups, "bouncy"));
 
@@ -300,6 +379,92 @@ static bool add_area_node_boxes(const v3s16 min, const v3s16 max, IGameDef *game
 	return any_position_valid;
 }
 
+/*
+	Adds the node boxes in the area to cinfo.
+	The boxes of each area are remembered until one of the blocks the area
+	is in changes. Objects that stand around, or crowd in one place, look
+	at the same areas on every step.
+*/
+static bool add_area_node_boxes(const v3s16 min, const v3s16 max, IGameDef *gamedef,
+		Environment *env, std::vector<NearbyCollisionInfo> &cinfo)
+{
+	// Larger areas, e.g. of fast objects, are not cached
+	constexpr s16 MAX_EXTENT = 31;
+	constexpr size_t MAX_AREAS = 4096;
+	// Size of the filter for areas that were seen once
+	constexpr size_t SEEN_SIZE = 1024;
+
+	struct CachedArea {
+		// Modification counters of the blocks, 0 if not loaded.
+		// They are never reused, so this also tells apart different maps.
+		std::vector<u64> block_counters;
+		std::vector<NearbyCollisionInfo> boxes;
+		bool any_position_valid;
+	};
+	// Per thread because objects are moved on several threads,
+	// see ServerActiveObject::prepareStep()
+	thread_local std::unordered_map<u64, CachedArea> cache;
+	thread_local u64 seen[SEEN_SIZE];
+	thread_local std::vector<u64> block_counters;
+
+	bool cacheable = true;
+	const v3s16 extent = max - min;
+	if (extent.X > MAX_EXTENT || extent.Y > MAX_EXTENT || extent.Z > MAX_EXTENT)
+		return collect_area_node_boxes(min, max, gamedef, env, cinfo, cacheable);
+
+	Map *map = &env->getMap();
+	const auto get_block_counters = [&] () {
+		block_counters.clear();
+		const v3s16 bpmin = getNodeBlockPos(min);
+		const v3s16 bpmax = getNodeBlockPos(max);
+		v3s16 bp;
+		for (bp.Z = bpmin.Z; bp.Z <= bpmax.Z; bp.Z++)
+		for (bp.Y = bpmin.Y; bp.Y <= bpmax.Y; bp.Y++)
+		for (bp.X = bpmin.X; bp.X <= bpmax.X; bp.X++) {
+			MapBlock *block = map->getBlockNoCreateNoEx(bp);
+			block_counters.push_back(block ? block->getModificationCounter() : 0);
+		}
+	};
+
+	// Bit 15 is set so that no key is 0, like the empty entries of seen
+	const u64 key = (u64)(u16)min.X << 48 | (u64)(u16)min.Y << 32 |
+			(u64)(u16)min.Z << 16 | extent.X << 10 | extent.Y << 5 | extent.Z | 1 << 15;
+	auto it = cache.find(key);
+	if (it != cache.end()) {
+		get_block_counters();
+		if (it->second.block_counters == block_counters) {
+			const CachedArea &area = it->second;
+			cinfo.insert(cinfo.end(), area.boxes.begin(), area.boxes.end());
+			return area.any_position_valid;
+		}
+	}
+
+	const size_t begin = cinfo.size();
+	const bool any_position_valid =
+			collect_area_node_boxes(min, max, gamedef, env, cinfo, cacheable);
+	if (!cacheable)
+		return any_position_valid;
+
+	if (it == cache.end()) {
+		// Moving objects rarely look at an area twice, only remember the
+		// areas that were seen before to keep the misses cheap
+		u64 &seen_key = seen[(key ^ key >> 29) % SEEN_SIZE];
+		if (seen_key != key) {
+			seen_key = key;
+			return any_position_valid;
+		}
+		get_block_counters();
+		if (cache.size() >= MAX_AREAS)
+			cache.clear();
+		it = cache.emplace(key, CachedArea()).first;
+	}
+	CachedArea &area = it->second;
+	area.block_counters = block_counters;
+	area.boxes.assign(cinfo.begin() + begin, cinfo.end());
+	area.any_position_valid = any_position_valid;
+	return any_position_valid;
+}
+
 static void add_object_boxes(Environment *env,
 		const aabb3f &box_0, f32 dtime,
 		const v3f pos_f, const v3f speed_f, ActiveObject *self,
@@ -348,25 +513,21 @@ static void add_object_boxes(Environment *env,
 	{
 		ServerEnvironment *s_env = dynamic_cast<ServerEnvironment*>(env);
 		if (s_env) {
-			// search for objects which are not us and not our children.
-			// we directly process the object in this callback to avoid useless
-			// looping afterwards.
-			auto include_obj_cb = [self, &process_object] (ServerActiveObject *obj) {
-				if (!obj->isGone() &&
-					(!self || (self != obj && self != obj->getParent()))) {
-					process_object(obj);
-				}
-				return false;
-			};
-
 			// Calculate distance by speed, add own extent and tolerance
 			const v3f movement = speed_f * dtime;
 			const v3f min = pos_f + box_0.MinEdge - v3f(tolerance) + componentwise_min(movement, v3f());
 			const v3f max = pos_f + box_0.MaxEdge + v3f(tolerance) + componentwise_max(movement, v3f());
 
-			// nothing is put into this vector
-			std::vector<ServerActiveObject*> s_objects;
-			s_env->getObjectsInArea(s_objects, aabb3f(min, max), include_obj_cb);
+			thread_local std::vector<ServerActiveObject*> s_objects;
+			s_objects.clear();
+			get_objects_in_area(s_env, aabb3f(min, max), s_objects);
+			// search for objects which are not us and not our children.
+			for (auto *obj : s_objects) {
+				if (!obj->isGone() &&
+					(!self || (self != obj && self != obj->getParent()))) {
+					process_object(obj);
+				}
+			}
 		}
 	}
 }
@@ -380,7 +541,8 @@ collisionMoveResult collisionMoveSimple(Environment *env, IGameDef *gamedef,
 		v3f accel_f, ActiveObject *self,
 		bool collide_with_objects)
 {
-	static bool time_notification_done = false;
+	// May be called from several threads, see ServerActiveObject::prepareStep()
+	static std::atomic<bool> time_notification_done{false};
 
 	ScopeProfiler sp(g_profiler, PROFILER_NAME("collisionMoveSimple()"), SPT_AVG, PRECISION_MICRO);
 
@@ -394,8 +556,7 @@ collisionMoveResult collisionMoveSimple(Environment *env, IGameDef *gamedef,
 		Calculate new velocity
 	*/
 	if (dtime > DTIME_LIMIT) {
-		if (!time_notification_done) {
-			time_notification_done = true;
+		if (!time_notification_done.exchange(true)) {
 			warningstream << "collisionMoveSimple: maximum step interval exceeded,"
 					" lost movement details!"<<std::endl;
 		}
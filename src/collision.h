@@ -5,6 +5,7 @@
 #pragma once
 
 #include "irrlichttypes_bloated.h"
+#include <atomic>
 #include <vector>
 
 class IGameDef;
@@ -50,7 +51,7 @@ struct collisionMoveResult
 
 /// Status if any problems were ever encountered during collision detection.
 /// @warning For unit test use only.
-extern bool g_collision_problems_encountered;
+extern std::atomic<bool> g_collision_problems_encountered;
 
 /// @param self (optional) ActiveObject to ignore in the collision detection.
 collisionMoveResult collisionMoveSimple(Environment *env, IGameDef *gamedef,
@@ -35,6 +35,11 @@
 #define LIMITED_BLOCK_SENDS_FACTOR 0.33f
 // Override for the previous one for blocks that are close by
 #define BLOCK_ALWAYS_SEND_MAX_D 1
+// Pending emerge requests of a player are dropped when the player moves
+// further than this many blocks at once, e.g. when teleporting
+#define BLOCK_EMERGE_CANCEL_JUMP_D 4
+// Emerge priority penalty, in blocks, for blocks outside the view cone
+#define BLOCK_EMERGE_OUT_OF_VIEW_PENALTY 4
 
 /*
     Client/Server
@@ -6,6 +6,7 @@
 
 #include "emerge_internal.h"
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include "config.h"
@@ -54,6 +55,273 @@ EmergeParams::EmergeParams(EmergeManager *parent, const BiomeGen *biomegen,
 	this->biomegen = biomegen->clone(this->biomemgr);
 }
 
+////
+//// EmergeQueue
+////
+
+// Number of shards for the queue entries, must be a power of two
+#define EMERGE_QUEUE_SHARDS 16
+// Number of outdated items a worker heap may hold beyond twice the queue size
+#define EMERGE_QUEUE_STALE_SLACK 64
+// Requests of players that were not repeated for this long are dropped
+#define EMERGE_REQUEST_TIMEOUT_MS 10000
+
+EmergeQueue::EmergeQueue(size_t num_workers, u32 limit_total,
+	u32 limit_diskonly, u32 limit_generate, u32 request_timeout_ms) :
+	m_shards(std::make_unique<Shard[]>(EMERGE_QUEUE_SHARDS)),
+	m_workers(std::make_unique<WorkerQueue[]>(num_workers)),
+	m_num_workers(num_workers),
+	m_peer_counts(std::make_unique<std::atomic<u32>[]>(U16_MAX + 1)),
+	m_limit_total(limit_total),
+	m_limit_diskonly(limit_diskonly),
+	m_limit_generate(limit_generate),
+	m_request_timeout_ms(request_timeout_ms)
+{
+	FATAL_ERROR_IF(num_workers == 0, "No emerge threads!");
+	for (u32 i = 0; i <= U16_MAX; i++)
+		m_peer_counts[i].store(0, std::memory_order_relaxed);
+}
+
+EmergeQueue::Shard &EmergeQueue::getShard(v3s16 pos)
+{
+	// Neighboring blocks are usually requested together, spread them out
+	u32 h = (u16)pos.X * 73856093U ^ (u16)pos.Y * 19349663U ^ (u16)pos.Z * 83492791U;
+	return m_shards[(h >> 4) & (EMERGE_QUEUE_SHARDS - 1)];
+}
+
+bool EmergeQueue::checkLimits(u16 peer_requested, u16 flags) const
+{
+	if (flags & BLOCK_EMERGE_FORCE_QUEUE)
+		return true;
+
+	if (size() >= m_limit_total)
+		return false;
+
+	const u32 count = m_peer_counts[peer_requested].load(std::memory_order_relaxed);
+	if (peer_requested != PEER_ID_INEXISTENT) {
+		u32 qlimit_peer = (flags & BLOCK_EMERGE_ALLOW_GEN) ?
+			m_limit_generate : m_limit_diskonly;
+		return count < qlimit_peer;
+	}
+	// limit block enqueue requests for active blocks to 1/2 of total
+	return count * 2 < m_limit_total;
+}
+
+bool EmergeQueue::push(v3s16 pos, u16 peer_requested, u16 flags,
+	EmergeCompletionCallback callback, void *callback_param,
+	u32 priority, int *worker)
+{
+	// Only these may be dropped, nobody waits for a callback of them
+	const bool from_view = peer_requested != PEER_ID_INEXISTENT && !callback &&
+		!(flags & BLOCK_EMERGE_FORCE_QUEUE);
+	Item item;
+	{
+		Shard &shard = getShard(pos);
+		std::lock_guard lock(shard.mutex);
+
+		auto it = shard.entries.find(pos);
+		if (it != shard.entries.end()) {
+			// Already queued, this does not count against the limits
+			Entry &entry = it->second;
+			entry.data.flags |= flags;
+			if (callback)
+				entry.data.callbacks.emplace_back(callback, callback_param);
+			if (peer_requested != PEER_ID_INEXISTENT)
+				entry.request_time = porting::getTimeMs();
+			// Another player may still wait for it after the first one left
+			entry.cancellable &= from_view &&
+				peer_requested == entry.data.peer_requested;
+
+			// The player that requested the block may have moved
+			bool reprioritize = peer_requested == entry.data.peer_requested ?
+				priority != entry.priority : priority < entry.priority;
+			if (!reprioritize) {
+				*worker = -1;
+				return true;
+			}
+			entry.priority = priority;
+			entry.version = m_next_version.fetch_add(1, std::memory_order_relaxed);
+			item = Item{priority, entry.version, pos};
+		} else {
+			if (!checkLimits(peer_requested, flags))
+				return false;
+
+			Entry &entry = shard.entries[pos];
+			entry.data.flags = flags;
+			entry.data.peer_requested = peer_requested;
+			if (callback)
+				entry.data.callbacks.emplace_back(callback, callback_param);
+			entry.priority = priority;
+			entry.version = m_next_version.fetch_add(1, std::memory_order_relaxed);
+			entry.request_time = porting::getTimeMs();
+			entry.cancellable = from_view;
+			item = Item{priority, entry.version, pos};
+
+			m_peer_counts[peer_requested].fetch_add(1, std::memory_order_relaxed);
+			m_size.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	// The entry has to exist before its item can be taken by a worker
+	*worker = addItem(item);
+	return true;
+}
+
+namespace {
+
+// Orders the heap so that the lowest priority value, then the oldest
+// item is at the front
+struct ItemLater {
+	template <typename T>
+	bool operator()(const T &a, const T &b) const
+	{
+		if (a.priority != b.priority)
+			return a.priority > b.priority;
+		return a.version > b.version;
+	}
+};
+
+}
+
+int EmergeQueue::addItem(const Item &item)
+{
+	// Pick the worker with the least work, preferably an idle one
+	size_t index = 0;
+	size_t load_lowest = m_workers[0].getLoad();
+	for (size_t i = 1; i < m_num_workers && load_lowest > 0; i++) {
+		size_t load = m_workers[i].getLoad();
+		if (load < load_lowest) {
+			index = i;
+			load_lowest = load;
+		}
+	}
+
+	WorkerQueue &queue = m_workers[index];
+	{
+		std::lock_guard lock(queue.mutex);
+		// Items of reprioritized or cancelled blocks pile up while the
+		// worker is busy, get rid of them now and then
+		if (queue.items.size() > 2 * size() + EMERGE_QUEUE_STALE_SLACK)
+			dropStaleItems(queue);
+		queue.items.push_back(item);
+		std::push_heap(queue.items.begin(), queue.items.end(), ItemLater());
+		queue.size.store(queue.items.size(), std::memory_order_relaxed);
+	}
+
+	return index;
+}
+
+void EmergeQueue::dropStaleItems(WorkerQueue &queue)
+{
+	// Lock order: worker queue, then shard
+	auto is_stale = [this] (const Item &item) {
+		Shard &shard = getShard(item.pos);
+		std::lock_guard lock(shard.mutex);
+		auto it = shard.entries.find(item.pos);
+		return it == shard.entries.end() || it->second.version != item.version;
+	};
+	auto &items = queue.items;
+	items.erase(std::remove_if(items.begin(), items.end(), is_stale), items.end());
+	std::make_heap(items.begin(), items.end(), ItemLater());
+}
+
+bool EmergeQueue::takeItem(WorkerQueue &queue, Item *item)
+{
+	if (queue.size.load(std::memory_order_relaxed) == 0)
+		return false;
+
+	std::lock_guard lock(queue.mutex);
+	if (queue.items.empty())
+		return false;
+	std::pop_heap(queue.items.begin(), queue.items.end(), ItemLater());
+	*item = queue.items.back();
+	queue.items.pop_back();
+	queue.size.store(queue.items.size(), std::memory_order_relaxed);
+	return true;
+}
+
+void EmergeQueue::removeEntry(const Entry &entry)
+{
+	std::atomic<u32> &count_peer = m_peer_counts[entry.data.peer_requested];
+	assert(count_peer.load() != 0);
+	count_peer.fetch_sub(1, std::memory_order_relaxed);
+	m_size.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool EmergeQueue::pop(size_t worker, bool steal, v3s16 *pos, BlockEmergeData *bedata,
+	bool *expired)
+{
+	assert(worker < m_num_workers);
+
+	while (true) {
+		Item item;
+		bool found = takeItem(m_workers[worker], &item);
+		while (!found && steal) {
+			// Steal from whoever has the most work left
+			size_t victim = m_num_workers;
+			size_t nitems_highest = 0;
+			for (size_t i = 0; i < m_num_workers; i++) {
+				size_t nitems = m_workers[i].size.load(std::memory_order_relaxed);
+				if (i != worker && nitems > nitems_highest) {
+					victim = i;
+					nitems_highest = nitems;
+				}
+			}
+			if (victim == m_num_workers)
+				break;
+			found = takeItem(m_workers[victim], &item);
+		}
+		m_workers[worker].busy.store(found, std::memory_order_relaxed);
+		if (!found)
+			return false;
+
+		Shard &shard = getShard(item.pos);
+		std::lock_guard lock(shard.mutex);
+		auto it = shard.entries.find(item.pos);
+		// The block was reprioritized, cancelled or already taken
+		if (it == shard.entries.end() || it->second.version != item.version)
+			continue;
+
+		const Entry &entry = it->second;
+		if (expired) {
+			*expired = entry.cancellable && m_request_timeout_ms > 0 &&
+				porting::getTimeMs() - entry.request_time > m_request_timeout_ms;
+		}
+		removeEntry(entry);
+		*pos = item.pos;
+		*bedata = std::move(it->second.data);
+		shard.entries.erase(it);
+		return true;
+	}
+}
+
+size_t EmergeQueue::cancelPeer(u16 peer_id)
+{
+	size_t cancelled = 0;
+	for (size_t i = 0; i < EMERGE_QUEUE_SHARDS; i++) {
+		Shard &shard = m_shards[i];
+		std::lock_guard lock(shard.mutex);
+		for (auto it = shard.entries.begin(); it != shard.entries.end();) {
+			// The heap items are skipped once their entry is gone
+			if (it->second.cancellable && it->second.data.peer_requested == peer_id) {
+				removeEntry(it->second);
+				it = shard.entries.erase(it);
+				cancelled++;
+			} else {
+				++it;
+			}
+		}
+	}
+	return cancelled;
+}
+
+bool EmergeQueue::contains(v3s16 pos)
+{
+	Shard &shard = getShard(pos);
+	std::lock_guard lock(shard.mutex);
+	return shard.entries.find(pos) != shard.entries.end();
+}
+
 ////
 //// EmergeManager
 ////
@@ -88,15 +356,6 @@ EmergeManager::EmergeManager(Server *server, MetricsBackend *mb)
 			{{"status", emergeActionStrs[i]}}
 		);
 	}
-
-	m_qlimit_total = g_settings->getU32("emergequeue_limit_total");
-	m_qlimit_diskonly = g_settings->getU32("emergequeue_limit_diskonly");
-	m_qlimit_generate = g_settings->getU32("emergequeue_limit_generate");
-
-	// don't trust user input for something very important like this
-	m_qlimit_diskonly = rangelim(m_qlimit_diskonly, 2, 1000000);
-	m_qlimit_generate = rangelim(m_qlimit_generate, 1, 1000000);
-	m_qlimit_total = std::max(m_qlimit_total, std::max(m_qlimit_diskonly, m_qlimit_generate));
 }
 
 
@@ -219,9 +478,20 @@ void EmergeManager::initThreads(bool should_multithread)
 	}
 	nthreads = std::max<s16>(1, nthreads);
 
+	u32 qlimit_total = g_settings->getU32("emergequeue_limit_total");
+	u32 qlimit_diskonly = g_settings->getU32("emergequeue_limit_diskonly");
+	u32 qlimit_generate = g_settings->getU32("emergequeue_limit_generate");
+
+	// don't trust user input for something very important like this
+	qlimit_diskonly = rangelim(qlimit_diskonly, 2, 1000000);
+	qlimit_generate = rangelim(qlimit_generate, 1, 1000000);
+	qlimit_total = std::max(qlimit_total, std::max(qlimit_diskonly, qlimit_generate));
+
 	FATAL_ERROR_IF(!m_threads.empty(), "Threads already initialized.");
 	for (s16 i = 0; i < nthreads; i++)
 		m_threads.push_back(new EmergeThread(m_server, i));
+	m_queue = std::make_unique<EmergeQueue>(nthreads,
+		qlimit_total, qlimit_diskonly, qlimit_generate, EMERGE_REQUEST_TIMEOUT_MS);
 
 	infostream << "EmergeManager: using " << nthreads << " thread(s)" << std::endl;
 }
@@ -276,7 +546,8 @@ bool EmergeManager::enqueueBlockEmerge(
 	session_t peer_id,
 	v3s16 blockpos,
 	bool allow_generate,
-	bool ignore_queue_limits)
+	bool ignore_queue_limits,
+	u32 priority)
 {
 	u16 flags = 0;
 	if (allow_generate)
@@ -284,7 +555,7 @@ bool EmergeManager::enqueueBlockEmerge(
 	if (ignore_queue_limits)
 		flags |= BLOCK_EMERGE_FORCE_QUEUE;
 
-	return enqueueBlockEmergeEx(blockpos, peer_id, flags, NULL, NULL);
+	return enqueueBlockEmergeEx(blockpos, peer_id, flags, NULL, NULL, priority);
 }
 
 
@@ -293,41 +564,42 @@ bool EmergeManager::enqueueBlockEmergeEx(
 	session_t peer_id,
 	u16 flags,
 	EmergeCompletionCallback callback,
-	void *callback_param)
+	void *callback_param,
+	u32 priority)
 {
-	EmergeThread *thread = NULL;
-	bool entry_already_exists = false;
+	FATAL_ERROR_IF(!m_queue, "No emerge threads!");
 
-	{
-		MutexAutoLock queuelock(m_queue_mutex);
+	int worker;
+	if (!m_queue->push(blockpos, peer_id, flags, callback, callback_param,
+			priority, &worker))
+		return false;
 
-		if (!pushBlockEmergeData(blockpos, peer_id, flags,
-				callback, callback_param, &entry_already_exists))
-			return false;
+	if (worker >= 0)
+		m_threads[worker]->signal();
 
-		if (entry_already_exists)
-			return true;
+	return true;
+}
 
-		thread = getOptimalThread();
-		thread->pushBlock(blockpos);
-	}
 
-	thread->signal();
+void EmergeManager::cancelBlockEmerges(session_t peer_id)
+{
+	if (!m_queue)
+		return;
 
-	return true;
+	size_t cancelled = m_queue->cancelPeer(peer_id);
+	for (size_t i = 0; i < cancelled; i++)
+		reportCompletedEmerge(EMERGE_CANCELLED);
 }
 
 
 size_t EmergeManager::getQueueSize()
 {
-	MutexAutoLock queuelock(m_queue_mutex);
-	return m_blocks_enqueued.size();
+	return m_queue ? m_queue->size() : 0;
 }
 
 bool EmergeManager::isBlockInQueue(v3s16 pos)
 {
-	MutexAutoLock queuelock(m_queue_mutex);
-	return m_blocks_enqueued.find(pos) != m_blocks_enqueued.end();
+	return m_queue && m_queue->contains(pos);
 }
 
 
@@ -364,96 +636,6 @@ bool EmergeManager::isBlockUnderground(v3s16 blockpos)
 	return blockpos.Y * (MAP_BLOCKSIZE + 1) <= mgparams->water_level;
 }
 
-bool EmergeManager::pushBlockEmergeData(
-	v3s16 pos,
-	u16 peer_requested,
-	u16 flags,
-	EmergeCompletionCallback callback,
-	void *callback_param,
-	bool *entry_already_exists)
-{
-	u32 &count_peer = m_peer_queue_count[peer_requested];
-
-	if ((flags & BLOCK_EMERGE_FORCE_QUEUE) == 0) {
-		if (m_blocks_enqueued.size() >= m_qlimit_total)
-			return false;
-
-		if (peer_requested != PEER_ID_INEXISTENT) {
-			u32 qlimit_peer = (flags & BLOCK_EMERGE_ALLOW_GEN) ?
-				m_qlimit_generate : m_qlimit_diskonly;
-			if (count_peer >= qlimit_peer)
-				return false;
-		} else {
-			// limit block enqueue requests for active blocks to 1/2 of total
-			if (count_peer * 2 >= m_qlimit_total)
-				return false;
-		}
-	}
-
-	auto findres = m_blocks_enqueued.emplace(pos, BlockEmergeData());
-
-	BlockEmergeData &bedata = findres.first->second;
-	*entry_already_exists   = !findres.second;
-
-	if (callback)
-		bedata.callbacks.emplace_back(callback, callback_param);
-
-	if (*entry_already_exists) {
-		bedata.flags |= flags;
-	} else {
-		bedata.flags = flags;
-		bedata.peer_requested = peer_requested;
-
-		count_peer++;
-	}
-
-	return true;
-}
-
-
-bool EmergeManager::popBlockEmergeData(v3s16 pos, BlockEmergeData *bedata)
-{
-	auto it = m_blocks_enqueued.find(pos);
-	if (it == m_blocks_enqueued.end())
-		return false;
-
-	*bedata = it->second;
-
-	auto it2 = m_peer_queue_count.find(bedata->peer_requested);
-	if (it2 == m_peer_queue_count.end())
-		return false;
-
-	u32 &count_peer = it2->second;
-
-	assert(count_peer != 0);
-	count_peer--;
-
-	m_blocks_enqueued.erase(it);
-
-	return true;
-}
-
-
-EmergeThread *EmergeManager::getOptimalThread()
-{
-	size_t nthreads = m_threads.size();
-
-	FATAL_ERROR_IF(nthreads == 0, "No emerge threads!");
-
-	size_t index = 0;
-	size_t nitems_lowest = m_threads[0]->m_block_queue.size();
-
-	for (size_t i = 1; i < nthreads; i++) {
-		size_t nitems = m_threads[i]->m_block_queue.size();
-		if (nitems < nitems_lowest) {
-			index = i;
-			nitems_lowest = nitems;
-		}
-	}
-
-	return m_threads[index];
-}
-
 void EmergeManager::reportCompletedEmerge(EmergeAction action)
 {
 	assert((size_t)action < ARRLEN(m_completed_emerge_counter));
@@ -484,28 +666,14 @@ void EmergeThread::signal()
 }
 
 
-bool EmergeThread::pushBlock(v3s16 pos)
-{
-	m_block_queue.push(pos);
-	return true;
-}
-
-
 void EmergeThread::cancelPendingItems()
 {
-	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
-
-	while (!m_block_queue.empty()) {
-		BlockEmergeData bedata;
-		v3s16 pos;
-
-		pos = m_block_queue.front();
-		m_block_queue.pop();
-
-		m_emerge->popBlockEmergeData(pos, &bedata);
+	BlockEmergeData bedata;
+	v3s16 pos;
 
+	// Other threads may still be running, leave their work to them
+	while (m_emerge->m_queue->pop(id, false, &pos, &bedata))
 		runCompletionCallbacks(pos, EMERGE_CANCELLED, bedata.callbacks);
-	}
 }
 
 
@@ -528,17 +696,14 @@ void EmergeThread::runCompletionCallbacks(v3s16 pos, EmergeAction action,
 
 bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
 {
-	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
-
-	if (m_block_queue.empty())
-		return false;
-
-	*pos = m_block_queue.front();
-	m_block_queue.pop();
-
-	m_emerge->popBlockEmergeData(*pos, bedata);
-
-	return true;
+	bool expired;
+	while (m_emerge->m_queue->pop(id, true, pos, bedata, &expired)) {
+		if (!expired)
+			return true;
+		// Nobody asked for the block recently
+		runCompletionCallbacks(*pos, EMERGE_CANCELLED, bedata->callbacks);
+	}
+	return false;
 }
 
 
@@ -609,20 +774,24 @@ MapBlock *EmergeThread::finishGen(v3s16 pos, BlockMakeData *bmdata,
 	v3s16 maxp = bmdata->blockpos_max * MAP_BLOCKSIZE +
 				 v3s16(1,1,1) * (MAP_BLOCKSIZE - 1);
 
-	// Ignore map edit events, they will not need to be sent
-	// to anyone because the block hasn't been sent yet.
-	MapEditEventAreaIgnorer ign(
-		&m_server->m_ignore_map_edit_events_area,
-		VoxelArea(minp, maxp));
-
 	/*
-		Run Lua on_generated callbacks in the server environment
+		Run Lua on_generated callbacks in the server environment.
+		Mods that do all their work in the mapgen environment have none,
+		then the chunk is done without entering the server's Lua.
 	*/
-	try {
-		m_server->getScriptIface()->environment_OnGenerated(
-			minp, maxp, m_mapgen->blockseed);
-	} catch (LuaError &e) {
-		m_server->setAsyncFatalError(e);
+	ServerScripting *script = m_server->getScriptIface();
+	if (script->has_on_generated()) {
+		// Ignore map edit events, they will not need to be sent
+		// to anyone because the block hasn't been sent yet.
+		MapEditEventAreaIgnorer ign(
+			&m_server->m_ignore_map_edit_events_area,
+			VoxelArea(minp, maxp));
+
+		try {
+			script->environment_OnGenerated(minp, maxp, m_mapgen->blockseed);
+		} catch (LuaError &e) {
+			m_server->setAsyncFatalError(e);
+		}
 	}
 
 	EMERGE_DBG_OUT("ended up with: " << analyze_block(block));
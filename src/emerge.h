@@ -4,8 +4,11 @@
 
 #pragma once
 
+#include <atomic>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <unordered_map>
 #include "network/networkprotocol.h"
 #include "irr_v3d.h"
 #include "util/metricsbackend.h"
@@ -15,6 +18,13 @@
 #define BLOCK_EMERGE_ALLOW_GEN   (1 << 0)
 #define BLOCK_EMERGE_FORCE_QUEUE (1 << 1)
 
+// Emerge priorities, lower values are emerged first. Blocks in the view of
+// a player use their distance to the player in blocks.
+// Blocks a player interacts with
+#define EMERGE_PRIORITY_INTERACT 0
+// Blocks wanted by the server or the API, after those players look at
+#define EMERGE_PRIORITY_SERVER 0x10000
+
 #define EMERGE_DBG_OUT(x) {                            \
 	if (enable_mapgen_debug_info)                      \
 		infostream << "EmergeThread: " x << std::endl; \
@@ -81,6 +91,127 @@ struct BlockEmergeData {
 	EmergeCallbackList callbacks;
 };
 
+/*
+	Queue of blocks waiting for the emerge threads.
+
+	Entries are sharded by position, and every worker has its own heap of
+	positions to process, so producers and workers rarely wait for the same
+	lock. A worker that runs out of positions takes them from the longest
+	heap of another worker.
+
+	Blocks are taken in order of priority, then in order of request. When a
+	request changes the priority of a queued block, a new heap item is
+	added and the old one is skipped once it comes up.
+*/
+class EmergeQueue {
+public:
+	/**
+	 * @param request_timeout_ms time after which requests of players that
+	 *        were not repeated are dropped, 0 to keep them
+	 */
+	EmergeQueue(size_t num_workers, u32 limit_total, u32 limit_diskonly,
+		u32 limit_generate, u32 request_timeout_ms = 0);
+	DISABLE_CLASS_COPY(EmergeQueue);
+
+	/**
+	 * Adds a block or merges the request into an existing entry.
+	 * Repeated requests of a player replace the priority of the entry,
+	 * other requests can only raise it.
+	 * The limits are checked without locking, so producers running at
+	 * the same time may exceed them by a few entries.
+	 * @param priority lower values are taken first
+	 * @param worker set to the worker that has to be woken up,
+	 *               or -1 if the block was already queued
+	 * @return false if the queue limits do not allow the request
+	 */
+	bool push(v3s16 pos, u16 peer_requested, u16 flags,
+		EmergeCompletionCallback callback, void *callback_param,
+		u32 priority, int *worker);
+
+	/**
+	 * Takes the next block for the given worker.
+	 * @param steal whether to take work from other workers if there is none
+	 * @param expired if given, set to whether the request timed out and
+	 *                the block should not be emerged. Only view requests
+	 *                of players expire, never forced or API requests.
+	 * @return false if there was nothing to do
+	 */
+	bool pop(size_t worker, bool steal, v3s16 *pos, BlockEmergeData *bedata,
+		bool *expired = nullptr);
+
+	/**
+	 * Drops the queued requests of a player.
+	 * Blocks that were also requested with a callback, by the server or
+	 * by another player stay.
+	 * @return number of dropped blocks
+	 */
+	size_t cancelPeer(u16 peer_id);
+
+	size_t size() const { return m_size.load(std::memory_order_relaxed); }
+	bool contains(v3s16 pos);
+
+private:
+	struct Entry {
+		BlockEmergeData data;
+		u32 priority;
+		// identifies the heap item that is currently valid
+		u64 version;
+		// last time a player requested the block
+		u64 request_time;
+		// false if anyone but one player without callbacks wants the block,
+		// or if it was forced into the queue
+		bool cancellable;
+	};
+
+	struct Shard {
+		std::mutex mutex;
+		std::unordered_map<v3s16, Entry> entries;
+	};
+
+	struct Item {
+		u32 priority;
+		u64 version;
+		v3s16 pos;
+	};
+
+	struct WorkerQueue {
+		std::mutex mutex;
+		// binary heap, the most urgent item first
+		std::vector<Item> items;
+		// readable without the mutex to pick a worker
+		std::atomic<size_t> size{0};
+		// whether the worker is processing a block it took
+		std::atomic<bool> busy{false};
+
+		size_t getLoad() const
+		{
+			return size.load(std::memory_order_relaxed) +
+				(busy.load(std::memory_order_relaxed) ? 1 : 0);
+		}
+	};
+
+	Shard &getShard(v3s16 pos);
+	bool checkLimits(u16 peer_requested, u16 flags) const;
+	int addItem(const Item &item);
+	bool takeItem(WorkerQueue &queue, Item *item);
+	void dropStaleItems(WorkerQueue &queue);
+	void removeEntry(const Entry &entry);
+
+	std::unique_ptr<Shard[]> m_shards;
+	std::unique_ptr<WorkerQueue[]> m_workers;
+	const size_t m_num_workers;
+
+	std::atomic<size_t> m_size{0};
+	std::atomic<u64> m_next_version{0};
+	// Queued blocks per peer, index = peer id
+	std::unique_ptr<std::atomic<u32>[]> m_peer_counts;
+
+	const u32 m_limit_total;
+	const u32 m_limit_diskonly;
+	const u32 m_limit_generate;
+	const u32 m_request_timeout_ms;
+};
+
 class EmergeParams {
 	friend class EmergeManager;
 public:
@@ -170,14 +301,19 @@ class EmergeManager {
 		session_t peer_id,
 		v3s16 blockpos,
 		bool allow_generate,
-		bool ignore_queue_limits=false);
+		bool ignore_queue_limits=false,
+		u32 priority=EMERGE_PRIORITY_SERVER);
 
 	bool enqueueBlockEmergeEx(
 		v3s16 blockpos,
 		session_t peer_id,
 		u16 flags,
 		EmergeCompletionCallback callback,
-		void *callback_param);
+		void *callback_param,
+		u32 priority=EMERGE_PRIORITY_SERVER);
+
+	// Drops the pending requests a player made for its view
+	void cancelBlockEmerges(session_t peer_id);
 
 	size_t getQueueSize();
 	bool isBlockInQueue(v3s16 pos);
@@ -203,13 +339,8 @@ class EmergeManager {
 	// The map database
 	MapDatabaseAccessor *m_db = nullptr;
 
-	std::mutex m_queue_mutex;
-	std::map<v3s16, BlockEmergeData> m_blocks_enqueued;
-	std::unordered_map<u16, u32> m_peer_queue_count;
-
-	u32 m_qlimit_total;
-	u32 m_qlimit_diskonly;
-	u32 m_qlimit_generate;
+	// created together with the threads
+	std::unique_ptr<EmergeQueue> m_queue;
 
 	// Emerge metrics
 	MetricCounterPtr m_completed_emerge_counter[5];
@@ -222,19 +353,6 @@ class EmergeManager {
 	DecorationManager *decomgr;
 	SchematicManager *schemmgr;
 
-	// Requires m_queue_mutex held
-	EmergeThread *getOptimalThread();
-
-	bool pushBlockEmergeData(
-		v3s16 pos,
-		u16 peer_requested,
-		u16 flags,
-		EmergeCompletionCallback callback,
-		void *callback_param,
-		bool *entry_already_exists);
-
-	bool popBlockEmergeData(v3s16 pos, BlockEmergeData *bedata);
-
 	void reportCompletedEmerge(EmergeAction action);
 
 	friend class EmergeThread;
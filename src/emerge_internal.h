@@ -10,8 +10,6 @@
 
 #include "emerge.h"
 
-#include <queue>
-
 #include "util/thread.h"
 #include "threading/event.h"
 
@@ -33,9 +31,6 @@ class EmergeThread : public Thread {
 	void *run();
 	void signal();
 
-	// Requires queue mutex held
-	bool pushBlock(v3s16 pos);
-
 	void cancelPendingItems();
 
 	EmergeManager *getEmergeManager() { return m_emerge; }
@@ -58,7 +53,6 @@ class EmergeThread : public Thread {
 	UniqueQueue<v3s16> *m_trans_liquid; //< non-null only when generating a mapblock
 
 	Event m_queue_event;
-	std::queue<v3s16> m_block_queue;
 
 	bool initScripting();
 
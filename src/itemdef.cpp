@@ -435,6 +435,11 @@ class CItemDefManager final : public IWritableItemDefManager
 		return m_item_definitions.find(name) != m_item_definitions.cend();
 	}
 
+	virtual u32 getChangeCounter() const
+	{
+		return m_change_counter;
+	}
+
 	void applyTextureOverrides(const std::vector<TextureOverride> &overrides)
 	{
 		if (overrides.empty())
@@ -442,6 +447,7 @@ class CItemDefManager final : public IWritableItemDefManager
 
 		infostream << "ItemDefManager::applyTextureOverrides(): Applying "
 			"overrides to textures" << std::endl;
+		m_change_counter++;
 
 		for (const TextureOverride& texture_override : overrides) {
 			if (m_item_definitions.find(texture_override.id) == m_item_definitions.end()) {
@@ -466,6 +472,7 @@ class CItemDefManager final : public IWritableItemDefManager
 		}
 		m_item_definitions.clear();
 		m_aliases.clear();
+		m_change_counter++;
 
 		// Add the four builtin items:
 		//   "" is the hand
@@ -507,6 +514,7 @@ class CItemDefManager final : public IWritableItemDefManager
 			m_item_definitions[def.name] = new ItemDefinition(def);
 		else
 			*(m_item_definitions[def.name]) = def;
+		m_change_counter++;
 
 		// Remove conflicting alias if it exists
 		bool alias_removed = (m_aliases.erase(def.name) != 0);
@@ -521,6 +529,7 @@ class CItemDefManager final : public IWritableItemDefManager
 
 		delete m_item_definitions[name];
 		m_item_definitions.erase(name);
+		m_change_counter++;
 	}
 
 	virtual void registerAlias(const std::string &name,
@@ -530,6 +539,7 @@ class CItemDefManager final : public IWritableItemDefManager
 			TRACESTREAM(<< "ItemDefManager: setting alias " << name
 				<< " -> " << convert_to << std::endl);
 			m_aliases[name] = convert_to;
+			m_change_counter++;
 		}
 	}
 
@@ -587,6 +597,8 @@ class CItemDefManager final : public IWritableItemDefManager
 	std::map<std::string, ItemDefinition*> m_item_definitions;
 	// Aliases
 	StringMap m_aliases;
+	// See getChangeCounter()
+	u32 m_change_counter = 0;
 };
 
 IWritableItemDefManager* createItemDefManager()
@@ -159,6 +159,10 @@ class IItemDefManager
 	virtual bool isKnown(const std::string &name) const=0;
 
 	virtual void serialize(std::ostream &os, u16 protocol_version)=0;
+
+	// Returns a number that changes whenever a definition or alias changes.
+	// Lets users cache the serialized definitions.
+	virtual u32 getChangeCounter() const=0;
 };
 
 class IWritableItemDefManager : public IItemDefManager
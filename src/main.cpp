@@ -117,6 +117,7 @@ static bool determine_subgame(GameParams *game_params);
 static bool run_dedicated_server(const GameParams &game_params, const Settings &cmd_args);
 static bool migrate_map_database(const GameParams &game_params, const Settings &cmd_args);
 static bool recompress_map_database(const GameParams &game_params, const Settings &cmd_args);
+static bool train_map_dictionary(const GameParams &game_params, const Settings &cmd_args);
 
 /**********************************************************************/
 
@@ -389,6 +390,8 @@ static void set_allowed_options(OptionList *allowed_options)
 			_("Enable ncurses interactive terminal" SERVER_ONLY))));
 	allowed_options->insert(std::make_pair("recompress", ValueSpec(VALUETYPE_FLAG,
 			_("Recompress the blocks of the given map database" SERVER_ONLY))));
+	allowed_options->insert(std::make_pair("train-map-dictionary", ValueSpec(VALUETYPE_FLAG,
+			_("Train compression dictionaries from the blocks of the given map database" SERVER_ONLY))));
 #if CHECK_CLIENT_BUILD()
 	allowed_options->insert(std::make_pair("address", ValueSpec(VALUETYPE_STRING,
 			_("Address to connect to ('' = local game)"))));
@@ -1136,6 +1139,9 @@ static bool run_dedicated_server(const GameParams &game_params, const Settings &
 	if (cmd_args.getFlag("recompress"))
 		return recompress_map_database(game_params, cmd_args);
 
+	if (cmd_args.getFlag("train-map-dictionary"))
+		return train_map_dictionary(game_params, cmd_args);
+
 	// Bind address
 	std::string bind_str = g_settings->get("bind_address");
 	Address bind_addr(0, 0, 0, 0, game_params.socket_port);
@@ -1316,6 +1322,8 @@ static bool recompress_map_database(const GameParams &game_params, const Setting
 	const std::string &backend = world_mt.get("backend");
 	Server server(game_params.world_path, game_params.game_spec, false, Address(), false);
 	MapDatabase *db = ServerMap::createDatabase(backend, game_params.world_path, world_mt);
+	const std::unique_ptr<ZstdDictionary> dict =
+		ServerMap::loadDictionary(game_params.world_path);
 
 	u32 count = 0;
 	u64 last_update_time = 0;
@@ -1327,8 +1335,6 @@ static bool recompress_map_database(const GameParams &game_params, const Setting
 	std::vector<v3s16> blocks;
 	db->listAllLoadableBlocks(blocks);
 	db->beginSave();
-	std::istringstream iss(std::ios_base::binary);
-	std::ostringstream oss(std::ios_base::binary);
 	for (auto it = blocks.begin(); it != blocks.end(); ++it) {
 		if (kill) return false;
 
@@ -1339,20 +1345,15 @@ static bool recompress_map_database(const GameParams &game_params, const Setting
 			return false;
 		}
 
-		iss.str(data);
-		iss.clear();
-
 		{
 			MapBlock mb(v3s16(0,0,0), &server);
-			ServerMap::deSerializeBlock(&mb, iss);
+			ServerMap::deSerializeBlock(&mb, data, dict.get());
 
-			oss.str("");
-			oss.clear();
-			writeU8(oss, serialize_as_ver);
-			mb.serialize(oss, serialize_as_ver, true, map_compression_level);
+			data.assign(1, serialize_as_ver);
+			mb.serialize(data, serialize_as_ver, true, map_compression_level, dict.get());
 		}
 
-		db->saveBlock(*it, oss.str());
+		db->saveBlock(*it, data);
 		count++;
 
 		if (porting::getTimeS() - last_update_time >= 1) {
@@ -1369,3 +1370,99 @@ static bool recompress_map_database(const GameParams &game_params, const Setting
 	actionstream << "Done, " << count << " blocks were recompressed." << std::endl;
 	return true;
 }
+
+static bool train_map_dictionary(const GameParams &game_params, const Settings &cmd_args)
+{
+	// Blocks compressed with an old dictionary could not be read anymore.
+	// Clients get the network one when they connect, so it can be replaced.
+	const std::string disk_path = ServerMap::getDictionaryPath(game_params.world_path);
+	const std::string net_path = ServerMap::getDictionaryPath(game_params.world_path, false);
+	const bool train_disk = !fs::PathExists(disk_path);
+	if (!train_disk) {
+		actionstream << "The world already has a map dictionary at " << disk_path
+			<< ", only the network one is trained" << std::endl;
+	}
+
+	Settings world_mt;
+	const std::string world_mt_path = game_params.world_path + DIR_DELIM + "world.mt";
+
+	if (!world_mt.readConfigFile(world_mt_path.c_str())) {
+		errorstream << "Cannot read world.mt at " << world_mt_path << std::endl;
+		return false;
+	}
+	const std::string &backend = world_mt.get("backend");
+	Server server(game_params.world_path, game_params.game_spec, false, Address(), false);
+	std::unique_ptr<MapDatabase> db(ServerMap::createDatabase(backend,
+		game_params.world_path, world_mt));
+	const std::unique_ptr<ZstdDictionary> dict =
+		ServerMap::loadDictionary(game_params.world_path);
+
+	constexpr size_t MAX_SAMPLES = 2000;
+
+	std::vector<v3s16> blocks;
+	db->listAllLoadableBlocks(blocks);
+	// Spread the samples over the whole map
+	const size_t step = std::max<size_t>(1, blocks.size() / MAX_SAMPLES);
+	std::vector<std::string> disk_samples, net_samples;
+	for (size_t i = 0; i < blocks.size(); i += step) {
+		std::string data;
+		db->loadBlock(blocks[i], &data);
+		if (data.empty())
+			continue;
+
+		/*
+			The network dictionary is sent to clients, so it must only be
+			trained on the network format. That leaves out private data
+			like node metadata fields, node timers and static objects.
+		*/
+		std::string disk_raw, net_raw;
+		try {
+			MapBlock mb(v3s16(0,0,0), &server);
+			ServerMap::deSerializeBlock(&mb, data, dict.get());
+			if (train_disk)
+				mb.serializeUncompressed(disk_raw, SER_FMT_VER_HIGHEST_WRITE, true);
+			mb.serializeUncompressed(net_raw, SER_FMT_VER_HIGHEST_WRITE, false);
+		} catch (SerializationError &e) {
+			errorstream << "Skipping block " << blocks[i] << ": " << e.what()
+				<< std::endl;
+			continue;
+		}
+		if (train_disk)
+			disk_samples.push_back(std::move(disk_raw));
+		net_samples.push_back(std::move(net_raw));
+	}
+
+	actionstream << "Training map dictionaries from " << net_samples.size()
+		<< " blocks" << std::endl;
+
+	auto train = [] (std::vector<std::string> samples, s16 compression_level,
+			const std::string &path) {
+		const std::string dict = ServerMap::trainDictionary(std::move(samples),
+			compression_level);
+		if (dict.empty()) {
+			errorstream << "No map dictionary was found that makes the blocks smaller, "
+				<< "not writing " << path << std::endl;
+			return false;
+		}
+		if (!fs::safeWriteToFile(path, dict)) {
+			errorstream << "Failed to write " << path << std::endl;
+			return false;
+		}
+		actionstream << "Wrote " << dict.size() << " bytes to " << path << std::endl;
+		return true;
+	};
+
+	bool wrote_disk = false;
+	if (train_disk) {
+		wrote_disk = train(std::move(disk_samples),
+			rangelim(g_settings->getS16("map_compression_level_disk"), -1, 9),
+			disk_path);
+	}
+	const bool wrote_net = train(std::move(net_samples),
+		rangelim(g_settings->getS16("map_compression_level_net"), -1, 9),
+		net_path);
+
+	if (wrote_disk)
+		actionstream << "Use --recompress to apply the disk dictionary to existing blocks." << std::endl;
+	return wrote_disk || wrote_net;
+}
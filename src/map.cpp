@@ -15,7 +15,7 @@
 #include "gamedef.h"
 #include "rollback_interface.h"
 #include "environment.h"
-#include <queue>
+#include <algorithm>
 
 /*
 	Map
@@ -91,14 +91,15 @@ MapSector *Map::getSectorNoGenerate(v2s16 p)
 	return getSectorNoGenerateNoLock(p);
 }
 
-MapBlock *Map::getBlockNoCreateNoEx(v3s16 p3d)
+void Map::getBlockNeighborhood(v3s16 p, MapBlock *(&blocks)[27])
 {
-	v2s16 p2d(p3d.X, p3d.Z);
-	MapSector *sector = getSectorNoGenerate(p2d);
-	if (!sector)
-		return nullptr;
-	MapBlock *block = sector->getBlockNoCreateNoEx(p3d.Y);
-	return block;
+	v3s16 positions[27];
+	size_t i = 0;
+	for (s16 z = -1; z <= 1; z++)
+	for (s16 y = -1; y <= 1; y++)
+	for (s16 x = -1; x <= 1; x++)
+		positions[i++] = p + v3s16(x, y, z);
+	m_block_index.get(positions, 27, blocks);
 }
 
 MapBlock *Map::getBlockNoCreate(v3s16 p3d)
@@ -265,20 +266,91 @@ bool Map::removeNodeWithEvent(v3s16 p)
 	return succeeded;
 }
 
-struct TimeOrderedMapBlock {
-	MapSector *sect;
-	MapBlock *block;
+bool Map::unloadQueueCompare(const UnloadQueueEntry &a, const UnloadQueueEntry &b)
+{
+	// The heap puts the greatest element on top, so the most recently used
+	// block has to compare as the smallest. Works across clock wrap-around.
+	return (s32)(a.usage_stamp - b.usage_stamp) > 0;
+}
 
-	TimeOrderedMapBlock(MapSector *sect, MapBlock *block) :
-		sect(sect),
-		block(block)
-	{}
+void Map::pushUnloadQueue(MapBlock *block)
+{
+	m_unload_queue.push_back(UnloadQueueEntry{block->getUsageStamp(),
+		(u32)(block->getModificationCounter() >> 32), block->getPos()});
+	std::push_heap(m_unload_queue.begin(), m_unload_queue.end(), unloadQueueCompare);
+}
 
-	bool operator<(const TimeOrderedMapBlock &b) const
-	{
-		return block->getUsageTimer() < b.block->getUsageTimer();
-	};
-};
+void Map::onBlockAdded(MapBlock *block)
+{
+	m_block_index.insert(block->getPos(), block);
+	block->setTracker(&m_block_tracker);
+	pushUnloadQueue(block);
+	m_block_count++;
+}
+
+void Map::onBlockRemoved(MapBlock *block)
+{
+	bool found = m_block_index.erase(block->getPos());
+	assert(found);
+	(void)found;
+	block->setTracker(nullptr);
+	assert(m_block_count > 0);
+	m_block_count--;
+	v3s16 p = block->getPos();
+	m_maybe_empty_sectors.emplace_back(p.X, p.Z);
+}
+
+void Map::pruneModifiedList()
+{
+	auto &modified = m_block_tracker.modified;
+	std::sort(modified.begin(), modified.end());
+	modified.erase(std::unique(modified.begin(), modified.end()), modified.end());
+	modified.erase(std::remove_if(modified.begin(), modified.end(), [this] (v3s16 p) {
+		MapBlock *block = getBlockNoCreateNoEx(p);
+		return !block || block->getModified() == MOD_STATE_CLEAN;
+	}), modified.end());
+}
+
+u32 Map::saveModifiedBlocks(ModifiedState save_level, Profiler &modprofiler)
+{
+	std::vector<v3s16> modified;
+	modified.swap(m_block_tracker.modified);
+	std::sort(modified.begin(), modified.end());
+	modified.erase(std::unique(modified.begin(), modified.end()), modified.end());
+
+	u32 block_count = 0;
+
+	// Don't do anything with sqlite unless something is really saved
+	bool save_started = false;
+
+	for (v3s16 p : modified) {
+		MapBlock *block = getBlockNoCreateNoEx(p);
+		if (!block || block->getModified() == MOD_STATE_CLEAN)
+			continue;
+
+		if (block->getModified() >= (u32)save_level) {
+			// Lazy beginSave()
+			if (!save_started) {
+				beginSave();
+				save_started = true;
+			}
+
+			modprofiler.add(block->getModifiedReasonString(), 1);
+
+			saveBlock(block);
+			block_count++;
+		}
+
+		// Look at it again next time
+		if (block->getModified() != MOD_STATE_CLEAN)
+			m_block_tracker.modified.push_back(p);
+	}
+
+	if (save_started)
+		endSave();
+
+	return block_count;
+}
 
 /*
 	Updates usage timers
@@ -291,119 +363,96 @@ void Map::timerUpdate(float dtime, float unload_timeout, s32 max_loaded_blocks,
 	// Profile modified reasons
 	Profiler modprofiler;
 
-	std::vector<v2s16> sector_deletion_queue;
 	u32 deleted_blocks_count = 0;
 	u32 saved_blocks_count = 0;
-	u32 block_count_all = 0;
 	u32 locked_blocks = 0;
 
 	const auto start_time = porting::getTimeUs();
-	beginSave();
-
-	// If there is no practical limit, we spare creation of mapblock_queue
-	if (max_loaded_blocks < 0) {
-		MapBlockVect blocks;
-		for (auto &sector_it : m_sectors) {
-			MapSector *sector = sector_it.second;
-
-			bool all_blocks_deleted = true;
-
-			blocks.clear();
-			sector->getBlocks(blocks);
-
-			for (MapBlock *block : blocks) {
-				block->incrementUsageTimer(dtime);
-
-				if (block->refGet() == 0
-						&& block->getUsageTimer() > unload_timeout) {
-					v3s16 p = block->getPos();
 
-					// Save if modified
-					if (block->getModified() != MOD_STATE_CLEAN
-							&& save_before_unloading) {
-						modprofiler.add(block->getModifiedReasonString(), 1);
-						if (!saveBlock(block))
-							continue;
-						saved_blocks_count++;
-					}
+	// Advancing the clock ages all blocks at once
+	m_usage_clock_frac += dtime * 1000.0f;
+	const u32 clock_step = m_usage_clock_frac;
+	m_usage_clock_frac -= clock_step;
+	m_block_tracker.usage_clock += clock_step;
+	const u32 now = m_block_tracker.usage_clock;
 
-					// Delete from memory
-					sector->deleteBlock(block);
-
-					if (unloaded_blocks)
-						unloaded_blocks->push_back(p);
+	beginSave();
 
-					deleted_blocks_count++;
-				} else {
-					all_blocks_deleted = false;
-					block_count_all++;
-				}
-			}
+	// Delete old blocks, and blocks over the limit from the memory.
+	// Only the least recently used blocks have to be looked at.
+	std::vector<UnloadQueueEntry> kept;
+	while (!m_unload_queue.empty()) {
+		const UnloadQueueEntry entry = m_unload_queue.front();
+		const bool over_limit = max_loaded_blocks >= 0 &&
+				m_block_count > (size_t)max_loaded_blocks;
+		if (!over_limit && (now - entry.usage_stamp) * 0.001f <= unload_timeout)
+			break;
+
+		std::pop_heap(m_unload_queue.begin(), m_unload_queue.end(), unloadQueueCompare);
+		m_unload_queue.pop_back();
+
+		MapBlock *block = getBlockNoCreateNoEx(entry.pos);
+		if (!block || (u32)(block->getModificationCounter() >> 32) != entry.instance)
+			continue;
 
-			// Delete sector if we emptied it
-			if (all_blocks_deleted) {
-				sector_deletion_queue.push_back(sector_it.first);
-			}
-		}
-	} else {
-		std::priority_queue<TimeOrderedMapBlock> mapblock_queue;
-		for (auto &sector_it : m_sectors) {
-			const MapSector *sector = sector_it.second;
-			for (const auto &entry : sector->getBlocks()) {
-				MapBlock *block = entry.second.get();
-				block->incrementUsageTimer(dtime);
-				mapblock_queue.push(TimeOrderedMapBlock(const_cast<MapSector*>(sector), block));
-			}
+		if (block->getUsageStamp() != entry.usage_stamp) {
+			// Was used in the meantime
+			pushUnloadQueue(block);
+			continue;
 		}
-		block_count_all = mapblock_queue.size();
 
-		// Delete old blocks, and blocks over the limit from the memory
-		while (!mapblock_queue.empty() && ((s32)mapblock_queue.size() > max_loaded_blocks
-				|| mapblock_queue.top().block->getUsageTimer() > unload_timeout)) {
-			TimeOrderedMapBlock b = mapblock_queue.top();
-			mapblock_queue.pop();
+		if (block->refGet() != 0) {
+			locked_blocks++;
+			kept.push_back(entry);
+			continue;
+		}
 
-			MapBlock *block = b.block;
+		v3s16 p = block->getPos();
 
-			if (block->refGet() != 0) {
-				locked_blocks++;
+		// Save if modified
+		if (block->getModified() != MOD_STATE_CLEAN && save_before_unloading) {
+			modprofiler.add(block->getModifiedReasonString(), 1);
+			if (!saveBlock(block)) {
+				kept.push_back(entry);
 				continue;
 			}
+			saved_blocks_count++;
+		}
 
-			v3s16 p = block->getPos();
-
-			// Save if modified
-			if (block->getModified() != MOD_STATE_CLEAN && save_before_unloading) {
-				modprofiler.add(block->getModifiedReasonString(), 1);
-				if (!saveBlock(block))
-					continue;
-				saved_blocks_count++;
-			}
-
-			// Delete from memory
-			b.sect->deleteBlock(block);
+		// Delete from memory
+		getSectorNoGenerate(v2s16(p.X, p.Z))->deleteBlock(block);
 
-			if (unloaded_blocks)
-				unloaded_blocks->push_back(p);
+		if (unloaded_blocks)
+			unloaded_blocks->push_back(p);
 
-			deleted_blocks_count++;
-			block_count_all--;
-		}
+		deleted_blocks_count++;
+	}
 
-		// Delete empty sectors
-		for (auto &sector_it : m_sectors) {
-			if (sector_it.second->empty()) {
-				sector_deletion_queue.push_back(sector_it.first);
-			}
-		}
+	for (const auto &entry : kept) {
+		m_unload_queue.push_back(entry);
+		std::push_heap(m_unload_queue.begin(), m_unload_queue.end(), unloadQueueCompare);
 	}
 
 	endSave();
 	const auto end_time = porting::getTimeUs();
 
-	reportMetrics(end_time - start_time, saved_blocks_count, block_count_all);
+	reportMetrics(end_time - start_time, saved_blocks_count, m_block_count);
+
+	// Nothing removes entries from the modified list if the map is never saved
+	if (m_block_tracker.modified.size() > 2 * m_block_count + 64)
+		pruneModifiedList();
 
 	// Finally delete the empty sectors
+	std::vector<v2s16> sector_deletion_queue;
+	std::sort(m_maybe_empty_sectors.begin(), m_maybe_empty_sectors.end());
+	m_maybe_empty_sectors.erase(std::unique(m_maybe_empty_sectors.begin(),
+			m_maybe_empty_sectors.end()), m_maybe_empty_sectors.end());
+	for (v2s16 p : m_maybe_empty_sectors) {
+		auto it = m_sectors.find(p);
+		if (it != m_sectors.end() && it->second->empty())
+			sector_deletion_queue.push_back(p);
+	}
+	m_maybe_empty_sectors.clear();
 	deleteSectors(sector_deletion_queue);
 
 	if(deleted_blocks_count != 0)
@@ -413,7 +462,7 @@ void Map::timerUpdate(float dtime, float unload_timeout, s32 max_loaded_blocks,
 				<<" blocks from memory";
 		if(save_before_unloading)
 			infostream<<", of which "<<saved_blocks_count<<" were written";
-		infostream<<", "<<block_count_all<<" blocks in memory, " << locked_blocks << " locked";
+		infostream<<", "<<m_block_count<<" blocks in memory, " << locked_blocks << " locked";
 		infostream<<"."<<std::endl;
 		if(saved_blocks_count != 0){
 			PrintInfo(infostream); // ServerMap/ClientMap:
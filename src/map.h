@@ -11,16 +11,19 @@
 
 #include "irrlichttypes_bloated.h"
 #include "mapblock.h" // for forEachNodeInArea
+#include "map_block_index.h"
 #include "mapnode.h"
 #include "constants.h"
 #include "voxel.h"
 #include "modifiedstate.h"
+#include "util/basic_macros.h" // for forEachNodeInArea
 #include "util/numeric.h" // for forEachNodeInArea
 
 class MapSector;
 class NodeMetadata;
 class NodeTimer;
 class IGameDef;
+class Profiler;
 
 /*
 	MapEditEvent
@@ -123,7 +126,26 @@ class Map /*: public NodeContainer*/
 	// Returns InvalidPositionException if not found
 	MapBlock * getBlockNoCreate(v3s16 p);
 	// Returns NULL if not found
-	MapBlock * getBlockNoCreateNoEx(v3s16 p);
+	MapBlock * getBlockNoCreateNoEx(v3s16 p)
+	{
+		return m_block_index.get(p);
+	}
+
+	/*
+		Looks up many blocks at once, missing ones are returned as nullptr.
+		Faster than calling getBlockNoCreateNoEx() for each position.
+	*/
+	void getBlocksNoCreateNoEx(const v3s16 *positions, size_t count,
+			MapBlock **blocks)
+	{
+		m_block_index.get(positions, count, blocks);
+	}
+
+	/*
+		Gets the 27 blocks of the 3x3x3 neighbourhood of p (including p).
+		Index is (z + 1) * 9 + (y + 1) * 3 + (x + 1) for offsets x, y, z.
+	*/
+	void getBlockNeighborhood(v3s16 p, MapBlock *(&blocks)[27]);
 
 	/* Server overrides */
 	virtual MapBlock * emergeBlock(v3s16 p, bool create_blank=true)
@@ -187,6 +209,9 @@ class Map /*: public NodeContainer*/
 	*/
 	void unloadUnreferencedBlocks(std::vector<v3s16> *unloaded_blocks=NULL);
 
+	// Number of blocks in memory
+	size_t getBlockCount() const { return m_block_count; }
+
 	// Deletes sectors and their blocks from memory
 	// Takes cache into account
 	// If deleted sector is in sector cache, clears cache
@@ -238,6 +263,32 @@ class Map /*: public NodeContainer*/
 	// as its second. If it returns false, forEachNodeInArea returns early.
 	template<typename F>
 	void forEachNodeInArea(v3s16 minp, v3s16 maxp, F func)
+	{
+		forEachNodeInAreaImpl(minp, maxp, nullptr, func);
+	}
+
+	// Like the above, but only the nodes with a content in the filter are
+	// guaranteed to be visited. Blocks that cannot contain any of them are
+	// skipped as a whole (see MapBlock::mayContainAny()).
+	template<typename F>
+	void forEachNodeInArea(v3s16 minp, v3s16 maxp,
+			const std::vector<content_t> &filter, F func)
+	{
+		forEachNodeInAreaImpl(minp, maxp, &filter, func);
+	}
+
+	bool isBlockOccluded(MapBlock *block, v3s16 cam_pos_nodes)
+	{
+		return isBlockOccluded(block->getPosRelative(), cam_pos_nodes, false);
+	}
+	bool isBlockOccluded(v3s16 pos_relative, v3s16 cam_pos_nodes, bool simple_check = false);
+
+protected:
+	friend class MapSector;
+
+	template<typename F>
+	void forEachNodeInAreaImpl(v3s16 minp, v3s16 maxp,
+			const std::vector<content_t> *filter, F &func)
 	{
 		v3s16 bpmin = getNodeBlockPos(minp);
 		v3s16 bpmax = getNodeBlockPos(maxp);
@@ -247,6 +298,9 @@ class Map /*: public NodeContainer*/
 			// y is iterated innermost to make use of the sector cache.
 			v3s16 bp(bx, by, bz);
 			MapBlock *block = getBlockNoCreateNoEx(bp);
+			if (filter && !(block ? block->mayContainAny(*filter) :
+					CONTAINS(*filter, CONTENT_IGNORE)))
+				continue;
 			v3s16 basep = bp * MAP_BLOCKSIZE;
 			s16 minx_block = rangelim(minp.X - basep.X, 0, MAP_BLOCKSIZE - 1);
 			s16 miny_block = rangelim(minp.Y - basep.Y, 0, MAP_BLOCKSIZE - 1);
@@ -267,13 +321,17 @@ class Map /*: public NodeContainer*/
 		}
 	}
 
-	bool isBlockOccluded(MapBlock *block, v3s16 cam_pos_nodes)
-	{
-		return isBlockOccluded(block->getPosRelative(), cam_pos_nodes, false);
-	}
-	bool isBlockOccluded(v3s16 pos_relative, v3s16 cam_pos_nodes, bool simple_check = false);
+	// Called by MapSector
+	void onBlockAdded(MapBlock *block);
+	void onBlockRemoved(MapBlock *block);
+
+	/*
+		Saves all blocks that are modified at least as much as save_level.
+		Only the blocks that were modified since their last save are looked at.
+		Returns the number of saved blocks.
+	*/
+	u32 saveModifiedBlocks(ModifiedState save_level, Profiler &modprofiler);
 
-protected:
 	IGameDef *m_gamedef;
 
 	std::set<MapEventReceiver*> m_event_receivers;
@@ -295,6 +353,39 @@ class Map /*: public NodeContainer*/
 	bool isOccluded(v3s16 pos_camera, v3s16 pos_target,
 		float step, float stepfac, float start_offset, float end_offset,
 		u32 needed_count);
+
+private:
+	struct UnloadQueueEntry {
+		u32 usage_stamp;
+		u32 instance; // upper half of MapBlock::getModificationCounter()
+		v3s16 pos;
+	};
+
+	static bool unloadQueueCompare(const UnloadQueueEntry &a,
+		const UnloadQueueEntry &b);
+	void pushUnloadQueue(MapBlock *block);
+	// Drops modified list entries of blocks that are gone or clean
+	void pruneModifiedList();
+
+	// All blocks of the map by position. The sectors own the blocks, this is
+	// for fast lookups.
+	MapBlockIndex m_block_index;
+
+	MapBlockTracker m_block_tracker;
+	// Sub-millisecond part of the usage clock
+	float m_usage_clock_frac = 0;
+	size_t m_block_count = 0;
+
+	/*
+		Heap of all blocks, least recently used first. An entry is outdated if
+		the block was used after it was pushed; timerUpdate() then pushes it
+		again with the new stamp. Entries of blocks that no longer exist
+		are dropped when they reach the top.
+	*/
+	std::vector<UnloadQueueEntry> m_unload_queue;
+
+	// Sectors that lost a block and may have to be deleted
+	std::vector<v2s16> m_maybe_empty_sectors;
 };
 
 class MMVManip : public VoxelManipulator
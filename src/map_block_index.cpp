@@ -0,0 +1,127 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#include "map_block_index.h"
+
+#include <algorithm>
+#include <cassert>
+
+// Minimum number of slots, must be a power of two
+#define BLOCK_INDEX_MIN_CAPACITY 64
+// Batch lookups are split into chunks of this size
+#define BLOCK_INDEX_BATCH 32
+
+void MapBlockIndex::get(const v3s16 *positions, size_t count, MapBlock **result) const
+{
+	if (m_count == 0) {
+		for (size_t i = 0; i < count; i++)
+			result[i] = nullptr;
+		return;
+	}
+
+	u64 keys[BLOCK_INDEX_BATCH];
+	size_t slots[BLOCK_INDEX_BATCH];
+	for (size_t base = 0; base < count; base += BLOCK_INDEX_BATCH) {
+		const size_t n = std::min<size_t>(count - base, BLOCK_INDEX_BATCH);
+
+		// Compute all slots first so that the loads below don't depend on
+		// each other and the CPU can issue them in parallel
+		for (size_t i = 0; i < n; i++) {
+			keys[i] = packKey(positions[base + i]);
+			slots[i] = slotFor(keys[i]);
+		}
+
+		for (size_t i = 0; i < n; i++) {
+			MapBlock *found = nullptr;
+			for (size_t s = slots[i]; m_slots[s].block; s = (s + 1) & m_mask) {
+				if (m_slots[s].key == keys[i]) {
+					found = m_slots[s].block;
+					break;
+				}
+			}
+			result[base + i] = found;
+		}
+	}
+}
+
+void MapBlockIndex::insert(v3s16 p, MapBlock *block)
+{
+	assert(block);
+	// Keep the load factor at or below 1/2
+	if ((m_count + 1) * 2 > m_slots.size())
+		rehash(std::max<size_t>(m_slots.size() * 2, BLOCK_INDEX_MIN_CAPACITY));
+
+	const u64 key = packKey(p);
+	size_t i = slotFor(key);
+	while (m_slots[i].block) {
+		assert(m_slots[i].key != key);
+		i = (i + 1) & m_mask;
+	}
+	m_slots[i] = Slot{key, block};
+	m_count++;
+}
+
+bool MapBlockIndex::erase(v3s16 p)
+{
+	if (m_count == 0)
+		return false;
+
+	const u64 key = packKey(p);
+	size_t i = slotFor(key);
+	while (true) {
+		if (!m_slots[i].block)
+			return false;
+		if (m_slots[i].key == key)
+			break;
+		i = (i + 1) & m_mask;
+	}
+
+	// Backward shift deletion: move following entries of the probe sequence
+	// into the hole, so that no tombstones are needed
+	size_t hole = i;
+	for (size_t j = (i + 1) & m_mask; m_slots[j].block; j = (j + 1) & m_mask) {
+		const size_t home = slotFor(m_slots[j].key);
+		// Can the entry at j be moved to the hole? Only if its home slot is
+		// not in the cyclic range (hole, j].
+		const bool home_after_hole = hole <= j ?
+			(hole < home && home <= j) : (hole < home || home <= j);
+		if (!home_after_hole) {
+			m_slots[hole] = m_slots[j];
+			hole = j;
+		}
+	}
+	m_slots[hole] = Slot{0, nullptr};
+	m_count--;
+	return true;
+}
+
+void MapBlockIndex::clear()
+{
+	m_slots.clear();
+	m_mask = 0;
+	m_shift = 64;
+	m_count = 0;
+}
+
+void MapBlockIndex::rehash(size_t capacity)
+{
+	assert((capacity & (capacity - 1)) == 0);
+
+	std::vector<Slot> old;
+	old.swap(m_slots);
+	m_slots.assign(capacity, Slot{0, nullptr});
+	m_mask = capacity - 1;
+	m_shift = 64;
+	for (size_t c = capacity; c > 1; c >>= 1)
+		m_shift--;
+
+	for (const Slot &slot : old) {
+		if (!slot.block)
+			continue;
+		size_t i = slotFor(slot.key);
+		while (m_slots[i].block)
+			i = (i + 1) & m_mask;
+		m_slots[i] = slot;
+	}
+}
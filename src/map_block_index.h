@@ -0,0 +1,80 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#pragma once
+
+#include <vector>
+#include "irrlichttypes.h"
+#include "irr_v3d.h"
+
+class MapBlock;
+
+/*
+	Hash index from block position to MapBlock.
+
+	Open addressing with linear probing on a flat array, so a lookup is
+	usually a single cache miss. The index does not own the blocks.
+*/
+class MapBlockIndex
+{
+public:
+	MapBlockIndex() = default;
+
+	// Returns nullptr if not found
+	MapBlock *get(v3s16 p) const
+	{
+		if (m_count == 0)
+			return nullptr;
+		const u64 key = packKey(p);
+		for (size_t i = slotFor(key); ; i = (i + 1) & m_mask) {
+			const Slot &slot = m_slots[i];
+			if (!slot.block)
+				return nullptr;
+			if (slot.key == key)
+				return slot.block;
+		}
+	}
+
+	/*
+		Looks up count positions at once. Missing blocks are returned as nullptr.
+		Faster than separate get() calls because the memory accesses for all
+		positions can overlap.
+	*/
+	void get(const v3s16 *positions, size_t count, MapBlock **result) const;
+
+	// The position must not be in the index yet
+	void insert(v3s16 p, MapBlock *block);
+
+	// Returns false if the position was not in the index
+	bool erase(v3s16 p);
+
+	void clear();
+
+	size_t size() const { return m_count; }
+
+private:
+	struct Slot {
+		u64 key;
+		// nullptr marks an empty slot
+		MapBlock *block;
+	};
+
+	static u64 packKey(v3s16 p)
+	{
+		return (u64)(u16)p.X << 32 | (u64)(u16)p.Y << 16 | (u64)(u16)p.Z;
+	}
+
+	size_t slotFor(u64 key) const
+	{
+		// Fibonacci hashing, uses the high bits of the product
+		return (key * 0x9E3779B97F4A7C15ULL) >> m_shift;
+	}
+
+	void rehash(size_t capacity);
+
+	std::vector<Slot> m_slots;
+	size_t m_mask = 0;
+	u32 m_shift = 64;
+	size_t m_count = 0;
+};
@@ -0,0 +1,234 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#include "map_save_queue.h"
+
+#include <vector>
+#include "database/database.h"
+#include "debug.h"
+#include "log.h"
+#include "mapblock.h"
+#include "serialization.h"
+#include "servermap.h"
+#include "threading/thread.h"
+
+// How many blocks may be pending before enqueue() starts blocking
+#define MAP_SAVE_QUEUE_LIMIT 4096
+// Maximum number of blocks written in one database transaction
+#define MAP_SAVE_BATCH_SIZE 256
+
+class MapSaveWriterThread : public Thread
+{
+public:
+	MapSaveWriterThread(MapSaveQueue *queue) :
+		Thread("MapSave"), m_queue(queue)
+	{}
+
+	void *run() override
+	{
+		BEGIN_DEBUG_EXCEPTION_HANDLER
+
+		m_queue->writerLoop();
+
+		END_DEBUG_EXCEPTION_HANDLER
+
+		return nullptr;
+	}
+
+private:
+	MapSaveQueue *m_queue;
+};
+
+MapSaveQueue::MapSaveQueue(MapDatabaseAccessor *db, int compression_level,
+		unsigned int num_threads, MetricsBackend *mb) :
+	m_db(db),
+	m_compression_level(compression_level),
+	m_max_pending(MAP_SAVE_QUEUE_LIMIT),
+	m_pool("MapCompress", num_threads)
+{
+	m_queue_gauge = mb->addGauge("minetest_map_save_queue",
+		"Number of blocks waiting to be saved");
+
+	m_writer = std::make_unique<MapSaveWriterThread>(this);
+	m_writer->start();
+}
+
+MapSaveQueue::~MapSaveQueue()
+{
+	flush();
+
+	{
+		std::lock_guard lock(m_mutex);
+		m_stopping = true;
+	}
+	m_ready_cv.notify_all();
+	m_writer->wait();
+}
+
+void MapSaveQueue::enqueue(MapBlock *block)
+{
+	const v3s16 pos = block->getPos();
+
+	/*
+		[0] u8 serialization version
+		[1] data
+	*/
+	const u8 version = SER_FMT_VER_HIGHEST_WRITE;
+	std::string raw(1, version);
+	block->serializeUncompressed(raw, version, true);
+	auto snapshot = std::make_shared<const std::string>(std::move(raw));
+
+	u64 generation;
+	{
+		std::unique_lock lock(m_mutex);
+		// Replacing an existing entry does not make the queue grow
+		m_written_cv.wait(lock, [&] {
+			return m_entries.size() < m_max_pending || m_entries.count(pos) > 0;
+		});
+
+		generation = m_next_generation++;
+		m_entries[pos] = Entry{generation, false, std::move(snapshot)};
+	}
+	updateGauge();
+
+	m_pool.submit([this, pos, generation] () {
+		compressJob(pos, generation);
+	});
+}
+
+std::string MapSaveQueue::compressSnapshot(const std::string &raw) const
+{
+	assert(!raw.empty());
+	std::string result(1, raw[0]);
+	compress(std::string_view(raw).substr(1), result, raw[0], m_compression_level,
+		m_db->dictionary);
+	return result;
+}
+
+void MapSaveQueue::compressJob(v3s16 pos, u64 generation)
+{
+	std::shared_ptr<const std::string> raw;
+	{
+		std::lock_guard lock(m_mutex);
+		auto it = m_entries.find(pos);
+		// superseded or cancelled in the meantime
+		if (it == m_entries.end() || it->second.generation != generation)
+			return;
+		raw = it->second.data;
+	}
+
+	auto compressed = std::make_shared<const std::string>(compressSnapshot(*raw));
+
+	{
+		std::lock_guard lock(m_mutex);
+		auto it = m_entries.find(pos);
+		if (it == m_entries.end() || it->second.generation != generation)
+			return;
+		it->second.compressed = true;
+		it->second.data = std::move(compressed);
+		m_ready.emplace_back(pos, generation);
+	}
+	m_ready_cv.notify_one();
+}
+
+bool MapSaveQueue::getPending(v3s16 pos, std::string &ret)
+{
+	std::shared_ptr<const std::string> data;
+	bool compressed;
+	{
+		std::lock_guard lock(m_mutex);
+		auto it = m_entries.find(pos);
+		if (it == m_entries.end())
+			return false;
+		data = it->second.data;
+		compressed = it->second.compressed;
+	}
+
+	// Rare case: the reader was faster than the worker pool
+	ret = compressed ? *data : compressSnapshot(*data);
+	return true;
+}
+
+void MapSaveQueue::cancel(v3s16 pos)
+{
+	{
+		std::lock_guard lock(m_mutex);
+		if (m_entries.erase(pos) == 0)
+			return;
+	}
+	m_written_cv.notify_all();
+	updateGauge();
+}
+
+void MapSaveQueue::flush()
+{
+	std::unique_lock lock(m_mutex);
+	m_written_cv.wait(lock, [this] {
+		return m_entries.empty();
+	});
+}
+
+size_t MapSaveQueue::size()
+{
+	std::lock_guard lock(m_mutex);
+	return m_entries.size();
+}
+
+void MapSaveQueue::updateGauge()
+{
+	m_queue_gauge->set(size());
+}
+
+void MapSaveQueue::writerLoop()
+{
+	std::vector<std::pair<v3s16, u64>> batch;
+	batch.reserve(MAP_SAVE_BATCH_SIZE);
+
+	while (true) {
+		batch.clear();
+		{
+			std::unique_lock lock(m_mutex);
+			m_ready_cv.wait(lock, [this] {
+				return !m_ready.empty() || m_stopping;
+			});
+			// flush() in the destructor guarantees that nothing is left
+			if (m_ready.empty())
+				return;
+			while (!m_ready.empty() && batch.size() < MAP_SAVE_BATCH_SIZE) {
+				batch.push_back(m_ready.front());
+				m_ready.pop_front();
+			}
+		}
+
+		std::lock_guard dblock(m_db->mutex);
+		MapDatabase *db = m_db->dbase;
+		db->beginSave();
+		for (auto &it : batch) {
+			const v3s16 pos = it.first;
+			std::shared_ptr<const std::string> data;
+			{
+				std::lock_guard lock(m_mutex);
+				auto e = m_entries.find(pos);
+				if (e == m_entries.end() || e->second.generation != it.second)
+					continue;
+				data = e->second.data;
+			}
+
+			if (!db->saveBlock(pos, *data)) {
+				errorstream << "MapSaveQueue: Failed to save block "
+					<< pos << std::endl;
+			}
+
+			std::lock_guard lock(m_mutex);
+			auto e = m_entries.find(pos);
+			// A newer snapshot has to stay around until it is written too
+			if (e != m_entries.end() && e->second.generation == it.second)
+				m_entries.erase(e);
+		}
+		db->endSave();
+
+		m_written_cv.notify_all();
+		updateGauge();
+	}
+}
@@ -0,0 +1,96 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "irr_v3d.h"
+#include "threading/worker_pool.h"
+#include "util/metricsbackend.h"
+
+class MapBlock;
+class MapSaveWriterThread;
+class MetricsBackend;
+struct MapDatabaseAccessor;
+
+/*
+	Saves map blocks in the background.
+
+	The server thread only takes an uncompressed snapshot of each block,
+	compression happens on a worker pool and a dedicated writer thread
+	commits the results to the database in batches.
+	Until a block has been written its newest data can be retrieved with
+	getPending(), so readers of the database never see stale data.
+
+	Lock order: MapDatabaseAccessor::mutex before the internal mutex.
+*/
+class MapSaveQueue
+{
+public:
+	MapSaveQueue(MapDatabaseAccessor *db, int compression_level,
+		unsigned int num_threads, MetricsBackend *mb);
+	/// Writes everything that is still queued.
+	~MapSaveQueue();
+	DISABLE_CLASS_COPY(MapSaveQueue)
+
+	/// Snapshot a block and queue it for saving.
+	/// Blocks the caller while too many saves are pending (backpressure).
+	void enqueue(MapBlock *block);
+
+	/// Get the queued data of a block that was not written yet,
+	/// in the same format as MapDatabase::loadBlock returns it.
+	/// @note call with the database mutex locked
+	/// @return true if there is pending data for this position
+	bool getPending(v3s16 pos, std::string &ret);
+
+	/// Forget a pending save, e.g. because the block is being deleted.
+	/// @note call with the database mutex locked
+	void cancel(v3s16 pos);
+
+	/// Block until everything enqueued up to now has been written.
+	void flush();
+
+	/// @return number of blocks that are not written yet
+	size_t size();
+
+private:
+	struct Entry {
+		// incremented for every new snapshot of the same block
+		u64 generation;
+		bool compressed;
+		// serialization version followed by the (un)compressed block data
+		std::shared_ptr<const std::string> data;
+	};
+
+	void compressJob(v3s16 pos, u64 generation);
+	std::string compressSnapshot(const std::string &raw) const;
+	void writerLoop();
+	void updateGauge();
+
+	MapDatabaseAccessor *m_db;
+	const int m_compression_level;
+	const size_t m_max_pending;
+
+	std::mutex m_mutex;
+	// signalled when entries were written (or dropped)
+	std::condition_variable m_written_cv;
+	// signalled when m_ready has new items or on shutdown
+	std::condition_variable m_ready_cv;
+	std::unordered_map<v3s16, Entry> m_entries;
+	// positions with compressed data waiting for the writer
+	std::deque<std::pair<v3s16, u64>> m_ready;
+	u64 m_next_generation = 0;
+	bool m_stopping = false;
+
+	MetricGaugePtr m_queue_gauge;
+
+	WorkerPool m_pool;
+	std::unique_ptr<MapSaveWriterThread> m_writer;
+	friend class MapSaveWriterThread;
+};
@@ -4,6 +4,7 @@
 
 #include "mapblock.h"
 
+#include <atomic>
 #include <memory>
 #include <sstream>
 #include "map.h"
@@ -14,6 +15,7 @@
 #include "content_mapnode.h"  // For legacy name-id mapping
 #include "content_nodemeta.h" // For legacy deserialization
 #include "serialization.h"
+#include "util/stream.h"
 #if CHECK_CLIENT_BUILD()
 #include "client/mapblock_mesh.h"
 #endif
@@ -98,12 +100,16 @@ static const char *modified_reason_strings[] = {
 	MapBlock
 */
 
+static std::atomic<u32> g_mapblock_instance_counter;
+
 MapBlock::MapBlock(v3s16 pos, IGameDef *gamedef):
 		m_pos(pos),
 		m_pos_relative(pos * MAP_BLOCKSIZE),
 		m_gamedef(gamedef),
 		m_is_mono_block(false)
 {
+	m_modification_counter = (u64)g_mapblock_instance_counter++ << 32;
+
 	// We start with nodecount nodes, because in the vast
 	// majority of the cases a block is created just before
 	// it is de-serialized or generated.
@@ -119,9 +125,10 @@ MapBlock::~MapBlock()
 	}
 #endif
 
-	delete[] data;
-	if (!m_is_mono_block)
+	if (!m_is_mono_block && !m_indices)
 		porting::TrackFreedMemory(sizeof(MapNode) * nodecount);
+	delete[] data;
+	delete[] m_indices;
 }
 
 static inline size_t get_max_objects_per_block()
@@ -216,8 +223,15 @@ void MapBlock::copyTo(VoxelManipulator &dst)
 	v3s16 data_size(MAP_BLOCKSIZE, MAP_BLOCKSIZE, MAP_BLOCKSIZE);
 	VoxelArea data_area(v3s16(0,0,0), data_size - v3s16(1,1,1));
 
+	const MapNode *nodes = data;
+	if (m_indices) {
+		thread_local std::unique_ptr<MapNode[]> decoded(new MapNode[nodecount]);
+		decodePalette(decoded.get());
+		nodes = decoded.get();
+	}
+
 	// Copy from data to VoxelManipulator
-	dst.copyFrom(data, m_is_mono_block, data_area, v3s16(0,0,0),
+	dst.copyFrom(nodes, m_is_mono_block, data_area, v3s16(0,0,0),
 			getPosRelative(), data_size);
 }
 
@@ -231,6 +245,7 @@ void MapBlock::copyFrom(const VoxelManipulator &src)
 	src.copyTo(data, data_area, v3s16(0,0,0),
 			getPosRelative(), data_size);
 	tryShrinkNodes();
+	contents.clear();
 }
 
 void MapBlock::reallocate(u32 count, MapNode n)
@@ -240,9 +255,11 @@ void MapBlock::reallocate(u32 count, MapNode n)
 	// The client has known data races on the block's data (FIXME).
 	assert(!m_gamedef->isClient() || count == nodecount);
 
-	delete[] data;
-	if (data && !m_is_mono_block && count == 1)
+	if (data && !m_is_mono_block && !m_indices && count == 1)
 		porting::TrackFreedMemory(sizeof(MapNode) * nodecount);
+	delete[] data;
+	delete[] m_indices;
+	m_indices = nullptr;
 
 	data = new MapNode[count];
 	std::fill_n(data, count, n);
@@ -260,54 +277,127 @@ void MapBlock::tryShrinkNodes()
 	if (m_is_mono_block)
 		return;
 
-	MapNode n = data[0];
-	bool is_mono_block = true;
-	for (u32 i=1; i<nodecount; i++) {
-		if (n != data[i]) {
-			is_mono_block = false;
-			break;
+	// A palette may have entries that aren't used anymore, start over
+	expandNodesIfNeeded();
+
+	MapNode palette[max_palette_size];
+	u8 indices[nodecount];
+	u32 palette_size = 1;
+	palette[0] = data[0];
+	u8 index = 0;
+	for (u32 i = 0; i < nodecount; i++) {
+		const MapNode n = data[i];
+		// Nodes tend to come in runs of the same type
+		if (n != palette[index]) {
+			index = 0;
+			while (index < palette_size && palette[index] != n)
+				index++;
+			if (index == palette_size) {
+				if (palette_size == max_palette_size)
+					return;
+				palette[palette_size++] = n;
+			}
 		}
+		indices[i] = index;
 	}
 
-	if (is_mono_block) {
-		reallocate(1, n);
-		m_is_air = n.getContent() == CONTENT_AIR;
-		m_is_air_expired = false;
+	if (palette_size == 1) {
+		reallocate(1, palette[0]);
+		setIsAir(palette[0].getContent() == CONTENT_AIR);
+		return;
 	}
+
+	m_index_bits = palette_size <= 2 ? 1 : palette_size <= 4 ? 2 : 4;
+	m_palette_size = palette_size;
+	m_compact_writes = 0;
+
+	porting::TrackFreedMemory(sizeof(MapNode) * nodecount);
+	delete[] data;
+	data = new MapNode[palette_size];
+	std::copy_n(palette, palette_size, data);
+	m_indices = new u8[nodecount * m_index_bits / 8]();
+	for (u32 i = 0; i < nodecount; i++)
+		setPaletteIndex(i, indices[i]);
 }
 
 void MapBlock::expandNodesIfNeeded()
 {
 	if (m_is_mono_block) {
 		reallocate(nodecount, data[0]);
+	} else if (m_indices) {
+		MapNode *nodes = new MapNode[nodecount];
+		decodePalette(nodes);
+		delete[] data;
+		delete[] m_indices;
+		data = nodes;
+		m_indices = nullptr;
 	}
 }
 
-void MapBlock::actuallyUpdateIsAir()
+void MapBlock::setCompactNode(u32 i, MapNode n)
+{
+	if (m_indices && m_compact_writes < max_compact_writes) {
+		u32 index = 0;
+		while (index < m_palette_size && data[index] != n)
+			index++;
+		if (index < (1U << m_index_bits)) {
+			// The palette has room for the new node
+			if (index == m_palette_size) {
+				MapNode *palette = new MapNode[m_palette_size + 1];
+				std::copy_n(data, m_palette_size, palette);
+				palette[m_palette_size++] = n;
+				delete[] data;
+				data = palette;
+			}
+			setPaletteIndex(i, index);
+			m_compact_writes++;
+			return;
+		}
+	}
+
+	// Blocks that keep being written to are faster with the full array
+	expandNodesIfNeeded();
+	data[i] = n;
+}
+
+void MapBlock::decodePalette(MapNode *dst) const
 {
-	// Running this function un-expires m_is_air
-	m_is_air_expired = false;
+	assert(m_indices);
+	for (u32 i = 0; i < nodecount; i++)
+		dst[i] = data[getPaletteIndex(i)];
+}
 
+size_t MapBlock::getNodeStorageSize() const
+{
+	if (m_is_mono_block)
+		return sizeof(MapNode);
+	if (m_indices)
+		return sizeof(MapNode) * m_palette_size + nodecount * m_index_bits / 8;
+	return sizeof(MapNode) * nodecount;
+}
+
+void MapBlock::actuallyUpdateIsAir()
+{
 	if (m_is_mono_block) {
-		m_is_air = data[0].getContent() == CONTENT_AIR;
+		setIsAir(data[0].getContent() == CONTENT_AIR);
 		return;
 	}
 	bool only_air = true;
 	for (u32 i = 0; i < nodecount; i++) {
-		MapNode &n = data[i];
+		const MapNode n = getNodeAt(i);
 		if (n.getContent() != CONTENT_AIR) {
 			only_air = false;
 			break;
 		}
 	}
 
-	// Set member variable
-	m_is_air = only_air;
+	// Running this function un-expires the cache
+	setIsAir(only_air);
 }
 
 void MapBlock::expireIsAirCache()
 {
-	m_is_air_expired = true;
+	m_is_air_state.store(IS_AIR_EXPIRED, std::memory_order_relaxed);
 }
 
 /*
@@ -349,7 +439,7 @@ void MapBlock::getBlockNodeIdMapping(NameIdMapping *nimap, MapNode *nodes,
 // Unknown ones are added to nodedef.
 // Will not update itself to match id-name pairs in nodedef.
 void MapBlock::correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
-		IGameDef *gamedef)
+		IGameDef *gamedef, std::vector<content_t> *global_ids)
 {
 	const NodeDefManager *nodedef = gamedef->ndef();
 
@@ -382,16 +472,94 @@ void MapBlock::correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
 
 		// Save previous node local_id & global_id result
 		mapping_cache.set(local_id, global_id);
+		if (global_ids)
+			global_ids->push_back(global_id);
 	}
 }
 
-void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int compression_level)
+void MapBlock::cacheContents()
+{
+	if (!contents.empty() || do_not_cache_contents)
+		return;
+
+	if (m_is_mono_block) {
+		contents.push_back(data[0].getContent());
+		return;
+	}
+
+	if (m_indices) {
+		// Unused entries are fine, see the comment of contents
+		for (u32 i = 0; i < m_palette_size; i++) {
+			if (!CONTAINS(contents, data[i].getContent()))
+				contents.push_back(data[i].getContent());
+		}
+		return;
+	}
+
+	content_t last = data[0].getContent();
+	contents.push_back(last);
+	for (u32 i = 1; i < nodecount; i++) {
+		const content_t c = data[i].getContent();
+		// Nodes tend to come in runs of the same type
+		if (c == last)
+			continue;
+		last = c;
+		if (CONTAINS(contents, c))
+			continue;
+		if (contents.size() >= CONTENT_TYPE_CACHE_MAX) {
+			// Too many different nodes... don't try to cache
+			do_not_cache_contents = true;
+			decltype(contents) empty;
+			std::swap(contents, empty);
+			return;
+		}
+		contents.push_back(c);
+	}
+}
+
+bool MapBlock::mayContainAny(const std::vector<content_t> &filter)
+{
+	cacheContents();
+	if (do_not_cache_contents)
+		return true;
+
+	for (content_t c : contents) {
+		if (CONTAINS(filter, c))
+			return true;
+	}
+	return false;
+}
+
+void MapBlock::serialize(std::string &result, u8 version, bool disk, int compression_level,
+	const ZstdDictionary *dict)
+{
+	serialize(result, version, disk, compression_level, true, dict);
+}
+
+void MapBlock::serializeUncompressed(std::string &result, u8 version, bool disk)
+{
+	if (version < 29)
+		throw VersionMismatchException("ERROR: MapBlock format is always compressed");
+
+	serialize(result, version, disk, 0, false, nullptr);
+}
+
+void MapBlock::serialize(std::string &result, u8 version, bool disk,
+	int compression_level, bool compress_whole, const ZstdDictionary *dict)
 {
 	if (!ser_ver_supported_write(version))
 		throw VersionMismatchException("ERROR: MapBlock format not supported");
-
-	std::ostringstream os_raw(std::ios_base::binary);
-	std::ostream &os = version >= 29 ? os_raw : os_compressed;
+	if (dict && version < 29)
+		throw VersionMismatchException("ERROR: MapBlock format has no dictionary");
+
+	// Since version 29 the whole block is compressed at the end
+	thread_local std::string raw_buffer;
+	const bool compress_later = version >= 29 && compress_whole;
+	std::string &raw = compress_later ? raw_buffer : result;
+	if (compress_later)
+		raw.clear();
+	StringAppendBuffer raw_buf(raw);
+	std::ostream os(&raw_buf);
 
 	// First byte
 	u8 flags = 0;
@@ -415,18 +583,19 @@ void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int
 		Bulk node data
 	*/
 	NameIdMapping nimap;
-	Buffer<u8> buf;
+	const MapNode *nodes = data;
+	thread_local std::unique_ptr<MapNode[]> tmp_nodes(new MapNode[nodecount]);
 	const u8 content_width = 2;
 	const u8 params_width = 2;
 	if(disk)
 	{
 		const size_t size = m_is_mono_block ? 1 : nodecount;
-		std::unique_ptr<MapNode[]> tmp_nodes(new MapNode[size]);
-		std::copy_n(data, size, tmp_nodes.get());
+		if (m_indices)
+			decodePalette(tmp_nodes.get());
+		else
+			std::copy_n(data, size, tmp_nodes.get());
 		getBlockNodeIdMapping(&nimap, tmp_nodes.get(), size, m_gamedef->ndef());
-
-		buf = MapNode::serializeBulk(version, tmp_nodes.get(), nodecount,
-				content_width, params_width, m_is_mono_block);
+		nodes = tmp_nodes.get();
 
 		// write timestamp and node/id mapping first
 		if (version >= 29) {
@@ -435,18 +604,26 @@ void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int
 			nimap.serialize(os);
 		}
 	}
-	else
+	else if (m_indices)
 	{
-		buf = MapNode::serializeBulk(version, data, nodecount,
-				content_width, params_width, m_is_mono_block);
+		decodePalette(tmp_nodes.get());
+		nodes = tmp_nodes.get();
 	}
 
 	writeU8(os, content_width);
 	writeU8(os, params_width);
+	const size_t bulk_size = nodecount * (content_width + params_width);
 	if (version >= 29) {
-		os.write(reinterpret_cast<char*>(*buf), buf.getSize());
+		// Nothing is buffered in os, so this can go straight into raw
+		const size_t start = raw.size();
+		raw.resize(start + bulk_size);
+		MapNode::serializeBulk(reinterpret_cast<u8*>(&raw[start]), version,
+				nodes, nodecount, content_width, params_width, m_is_mono_block);
 	} else {
 		// prior to 29 node data was compressed individually
+		Buffer<u8> buf(bulk_size);
+		MapNode::serializeBulk(*buf, version, nodes, nodecount,
+				content_width, params_width, m_is_mono_block);
 		compress(buf, os, version, compression_level);
 	}
 
@@ -456,10 +633,10 @@ void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int
 	if (version >= 29) {
 		m_node_metadata.serialize(os, version, disk);
 	} else {
-		// use os_raw from above to avoid allocating another stream object
-		m_node_metadata.serialize(os_raw, version, disk);
+		std::ostringstream os_meta(std::ios_base::binary);
+		m_node_metadata.serialize(os_meta, version, disk);
 		// prior to 29 node data was compressed individually
-		compress(os_raw.str(), os, version, compression_level);
+		compress(os_meta.str(), os, version, compression_level);
 	}
 
 	/*
@@ -488,9 +665,9 @@ void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int
 		}
 	}
 
-	if (version >= 29) {
+	if (compress_later) {
 		// now compress the whole thing
-		compress(os_raw.str(), os_compressed, version, compression_level);
+		compress(raw, result, version, compression_level, dict);
 	}
 }
 
@@ -499,28 +676,44 @@ void MapBlock::serializeNetworkSpecific(std::ostream &os)
 	writeU8(os, 2); // version
 }
 
-void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
+size_t MapBlock::deSerialize(std::string_view data, u8 version, bool disk,
+	const ZstdDictionary *dict)
 {
 	if (!ser_ver_supported_read(version))
 		throw VersionMismatchException("ERROR: MapBlock format not supported");
 
+	if (version < 29) {
+		StringViewBuffer buf(data);
+		std::istream is(&buf);
+		deSerialize(is, {}, version, disk);
+		return buf.pubseekoff(0, std::ios_base::cur, std::ios_base::in);
+	}
+
+	// Decompress the whole block
+	thread_local std::string raw;
+	raw.clear();
+	const size_t used = decompressZstd(data, raw, dict);
+	StringViewBuffer buf(raw);
+	std::istream is(&buf);
+	deSerialize(is, raw, version, disk);
+	return used;
+}
+
+void MapBlock::deSerialize(std::istream &is, std::string_view raw, u8 version, bool disk)
+{
 	TRACESTREAM(<<"MapBlock::deSerialize "<<getPos()<<std::endl);
 
-	m_is_air_expired = true;
+	expireIsAirCache();
+	m_modification_counter++;
+	contents.clear();
 	expandNodesIfNeeded();
 
 	if(version <= 21)
 	{
-		deSerialize_pre22(in_compressed, version, disk);
+		deSerialize_pre22(is, version, disk);
 		return;
 	}
 
-	// Decompress the whole block (version >= 29)
-	std::stringstream in_raw(std::ios_base::binary | std::ios_base::in | std::ios_base::out);
-	if (version >= 29)
-		decompress(in_compressed, in_raw, version);
-	std::istream &is = version >= 29 ? in_raw : in_compressed;
-
 	u8 flags = readU8(is);
 	is_underground = (flags & 0x01) != 0;
 	// IMPORTANT: when the version is bumped to 30 we can read m_is_air from here
@@ -559,10 +752,17 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 		Bulk node data
 	*/
 	if (version >= 29) {
-		MapNode::deSerializeBulk(is, version, data, nodecount,
-			content_width, params_width);
+		// Read the nodes straight from the decompressed data
+		const std::streamoff start = is.tellg();
+		const size_t len = nodecount * (content_width + params_width);
+		if (start < 0 || start + len > raw.size())
+			throw SerializationError("MapBlock::deSerialize(): node data ended too early");
+		MapNode::deSerializeBulk(reinterpret_cast<const u8*>(&raw[start]), version,
+			data, nodecount, content_width, params_width);
+		is.seekg(start + len);
 	} else {
-		// use in_raw from above to avoid allocating another stream object
+		// prior to 29 node data was compressed individually
+		std::stringstream in_raw(std::ios_base::binary | std::ios_base::in | std::ios_base::out);
 		decompress(is, in_raw, version);
 		MapNode::deSerializeBulk(in_raw, version, data, nodecount,
 			content_width, params_width);
@@ -577,9 +777,7 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 		m_node_metadata.deSerialize(is, m_gamedef->idef());
 	} else {
 		try {
-			// reuse in_raw
-			in_raw.str("");
-			in_raw.clear();
+			std::stringstream in_raw(std::ios_base::binary | std::ios_base::in | std::ios_base::out);
 			decompress(is, in_raw, version);
 			if (version >= 23)
 				m_node_metadata.deSerialize(in_raw, m_gamedef->idef());
@@ -628,7 +826,13 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 		}
 
 		// Dynamically re-set ids based on node names
-		correctBlockNodeIds(&nimap, data, m_gamedef);
+		std::vector<content_t> global_ids;
+		correctBlockNodeIds(&nimap, data, m_gamedef, &global_ids);
+
+		// This gives the content types cache for free
+		SORT_AND_UNIQUE(global_ids);
+		if (!do_not_cache_contents && global_ids.size() <= CONTENT_TYPE_CACHE_MAX)
+			contents = std::move(global_ids);
 
 		if(version >= 25){
 			TRACESTREAM(<<"MapBlock::deSerialize "<<getPos()
@@ -636,12 +840,11 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 			m_node_timers.deSerialize(is, version);
 		}
 
-		if (nimap.size() == 1) {
+		if (nimap.size() <= max_palette_size)
 			tryShrinkNodes();
-
+		if (nimap.size() == 1) {
 			u16 dummy;
-			m_is_air = nimap.getId("air", dummy);
-			m_is_air_expired = false;
+			setIsAir(nimap.getId("air", dummy));
 		}
 	}
 
@@ -686,7 +889,7 @@ void MapBlock::deSerialize_pre22(std::istream &is, u8 version, bool disk)
 {
 	// Initialize default flags
 	is_underground = false;
-	m_is_air = false;
+	expireIsAirCache();
 	m_lighting_complete = 0xFFFF;
 	m_generated = true;
 
@@ -837,12 +1040,11 @@ void MapBlock::deSerialize_pre22(std::istream &is, u8 version, bool disk)
 		if (version >= 21) {
 			nimap.deSerialize(is);
 			u16 dummy;
-			m_is_air = nimap.size() == 1 && nimap.getId("air", dummy);
+			setIsAir(nimap.size() == 1 && nimap.getId("air", dummy));
 		// Else set the legacy mapping
 		} else {
 			content_mapnode_get_name_id_mapping(&nimap);
-			m_is_air = false;
-			m_is_air_expired = true;
+			expireIsAirCache();
 		}
 		correctBlockNodeIds(&nimap, data, m_gamedef);
 	}
@@ -4,6 +4,10 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <string_view>
 #include <vector>
 #include "irr_v3d.h"
 #include "mapnode.h"
@@ -21,9 +25,13 @@ class MapBlockMesh;
 class VoxelManipulator;
 class NameIdMapping;
 class TestMapBlock;
+class ZstdDictionary;
 
 #define BLOCK_TIMESTAMP_UNDEFINED 0xffffffff
 
+// Blocks with more different content types don't cache them (see MapBlock::contents)
+#define CONTENT_TYPE_CACHE_MAX 64
+
 ////
 //// MapBlock modified reason flags
 ////
@@ -50,6 +58,24 @@ enum ModReason : u32 {
 	MOD_REASON_UNKNOWN                    = 1 << 18,
 };
 
+////
+//// Bookkeeping shared with the Map
+////
+
+/*
+	State that a Map shares with all of its blocks, so that it can find the
+	modified and the unused blocks without looking at every block.
+*/
+struct MapBlockTracker
+{
+	// Milliseconds, advanced by Map::timerUpdate(). Usage timers are measured
+	// against this clock.
+	u32 usage_clock = 0;
+	// Blocks that went from clean to modified. May contain duplicates and
+	// blocks that were saved or unloaded in the meantime.
+	std::vector<v3s16> modified;
+};
+
 ////
 //// MapBlock itself
 ////
@@ -73,23 +99,26 @@ class MapBlock
 		m_orphan = true;
 	}
 
+	// Called by MapSector when the block is added to or removed from a Map
+	void setTracker(MapBlockTracker *tracker)
+	{
+		m_tracker = tracker;
+		resetUsageTimer();
+		if (m_tracker && m_modified != MOD_STATE_CLEAN)
+			m_tracker->modified.push_back(m_pos);
+	}
+
 	////
 	//// Modification tracking methods
 	////
 	void raiseModified(u32 mod, u32 reason=MOD_REASON_UNKNOWN)
 	{
-		if (mod > m_modified) {
-			m_modified = mod;
-			m_modified_reason = reason;
-			if (m_modified >= MOD_STATE_WRITE_AT_UNLOAD)
-				m_disk_timestamp = m_timestamp;
-		} else if (mod == m_modified) {
-			m_modified_reason |= reason;
-		}
+		raiseModifiedState(mod, reason);
 		if (mod == MOD_STATE_WRITE_NEEDED)
 			contents.clear();
 	}
 
+
 	inline u32 getModified()
 	{
 		return m_modified;
@@ -102,12 +131,32 @@ class MapBlock
 
 	std::string getModifiedReasonString();
 
+	// Changes whenever the block is modified. Values are never reused, not
+	// even by another MapBlock at the same position.
+	inline u64 getModificationCounter() const
+	{
+		return m_modification_counter;
+	}
+
 	inline void resetModified()
 	{
 		m_modified = MOD_STATE_CLEAN;
 		m_modified_reason = 0;
 	}
 
+	/*
+		Makes sure that `contents` is filled, unless do_not_cache_contents is
+		set. Scans the nodes only if the cache is not valid.
+	*/
+	void cacheContents();
+
+	/*
+		Returns false if none of the given content types are in the block.
+		Uses the contents cache, so it may return true for content that has
+		been removed since, and always does if contents are not cached.
+	*/
+	bool mayContainAny(const std::vector<content_t> &filter);
+
 	////
 	//// Flags
 	////
@@ -226,7 +275,7 @@ class MapBlock
 		if (!*valid_position)
 			return {CONTENT_IGNORE};
 
-		return data[m_is_mono_block ? 0 : z * zstride + y * ystride + x];
+		return getNodeAt(z * zstride + y * ystride + x);
 	}
 
 	inline MapNode getNode(v3s16 p, bool *valid_position)
@@ -245,9 +294,9 @@ class MapBlock
 		if (!isValidPosition(x, y, z))
 			throw InvalidPositionException();
 
-		expandNodesIfNeeded();
-		data[z * zstride + y * ystride + x] = n;
-		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE);
+		setNodeAt(z * zstride + y * ystride + x, n);
+		raiseModifiedState(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE);
+		addToContentsCache(n.getContent());
 	}
 
 	inline void setNode(v3s16 p, MapNode n)
@@ -261,7 +310,7 @@ class MapBlock
 
 	inline MapNode getNodeNoCheck(s16 x, s16 y, s16 z)
 	{
-		return data[m_is_mono_block ? 0 : z * zstride + y * ystride + x];
+		return getNodeAt(z * zstride + y * ystride + x);
 	}
 
 	inline MapNode getNodeNoCheck(v3s16 p)
@@ -271,9 +320,9 @@ class MapBlock
 
 	inline void setNodeNoCheck(s16 x, s16 y, s16 z, MapNode n)
 	{
-		expandNodesIfNeeded();
-		data[z * zstride + y * ystride + x] = n;
-		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE);
+		setNodeAt(z * zstride + y * ystride + x, n);
+		raiseModifiedState(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE);
+		addToContentsCache(n.getContent());
 	}
 
 	inline void setNodeNoCheck(v3s16 p, MapNode n)
@@ -288,18 +337,20 @@ class MapBlock
 	void copyFrom(const VoxelManipulator &src);
 
 	// Update is air flag.
-	// Sets m_is_air to appropriate value.
+	// Sets the isAir() cache to the appropriate value.
 	void actuallyUpdateIsAir();
 
 	// Call this to schedule what the previous function does to be done
 	// when the value is actually needed.
 	void expireIsAirCache();
 
+	// Safe to call from several threads at once while the block is not
+	// modified, e.g. during the parallel phase of the object step.
 	inline bool isAir()
 	{
-		if (m_is_air_expired)
+		if (m_is_air_state.load(std::memory_order_relaxed) == IS_AIR_EXPIRED)
 			actuallyUpdateIsAir();
-		return m_is_air;
+		return m_is_air_state.load(std::memory_order_relaxed) == IS_AIR_YES;
 	}
 
 	bool onObjectsActivation();
@@ -337,22 +388,24 @@ class MapBlock
 	}
 
 	////
-	//// Usage timer (see m_usage_timer)
+	//// Usage timer (see m_usage_stamp)
 	////
 
 	inline void resetUsageTimer()
 	{
-		m_usage_timer = 0;
+		m_usage_stamp = getUsageClock();
 	}
 
-	inline void incrementUsageTimer(float dtime)
+	// Seconds since the block was last used
+	inline float getUsageTimer() const
 	{
-		m_usage_timer += dtime;
+		return (getUsageClock() - m_usage_stamp) * 0.001f;
 	}
 
-	inline float getUsageTimer()
+	// Usage clock value at the last use, see MapBlockTracker
+	inline u32 getUsageStamp() const
 	{
-		return m_usage_timer;
+		return m_usage_stamp;
 	}
 
 	////
@@ -407,10 +460,19 @@ class MapBlock
 	// These don't write or read version by itself
 	// Set disk to true for on-disk format, false for over-the-network format
 	// Precondition: version >= SER_FMT_VER_LOWEST_WRITE
-	void serialize(std::ostream &result, u8 version, bool disk, int compression_level);
+	// Appends to result. The dictionary needs version >= 29.
+	void serialize(std::string &result, u8 version, bool disk, int compression_level,
+		const ZstdDictionary *dict = nullptr);
+	// Same as serialize() but leaves out the final compression step, so
+	// passing the result to compress() yields the regular format.
+	// This is cheap enough to snapshot a block for saving on another thread.
+	// Precondition: version >= 29
+	void serializeUncompressed(std::string &result, u8 version, bool disk);
 	// If disk == true: In addition to doing other things, will add
 	// unknown blocks from id-name mapping to wndef
-	void deSerialize(std::istream &is, u8 version, bool disk);
+	// Returns how many bytes of data were used.
+	size_t deSerialize(std::string_view data, u8 version, bool disk,
+		const ZstdDictionary *dict = nullptr);
 
 	void serializeNetworkSpecific(std::ostream &os);
 	void deSerializeNetworkSpecific(std::istream &is);
@@ -419,12 +481,31 @@ class MapBlock
 	// clearObject and return removed objects count
 	u32 clearObjects();
 
+	// Bytes used to store the nodes
+	size_t getNodeStorageSize() const;
+
+	/*
+		Stores the nodes in the full array if they are in a palette.
+		Palettes save memory but make reads slower, so this is done for
+		blocks that are read a lot, like active blocks.
+	*/
+	void expandPalette()
+	{
+		if (m_indices)
+			expandNodesIfNeeded();
+	}
+
 private:
 	static const u32 ystride = MAP_BLOCKSIZE;
 	static const u32 zstride = MAP_BLOCKSIZE * MAP_BLOCKSIZE;
 
 	static const u32 nodecount = MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE;
 
+	// More different nodes are stored in the full array
+	static const u32 max_palette_size = 16;
+	// Writes to a compact block before it is expanded to the full array
+	static const u16 max_compact_writes = 256;
+
 private:
 #if BUILD_UNITTESTS
 	// access to data, tryConvertToMonoBlock, deconvertMonoblock
@@ -435,17 +516,55 @@ class MapBlock
 		Private methods
 	*/
 
+	void serialize(std::string &result, u8 version, bool disk,
+		int compression_level, bool compress_whole, const ZstdDictionary *dict);
+	// If version >= 29, is reads from raw, the decompressed block
+	void deSerialize(std::istream &is, std::string_view raw, u8 version, bool disk);
 	void deSerialize_pre22(std::istream &is, u8 version, bool disk);
-	// check if all nodes are identical, if so convert to monoblock
+	// check if all nodes are identical, if so convert to monoblock,
+	// otherwise to a palette if there are few different nodes
 	void tryShrinkNodes();
-	// if a monoblock, expand storage back to the full array
+	// if a monoblock or palette, expand storage back to the full array
 	void expandNodesIfNeeded();
 	void reallocate(u32 count, MapNode n);
+	// Writes n to the palette, expands the storage if that doesn't work out
+	void setCompactNode(u32 i, MapNode n);
+	// Writes all nodes of a palette block to dst, which has nodecount nodes
+	void decodePalette(MapNode *dst) const;
+
+	inline u32 getPaletteIndex(u32 i) const
+	{
+		const u32 bit = i * m_index_bits;
+		return (m_indices[bit / 8] >> (bit % 8)) & ((1 << m_index_bits) - 1);
+	}
+
+	inline void setPaletteIndex(u32 i, u32 index)
+	{
+		const u32 bit = i * m_index_bits;
+		const u8 mask = ((1 << m_index_bits) - 1) << (bit % 8);
+		m_indices[bit / 8] = (m_indices[bit / 8] & ~mask) | (index << (bit % 8));
+	}
+
+	inline MapNode getNodeAt(u32 i) const
+	{
+		if (m_indices)
+			return data[getPaletteIndex(i)];
+		return data[m_is_mono_block ? 0 : i];
+	}
+
+	inline void setNodeAt(u32 i, MapNode n)
+	{
+		if (m_indices || m_is_mono_block)
+			setCompactNode(i, n);
+		else
+			data[i] = n;
+	}
 
 	static void getBlockNodeIdMapping(NameIdMapping *nimap, MapNode *nodes,
 		u32 count, const NodeDefManager *nodedef);
+	// global_ids (optional): receives the content types that occur in nodes
 	static void correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
-			IGameDef *gamedef);
+			IGameDef *gamedef, std::vector<content_t> *global_ids = nullptr);
 
 	/*
 	 * PLEASE NOTE: When adding something here be mindful of position and size
@@ -463,6 +582,42 @@ class MapBlock
 #endif
 
 private:
+	// raiseModified() without touching the contents cache
+	void raiseModifiedState(u32 mod, u32 reason)
+	{
+		m_modification_counter++;
+		if (mod > m_modified) {
+			if (m_modified == MOD_STATE_CLEAN && m_tracker)
+				m_tracker->modified.push_back(m_pos);
+			m_modified = mod;
+			m_modified_reason = reason;
+			if (m_modified >= MOD_STATE_WRITE_AT_UNLOAD)
+				m_disk_timestamp = m_timestamp;
+		} else if (mod == m_modified) {
+			m_modified_reason |= reason;
+		}
+	}
+
+	// Keeps the contents cache valid after a single node was set to c
+	inline void addToContentsCache(content_t c)
+	{
+		if (contents.empty() ||
+				std::find(contents.begin(), contents.end(), c) != contents.end())
+			return;
+		if (contents.size() >= CONTENT_TYPE_CACHE_MAX) {
+			do_not_cache_contents = true;
+			decltype(contents) empty;
+			std::swap(contents, empty);
+		} else {
+			contents.push_back(c);
+		}
+	}
+
+	inline u32 getUsageClock() const
+	{
+		return m_tracker ? m_tracker->usage_clock : 0;
+	}
+
 	// see isOrphan()
 	bool m_orphan = false;
 
@@ -483,23 +638,40 @@ class MapBlock
 	 * Note that this is not an inline array because that has implications for heap
 	 * fragmentation (the array is exactly 16K, or exactly 4 bytes for a "monoblock"),
 	 * CPU caches and/or optimizability of algorithms working on this array.
+	 * For palette blocks this is the palette.
 	 */
 	MapNode *data = nullptr;
 
+	/*
+	 * For palette blocks, the index of each node in the palette, packed with
+	 * m_index_bits per node. Otherwise nullptr.
+	 * (For reduced memory usage of blocks with few different nodes)
+	 */
+	u8 *m_indices = nullptr;
+
 	// provides the item and node definitions
 	IGameDef *m_gamedef;
 
+	// Bookkeeping of the Map this block is in, nullptr if it is in none
+	MapBlockTracker *m_tracker = nullptr;
+
 	/*
-		When the block is accessed, this is set to 0.
-		Map will unload the block when this reaches a timeout.
+		When the block is accessed, this is set to the usage clock.
+		Map will unload the block when it was not accessed for a timeout.
 	*/
-	float m_usage_timer = 0;
+	u32 m_usage_stamp = 0;
 
 	/*
 	 * For "monoblocks", the whole block is filled with the same node, only this node is stored.
 	 * (For reduced memory usage)
 	 */
 	bool m_is_mono_block;
+
+	// For palette blocks: bits per index (1, 2 or 4), entries in the palette,
+	// and the number of writes since the palette was made
+	u8 m_index_bits = 0;
+	u8 m_palette_size = 0;
+	u16 m_compact_writes = 0;
 public:
 	//// ABM optimizations ////
 	// True if we never want to cache content types for this block
@@ -507,13 +679,22 @@ class MapBlock
 	// Cache of content types
 	// This is actually a set but for the small sizes we have a vector should be
 	// more efficient.
-	// Can be empty, in which case nothing was cached yet.
+	// Can be empty, in which case nothing was cached yet. setNode() keeps it
+	// up to date, other modifications clear it. It may contain types that
+	// are no longer present in the block, but never misses one that is.
 	std::vector<content_t> contents;
 
 private:
-	// Whether day and night lighting differs
-	bool m_is_air = false;
-	bool m_is_air_expired = true;
+	void setIsAir(bool is_air)
+	{
+		m_is_air_state.store(is_air ? IS_AIR_YES : IS_AIR_NO,
+				std::memory_order_relaxed);
+	}
+
+	// Cache for isAir(). Concurrent readers may all find it expired and
+	// store the same result, which is why it is a single atomic value.
+	enum : u8 { IS_AIR_EXPIRED, IS_AIR_YES, IS_AIR_NO };
+	std::atomic<u8> m_is_air_state{IS_AIR_EXPIRED};
 
 	/*
 		- On the server, this is used for telling whether the
@@ -523,6 +704,10 @@ class MapBlock
 	u16 m_modified = MOD_STATE_CLEAN;
 	u32 m_modified_reason = 0;
 
+	// see getModificationCounter()
+	// The upper half identifies the MapBlock instance.
+	u64 m_modification_counter;
+
 	/*
 		When block is removed from active blocks, this is set to gametime.
 		Value BLOCK_TIMESTAMP_UNDEFINED=0xffffffff means there is no timestamp.
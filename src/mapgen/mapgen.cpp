@@ -4,6 +4,7 @@
 // Copyright (C) 2013-2018 kwolekr, Ryan Kwolek <kwolekr@minetest.net>
 // Copyright (C) 2015-2018 paramat
 
+#include <algorithm>
 #include <cmath>
 #include "mapgen.h"
 #include "voxel.h"
@@ -21,6 +22,7 @@
 #include "util/numeric.h"
 #include "util/directiontables.h"
 #include "log.h"
+#include "threading/worker_pool.h"
 #include "mapgen_carpathian.h"
 #include "mapgen_flat.h"
 #include "mapgen_fractal.h"
@@ -114,10 +116,13 @@ Mapgen::Mapgen(int mapgenid, MapgenParams *params, EmergeParams *emerge) :
 
 	m_emerge  = emerge;
 	ndef      = emerge->ndef;
+
+	light_threads = g_settings->getU16("mapgen_light_threads");
 }
 
 Mapgen::~Mapgen()
 {
+	delete m_light_pool;
 	delete m_emerge; // this is our responsibility
 }
 
@@ -426,40 +431,184 @@ void Mapgen::setLighting(u8 light, v3s16 nmin, v3s16 nmax)
 }
 
 
-void Mapgen::lightSpread(VoxelArea &a, std::queue<std::pair<v3s16, u8>> &queue,
-	const v3s16 &p, u8 light)
-{
-	if (light <= 1 || !a.contains(p))
-		return;
+namespace {
+
+// Minimum depth of the slices the light spread is split into
+#define LIGHT_SLICE_MIN_DEPTH MAP_BLOCKSIZE
+// Below this number of queued nodes the light is spread in one thread
+#define LIGHT_SPREAD_PARALLEL_MIN 4096
 
-	u32 vi = vm->m_area.index(p);
-	MapNode &n = vm->m_data[vi];
+// A node that light is spread from
+struct LightNode {
+	v3s16 p;
+	// light value (contains both banks)
+	u8 light;
+	// index in the voxel manipulator
+	u32 vi;
+};
+
+// FIFO queue of nodes in a ring buffer, keeps its memory when emptied
+class LightQueue {
+public:
+	bool empty() const { return m_head == m_tail; }
+	size_t size() const { return m_tail - m_head; }
+
+	void push(const LightNode &node)
+	{
+		if (m_tail - m_head == m_buf.size())
+			grow();
+		m_buf[m_tail++ & m_mask] = node;
+	}
 
-	// Decay light in each of the banks separately
-	u8 light_day = light & 0x0F;
-	if (light_day > 0)
-		light_day -= 0x01;
+	LightNode pop() { return m_buf[m_head++ & m_mask]; }
 
-	u8 light_night = light & 0xF0;
-	if (light_night > 0)
-		light_night -= 0x10;
+	void clear() { m_head = m_tail = 0; }
 
-	// Bail out only if we have no more light from either bank to propogate, or
-	// we hit a solid block that light cannot pass through.
-	if ((light_day  <= (n.param1 & 0x0F) &&
-			light_night <= (n.param1 & 0xF0)) ||
-			!ndef->getLightingFlags(n).light_propagates)
-		return;
+private:
+	void grow()
+	{
+		std::vector<LightNode> buf(std::max<size_t>(m_buf.size() * 2, 1024));
+		for (size_t i = m_head; i != m_tail; i++)
+			buf[i - m_head] = m_buf[i & m_mask];
+		m_tail -= m_head;
+		m_head = 0;
+		m_buf.swap(buf);
+		m_mask = m_buf.size() - 1;
+	}
+
+	std::vector<LightNode> m_buf;
+	size_t m_mask = 0;
+	size_t m_head = 0;
+	size_t m_tail = 0;
+};
+
+/*
+	Spreads light in an area of a voxel manipulator. Only the nodes with a Z
+	coordinate in [min_z, max_z] are touched, light that leaves this range is
+	collected in the outgoing list instead.
+*/
+class LightSpreader {
+public:
+	LightSpreader(MMVManip *vm, const NodeDefManager *ndef, const VoxelArea &a,
+			s16 min_z, s16 max_z) :
+		m_data(vm->m_data), m_ndef(ndef), m_area(a), m_min_z(min_z), m_max_z(max_z)
+	{
+		const v3s32 &em = vm->m_area.getExtent();
+		m_ystride = em.X;
+		m_zstride = em.X * em.Y;
+	}
 
-	// MYMAX still needed here because we only exit early if both banks have
-	// nothing to propagate anymore.
-	light = MYMAX(light_day, n.param1 & 0x0F) |
-			MYMAX(light_night, n.param1 & 0xF0);
+	// Spread the light of a node to its 6 neighbors
+	void spreadFrom(v3s16 p, u32 vi, u8 light, LightQueue &queue)
+	{
+		if (light <= 1)
+			return;
+
+		// Decay light in each of the banks separately
+		u8 light_day = light & 0x0F;
+		if (light_day > 0)
+			light_day -= 0x01;
+
+		u8 light_night = light & 0xF0;
+		if (light_night > 0)
+			light_night -= 0x10;
+
+		light = light_day | light_night;
+		if (p.X > m_area.MinEdge.X)
+			spreadTo(v3s16(p.X - 1, p.Y, p.Z), vi - 1, light, queue);
+		if (p.X < m_area.MaxEdge.X)
+			spreadTo(v3s16(p.X + 1, p.Y, p.Z), vi + 1, light, queue);
+		if (p.Y > m_area.MinEdge.Y)
+			spreadTo(v3s16(p.X, p.Y - 1, p.Z), vi - m_ystride, light, queue);
+		if (p.Y < m_area.MaxEdge.Y)
+			spreadTo(v3s16(p.X, p.Y + 1, p.Z), vi + m_ystride, light, queue);
+		if (p.Z > m_area.MinEdge.Z)
+			spreadTo(v3s16(p.X, p.Y, p.Z - 1), vi - m_zstride, light, queue);
+		if (p.Z < m_area.MaxEdge.Z)
+			spreadTo(v3s16(p.X, p.Y, p.Z + 1), vi + m_zstride, light, queue);
+	}
 
-	n.param1 = light;
+	// Spread already decayed light to a node, add it to the queue if changed
+	void spreadTo(v3s16 p, u32 vi, u8 light, LightQueue &queue)
+	{
+		if (p.Z < m_min_z || p.Z > m_max_z) {
+			outgoing.push_back({p, light, vi});
+			return;
+		}
+
+		MapNode &n = m_data[vi];
+		const u8 light_day = light & 0x0F;
+		const u8 light_night = light & 0xF0;
+
+		// Bail out only if we have no more light from either bank to propogate, or
+		// we hit a solid block that light cannot pass through.
+		if ((light_day  <= (n.param1 & 0x0F) &&
+				light_night <= (n.param1 & 0xF0)) ||
+				!m_ndef->getLightingFlags(n).light_propagates)
+			return;
+
+		// MYMAX still needed here because we only exit early if both banks have
+		// nothing to propagate anymore.
+		n.param1 = MYMAX(light_day, n.param1 & 0x0F) |
+				MYMAX(light_night, n.param1 & 0xF0);
+		queue.push({p, n.param1, vi});
+	}
+
+	void spreadQueued(LightQueue &queue)
+	{
+		while (!queue.empty()) {
+			const LightNode node = queue.pop();
+			spreadFrom(node.p, node.vi, node.light, queue);
+		}
+	}
+
+	std::vector<LightNode> outgoing;
+
+private:
+	MapNode *m_data;
+	const NodeDefManager *m_ndef;
+	VoxelArea m_area;
+	s16 m_min_z;
+	s16 m_max_z;
+	u32 m_ystride;
+	u32 m_zstride;
+};
+
+// Splits the Z range of an area into slices of about equal depth
+class LightSlicing {
+public:
+	LightSlicing(const VoxelArea &a, unsigned int max_slices) :
+		m_min_z(a.MinEdge.Z), m_depth(a.getExtent().Z),
+		m_count(std::min<s32>(max_slices, m_depth / LIGHT_SLICE_MIN_DEPTH))
+	{}
+
+	s32 count() const { return m_count; }
+
+	// First Z coordinate of the slice, or one past the area for count()
+	s16 start(s32 slice) const
+	{
+		return m_min_z + (m_depth * slice + m_count - 1) / m_count;
+	}
+
+	s32 sliceOf(s16 z) const { return (z - m_min_z) * m_count / m_depth; }
+
+private:
+	s16 m_min_z;
+	s32 m_depth;
+	s32 m_count;
+};
 
-	// add to queue
-	queue.emplace(p, light);
+}
+
+WorkerPool *Mapgen::getLightPool()
+{
+	if (light_threads == 0)
+		return nullptr;
+	if (!m_light_pool || m_light_pool->getThreadCount() != light_threads) {
+		delete m_light_pool;
+		m_light_pool = new WorkerPool("MapgenLight", light_threads);
+	}
+	return m_light_pool;
 }
 
 
@@ -483,27 +632,42 @@ void Mapgen::propagateSunlight(v3s16 nmin, v3s16 nmax, bool propagate_shadow)
 	// NOTE: Direct access to the low 4 bits of param1 is okay here because,
 	// by definition, sunlight will never be in the night lightbank.
 
-	for (int z = a.MinEdge.Z; z <= a.MaxEdge.Z; z++) {
-		for (int x = a.MinEdge.X; x <= a.MaxEdge.X; x++) {
-			// see if we can get a light value from the overtop
-			u32 i = vm->m_area.index(x, a.MaxEdge.Y + 1, z);
-			if (vm->m_data[i].getContent() == CONTENT_IGNORE) {
-				if (block_is_underground)
+	// The columns don't depend on each other
+	auto propagate = [&] (s16 min_z, s16 max_z) {
+		for (int z = min_z; z <= max_z; z++) {
+			for (int x = a.MinEdge.X; x <= a.MaxEdge.X; x++) {
+				// see if we can get a light value from the overtop
+				u32 i = vm->m_area.index(x, a.MaxEdge.Y + 1, z);
+				if (vm->m_data[i].getContent() == CONTENT_IGNORE) {
+					if (block_is_underground)
+						continue;
+				} else if ((vm->m_data[i].param1 & 0x0F) != LIGHT_SUN &&
+						propagate_shadow) {
 					continue;
-			} else if ((vm->m_data[i].param1 & 0x0F) != LIGHT_SUN &&
-					propagate_shadow) {
-				continue;
-			}
-			VoxelArea::add_y(em, i, -1);
-
-			for (int y = a.MaxEdge.Y; y >= a.MinEdge.Y; y--) {
-				MapNode &n = vm->m_data[i];
-				if (!ndef->getLightingFlags(n).sunlight_propagates)
-					break;
-				n.param1 = LIGHT_SUN;
+				}
 				VoxelArea::add_y(em, i, -1);
+
+				for (int y = a.MaxEdge.Y; y >= a.MinEdge.Y; y--) {
+					MapNode &n = vm->m_data[i];
+					if (!ndef->getLightingFlags(n).sunlight_propagates)
+						break;
+					n.param1 = LIGHT_SUN;
+					VoxelArea::add_y(em, i, -1);
+				}
 			}
 		}
+	};
+
+	WorkerPool *pool = getLightPool();
+	const LightSlicing slicing(a, pool ? pool->getThreadCount() : 0);
+	if (slicing.count() < 2) {
+		propagate(a.MinEdge.Z, a.MaxEdge.Z);
+	} else {
+		for (s32 k = 0; k < slicing.count(); k++) {
+			const s16 min_z = slicing.start(k), max_z = slicing.start(k + 1) - 1;
+			pool->submit([&propagate, min_z, max_z] { propagate(min_z, max_z); });
+		}
+		pool->waitIdle();
 	}
 	//printf("propagateSunlight: %dms\n", t.stop());
 }
@@ -512,8 +676,10 @@ void Mapgen::propagateSunlight(v3s16 nmin, v3s16 nmax, bool propagate_shadow)
 void Mapgen::spreadLight(const v3s16 &nmin, const v3s16 &nmax)
 {
 	//TimeTaker t("spreadLight");
-	std::queue<std::pair<v3s16, u8>> queue;
+	thread_local LightQueue queue;
+	queue.clear();
 	VoxelArea a(nmin, nmax);
+	LightSpreader spreader(vm, ndef, a, a.MinEdge.Z, a.MaxEdge.Z);
 
 	for (int z = a.MinEdge.Z; z <= a.MaxEdge.Z; z++) {
 		for (int y = a.MinEdge.Y; y <= a.MaxEdge.Y; y++) {
@@ -536,21 +702,68 @@ void Mapgen::spreadLight(const v3s16 &nmin, const v3s16 &nmax)
 
 				u8 light = n.param1;
 				if (light) {
-					const v3s16 p(x, y, z);
 					// spread to all 6 neighbor nodes
-					for (const auto &dir : g_6dirs)
-						lightSpread(a, queue, p + dir, light);
+					spreader.spreadFrom(v3s16(x, y, z), i, light, queue);
 				}
 			}
 		}
 	}
 
+	/*
+		The loop above lets light sources overwrite the light that reached
+		them earlier, so its result depends on the order of the nodes and it
+		has to run in one thread. Spreading the queued light further only
+		ever raises light values, which gives the same result in any order.
+		So that part is split into slices along Z when a pool is available.
+	*/
+	WorkerPool *pool = getLightPool();
+	const LightSlicing slicing(a, pool ? pool->getThreadCount() : 0);
+	if (slicing.count() < 2 || queue.size() < LIGHT_SPREAD_PARALLEL_MIN) {
+		spreader.spreadQueued(queue);
+		return;
+	}
+
+	struct Slice {
+		LightSpreader spreader;
+		LightQueue queue;
+		// light spread into this slice from its neighbors
+		std::vector<LightNode> incoming;
+	};
+	std::vector<Slice> slices;
+	slices.reserve(slicing.count());
+	for (s32 k = 0; k < slicing.count(); k++) {
+		slices.push_back({LightSpreader(vm, ndef, a, slicing.start(k),
+			slicing.start(k + 1) - 1), {}, {}});
+	}
 	while (!queue.empty()) {
-		const auto &i = queue.front();
-		// spread to all 6 neighbor nodes
-		for (const auto &dir : g_6dirs)
-			lightSpread(a, queue, i.first + dir, i.second);
-		queue.pop();
+		const LightNode node = queue.pop();
+		slices[slicing.sliceOf(node.p.Z)].queue.push(node);
+	}
+
+	// Every round spreads the light as far as possible within the slices,
+	// then the light that crossed into another slice is handed over
+	bool pending = true;
+	while (pending) {
+		for (Slice &slice : slices) {
+			if (slice.queue.empty() && slice.incoming.empty())
+				continue;
+			pool->submit([&slice] {
+				for (const LightNode &node : slice.incoming)
+					slice.spreader.spreadTo(node.p, node.vi, node.light, slice.queue);
+				slice.incoming.clear();
+				slice.spreader.spreadQueued(slice.queue);
+			});
+		}
+		pool->waitIdle();
+
+		pending = false;
+		for (Slice &slice : slices) {
+			for (const LightNode &node : slice.spreader.outgoing) {
+				slices[slicing.sliceOf(node.p.Z)].incoming.push_back(node);
+				pending = true;
+			}
+			slice.spreader.outgoing.clear();
+		}
 	}
 
 	//printf("spreadLight: %lums\n", t.stop());
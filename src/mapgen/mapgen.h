@@ -40,6 +40,7 @@ class BiomeManager;
 class EmergeParams;
 struct BlockMakeData;
 class VoxelArea;
+class WorkerPool;
 
 enum MapgenObject {
 	MGOBJ_VMANIP,
@@ -170,6 +171,10 @@ class Mapgen {
 	BiomeGen *biomegen = nullptr;
 	GenerateNotifier gennotify;
 
+	// Number of threads that calcLighting() may use, 0 to light in the
+	// calling thread only
+	u16 light_threads = 0;
+
 	Mapgen() = default;
 	Mapgen(int mapgenid, MapgenParams *params, EmergeParams *emerge);
 	virtual ~Mapgen();
@@ -241,22 +246,15 @@ class Mapgen {
 	static void setDefaultSettings(Settings *settings);
 
 private:
-	/**
-	 * Spread light to the node at the given position, add to queue if changed.
-	 * The given light value is diminished once.
-	 * @param a VoxelArea being operated on
-	 * @param queue Queue for later lightSpread() calls
-	 * @param p Node position
-	 * @param light Light value (contains both banks)
-	 *
-	 */
-	void lightSpread(VoxelArea &a, std::queue<std::pair<v3s16, u8>> &queue,
-		const v3s16 &p, u8 light);
+	// Worker threads for lighting, created on first use
+	WorkerPool *getLightPool();
 
 	// isLiquidHorizontallyFlowable() is a helper function for updateLiquid()
 	// that checks whether there are floodable nodes without liquid beneath
 	// the node at index vi.
 	inline bool isLiquidHorizontallyFlowable(u32 vi, v3s32 em);
+
+	WorkerPool *m_light_pool = nullptr;
 };
 
 /*
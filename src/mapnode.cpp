@@ -10,6 +10,7 @@
 #include "serialization.h" // For ser_ver_supported_*
 #include "util/serialize.h"
 #include "util/directiontables.h"
+#include <cstring>
 #include <string>
 
 static const Rotation wallmounted_to_rot[] = {
@@ -577,6 +578,16 @@ void MapNode::deSerialize(const u8 *source, u8 version)
 Buffer<u8> MapNode::serializeBulk(int version,
 		const MapNode *nodes, u32 nodecount,
 		u8 content_width, u8 params_width, bool is_mono_block)
+{
+	Buffer<u8> databuf(nodecount * (content_width + params_width));
+	serializeBulk(&databuf[0], version, nodes, nodecount,
+		content_width, params_width, is_mono_block);
+	return databuf;
+}
+
+void MapNode::serializeBulk(u8 *dest, int version,
+		const MapNode *nodes, u32 nodecount,
+		u8 content_width, u8 params_width, bool is_mono_block)
 {
 	if (!ser_ver_supported_write(version))
 		throw VersionMismatchException("ERROR: MapNode format not supported");
@@ -584,18 +595,15 @@ Buffer<u8> MapNode::serializeBulk(int version,
 	sanity_check(content_width == 2);
 	sanity_check(params_width == 2);
 
-	Buffer<u8> databuf(nodecount * (content_width + params_width));
-
 	// Writing to the buffer linearly is faster
-	u8 *p = &databuf[0];
+	u8 *p = dest;
 	if (is_mono_block) {
 		MapNode n = nodes[0];
 		for (u32 i = 0; i < nodecount; i++, p += 2)
 			writeU16(p, n.param0);
-		for (u32 i = 0; i < nodecount; i++, p++)
-			writeU8(p, n.param1);
-		for (u32 i = 0; i < nodecount; i++, p++)
-			writeU8(p, n.param2);
+		memset(p, n.param1, nodecount);
+		p += nodecount;
+		memset(p, n.param2, nodecount);
 	} else {
 		for (u32 i = 0; i < nodecount; i++, p += 2)
 			writeU16(p, nodes[i].param0);
@@ -604,8 +612,6 @@ Buffer<u8> MapNode::serializeBulk(int version,
 		for (u32 i = 0; i < nodecount; i++, p++)
 			writeU8(p, nodes[i].param2);
 	}
-
-	return databuf;
 }
 
 // Deserialize bulk node data
@@ -626,29 +632,45 @@ void MapNode::deSerializeBulk(std::istream &is, int version,
 	Buffer<u8> databuf(len);
 	is.read(reinterpret_cast<char*>(*databuf), len);
 
+	deSerializeBulk(*databuf, version, nodes, nodecount,
+		content_width, params_width);
+}
+
+void MapNode::deSerializeBulk(const u8 *source, int version,
+		MapNode *nodes, u32 nodecount,
+		u8 content_width, u8 params_width)
+{
+	if (!ser_ver_supported_read(version))
+		throw VersionMismatchException("ERROR: MapNode format not supported");
+
+	if (version < 22
+			|| (content_width != 1 && content_width != 2)
+			|| params_width != 2)
+		throw SerializationError("Deserialize bulk node data error");
+
 	// Deserialize content
 	if(content_width == 1)
 	{
 		for(u32 i=0; i<nodecount; i++)
-			nodes[i].param0 = readU8(&databuf[i]);
+			nodes[i].param0 = readU8(&source[i]);
 	}
 	else if(content_width == 2)
 	{
 		for(u32 i=0; i<nodecount; i++)
-			nodes[i].param0 = readU16(&databuf[i*2]);
+			nodes[i].param0 = readU16(&source[i*2]);
 	}
 
 	// Deserialize param1
 	u32 start1 = content_width * nodecount;
 	for(u32 i=0; i<nodecount; i++)
-		nodes[i].param1 = readU8(&databuf[start1 + i]);
+		nodes[i].param1 = readU8(&source[start1 + i]);
 
 	// Deserialize param2
 	u32 start2 = (content_width + 1) * nodecount;
 	if(content_width == 1)
 	{
 		for(u32 i=0; i<nodecount; i++) {
-			nodes[i].param2 = readU8(&databuf[start2 + i]);
+			nodes[i].param2 = readU8(&source[start2 + i]);
 			if(nodes[i].param0 > 0x7F){
 				nodes[i].param0 <<= 4;
 				nodes[i].param0 |= (nodes[i].param2&0xF0)>>4;
@@ -659,7 +681,7 @@ void MapNode::deSerializeBulk(std::istream &is, int version,
 	else if(content_width == 2)
 	{
 		for(u32 i=0; i<nodecount; i++)
-			nodes[i].param2 = readU8(&databuf[start2 + i]);
+			nodes[i].param2 = readU8(&source[start2 + i]);
 	}
 }
 
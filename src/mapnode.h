@@ -295,6 +295,14 @@ struct alignas(u32) MapNode
 	static void deSerializeBulk(std::istream &is, int version,
 			MapNode *nodes, u32 nodecount,
 			u8 content_width, u8 params_width);
+	// Same as above, on nodecount * (content_width + params_width) bytes
+	// of memory
+	static void serializeBulk(u8 *dest, int version,
+			const MapNode *nodes, u32 nodecount,
+			u8 content_width, u8 params_width, bool is_mono_block = false);
+	static void deSerializeBulk(const u8 *source, int version,
+			MapNode *nodes, u32 nodecount,
+			u8 content_width, u8 params_width);
 
 private:
 	// Deprecated serialization methods
@@ -4,6 +4,7 @@
 
 #include "mapsector.h"
 #include "exceptions.h"
+#include "map.h"
 #include "mapblock.h"
 
 MapSector::MapSector(Map *parent, v2s16 pos, IGameDef *gamedef):
@@ -26,6 +27,7 @@ void MapSector::deleteBlocks(size_t *used_count)
 	for (auto &it : m_blocks) {
 		if (it.second->refGet() > 0)
 			u++;
+		m_parent->onBlockRemoved(it.second.get());
 		it.second.reset();
 	}
 	if (used_count)
@@ -75,6 +77,7 @@ MapBlock *MapSector::createBlankBlock(s16 y)
 	MapBlock *block = block_u.get();
 
 	m_blocks[y] = std::move(block_u);
+	m_parent->onBlockAdded(block);
 
 	return block;
 }
@@ -92,7 +95,9 @@ void MapSector::insertBlock(std::unique_ptr<MapBlock> block)
 	assert(p2d == m_pos);
 
 	// Insert into container
+	MapBlock *block_p = block.get();
 	m_blocks[block_y] = std::move(block);
+	m_parent->onBlockAdded(block_p);
 }
 
 void MapSector::deleteBlock(MapBlock *block)
@@ -114,6 +119,7 @@ std::unique_ptr<MapBlock> MapSector::detachBlock(MapBlock *block)
 	std::unique_ptr<MapBlock> ret = std::move(it->second);
 	assert(ret.get() == block);
 	m_blocks.erase(it);
+	m_parent->onBlockRemoved(block);
 
 	// Mark as removed
 	block->makeOrphan();
@@ -67,12 +67,15 @@ void Client::handleCommand_Hello(NetworkPacket* pkt)
 
 	u8 serialization_ver; // negotiated value
 	u16 proto_ver;
-	u16 unused_compression_mode;
+	u16 compression_modes;
 	u32 auth_mechs;
 	std::string unused;
-	*pkt >> serialization_ver >> unused_compression_mode >> proto_ver
+	*pkt >> serialization_ver >> compression_modes >> proto_ver
 		>> auth_mechs >> unused;
 
+	// The dictionary follows in TOCLIENT_AUTH_ACCEPT
+	m_compression_modes = compression_modes;
+
 	// Chose an auth method we support
 	AuthMechanism chosen_auth_mechanism = choseAuthMech(auth_mechs);
 
@@ -138,6 +141,22 @@ void Client::handleCommand_AuthAccept(NetworkPacket* pkt)
 	*pkt >> unused >> m_map_seed >> m_recommended_send_interval
 		>> m_sudo_auth_methods;
 
+	m_map_dictionary.reset();
+	if (m_compression_modes & NETPROTO_COMPRESSION_MAP_DICTIONARY) {
+		try {
+			m_map_dictionary = std::make_unique<ZstdDictionary>(pkt->readLongString());
+		} catch (SerializationError &e) {
+			errorstream << "Client: TOCLIENT_AUTH_ACCEPT: Invalid map dictionary: "
+				<< e.what() << std::endl;
+			// Map blocks could not be read
+			m_access_denied = true;
+			m_access_denied_reason =
+					gettext("The server sent invalid data.  Try reconnecting.");
+			m_con->Disconnect();
+			return;
+		}
+	}
+
 	infostream << "Client: received map seed: " << m_map_seed << std::endl;
 	infostream << "Client: received recommended send interval "
 					<< m_recommended_send_interval<<std::endl;
@@ -301,8 +320,7 @@ void Client::handleCommand_BlockData(NetworkPacket* pkt)
 	v3s16 p;
 	*pkt >> p;
 
-	std::string datastring(pkt->getRemainingString(), pkt->getRemainingBytes());
-	std::istringstream istr(datastring, std::ios_base::binary);
+	std::string_view data(pkt->getRemainingString(), pkt->getRemainingBytes());
 
 	MapSector *sector;
 	MapBlock *block;
@@ -313,22 +331,18 @@ void Client::handleCommand_BlockData(NetworkPacket* pkt)
 	assert(sector->getPos() == p2d);
 
 	block = sector->getBlockNoCreateNoEx(p.Y);
-	if (block) {
-		/*
-			Update an existing block
-		*/
-		block->deSerialize(istr, m_server_ser_ver, false);
-		block->deSerializeNetworkSpecific(istr);
-	}
-	else {
+	if (!block) {
 		/*
 			Create a new block
 		*/
 		block = sector->createBlankBlock(p.Y);
-		block->deSerialize(istr, m_server_ser_ver, false);
-		block->deSerializeNetworkSpecific(istr);
 	}
 
+	const size_t used = block->deSerialize(data, m_server_ser_ver, false,
+		m_map_dictionary.get());
+	std::istringstream istr(std::string(data.substr(used)), std::ios_base::binary);
+	block->deSerializeNetworkSpecific(istr);
+
 	if (m_localdb) {
 		ServerMap::saveBlock(block, m_localdb.get());
 	}
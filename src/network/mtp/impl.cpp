@@ -59,6 +59,14 @@ void BufferedPacket::setSenderPeerId(session_t id)
 	writeU16(&data[4], id);
 }
 
+static void writeBaseHeader(BufferedPacket &p, u32 protocol_id,
+		session_t sender_peer_id, u8 channel)
+{
+	writeU32(&p.data[0], protocol_id);
+	writeU16(&p.data[4], sender_peer_id);
+	writeU8(&p.data[6], channel);
+}
+
 BufferedPacketPtr makePacket(const Address &address, const SharedBuffer<u8> &data,
 		u32 protocol_id, session_t sender_peer_id, u8 channel)
 {
@@ -67,181 +75,218 @@ BufferedPacketPtr makePacket(const Address &address, const SharedBuffer<u8> &dat
 	auto p = std::make_shared<BufferedPacket>(packet_size);
 	p->address = address;
 
-	writeU32(&p->data[0], protocol_id);
-	writeU16(&p->data[4], sender_peer_id);
-	writeU8(&p->data[6], channel);
+	writeBaseHeader(*p, protocol_id, sender_peer_id, channel);
 
 	memcpy(&p->data[BASE_HEADER_SIZE], *data, data.getSize());
 
 	return p;
 }
 
-SharedBuffer<u8> makeOriginalPacket(const SharedBuffer<u8> &data)
+SharedBuffer<u8> makeReliablePacket(const SharedBuffer<u8> &data, u16 seqnum)
 {
-	u32 header_size = 1;
+	u32 header_size = 3;
 	u32 packet_size = data.getSize() + header_size;
 	SharedBuffer<u8> b(packet_size);
 
-	writeU8(&(b[0]), PACKET_TYPE_ORIGINAL);
-	if (data.getSize() > 0) {
-		memcpy(&(b[header_size]), *data, data.getSize());
-	}
+	writeU8(&b[0], PACKET_TYPE_RELIABLE);
+	writeU16(&b[1], seqnum);
+
+	memcpy(&b[header_size], *data, data.getSize());
+
 	return b;
 }
 
-// Split data in chunks and add TYPE_SPLIT headers to them
-void makeSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max, u16 seqnum,
-		std::list<SharedBuffer<u8>> *chunks)
-{
-	// Chunk packets, containing the TYPE_SPLIT header
-	const u32 chunk_header_size = 7;
-	const u32 maximum_data_size = chunksize_max - chunk_header_size;
-	u32 start = 0, end = 0;
-	u16 chunk_num = 0;
-	do {
-		end = start + maximum_data_size - 1;
-		if (end > data.getSize() - 1)
-			end = data.getSize() - 1;
+/*
+	PacketData
+*/
 
-		u32 payload_size = end - start + 1;
-		u32 packet_size = chunk_header_size + payload_size;
+void PacketData::copyTo(u8 *dst, u32 offset, u32 size) const
+{
+	if (offset < head_size) {
+		const u32 n = std::min(size, head_size - offset);
+		memcpy(dst, &head[offset], n);
+		dst += n;
+		offset += n;
+		size -= n;
+	}
+	if (size > 0)
+		memcpy(dst, &payload[offset - head_size], size);
+}
 
-		SharedBuffer<u8> chunk(packet_size);
+/*
+	PacketSplitter
+*/
 
-		writeU8(&chunk[0], PACKET_TYPE_SPLIT);
-		writeU16(&chunk[1], seqnum);
-		// [3] u16 chunk_count is written at next stage
-		writeU16(&chunk[5], chunk_num);
-		memcpy(&chunk[chunk_header_size], &data[start], payload_size);
+// TYPE_SPLIT header: u8 type, u16 seqnum, u16 chunk_count, u16 chunk_num
+#define SPLIT_HEADER_SIZE 7
 
-		chunks->push_back(chunk);
+PacketSplitter::PacketSplitter(const PacketData &data) :
+	m_data(data)
+{
+}
 
-		start = end + 1;
-		sanity_check(chunk_num < 0xFFFF); // overflow
-		chunk_num++;
+PacketSplitter::PacketSplitter(const PacketData &data, u32 chunksize_max,
+		u16 &split_seqnum) :
+	m_data(data)
+{
+	if (data.getSize() + 1 <= chunksize_max) {
+		m_header_size = 1;
+		return;
 	}
-	while (end != data.getSize() - 1);
 
-	for (auto &chunk : *chunks) {
-		// Write chunk_count
-		writeU16(&chunk[3], chunk_num);
-	}
+	m_header_size = SPLIT_HEADER_SIZE;
+	m_chunk_size = chunksize_max - SPLIT_HEADER_SIZE;
+	m_count = (data.getSize() + m_chunk_size - 1) / m_chunk_size;
+	sanity_check(m_count <= 0xFFFF); // overflow
+	m_split_seqnum = split_seqnum++;
 }
 
-void makeAutoSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max,
-		u16 &split_seqnum, std::list<SharedBuffer<u8>> *list)
+u32 PacketSplitter::getSize(u32 i) const
 {
-	u32 original_header_size = 1;
+	if (m_header_size != SPLIT_HEADER_SIZE)
+		return m_header_size + m_data.getSize();
+	return m_header_size + std::min(m_chunk_size, m_data.getSize() - i * m_chunk_size);
+}
 
-	if (data.getSize() + original_header_size > chunksize_max) {
-		makeSplitPacket(data, chunksize_max, split_seqnum, list);
-		split_seqnum++;
-		return;
+void PacketSplitter::write(u32 i, u8 *dst) const
+{
+	const u32 data_size = getSize(i) - m_header_size;
+	if (m_header_size == 1) {
+		writeU8(&dst[0], PACKET_TYPE_ORIGINAL);
+	} else if (m_header_size == SPLIT_HEADER_SIZE) {
+		writeU8(&dst[0], PACKET_TYPE_SPLIT);
+		writeU16(&dst[1], m_split_seqnum);
+		writeU16(&dst[3], m_count);
+		writeU16(&dst[5], i);
 	}
-
-	list->push_back(makeOriginalPacket(data));
+	m_data.copyTo(&dst[m_header_size], i * m_chunk_size, data_size);
 }
 
-SharedBuffer<u8> makeReliablePacket(const SharedBuffer<u8> &data, u16 seqnum)
+BufferedPacketPtr makeReliablePacket(const Address &address,
+		const PacketSplitter &splitter, u32 i, u16 seqnum,
+		u32 protocol_id, session_t sender_peer_id, u8 channel)
 {
-	u32 header_size = 3;
-	u32 packet_size = data.getSize() + header_size;
-	SharedBuffer<u8> b(packet_size);
+	const u32 header_size = BASE_HEADER_SIZE + RELIABLE_HEADER_SIZE;
 
-	writeU8(&b[0], PACKET_TYPE_RELIABLE);
-	writeU16(&b[1], seqnum);
+	auto p = std::make_shared<BufferedPacket>(header_size + splitter.getSize(i));
+	p->address = address;
 
-	memcpy(&b[header_size], *data, data.getSize());
+	writeBaseHeader(*p, protocol_id, sender_peer_id, channel);
+	writeU8(&p->data[BASE_HEADER_SIZE], PACKET_TYPE_RELIABLE);
+	writeU16(&p->data[BASE_HEADER_SIZE + 1], seqnum);
+	splitter.write(i, &p->data[header_size]);
 
-	return b;
+	return p;
 }
 
 /*
 	ReliablePacketBuffer
 */
 
+// Minimum number of slots of the packet buffers, must be a power of two
+#define PACKET_BUFFER_MIN_CAPACITY 64
+
+template <typename F>
+void ReliablePacketBuffer::forEachNoLock(F f)
+{
+	if (m_count == 0)
+		return;
+	const u32 span = (u16)(m_last - m_first) + 1;
+	for (u32 i = 0; i < span; i++) {
+		BufferedPacketPtr &packet = slotNoLock(m_first + i);
+		if (packet && !f(packet))
+			break;
+	}
+}
+
 void ReliablePacketBuffer::print()
 {
-	MutexAutoLock listlock(m_list_mutex);
+	MutexAutoLock listlock(m_mutex);
 	LOG(dout_con<<"Dump of ReliablePacketBuffer:" << std::endl);
 	unsigned int index = 0;
-	for (BufferedPacketPtr &packet : m_list) {
+	forEachNoLock([&] (BufferedPacketPtr &packet) {
 		LOG(dout_con<<index<< ":" << packet->getSeqnum() << std::endl);
 		index++;
-	}
+		return true;
+	});
 }
 
 bool ReliablePacketBuffer::empty()
 {
-	MutexAutoLock listlock(m_list_mutex);
-	return m_list.empty();
+	MutexAutoLock listlock(m_mutex);
+	return m_count == 0;
 }
 
 u32 ReliablePacketBuffer::size()
 {
-	MutexAutoLock listlock(m_list_mutex);
-	return m_list.size();
+	MutexAutoLock listlock(m_mutex);
+	return m_count;
+}
+
+void ReliablePacketBuffer::removedNoLock()
+{
+	m_count--;
+	if (m_count == 0)
+		return;
+	while (!slotNoLock(m_first))
+		m_first++;
+	while (!slotNoLock(m_last))
+		m_last--;
 }
 
-ReliablePacketBuffer::FindResult ReliablePacketBuffer::findPacketNoLock(u16 seqnum)
+void ReliablePacketBuffer::growNoLock(u32 span)
 {
-	for (auto it = m_list.begin(); it != m_list.end(); ++it) {
-		if ((*it)->getSeqnum() == seqnum)
-			return it;
+	size_t capacity = std::max<size_t>(m_slots.size(), PACKET_BUFFER_MIN_CAPACITY);
+	while (capacity < span)
+		capacity *= 2;
+
+	std::vector<BufferedPacketPtr> old;
+	old.swap(m_slots);
+	m_slots.resize(capacity);
+	for (BufferedPacketPtr &packet : old) {
+		if (packet)
+			slotNoLock(packet->getSeqnum()) = std::move(packet);
 	}
-	return m_list.end();
 }
 
 bool ReliablePacketBuffer::getFirstSeqnum(u16& result)
 {
-	MutexAutoLock listlock(m_list_mutex);
-	if (m_list.empty())
+	MutexAutoLock listlock(m_mutex);
+	if (m_count == 0)
 		return false;
-	result = m_list.front()->getSeqnum();
+	result = m_first;
 	return true;
 }
 
 BufferedPacketPtr ReliablePacketBuffer::popFirst()
 {
-	MutexAutoLock listlock(m_list_mutex);
-	if (m_list.empty())
+	MutexAutoLock listlock(m_mutex);
+	if (m_count == 0)
 		throw NotFoundException("Buffer is empty");
 
-	BufferedPacketPtr p(m_list.front());
-	m_list.pop_front();
-
-	if (m_list.empty()) {
-		m_oldest_non_answered_ack = 0;
-	} else {
-		m_oldest_non_answered_ack = m_list.front()->getSeqnum();
-	}
+	BufferedPacketPtr p(std::move(slotNoLock(m_first)));
+	removedNoLock();
 	return p;
 }
 
 BufferedPacketPtr ReliablePacketBuffer::popSeqnum(u16 seqnum)
 {
-	MutexAutoLock listlock(m_list_mutex);
-	auto r = findPacketNoLock(seqnum);
-	if (r == m_list.end()) {
+	MutexAutoLock listlock(m_mutex);
+	if (m_count == 0 || (u16)(seqnum - m_first) > (u16)(m_last - m_first) ||
+			!slotNoLock(seqnum)) {
 		LOG(dout_con<<"Sequence number: " << seqnum
 				<< " not found in reliable buffer"<<std::endl);
 		throw NotFoundException("seqnum not found in buffer");
 	}
 
-	BufferedPacketPtr p(*r);
-	m_list.erase(r);
-
-	if (m_list.empty()) {
-		m_oldest_non_answered_ack = 0;
-	} else {
-		m_oldest_non_answered_ack = m_list.front()->getSeqnum();
-	}
+	BufferedPacketPtr p(std::move(slotNoLock(seqnum)));
+	removedNoLock();
 	return p;
 }
 
 void ReliablePacketBuffer::insert(BufferedPacketPtr &p_ptr, u16 next_expected)
 {
-	MutexAutoLock listlock(m_list_mutex);
+	MutexAutoLock listlock(m_mutex);
 	const BufferedPacket &p = *p_ptr;
 
 	if (p.size() < BASE_HEADER_SIZE + 3) {
@@ -268,45 +313,35 @@ void ReliablePacketBuffer::insert(BufferedPacketPtr &p_ptr, u16 next_expected)
 		return;
 	}
 
-	sanity_check(m_list.size() <= SEQNUM_MAX); // FIXME: Handle the error?
+	sanity_check(m_count <= SEQNUM_MAX); // FIXME: Handle the error?
 
-	// Find the right place for the packet and insert it there
-	// If list is empty, just add it
-	if (m_list.empty()) {
-		m_list.push_back(p_ptr);
-		m_oldest_non_answered_ack = seqnum;
-		// Done.
+	if (m_count == 0) {
+		if (m_slots.empty())
+			growNoLock(1);
+		slotNoLock(seqnum) = p_ptr;
+		m_first = m_last = seqnum;
+		m_count = 1;
 		return;
 	}
 
-	// Otherwise find the right place
-	auto it = m_list.begin();
-	// Find the first packet in the list which has a higher seqnum
-	u16 s = (*it)->getSeqnum();
-
-	/* case seqnum is smaller then next_expected seqnum */
-	/* this is true e.g. on wrap around */
-	if (seqnum < next_expected) {
-		while(((s < seqnum) || (s >= next_expected)) && (it != m_list.end())) {
-			++it;
-			if (it != m_list.end())
-				s = (*it)->getSeqnum();
-		}
-	}
-	/* non wrap around case (at least for incoming and next_expected */
-	else
-	{
-		while(((s < seqnum) && (s >= next_expected)) && (it != m_list.end())) {
-			++it;
-			if (it != m_list.end())
-				s = (*it)->getSeqnum();
-		}
-	}
+	// Packets are ordered by their distance from next_expected, this
+	// handles the wrap around
+	u16 first = m_first, last = m_last;
+	const u16 offset = seqnum - next_expected;
+	if (offset < (u16)(m_first - next_expected))
+		first = seqnum;
+	else if (offset > (u16)(m_last - next_expected))
+		last = seqnum;
+
+	const u32 span = (u16)(last - first) + 1;
+	if (span > m_slots.size())
+		growNoLock(span);
 
-	if (s == seqnum) {
+	BufferedPacketPtr &slot = slotNoLock(seqnum);
+	if (slot) {
 		/* nothing to do this seems to be a resent packet */
 		/* for paranoia reason data should be compared */
-		auto &i = *it;
+		auto &i = slot;
 		if (
 			(i->getSeqnum() != seqnum) ||
 			(i->size() != p.size()) ||
@@ -331,56 +366,59 @@ void ReliablePacketBuffer::insert(BufferedPacketPtr &p_ptr, u16 next_expected)
 			warningstream << buf << std::flush;
 			throw IncomingDataCorruption("duplicated packet isn't same as original one");
 		}
-	}
-	/* insert or push back */
-	else if (it != m_list.end()) {
-		m_list.insert(it, p_ptr);
-	} else {
-		m_list.push_back(p_ptr);
+		return;
 	}
 
-	/* update last packet number */
-	m_oldest_non_answered_ack = m_list.front()->getSeqnum();
+	slot = p_ptr;
+	m_first = first;
+	m_last = last;
+	m_count++;
 }
 
 void ReliablePacketBuffer::fixPeerId(session_t new_id)
 {
-	MutexAutoLock listlock(m_list_mutex);
-	for (auto &packet : m_list)
+	MutexAutoLock listlock(m_mutex);
+	forEachNoLock([&] (BufferedPacketPtr &packet) {
 		packet->setSenderPeerId(new_id);
+		return true;
+	});
 }
 
 void ReliablePacketBuffer::incrementTimeouts(float dtime)
 {
-	MutexAutoLock listlock(m_list_mutex);
-	for (auto &packet : m_list) {
+	MutexAutoLock listlock(m_mutex);
+	forEachNoLock([&] (BufferedPacketPtr &packet) {
 		packet->time += dtime;
 		packet->totaltime += dtime;
-	}
+		return true;
+	});
 }
 
 u32 ReliablePacketBuffer::getTimedOuts(float timeout)
 {
-	MutexAutoLock listlock(m_list_mutex);
+	MutexAutoLock listlock(m_mutex);
 	u32 count = 0;
-	for (auto &packet : m_list) {
+	forEachNoLock([&] (BufferedPacketPtr &packet) {
 		if (packet->totaltime >= timeout)
 			count++;
-	}
+		return true;
+	});
 	return count;
 }
 
 std::vector<ConstSharedPtr<BufferedPacket>>
 	ReliablePacketBuffer::getResend(float timeout, u32 max_packets)
 {
-	MutexAutoLock listlock(m_list_mutex);
+	MutexAutoLock listlock(m_mutex);
 	std::vector<ConstSharedPtr<BufferedPacket>> timed_outs;
-	for (auto &packet : m_list) {
+	if (max_packets == 0)
+		return timed_outs;
+	forEachNoLock([&] (BufferedPacketPtr &packet) {
 		// resend time scales exponentially with each cycle
 		const float pkt_timeout = timeout * powf(RESEND_SCALE_BASE, packet->resend_count);
 
 		if (packet->time < pkt_timeout)
-			continue;
+			return true;
 
 		// caller will resend packet so reset time and increase counter
 		packet->time = 0.0f;
@@ -388,9 +426,8 @@ std::vector<ConstSharedPtr<BufferedPacket>>
 
 		timed_outs.emplace_back(packet);
 
-		if (timed_outs.size() >= max_packets)
-			break;
-	}
+		return timed_outs.size() < max_packets;
+	});
 	return timed_outs;
 }
 
@@ -442,15 +479,32 @@ SharedBuffer<u8> IncomingSplitPacket::reassemble()
 
 IncomingSplitBuffer::~IncomingSplitBuffer()
 {
-	MutexAutoLock listlock(m_map_mutex);
-	for (auto &i : m_buf) {
-		delete i.second;
+	MutexAutoLock listlock(m_mutex);
+	for (Slot &slot : m_slots)
+		delete slot.packet;
+}
+
+u32 IncomingSplitBuffer::size()
+{
+	MutexAutoLock listlock(m_mutex);
+	return m_count;
+}
+
+void IncomingSplitBuffer::growNoLock()
+{
+	// Seqnums in different slots stay in different slots
+	std::vector<Slot> old;
+	old.swap(m_slots);
+	m_slots.resize(std::max<size_t>(old.size() * 2, PACKET_BUFFER_MIN_CAPACITY));
+	for (const Slot &slot : old) {
+		if (slot.packet)
+			slotNoLock(slot.seqnum) = slot;
 	}
 }
 
 SharedBuffer<u8> IncomingSplitBuffer::insert(BufferedPacketPtr &p_ptr, bool reliable)
 {
-	MutexAutoLock listlock(m_map_mutex);
+	MutexAutoLock listlock(m_mutex);
 	const BufferedPacket &p = *p_ptr;
 
 	u32 headersize = BASE_HEADER_SIZE + 7;
@@ -475,13 +529,17 @@ SharedBuffer<u8> IncomingSplitBuffer::insert(BufferedPacketPtr &p_ptr, bool reli
 	}
 
 	// Add if doesn't exist
-	IncomingSplitPacket *sp;
-	if (m_buf.find(seqnum) == m_buf.end()) {
-		sp = new IncomingSplitPacket(chunk_count, reliable);
-		m_buf[seqnum] = sp;
-	} else {
-		sp = m_buf[seqnum];
-	}
+	if (m_slots.empty())
+		growNoLock();
+	while (slotNoLock(seqnum).packet && slotNoLock(seqnum).seqnum != seqnum)
+		growNoLock();
+	Slot &slot = slotNoLock(seqnum);
+	if (!slot.packet) {
+		slot.seqnum = seqnum;
+		slot.packet = new IncomingSplitPacket(chunk_count, reliable);
+		m_count++;
+	}
+	IncomingSplitPacket *sp = slot.packet;
 
 	if (chunk_count != sp->chunk_count) {
 		errorstream << "IncomingSplitBuffer::insert(): chunk_count="
@@ -509,7 +567,8 @@ SharedBuffer<u8> IncomingSplitBuffer::insert(BufferedPacketPtr &p_ptr, bool reli
 	SharedBuffer<u8> fulldata = sp->reassemble();
 
 	// Remove sp from buffer
-	m_buf.erase(seqnum);
+	slot.packet = nullptr;
+	m_count--;
 	delete sp;
 
 	return fulldata;
@@ -517,25 +576,22 @@ SharedBuffer<u8> IncomingSplitBuffer::insert(BufferedPacketPtr &p_ptr, bool reli
 
 void IncomingSplitBuffer::removeUnreliableTimedOuts(float dtime, float timeout)
 {
-	MutexAutoLock listlock(m_map_mutex);
-	std::vector<u16> remove_queue;
-	{
-		for (const auto &i : m_buf) {
-			IncomingSplitPacket *p = i.second;
-			// Reliable ones are not removed by timeout
-			if (p->reliable)
-				continue;
-			p->time += dtime;
-			if (p->time >= timeout)
-				remove_queue.push_back(i.first);
+	MutexAutoLock listlock(m_mutex);
+	if (m_count == 0)
+		return;
+	for (Slot &slot : m_slots) {
+		IncomingSplitPacket *p = slot.packet;
+		// Reliable ones are not removed by timeout
+		if (!p || p->reliable)
+			continue;
+		p->time += dtime;
+		if (p->time >= timeout) {
+			LOG(dout_con<<"NOTE: Removing timed out unreliable split packet"<<std::endl);
+			delete p;
+			slot.packet = nullptr;
+			m_count--;
 		}
 	}
-	for (u16 j : remove_queue) {
-		LOG(dout_con<<"NOTE: Removing timed out unreliable split packet"<<std::endl);
-		auto it = m_buf.find(j);
-		delete it->second;
-		m_buf.erase(it);
-	}
 }
 
 /*
@@ -596,7 +652,8 @@ ConnectionCommandPtr ConnectionCommand::send(session_t peer_id, u8 channelnum,
 	c->peer_id = peer_id;
 	c->channelnum = channelnum;
 	c->reliable = reliable;
-	c->data = pkt->oldForgePacket();
+	c->data = pkt->forgeHead();
+	c->payload = pkt->getSharedPayload();
 	return c;
 }
 
@@ -1050,13 +1107,13 @@ void UDPPeer::PutReliableSendCommand(ConnectionCommandPtr &c,
 			(chan.queued_reliables.size() + 1 < chan.getWindowSize() / 2)) {
 		LOG(dout_con<<m_connection->getDesc()
 				<<" processing reliable command for peer id: " << c->peer_id
-				<<" data size: " << c->data.getSize() << std::endl);
+				<<" data size: " << c->getData().getSize() << std::endl);
 		if (processReliableSendCommand(c, max_packet_size))
 			return;
 	} else {
 		LOG(dout_con<<m_connection->getDesc()
 				<<" Queueing reliable command for peer id: " << c->peer_id
-				<<" data size: " << c->data.getSize() <<std::endl);
+				<<" data size: " << c->getData().getSize() <<std::endl);
 
 		if (chan.queued_commands.size() + 1 >= chan.getWindowSize() / 2) {
 			LOG(derr_con << m_connection->getDesc()
@@ -1082,24 +1139,20 @@ bool UDPPeer::processReliableSendCommand(
 							- BASE_HEADER_SIZE
 							- RELIABLE_HEADER_SIZE;
 
-	std::list<SharedBuffer<u8>> originals;
+	const PacketData data = c.getData();
+	u16 split_seqnum = chan.readNextSplitSeqNum();
+	const PacketSplitter splitter = c.raw ? PacketSplitter(data) :
+		PacketSplitter(data, chunksize_max, split_seqnum);
+	chan.setNextSplitSeqNum(split_seqnum);
 
-	if (c.raw) {
-		originals.emplace_back(c.data);
-	} else {
-		u16 split_seqnum = chan.readNextSplitSeqNum();
-		makeAutoSplitPacket(c.data, chunksize_max, split_seqnum, &originals);
-		chan.setNextSplitSeqNum(split_seqnum);
-	}
-
-	sanity_check(originals.size() < MAX_RELIABLE_WINDOW_SIZE);
+	sanity_check(splitter.getCount() < MAX_RELIABLE_WINDOW_SIZE);
 
 	bool have_sequence_number = false;
 	bool have_initial_sequence_number = false;
 	std::queue<BufferedPacketPtr> toadd;
 	u16 initial_sequence_number = 0;
 
-	for (SharedBuffer<u8> &original : originals) {
+	for (u32 i = 0; i < splitter.getCount(); i++) {
 		u16 seqnum = chan.getOutgoingSequenceNumber(have_sequence_number);
 
 		/* oops, we don't have enough sequence numbers to send this packet */
@@ -1112,11 +1165,9 @@ bool UDPPeer::processReliableSendCommand(
 			have_initial_sequence_number = true;
 		}
 
-		SharedBuffer<u8> reliable = makeReliablePacket(original, seqnum);
-
-		// Add base headers and make a packet
-		BufferedPacketPtr p = con::makePacket(address, reliable,
-				m_connection->GetProtocolID(), m_connection->GetPeerID(),
+		// Add all headers and make a packet
+		BufferedPacketPtr p = con::makeReliablePacket(address, splitter, i,
+				seqnum, m_connection->GetProtocolID(), m_connection->GetPeerID(),
 				c.channelnum);
 
 		toadd.push(p);
@@ -1159,7 +1210,7 @@ bool UDPPeer::processReliableSendCommand(
 
 	LOG(dout_con<<m_connection->getDesc()
 			<< " Windowsize exceeded on reliable sending "
-			<< c.data.getSize() << " bytes"
+			<< c.getData().getSize() << " bytes"
 			<< std::endl << "\t\tinitial_sequence_number: "
 			<< initial_sequence_number
 			<< std::endl << "\t\tgot at most            : "
@@ -1192,7 +1243,7 @@ void UDPPeer::RunCommandQueues(
 				} else {
 					LOG(dout_con << m_connection->getDesc()
 							<< " Failed to queue packets for peer_id: " << c->peer_id
-							<< ", delaying sending of " << c->data.getSize()
+							<< ", delaying sending of " << c->getData().getSize()
 							<< " bytes" << std::endl);
 				}
 			}
@@ -222,14 +222,60 @@ struct BufferedPacket {
 BufferedPacketPtr makePacket(const Address &address, const SharedBuffer<u8> &data,
 		u32 protocol_id, session_t sender_peer_id, u8 channel);
 
-// Depending on size, make a TYPE_ORIGINAL or TYPE_SPLIT packet
-// Increments split_seqnum if a split packet is made
-void makeAutoSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max,
-		u16 &split_seqnum, std::list<SharedBuffer<u8>> *list);
-
 // Add the TYPE_RELIABLE header to the data
 SharedBuffer<u8> makeReliablePacket(const SharedBuffer<u8> &data, u16 seqnum);
 
+/*
+	View of the data of an outgoing packet: a head, followed by a payload
+	that may be shared with other packets, e.g. a map block that is sent
+	to many peers. Neither is owned.
+*/
+struct PacketData
+{
+	PacketData(const u8 *head_, u32 head_size_, std::string_view payload_ = {}) :
+		head(head_), head_size(head_size_), payload(payload_)
+	{}
+
+	u32 getSize() const { return head_size + payload.size(); }
+	// Copies size bytes starting at offset
+	void copyTo(u8 *dst, u32 offset, u32 size) const;
+
+	const u8 *head;
+	u32 head_size;
+	std::string_view payload;
+};
+
+/*
+	Cuts data into a TYPE_ORIGINAL packet, or into TYPE_SPLIT packets if it
+	is too big for one. The data is only copied when a packet is written,
+	directly to where it is sent from.
+*/
+class PacketSplitter
+{
+public:
+	// One packet holding the data as it is, without a header
+	PacketSplitter(const PacketData &data);
+	// Increments split_seqnum if split packets are made
+	PacketSplitter(const PacketData &data, u32 chunksize_max, u16 &split_seqnum);
+
+	u32 getCount() const { return m_count; }
+	// Size of packet i, including its header
+	u32 getSize(u32 i) const;
+	void write(u32 i, u8 *dst) const;
+
+private:
+	PacketData m_data;
+	u32 m_header_size = 0;
+	u32 m_chunk_size = 0;
+	u32 m_count = 1;
+	u16 m_split_seqnum = 0;
+};
+
+// Makes packet i of the splitter with the base and TYPE_RELIABLE headers
+BufferedPacketPtr makeReliablePacket(const Address &address,
+		const PacketSplitter &splitter, u32 i, u16 seqnum,
+		u32 protocol_id, session_t sender_peer_id, u8 channel);
+
 struct IncomingSplitPacket
 {
 	IncomingSplitPacket(u32 cc, bool r):
@@ -280,15 +326,28 @@ class ReliablePacketBuffer
 
 
 private:
-	typedef std::list<BufferedPacketPtr>::iterator FindResult;
-
-	FindResult findPacketNoLock(u16 seqnum);
-
-	std::list<BufferedPacketPtr> m_list;
+	BufferedPacketPtr &slotNoLock(u16 seqnum)
+	{
+		return m_slots[seqnum & (m_slots.size() - 1)];
+	}
+	// Calls f for every packet, in order of seqnum
+	template <typename F>
+	void forEachNoLock(F f);
+	// Moves first and last to the remaining packets after one was taken out
+	void removedNoLock();
+	void growNoLock(u32 span);
 
-	u16 m_oldest_non_answered_ack;
+	/*
+		Packets indexed by seqnum modulo the capacity, which is a power of two.
+		All packets lie in [m_first, m_last] and that range never has more
+		seqnums than there are slots, so lookups are a single index.
+	*/
+	std::vector<BufferedPacketPtr> m_slots;
+	u16 m_first = 0;
+	u16 m_last = 0;
+	u32 m_count = 0;
 
-	std::mutex m_list_mutex;
+	std::mutex m_mutex;
 };
 
 /*
@@ -308,11 +367,27 @@ class IncomingSplitBuffer
 
 	void removeUnreliableTimedOuts(float dtime, float timeout);
 
+	u32 size();
+
 private:
-	// Key is seqnum
-	std::map<u16, IncomingSplitPacket*> m_buf;
+	struct Slot
+	{
+		u16 seqnum = 0;
+		IncomingSplitPacket *packet = nullptr;
+	};
+
+	Slot &slotNoLock(u16 seqnum)
+	{
+		return m_slots[seqnum & (m_slots.size() - 1)];
+	}
+	void growNoLock();
 
-	std::mutex m_map_mutex;
+	// Packets indexed by seqnum modulo the capacity, which is a power of two
+	// and is doubled when two packets would share a slot
+	std::vector<Slot> m_slots;
+	u32 m_count = 0;
+
+	std::mutex m_mutex;
 };
 
 enum ConnectionCommandType{
@@ -337,11 +412,19 @@ struct ConnectionCommand
 	session_t peer_id = PEER_ID_INEXISTENT;
 	u8 channelnum = 0;
 	Buffer<u8> data;
+	// Sent after data, may be shared with other commands
+	std::shared_ptr<const std::string> payload;
 	bool reliable = false;
 	bool raw = false;
 
 	DISABLE_CLASS_COPY(ConnectionCommand);
 
+	PacketData getData() const
+	{
+		return PacketData(*data, data.getSize(),
+			payload ? std::string_view(*payload) : std::string_view());
+	}
+
 	static ConnectionCommandPtr serve(Address address);
 	static ConnectionCommandPtr connect(Address address);
 	static ConnectionCommandPtr disconnect();
@@ -124,6 +124,8 @@ void *ConnectionSendThread::run()
 		/* send queued packets */
 		sendPackets(dtime, calculate_quota());
 
+		flushSendBatch();
+
 		END_DEBUG_EXCEPTION_HANDLER
 	}
 
@@ -241,7 +243,7 @@ void ConnectionSendThread::runTimeouts(float dtime, u32 peer_packet_quota)
 				m_iteration_packets_avaialble = 0;
 
 			for (const auto &k : timed_outs)
-				resendReliable(channel, k.get(), resend_timeout);
+				resendReliable(channel, k, resend_timeout);
 
 			auto ws_old = channel.getWindowSize();
 			channel.UpdateTimers(dtime);
@@ -271,9 +273,9 @@ void ConnectionSendThread::runTimeouts(float dtime, u32 peer_packet_quota)
 	}
 }
 
-void ConnectionSendThread::resendReliable(Channel &channel, const BufferedPacket *k, float resend_timeout)
+void ConnectionSendThread::resendReliable(Channel &channel,
+	const ConstSharedPtr<BufferedPacket> &k, float resend_timeout)
 {
-	assert(k);
 	u8 channelnum = readChannel(k->data);
 	u16 seqnum = k->getSeqnum();
 
@@ -298,19 +300,39 @@ void ConnectionSendThread::resendReliable(Channel &channel, const BufferedPacket
 	// lost or really takes more time to transmit
 }
 
-void ConnectionSendThread::rawSend(const BufferedPacket *p)
+void ConnectionSendThread::rawSend(const ConstSharedPtr<BufferedPacket> &p)
 {
-	assert(p);
-	try {
-		m_connection->m_udpSocket.Send(p->address, p->data, p->size());
-		//LOG(dout_con << m_connection->getDesc()
-		//	<< " rawSend: " << p->size()
-		//	<< " bytes sent" << std::endl);
-	} catch (SendFailedException &e) {
-		LOG(derr_con << m_connection->getDesc()
-			<< "SendFailedException: " << e.what() << " to "
-			<< p->address.serializeString() << std::endl);
+	assert(p.get());
+	m_send_batch.push_back(p);
+	if (m_send_batch.size() >= UDPSocket::MAX_BATCH)
+		flushSendBatch();
+}
+
+void ConnectionSendThread::flushSendBatch()
+{
+	if (m_send_batch.empty())
+		return;
+
+	m_send_datagrams.resize(m_send_batch.size());
+	for (size_t i = 0; i < m_send_batch.size(); i++) {
+		const BufferedPacket &p = *m_send_batch[i];
+		m_send_datagrams[i].address = p.address;
+		m_send_datagrams[i].data = p.data;
+		m_send_datagrams[i].size = p.size();
+	}
+
+	int sent = m_connection->m_udpSocket.SendBatch(m_send_datagrams.data(),
+		m_send_datagrams.size());
+	if (sent != (int)m_send_datagrams.size()) {
+		for (const UDPSocket::Datagram &datagram : m_send_datagrams) {
+			if (!datagram.error)
+				continue;
+			LOG(derr_con << m_connection->getDesc()
+				<< "SendFailedException: " << datagram.error << " to "
+				<< datagram.address.serializeString() << std::endl);
+		}
 	}
+	m_send_batch.clear();
 }
 
 void ConnectionSendThread::sendAsPacketReliable(BufferedPacketPtr &p, Channel *channel)
@@ -330,7 +352,7 @@ void ConnectionSendThread::sendAsPacketReliable(BufferedPacketPtr &p, Channel *c
 	}
 
 	// Send the packet
-	rawSend(p.get());
+	rawSend(p);
 }
 
 bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
@@ -383,7 +405,7 @@ bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
 		channelnum);
 
 	// Send the packet
-	rawSend(p.get());
+	rawSend(p);
 	return true;
 }
 
@@ -430,7 +452,7 @@ void ConnectionSendThread::processReliableCommand(ConnectionCommandPtr &c)
 			auto list = channel.outgoing_reliables_sent.getResend(0, 1);
 
 			if (!list.empty())
-				resendReliable(channel, list.front().get(), -1);
+				resendReliable(channel, list.front(), -1);
 
 			return;
 		}
@@ -486,12 +508,12 @@ void ConnectionSendThread::processNonReliableCommand(ConnectionCommandPtr &c_ptr
 		case CONNCMD_SEND:
 			LOG(dout_con << m_connection->getDesc()
 				<< " UDP processing CONNCMD_SEND" << std::endl);
-			send(c.peer_id, c.channelnum, c.data);
+			send(c.peer_id, c.channelnum, c.getData());
 			return;
 		case CONNCMD_SEND_TO_ALL:
 			LOG(dout_con << m_connection->getDesc()
 				<< " UDP processing CONNCMD_SEND_TO_ALL" << std::endl);
-			sendToAll(c.channelnum, c.data);
+			sendToAll(c.channelnum, c.getData());
 			return;
 		case CONCMD_ACK:
 			LOG(dout_con << m_connection->getDesc()
@@ -607,7 +629,7 @@ void ConnectionSendThread::fix_peer_id(session_t own_peer_id)
 }
 
 void ConnectionSendThread::send(session_t peer_id, u8 channelnum,
-	const SharedBuffer<u8> &data)
+	const PacketData &data)
 {
 	assert(channelnum < CHANNEL_COUNT); // Pre-condition
 
@@ -627,13 +649,13 @@ void ConnectionSendThread::send(session_t peer_id, u8 channelnum,
 	u16 split_sequence_number = peer->getNextSplitSequenceNumber(channelnum);
 
 	u32 chunksize_max = m_max_packet_size - BASE_HEADER_SIZE;
-	std::list<SharedBuffer<u8>> originals;
-
-	makeAutoSplitPacket(data, chunksize_max, split_sequence_number, &originals);
+	PacketSplitter splitter(data, chunksize_max, split_sequence_number);
 
 	peer->setNextSplitSequenceNumber(channelnum, split_sequence_number);
 
-	for (const SharedBuffer<u8> &original : originals) {
+	for (u32 i = 0; i < splitter.getCount(); i++) {
+		SharedBuffer<u8> original(splitter.getSize(i));
+		splitter.write(i, *original);
 		sendAsPacket(peer_id, channelnum, original);
 	}
 }
@@ -647,7 +669,7 @@ void ConnectionSendThread::sendReliable(ConnectionCommandPtr &c)
 	peer->PutReliableSendCommand(c, m_max_packet_size);
 }
 
-void ConnectionSendThread::sendToAll(u8 channelnum, const SharedBuffer<u8> &data)
+void ConnectionSendThread::sendToAll(u8 channelnum, const PacketData &data)
 {
 	std::vector<session_t> peerids = m_connection->getPeerIDs();
 
@@ -827,7 +849,8 @@ void ConnectionSendThread::sendAsPacket(session_t peer_id, u8 channelnum,
 }
 
 ConnectionReceiveThread::ConnectionReceiveThread() :
-	Thread("ConnectionReceive")
+	Thread("ConnectionReceive"),
+	m_num_process_threads(g_settings->getU16("network_process_threads"))
 {
 }
 
@@ -846,7 +869,9 @@ void *ConnectionReceiveThread::run()
 	// theoretical reliable upper boundary of a udp packet for all IPv6 enabled
 	// infrastructure
 	const unsigned int packet_maxsize = 1500;
-	SharedBuffer<u8> packetdata(packet_maxsize);
+	m_datagram_buffers = std::make_unique<u8[]>(UDPSocket::MAX_BATCH * packet_maxsize);
+	for (int i = 0; i < UDPSocket::MAX_BATCH; i++)
+		m_datagrams[i].data = &m_datagram_buffers[i * packet_maxsize];
 
 	bool packet_queued = true;
 
@@ -868,7 +893,9 @@ void *ConnectionReceiveThread::run()
 #endif
 
 		/* receive packets */
-		receive(packetdata, packet_queued);
+		for (auto &datagram : m_datagrams)
+			datagram.size = packet_maxsize;
+		receive(packet_queued);
 
 #ifdef DEBUG_CONNECTION_KBPS
 		debug_print_timer += dtime;
@@ -923,164 +950,306 @@ void *ConnectionReceiveThread::run()
 		END_DEBUG_EXCEPTION_HANDLER
 	}
 
+	stopProcessThreads();
+
 	PROFILE(g_profiler->remove(ThreadIdentifier.str()));
 	return NULL;
 }
 
+void ConnectionReceiveThread::startProcessThreads()
+{
+	for (u16 i = 0; i < m_num_process_threads; i++) {
+		m_process_threads.push_back(std::make_unique<ConnectionProcessThread>(this));
+		m_process_threads.back()->start();
+	}
+	m_process_queues.resize(m_process_threads.size());
+}
+
+void ConnectionReceiveThread::stopProcessThreads()
+{
+	for (auto &thread : m_process_threads)
+		thread->stop();
+	for (auto &thread : m_process_threads)
+		thread->wait();
+	m_process_threads.clear();
+	m_process_queues.clear();
+}
+
 // Receive packets from the network and buffers and create ConnectionEvents
-void ConnectionReceiveThread::receive(SharedBuffer<u8> &packetdata,
-		bool &packet_queued)
+void ConnectionReceiveThread::receive(bool &packet_queued)
 {
-	try {
-		// First, see if there any buffered packets we can process now
-		if (packet_queued) {
-			session_t peer_id;
-			SharedBuffer<u8> resultdata;
-			while (true) {
-				try {
-					if (!getFromBuffers(peer_id, resultdata))
-						break;
+	// First, see if there any buffered packets we can process now
+	if (packet_queued) {
+		processBufferedPackets();
+		packet_queued = false;
+	}
 
-					m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
-				}
-				catch (ProcessedSilentlyException &e) {
-					/* try reading again */
-				}
-			}
+	// Wait for incoming data and take all datagrams that arrived
+	int count = m_connection->m_udpSocket.ReceiveBatch(m_datagrams,
+		UDPSocket::MAX_BATCH);
+
+	for (int i = 0; i < count; i++) {
+		if (packet_queued) {
+			processBufferedPackets();
 			packet_queued = false;
 		}
 
-		// Call Receive() to wait for incoming data
-		Address sender;
-		s32 received_size = m_connection->m_udpSocket.Receive(sender,
-			*packetdata, packetdata.getSize());
-		if (received_size < 0)
-			return;
-
-		if ((received_size < BASE_HEADER_SIZE) ||
-				(readU32(&packetdata[0]) != m_connection->GetProtocolID())) {
-			LOG(derr_con << m_connection->getDesc()
-				<< "Receive(): Invalid incoming packet, "
-				<< "size: " << received_size
-				<< ", protocol: "
-				<< ((received_size >= 4) ? readU32(&packetdata[0]) : -1)
-				<< std::endl);
-			return;
+		try {
+			processDatagram(m_datagrams[i], packet_queued);
+		}
+		catch (InvalidIncomingDataException &e) {
 		}
+	}
 
-		session_t peer_id = readPeerId(*packetdata);
-		u8 channelnum = readChannel(*packetdata);
+	for (size_t i = 0; i < m_process_queues.size(); i++) {
+		if (!m_process_queues[i].empty())
+			m_process_threads[i]->push(m_process_queues[i]);
+	}
+}
 
-		if (channelnum >= CHANNEL_COUNT) {
-			LOG(derr_con << m_connection->getDesc()
-				<< "Receive(): Invalid channel " << (int)channelnum << std::endl);
-			return;
+void ConnectionReceiveThread::processBufferedPackets()
+{
+	session_t peer_id;
+	SharedBuffer<u8> resultdata;
+	try {
+		while (true) {
+			try {
+				if (!getFromBuffers(peer_id, resultdata))
+					break;
+
+				m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
+			}
+			catch (ProcessedSilentlyException &e) {
+				/* try reading again */
+			}
 		}
+	}
+	catch (InvalidIncomingDataException &e) {
+	}
+}
 
-		const bool knew_peer_id = peer_id != PEER_ID_INEXISTENT;
-
-		if (!m_connection->ConnectedToServer()) {
-			// Try to identify peer by sender address
-			if (peer_id == PEER_ID_INEXISTENT) {
-				peer_id = m_connection->lookupPeer(sender);
-				if (peer_id != PEER_ID_INEXISTENT) {
-					/* During join it can happen that the CONTROLTYPE_SET_PEER_ID
-					 * packet is lost. Since resends are not active at this stage
-					 * we need to remind the peer manually. */
-					m_connection->doResendOne(peer_id);
-				}
+void ConnectionReceiveThread::processDatagram(const UDPSocket::Datagram &datagram,
+	bool &packet_queued)
+{
+	const u8 *packetdata = datagram.data;
+	const s32 received_size = datagram.size;
+	const Address &sender = datagram.address;
+
+	if ((received_size < BASE_HEADER_SIZE) ||
+			(readU32(&packetdata[0]) != m_connection->GetProtocolID())) {
+		LOG(derr_con << m_connection->getDesc()
+			<< "Receive(): Invalid incoming packet, "
+			<< "size: " << received_size
+			<< ", protocol: "
+			<< ((received_size >= 4) ? readU32(&packetdata[0]) : -1)
+			<< std::endl);
+		return;
+	}
+
+	session_t peer_id = readPeerId(packetdata);
+	u8 channelnum = readChannel(packetdata);
+
+	if (channelnum >= CHANNEL_COUNT) {
+		LOG(derr_con << m_connection->getDesc()
+			<< "Receive(): Invalid channel " << (int)channelnum << std::endl);
+		return;
+	}
+
+	const bool knew_peer_id = peer_id != PEER_ID_INEXISTENT;
+	const bool connected_to_server = m_connection->ConnectedToServer();
+
+	if (!connected_to_server) {
+		// Try to identify peer by sender address
+		if (peer_id == PEER_ID_INEXISTENT) {
+			peer_id = m_connection->lookupPeer(sender);
+			if (peer_id != PEER_ID_INEXISTENT) {
+				/* During join it can happen that the CONTROLTYPE_SET_PEER_ID
+				 * packet is lost. Since resends are not active at this stage
+				 * we need to remind the peer manually. */
+				m_connection->doResendOne(peer_id);
 			}
+		}
 
-			// Someone new is trying to talk to us. Add them.
-			if (peer_id == PEER_ID_INEXISTENT) {
-				auto &l = m_new_peer_ratelimit;
-				l.tick();
-				if (++l.counter > MAX_NEW_PEERS_PER_SEC) {
-					if (!l.logged) {
-						warningstream << m_connection->getDesc()
-							<< "Receive(): More than " << MAX_NEW_PEERS_PER_SEC
-							<< " new clients within 1s. Throttling." << std::endl;
-					}
-					l.logged = true;
-					// We simply drop the packet, the client can try again.
-				} else {
-					peer_id = m_connection->createPeer(sender, 0);
+		// Someone new is trying to talk to us. Add them.
+		if (peer_id == PEER_ID_INEXISTENT) {
+			auto &l = m_new_peer_ratelimit;
+			l.tick();
+			if (++l.counter > MAX_NEW_PEERS_PER_SEC) {
+				if (!l.logged) {
+					warningstream << m_connection->getDesc()
+						<< "Receive(): More than " << MAX_NEW_PEERS_PER_SEC
+						<< " new clients within 1s. Throttling." << std::endl;
 				}
+				l.logged = true;
+				// We simply drop the packet, the client can try again.
+			} else {
+				peer_id = m_connection->createPeer(sender, 0);
 			}
 		}
+	}
 
-		PeerHelper peer = m_connection->getPeerNoEx(peer_id);
-		if (!peer) {
-			LOG(dout_con << m_connection->getDesc()
-				<< " got packet from unknown peer_id: "
-				<< peer_id << " Ignoring." << std::endl);
-			return;
-		}
+	PeerHelper peer = m_connection->getPeerNoEx(peer_id);
+	if (!peer) {
+		LOG(dout_con << m_connection->getDesc()
+			<< " got packet from unknown peer_id: "
+			<< peer_id << " Ignoring." << std::endl);
+		return;
+	}
 
-		// Validate peer address
+	// Validate peer address
 
-		if (sender != peer->getAddress()) {
-			LOG(derr_con << m_connection->getDesc()
-				<< " Peer " << peer_id << " sending from different address."
-				" Ignoring." << std::endl);
-			return;
-		}
+	if (sender != peer->getAddress()) {
+		LOG(derr_con << m_connection->getDesc()
+			<< " Peer " << peer_id << " sending from different address."
+			" Ignoring." << std::endl);
+		return;
+	}
 
-		if (knew_peer_id) {
-			peer->SetFullyOpen();
-			// Setup phase has a fixed timeout
-			peer->ResetTimeout();
-		} else if (!peer->isHalfOpen()) {
-			// If the peer talks to us without a peer ID when it has done so
-			// before something is definitely fishy.
-			LOG(derr_con << m_connection->getDesc()
-				<< " Peer " << peer_id << " sending without peer id?!"
-				" Ignoring." << std::endl);
-			return;
-		}
+	if (knew_peer_id) {
+		peer->SetFullyOpen();
+		// Setup phase has a fixed timeout
+		peer->ResetTimeout();
+	} else if (!peer->isHalfOpen()) {
+		// If the peer talks to us without a peer ID when it has done so
+		// before something is definitely fishy.
+		LOG(derr_con << m_connection->getDesc()
+			<< " Peer " << peer_id << " sending without peer id?!"
+			" Ignoring." << std::endl);
+		return;
+	}
 
-		auto *udpPeer = dynamic_cast<UDPPeer *>(&peer);
-		if (!udpPeer) {
-			LOG(derr_con << m_connection->getDesc()
-				<< "Receive(): peer_id=" << peer_id << " isn't an UDPPeer?!"
-				" Ignoring." << std::endl);
-			return;
-		}
-		Channel *channel = &udpPeer->channels[channelnum];
+	auto *udpPeer = dynamic_cast<UDPPeer *>(&peer);
+	if (!udpPeer) {
+		LOG(derr_con << m_connection->getDesc()
+			<< "Receive(): peer_id=" << peer_id << " isn't an UDPPeer?!"
+			" Ignoring." << std::endl);
+		return;
+	}
+	Channel *channel = &udpPeer->channels[channelnum];
 
-		channel->UpdateBytesReceived(received_size);
+	channel->UpdateBytesReceived(received_size);
 
-		// Throw the received packet to channel->processPacket()
+	// Throw the received packet to channel->processPacket()
 
-		// Make a new SharedBuffer from the data without the base headers
-		SharedBuffer<u8> strippeddata(received_size - BASE_HEADER_SIZE);
-		memcpy(*strippeddata, &packetdata[BASE_HEADER_SIZE],
-			strippeddata.getSize());
+	// Make a new SharedBuffer from the data without the base headers
+	SharedBuffer<u8> strippeddata(received_size - BASE_HEADER_SIZE);
+	memcpy(*strippeddata, &packetdata[BASE_HEADER_SIZE],
+		strippeddata.getSize());
 
-		try {
-			// Process it (the result is some data with no headers made by us)
-			SharedBuffer<u8> resultdata = processPacket
-				(channel, strippeddata, peer_id, channelnum, false);
+	// A server spreads the work for its peers over the process threads
+	if (m_num_process_threads > 0 && !connected_to_server) {
+		if (m_process_threads.empty())
+			startProcessThreads();
+		m_process_queues[peer_id % m_process_threads.size()].push_back(
+			{peer_id, channelnum, strippeddata});
+		return;
+	}
 
-			LOG(dout_con << m_connection->getDesc()
-				<< " ProcessPacket from peer_id: " << peer_id
-				<< ", channel: " << (u32)channelnum << ", returned "
-				<< resultdata.getSize() << " bytes" << std::endl);
+	/* Every time we receive a packet it can happen that a previously
+	 * buffered packet is now ready to process. */
+	packet_queued = true;
 
-			m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
-		}
-		catch (ProcessedSilentlyException &e) {
+	deliverPacket(channel, strippeddata, peer_id, channelnum);
+}
+
+void ConnectionReceiveThread::deliverPacket(Channel *channel,
+	const SharedBuffer<u8> &packetdata, session_t peer_id, u8 channelnum)
+{
+	try {
+		// Process it (the result is some data with no headers made by us)
+		SharedBuffer<u8> resultdata = processPacket
+			(channel, packetdata, peer_id, channelnum, false);
+
+		LOG(dout_con << m_connection->getDesc()
+			<< " ProcessPacket from peer_id: " << peer_id
+			<< ", channel: " << (u32)channelnum << ", returned "
+			<< resultdata.getSize() << " bytes" << std::endl);
+
+		m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
+	}
+	catch (ProcessedSilentlyException &e) {
+	}
+	catch (ProcessedQueued &e) {
+		// the buffers are checked after every packet anyway
+	}
+}
+
+void ConnectionReceiveThread::processPeerPacket(const ReceivedPacket &packet)
+{
+	PeerHelper peer = m_connection->getPeerNoEx(packet.peer_id);
+	if (!peer)
+		return;
+	auto *udpPeer = dynamic_cast<UDPPeer *>(&peer);
+	if (!udpPeer)
+		return;
+
+	try {
+		deliverPacket(&udpPeer->channels[packet.channelnum], packet.data,
+			packet.peer_id, packet.channelnum);
+
+		// Only the buffers of this peer can have become ready
+		session_t peer_id;
+		SharedBuffer<u8> resultdata;
+		for (Channel &channel : udpPeer->channels) {
+			while (true) {
+				try {
+					if (!checkIncomingBuffers(&channel, peer_id, resultdata))
+						break;
+
+					m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
+				}
+				catch (ProcessedSilentlyException &e) {
+					/* try reading again */
+				}
+			}
 		}
-		catch (ProcessedQueued &e) {
-			// we set it to true anyway (see below)
+	}
+	catch (InvalidIncomingDataException &e) {
+	}
+}
+
+ConnectionProcessThread::ConnectionProcessThread(ConnectionReceiveThread *receiver) :
+	Thread("ConnectionProcess"),
+	m_receiver(receiver)
+{
+}
+
+void *ConnectionProcessThread::run()
+{
+	std::vector<ReceivedPacket> packets;
+	while (!stopRequested()) {
+		BEGIN_DEBUG_EXCEPTION_HANDLER
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			// wake up now and then to notice a stop request
+			m_cv.wait_for(lock, std::chrono::milliseconds(100),
+				[this] { return !m_queue.empty(); });
+			packets.swap(m_queue);
 		}
 
-		/* Every time we receive a packet it can happen that a previously
-		 * buffered packet is now ready to process. */
-		packet_queued = true;
+		for (const ReceivedPacket &packet : packets)
+			m_receiver->processPeerPacket(packet);
+		packets.clear();
+
+		END_DEBUG_EXCEPTION_HANDLER
 	}
-	catch (InvalidIncomingDataException &e) {
+	return nullptr;
+}
+
+void ConnectionProcessThread::push(std::vector<ReceivedPacket> &packets)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_queue.empty()) {
+			m_queue.swap(packets);
+		} else {
+			for (ReceivedPacket &packet : packets)
+				m_queue.push_back(std::move(packet));
+		}
 	}
+	packets.clear();
+	m_cv.notify_one();
 }
 
 bool ConnectionReceiveThread::getFromBuffers(session_t &peer_id, SharedBuffer<u8> &dst)
@@ -10,8 +10,13 @@
 /********************************************/
 
 #include <cassert>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include "threading/thread.h"
 #include "network/mtp/internal.h"
+#include "network/socket.h"
 
 namespace con
 {
@@ -59,8 +64,12 @@ class ConnectionSendThread : public Thread
 
 private:
 	void runTimeouts(float dtime, u32 peer_packet_quota);
-	void resendReliable(Channel &channel, const BufferedPacket *k, float resend_timeout);
-	void rawSend(const BufferedPacket *p);
+	void resendReliable(Channel &channel, const ConstSharedPtr<BufferedPacket> &k,
+			float resend_timeout);
+	// Queues the packet for the next flushSendBatch()
+	void rawSend(const ConstSharedPtr<BufferedPacket> &p);
+	// Hands all packets given to rawSend() to the socket
+	void flushSendBatch();
 	bool rawSendAsPacket(session_t peer_id, u8 channelnum,
 			const SharedBuffer<u8> &data, bool reliable);
 
@@ -71,9 +80,9 @@ class ConnectionSendThread : public Thread
 	void disconnect();
 	void disconnect_peer(session_t peer_id);
 	void fix_peer_id(session_t own_peer_id);
-	void send(session_t peer_id, u8 channelnum, const SharedBuffer<u8> &data);
+	void send(session_t peer_id, u8 channelnum, const PacketData &data);
 	void sendReliable(ConnectionCommandPtr &c);
-	void sendToAll(u8 channelnum, const SharedBuffer<u8> &data);
+	void sendToAll(u8 channelnum, const PacketData &data);
 	void sendToAllReliable(ConnectionCommandPtr &c);
 
 	void sendPackets(float dtime, u32 peer_packet_quota);
@@ -94,11 +103,49 @@ class ConnectionSendThread : public Thread
 	unsigned int m_iteration_packets_avaialble;
 	unsigned int m_max_data_packets_per_iteration;
 	unsigned int m_max_packets_requeued = 256;
+
+	std::vector<ConstSharedPtr<BufferedPacket>> m_send_batch;
+	std::vector<UDPSocket::Datagram> m_send_datagrams;
+};
+
+class ConnectionReceiveThread;
+
+// A received packet without the base headers, waiting to be processed
+struct ReceivedPacket
+{
+	session_t peer_id;
+	u8 channelnum;
+	SharedBuffer<u8> data;
+};
+
+/*
+	Processes the received packets of a share of the peers for the
+	ConnectionReceiveThread. The packets of one peer always go to the same
+	thread, so they stay in order.
+*/
+class ConnectionProcessThread : public Thread
+{
+public:
+	ConnectionProcessThread(ConnectionReceiveThread *receiver);
+
+	void *run();
+
+	// Queues the packets and clears the vector
+	void push(std::vector<ReceivedPacket> &packets);
+
+private:
+	ConnectionReceiveThread *m_receiver;
+
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::vector<ReceivedPacket> m_queue;
 };
 
 class ConnectionReceiveThread : public Thread
 {
 public:
+	friend class ConnectionProcessThread;
+
 	ConnectionReceiveThread();
 
 	void *run();
@@ -110,7 +157,18 @@ class ConnectionReceiveThread : public Thread
 	}
 
 private:
-	void receive(SharedBuffer<u8> &packetdata, bool &packet_queued);
+	void receive(bool &packet_queued);
+	void processBufferedPackets();
+	void processDatagram(const UDPSocket::Datagram &datagram, bool &packet_queued);
+	// Processes a packet and passes the result to the user
+	void deliverPacket(Channel *channel, const SharedBuffer<u8> &packetdata,
+			session_t peer_id, u8 channelnum);
+
+	// Processes a packet of a peer and then the packets of the peer that
+	// were buffered and are ready now. Used by the ConnectionProcessThreads.
+	void processPeerPacket(const ReceivedPacket &packet);
+	void startProcessThreads();
+	void stopProcessThreads();
 
 	// Returns next data from a buffer if possible
 	// If found, returns true; if not, false.
@@ -172,5 +230,15 @@ class ConnectionReceiveThread : public Thread
 	Connection *m_connection = nullptr;
 
 	RateLimitHelper m_new_peer_ratelimit;
+
+	// Memory for one batch of received datagrams, reused for every batch
+	std::unique_ptr<u8[]> m_datagram_buffers;
+	UDPSocket::Datagram m_datagrams[UDPSocket::MAX_BATCH];
+
+	// Peers are distributed over these threads by their ID, if there are any
+	u16 m_num_process_threads;
+	std::vector<std::unique_ptr<ConnectionProcessThread>> m_process_threads;
+	// Packets for each process thread, handed over once per batch
+	std::vector<std::vector<ReceivedPacket>> m_process_queues;
 };
 }
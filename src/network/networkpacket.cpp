@@ -39,6 +39,7 @@ void NetworkPacket::putRawPacket(const u8 *data, u32 datasize, session_t peer_id
 void NetworkPacket::clear()
 {
 	m_data.clear();
+	m_payload.reset();
 	m_datasize = 0;
 	m_read_offset = 0;
 	m_command = 0;
@@ -69,6 +70,12 @@ void NetworkPacket::putRawString(const char* src, u32 len)
 	m_read_offset += len;
 }
 
+void NetworkPacket::putSharedRawString(std::shared_ptr<const std::string> src)
+{
+	assert(!m_payload);
+	m_payload = std::move(src);
+}
+
 void NetworkPacket::readRawString(char *dst, u32 len)
 {
 	checkReadOffset(m_read_offset, len);
@@ -509,7 +516,7 @@ NetworkPacket& NetworkPacket::operator<<(video::SColor src)
 	return *this;
 }
 
-Buffer<u8> NetworkPacket::oldForgePacket()
+Buffer<u8> NetworkPacket::forgeHead() const
 {
 	// this is the dummy packet used to first contact the server
 	if (m_command == 0) {
@@ -8,6 +8,8 @@
 #include "irrlichttypes_bloated.h"
 #include "networkprotocol.h"
 #include <SColor.h>
+#include <cassert>
+#include <memory>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -33,7 +35,7 @@ class NetworkPacket
 	void clear();
 
 	// Getters
-	u32 getSize() const { return m_datasize; }
+	u32 getSize() const { return m_datasize + (m_payload ? m_payload->size() : 0); }
 	session_t getPeerId() const { return m_peer_id; }
 	u16 getCommand() const { return m_command; }
 
@@ -58,6 +60,10 @@ class NetworkPacket
 		putRawString(src.data(), src.size());
 	}
 
+	// Appends bytes that are referenced instead of copied, so that they can
+	// be sent to many peers. Nothing can be written or read after them.
+	void putSharedRawString(std::shared_ptr<const std::string> src);
+
 	// Reads bytes from packet into string buffer
 	void readRawString(char *dst, u32 len);
 	std::string readRawString(u32 len)
@@ -123,9 +129,12 @@ class NetworkPacket
 	NetworkPacket &operator>>(video::SColor &dst);
 	NetworkPacket &operator<<(video::SColor src);
 
-	// Temp, we remove SharedBuffer when migration finished
-	// ^ this comment has been here for 7 years
-	Buffer<u8> oldForgePacket();
+	// Command and data for sending, without the shared bytes
+	Buffer<u8> forgeHead() const;
+	const std::shared_ptr<const std::string> &getSharedPayload() const
+	{
+		return m_payload;
+	}
 
 private:
 	void checkReadOffset(u32 from_offset, u32 field_size) const;
@@ -133,6 +142,7 @@ class NetworkPacket
 	// resize data buffer for writing
 	inline void checkDataSize(u32 field_size)
 	{
+		assert(!m_payload);
 		if (m_read_offset + field_size > m_datasize) {
 			m_datasize = m_read_offset + field_size;
 			m_data.resize(m_datasize);
@@ -140,6 +150,8 @@ class NetworkPacket
 	}
 
 	std::vector<u8> m_data;
+	// Sent after m_data, see putSharedRawString()
+	std::shared_ptr<const std::string> m_payload;
 	u32 m_datasize = 0;
 	u32 m_read_offset = 0; // read and write offset
 	u16 m_command = 0;
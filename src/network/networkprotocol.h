@@ -26,6 +26,14 @@ extern const u16 FORMSPEC_API_VERSION;
 
 typedef u16 session_t;
 
+enum NetProtoCompressionMode : u16
+{
+	NETPROTO_COMPRESSION_NONE = 0,
+	// Map blocks may be compressed with a zstd dictionary that is sent
+	// in TOCLIENT_AUTH_ACCEPT (needs serialization version >= 29)
+	NETPROTO_COMPRESSION_MAP_DICTIONARY = 1 << 0,
+};
+
 enum ToClientCommand : u16
 {
 	TOCLIENT_HELLO = 0x02,
@@ -33,7 +41,7 @@ enum ToClientCommand : u16
 		Sent after TOSERVER_INIT.
 
 		u8 deployed serialization version
-		u16 unused (network compression, never implemeneted)
+		u16 deployed compression modes (NetProtoCompressionMode)
 		u16 deployed protocol version
 		u32 supported auth methods
 		std::string unused (used to be username)
@@ -48,6 +56,9 @@ enum ToClientCommand : u16
 		f1000 recommended send interval
 		u32 : supported auth methods for sudo mode
 		      (where the user can change their password)
+		if compression modes in TOCLIENT_HELLO & NETPROTO_COMPRESSION_MAP_DICTIONARY:
+			u32 len
+			u8[len] zstd dictionary of the map blocks
 	*/
 
 	TOCLIENT_ACCEPT_SUDO_MODE = 0x04,
@@ -711,7 +722,7 @@ enum ToServerCommand : u16
 		Sent first after connected.
 
 		u8 serialization version (=SER_FMT_VER_HIGHEST_READ)
-		u16 unused (supported network compression modes, never implemeneted)
+		u16 supported compression modes (NetProtoCompressionMode)
 		u16 minimum supported network protocol version
 		u16 maximum supported network protocol version
 		std::string player name
@@ -16,6 +16,7 @@
 #include "rollback_interface.h"
 #include "scripting_server.h"
 #include "serialization.h"
+#include "servermap.h"
 #include "settings.h"
 #include "tool.h"
 #include "network/connection.h"
@@ -77,12 +78,12 @@ void Server::handleCommand_Init(NetworkPacket* pkt)
 		return;
 
 	u8 max_ser_ver; // SER_FMT_VER_HIGHEST_READ (of client)
-	u16 unused;
+	u16 compression_modes;
 	u16 min_net_proto_version;
 	u16 max_net_proto_version;
 	std::string playerName;
 
-	*pkt >> max_ser_ver >> unused
+	*pkt >> max_ser_ver >> compression_modes
 			>> min_net_proto_version >> max_net_proto_version
 			>> playerName;
 
@@ -253,9 +254,16 @@ void Server::handleCommand_Init(NetworkPacket* pkt)
 	verbosestream << "Sending TOCLIENT_HELLO with auth method field: "
 		<< auth_mechs << std::endl;
 
+	// Only blocks in the whole-block zstd format can use the dictionary
+	const ZstdDictionary *map_dictionary = m_env->getServerMap().getNetDictionary();
+	client->map_dictionary = map_dictionary && serialization_ver >= 29 &&
+		(compression_modes & NETPROTO_COMPRESSION_MAP_DICTIONARY);
+
 	NetworkPacket resp_pkt(TOCLIENT_HELLO, 0, peer_id);
 
-	resp_pkt << serialization_ver << u16(0) /* unused */
+	resp_pkt << serialization_ver
+		<< u16(client->map_dictionary ? NETPROTO_COMPRESSION_MAP_DICTIONARY :
+			NETPROTO_COMPRESSION_NONE)
 		<< net_proto_version
 		<< auth_mechs << std::string_view() /* unused */;
 
@@ -1037,7 +1045,8 @@ void Server::handleCommand_Interact(NetworkPacket *pkt)
 				infostream << "Server: Not punching: Node not found. "
 					"Adding block to emerge queue." << std::endl;
 				m_emerge->enqueueBlockEmerge(peer_id,
-					getNodeBlockPos(pointed.node_abovesurface), false);
+					getNodeBlockPos(pointed.node_abovesurface), false, false,
+					EMERGE_PRIORITY_INTERACT);
 			}
 
 			if (n.getContent() != CONTENT_IGNORE)
@@ -1090,7 +1099,8 @@ void Server::handleCommand_Interact(NetworkPacket *pkt)
 			infostream << "Server: Not finishing digging: Node not found. "
 				"Adding block to emerge queue." << std::endl;
 			m_emerge->enqueueBlockEmerge(peer_id,
-				getNodeBlockPos(pointed.node_abovesurface), false);
+				getNodeBlockPos(pointed.node_abovesurface), false, false,
+				EMERGE_PRIORITY_INTERACT);
 		}
 
 		/* Cheat prevention */
@@ -4,6 +4,7 @@
 
 #include "socket.h"
 
+#include <algorithm>
 #include <iostream>
 #include <cstring>
 #include "util/numeric.h"
@@ -33,8 +34,60 @@ typedef int socklen_t;
 #define SOCKET_ERR_STR(e) strerror(e)
 #endif
 
+// recvmmsg() and sendmmsg() transfer several datagrams in one system call
+#ifdef __linux__
+#define HAVE_MMSG 1
+#else
+#define HAVE_MMSG 0
+#endif
+
 static bool g_sockets_initialized = false;
 
+namespace {
+
+union SocketAddress {
+	struct sockaddr_in v4;
+	struct sockaddr_in6 v6;
+};
+
+socklen_t toSocketAddress(const Address &address, SocketAddress &out)
+{
+	memset(&out, 0, sizeof(out));
+	if (address.isIPv6()) {
+		out.v6.sin6_family = AF_INET6;
+		out.v6.sin6_addr = address.getAddress6();
+		out.v6.sin6_port = htons(address.getPort());
+		return sizeof(out.v6);
+	}
+	out.v4.sin_family = AF_INET;
+	out.v4.sin_addr = address.getAddress();
+	out.v4.sin_port = htons(address.getPort());
+	return sizeof(out.v4);
+}
+
+Address fromSocketAddress(const SocketAddress &in, unsigned short family)
+{
+	if (family == AF_INET6) {
+		const auto *bytes = reinterpret_cast<const IPv6AddressBytes*>
+			(in.v6.sin6_addr.s6_addr);
+		return Address(bytes, ntohs(in.v6.sin6_port));
+	}
+	return Address(ntohl(in.v4.sin_addr.s_addr), ntohs(in.v4.sin_port));
+}
+
+bool simulatePacketLoss()
+{
+	if (INTERNET_SIMULATOR && myrand() % INTERNET_SIMULATOR_PACKET_LOSS == 0) {
+		// Lol let's forget it
+		tracestream << "UDPSocket: INTERNET_SIMULATOR: dumping packet."
+			<< std::endl;
+		return true;
+	}
+	return false;
+}
+
+}
+
 // Initialize sockets
 void sockets_init()
 {
@@ -165,39 +218,16 @@ void UDPSocket::Bind(Address addr)
 
 void UDPSocket::Send(const Address &destination, const void *data, int size)
 {
-	bool dumping_packet = false; // for INTERNET_SIMULATOR
-
-	if (INTERNET_SIMULATOR)
-		dumping_packet = myrand() % INTERNET_SIMULATOR_PACKET_LOSS == 0;
-
-	if (dumping_packet) {
-		// Lol let's forget it
-		tracestream << "UDPSocket::Send(): INTERNET_SIMULATOR: dumping packet."
-			<< std::endl;
+	if (simulatePacketLoss())
 		return;
-	}
 
 	if (destination.getFamily() != m_addr_family)
 		throw SendFailedException("Address family mismatch");
 
-	int sent;
-	if (m_addr_family == AF_INET6) {
-		struct sockaddr_in6 address = {};
-		address.sin6_family = AF_INET6;
-		address.sin6_addr = destination.getAddress6();
-		address.sin6_port = htons(destination.getPort());
-
-		sent = sendto(m_handle, (const char *)data, size, 0,
-				(struct sockaddr *)&address, sizeof(struct sockaddr_in6));
-	} else {
-		struct sockaddr_in address = {};
-		address.sin_family = AF_INET;
-		address.sin_addr = destination.getAddress();
-		address.sin_port = htons(destination.getPort());
-
-		sent = sendto(m_handle, (const char *)data, size, 0,
-				(struct sockaddr *)&address, sizeof(struct sockaddr_in));
-	}
+	SocketAddress address;
+	socklen_t address_len = toSocketAddress(destination, address);
+	int sent = sendto(m_handle, (const char *)data, size, 0,
+			(struct sockaddr *)&address, address_len);
 
 	if (sent != size)
 		throw SendFailedException("Failed to send packet");
@@ -210,45 +240,159 @@ int UDPSocket::Receive(Address &sender, void *data, int size)
 	if (!WaitData(m_timeout_ms))
 		return -1;
 
-	size = MYMAX(size, 0);
+	return receiveReady(sender, data, size);
+}
 
-	int received;
-	if (m_addr_family == AF_INET6) {
-		struct sockaddr_in6 address;
-		memset(&address, 0, sizeof(address));
-		socklen_t address_len = sizeof(address);
+int UDPSocket::receiveReady(Address &sender, void *data, int size)
+{
+	size = MYMAX(size, 0);
 
-		received = recvfrom(m_handle, (char *)data, size, 0,
-				(struct sockaddr *)&address, &address_len);
+	SocketAddress address;
+	socklen_t address_len = sizeof(address);
+	memset(&address, 0, sizeof(address));
 
-		if (received < 0)
-			return -1;
+	int received = recvfrom(m_handle, (char *)data, size, 0,
+			(struct sockaddr *)&address, &address_len);
 
-		u16 address_port = ntohs(address.sin6_port);
-		const auto *bytes = reinterpret_cast<IPv6AddressBytes*>
-			(address.sin6_addr.s6_addr);
-		sender = Address(bytes, address_port);
-	} else {
-		struct sockaddr_in address;
-		memset(&address, 0, sizeof(address));
+	if (received < 0)
+		return -1;
 
-		socklen_t address_len = sizeof(address);
+	sender = fromSocketAddress(address, m_addr_family);
+	return received;
+}
 
-		received = recvfrom(m_handle, (char *)data, size, 0,
-				(struct sockaddr *)&address, &address_len);
+#if HAVE_MMSG
 
-		if (received < 0)
-			return -1;
+int UDPSocket::SendBatch(Datagram *datagrams, int count)
+{
+	int sent = 0;
+	struct mmsghdr msgs[MAX_BATCH];
+	struct iovec iovs[MAX_BATCH];
+	SocketAddress addresses[MAX_BATCH];
+	// Index of the datagram of each message
+	int indices[MAX_BATCH];
+
+	for (int base = 0; base < count; base += MAX_BATCH) {
+		const int end = std::min(count, base + MAX_BATCH);
+		int n = 0;
+		for (int i = base; i < end; i++) {
+			Datagram &datagram = datagrams[i];
+			datagram.error = nullptr;
+			if (simulatePacketLoss()) {
+				sent++;
+				continue;
+			}
+			if (datagram.address.getFamily() != m_addr_family) {
+				datagram.error = "Address family mismatch";
+				continue;
+			}
+
+			iovs[n].iov_base = datagram.data;
+			iovs[n].iov_len = MYMAX(datagram.size, 0);
+			memset(&msgs[n], 0, sizeof(msgs[n]));
+			msgs[n].msg_hdr.msg_name = &addresses[n];
+			msgs[n].msg_hdr.msg_namelen = toSocketAddress(datagram.address, addresses[n]);
+			msgs[n].msg_hdr.msg_iov = &iovs[n];
+			msgs[n].msg_hdr.msg_iovlen = 1;
+			indices[n] = i;
+			n++;
+		}
 
-		u32 address_ip = ntohl(address.sin_addr.s_addr);
-		u16 address_port = ntohs(address.sin_port);
+		int done = 0;
+		while (done < n) {
+			int result = sendmmsg(m_handle, &msgs[done], n - done, 0);
+			if (result <= 0) {
+				if (result < 0 && LAST_SOCKET_ERR() == EINTR)
+					continue;
+				tracestream << (int)m_handle << ": sendmmsg failed: "
+					<< SOCKET_ERR_STR(LAST_SOCKET_ERR()) << std::endl;
+				// Skip the datagram that could not be sent
+				datagrams[indices[done]].error = "Failed to send packet";
+				done++;
+				continue;
+			}
+			for (int i = done; i < done + result; i++) {
+				if (msgs[i].msg_len == iovs[i].iov_len)
+					sent++;
+				else
+					datagrams[indices[i]].error = "Failed to send packet";
+			}
+			done += result;
+		}
+	}
+	return sent;
+}
 
-		sender = Address(address_ip, address_port);
+int UDPSocket::ReceiveBatch(Datagram *datagrams, int count)
+{
+	assert(m_timeout_ms >= 0);
+	if (count <= 0 || !WaitData(m_timeout_ms))
+		return 0;
+
+	count = std::min(count, MAX_BATCH);
+	struct mmsghdr msgs[MAX_BATCH];
+	struct iovec iovs[MAX_BATCH];
+	SocketAddress addresses[MAX_BATCH];
+	for (int i = 0; i < count; i++) {
+		iovs[i].iov_base = datagrams[i].data;
+		iovs[i].iov_len = MYMAX(datagrams[i].size, 0);
+		memset(&msgs[i], 0, sizeof(msgs[i]));
+		msgs[i].msg_hdr.msg_name = &addresses[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
 	}
 
+	// The first datagram is known to be there, only take what is ready
+	int received = recvmmsg(m_handle, msgs, count, MSG_DONTWAIT, nullptr);
+	if (received <= 0)
+		return 0;
+
+	for (int i = 0; i < received; i++) {
+		datagrams[i].address = fromSocketAddress(addresses[i], m_addr_family);
+		datagrams[i].size = msgs[i].msg_len;
+	}
 	return received;
 }
 
+#else
+
+int UDPSocket::SendBatch(Datagram *datagrams, int count)
+{
+	int sent = 0;
+	for (int i = 0; i < count; i++) {
+		Datagram &datagram = datagrams[i];
+		datagram.error = nullptr;
+		if (datagram.address.getFamily() != m_addr_family) {
+			datagram.error = "Address family mismatch";
+			continue;
+		}
+		try {
+			Send(datagram.address, datagram.data, datagram.size);
+			sent++;
+		} catch (SendFailedException &e) {
+			datagram.error = "Failed to send packet";
+		}
+	}
+	return sent;
+}
+
+int UDPSocket::ReceiveBatch(Datagram *datagrams, int count)
+{
+	assert(m_timeout_ms >= 0);
+	if (count <= 0 || !WaitData(m_timeout_ms))
+		return 0;
+
+	int received = receiveReady(datagrams[0].address, datagrams[0].data,
+		datagrams[0].size);
+	if (received < 0)
+		return 0;
+	datagrams[0].size = received;
+	return 1;
+}
+
+#endif
+
 void UDPSocket::setTimeoutMs(int timeout_ms)
 {
 	m_timeout_ms = timeout_ms;
@@ -5,8 +5,7 @@
 #pragma once
 
 #include "irrlichttypes.h"
-
-class Address;
+#include "address.h"
 
 void sockets_init();
 void sockets_cleanup();
@@ -14,6 +13,19 @@ void sockets_cleanup();
 class UDPSocket
 {
 public:
+	/// Maximum number of datagrams passed to the OS at once by the batch functions
+	static constexpr int MAX_BATCH = 32;
+
+	struct Datagram
+	{
+		Address address;
+		u8 *data = nullptr;
+		// Size of the data, or of the buffer for ReceiveBatch()
+		int size = 0;
+		// Set by SendBatch() if the datagram could not be sent
+		const char *error = nullptr;
+	};
+
 	UDPSocket() = default;
 	UDPSocket(bool ipv6); // calls init()
 	~UDPSocket();
@@ -24,6 +36,15 @@ class UDPSocket
 	void Send(const Address &destination, const void *data, int size);
 	// Returns -1 if there is no data
 	int Receive(Address &sender, void *data, int size);
+
+	// Sends several datagrams, with a single system call where supported.
+	// Returns the number of datagrams sent. Failures are skipped, and the
+	// reason is stored in the error field of the datagram.
+	int SendBatch(Datagram *datagrams, int count);
+	// Waits for data like Receive(), then receives up to count datagrams
+	// that are ready, with a single system call where supported.
+	// The sizes are set to the received sizes. Returns 0 if there is no data.
+	int ReceiveBatch(Datagram *datagrams, int count);
 	void setTimeoutMs(int timeout_ms);
 	// Returns true if there is data, false if timeout occurred
 	bool WaitData(int timeout_ms);
@@ -32,6 +53,9 @@ class UDPSocket
 	int GetHandle() const { return m_handle; };
 
 private:
+	// Receives one datagram without waiting, returns -1 if there is none
+	int receiveReady(Address &sender, void *data, int size);
+
 	int m_handle = -1;
 	int m_timeout_ms = -1;
 	unsigned short m_addr_family = 0;
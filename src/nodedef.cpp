@@ -671,6 +671,7 @@ void NodeDefManager::clear()
 	m_name_id_mapping_with_aliases.clear();
 	m_group_to_items.clear();
 	m_next_id = 0;
+	m_change_counter++;
 	m_selection_box_union.reset(0,0,0);
 	m_selection_box_int_union.reset(0,0,0);
 #if CHECK_CLIENT_BUILD()
@@ -986,6 +987,7 @@ content_t NodeDefManager::set(const std::string &name, const ContentFeatures &de
 
 	// Clear old groups in case of re-registration
 	eraseIdFromGroups(id);
+	m_change_counter++;
 
 	m_content_features[id] = def;
 	m_content_features[id].floats = itemgroup_get(def.groups, "float") != 0;
@@ -1027,6 +1029,7 @@ void NodeDefManager::removeNode(const std::string &name)
 		m_name_id_mapping_with_aliases.erase(name);
 
 		eraseIdFromGroups(id);
+		m_change_counter++;
 	}
 }
 
@@ -1036,6 +1039,7 @@ void NodeDefManager::updateAliases(IItemDefManager *idef)
 	std::set<std::string> all;
 	idef->getAll(all);
 	m_name_id_mapping_with_aliases.clear();
+	m_change_counter++;
 	for (const std::string &name : all) {
 		const std::string &convert_to = idef->getAlias(name);
 		content_t id;
@@ -1053,6 +1057,7 @@ void NodeDefManager::applyTextureOverrides(const std::vector<TextureOverride> &o
 
 	infostream << "NodeDefManager::applyTextureOverrides(): Applying "
 		"overrides to textures" << std::endl;
+	m_change_counter++;
 
 	for (const TextureOverride& texture_override : overrides) {
 		content_t id;
@@ -1260,6 +1265,7 @@ void NodeDefManager::resetNodeResolveState()
 
 void NodeDefManager::resolveCrossrefs()
 {
+	m_change_counter++;
 	for (ContentFeatures &f : m_content_features) {
 		if (f.isLiquid() || f.isLiquidRender()) {
 			f.liquid_alternative_flowing_id = getId(f.liquid_alternative_flowing);
@@ -579,6 +579,13 @@ class NodeDefManager {
 	 */
 	bool getIds(const std::string &name, std::vector<content_t> &result) const;
 
+	/*!
+	 * Returns a number that changes whenever getId() or getIds() may
+	 * give different results than before, or a definition changes.
+	 * Lets users cache resolved IDs and serialized definitions.
+	 */
+	u32 getChangeCounter() const { return m_change_counter; }
+
 	/*!
 	 * Returns the smallest box in integer node coordinates that
 	 * contains all nodes' selection boxes. The returned box might be larger
@@ -781,6 +788,9 @@ class NodeDefManager {
 	 */
 	content_t m_next_id;
 
+	//! See getChangeCounter()
+	u32 m_change_counter = 0;
+
 	//! True if all nodes have been registered.
 	bool m_node_registration_complete;
 
@@ -171,23 +171,27 @@ void PcgRandom::setState(const u64 state[2])
 
 ///////////////////////////////////////////////////////////////////////////////
 
-float noise2d(int x, int y, s32 seed)
+// Hash of a lattice point, takes the wrapped sum of the magic products
+static inline float noiseHash(u32 n)
 {
-	unsigned int n = (NOISE_MAGIC_X * x + NOISE_MAGIC_Y * y
-			+ NOISE_MAGIC_SEED * seed) & 0x7fffffff;
+	n &= 0x7fffffff;
 	n = (n >> 13) ^ n;
 	n = (n * (n * n * 60493 + 19990303) + 1376312589) & 0x7fffffff;
 	return 1.f - (float)(int)n / 0x40000000;
 }
 
 
+float noise2d(int x, int y, s32 seed)
+{
+	return noiseHash(NOISE_MAGIC_X * (u32)x + NOISE_MAGIC_Y * (u32)y
+			+ NOISE_MAGIC_SEED * seed);
+}
+
+
 float noise3d(int x, int y, int z, s32 seed)
 {
-	unsigned int n = (NOISE_MAGIC_X * x + NOISE_MAGIC_Y * y + NOISE_MAGIC_Z * z
-			+ NOISE_MAGIC_SEED * seed) & 0x7fffffff;
-	n = (n >> 13) ^ n;
-	n = (n * (n * n * 60493 + 19990303) + 1376312589) & 0x7fffffff;
-	return 1.f - (float)(int)n / 0x40000000;
+	return noiseHash(NOISE_MAGIC_X * (u32)x + NOISE_MAGIC_Y * (u32)y
+			+ NOISE_MAGIC_Z * (u32)z + NOISE_MAGIC_SEED * seed);
 }
 
 
@@ -382,6 +386,8 @@ Noise::~Noise()
 	delete[] persist_buf;
 	delete[] noise_buf;
 	delete[] result;
+	delete[] frac_x_buf;
+	delete[] cell_start_buf;
 }
 
 
@@ -400,12 +406,16 @@ void Noise::allocBuffers()
 	delete[] value_buf;
 	delete[] persist_buf;
 	delete[] result;
+	delete[] frac_x_buf;
+	delete[] cell_start_buf;
 
 	try {
 		size_t bufsize = sx * sy * sz;
 		this->persist_buf = NULL;
 		this->value_buf = new float[bufsize];
 		this->result = new float[bufsize];
+		this->frac_x_buf = new float[sx];
+		this->cell_start_buf = new u32[sx + 2];
 	} catch (std::bad_alloc &e) {
 		throw InvalidNoiseParamsException();
 	}
@@ -481,6 +491,83 @@ void Noise::resizeNoiseBuf(bool is3d)
 }
 
 
+///////////////////////// [ Noise map kernels ] //////////////////////////////
+
+/*
+ * The inner loops of the noise maps work on whole rows of plain arrays, so
+ * that the compiler can vectorize them.
+ * Every output value goes through the same floating point operations in the
+ * same order as in a point by point loop, so the results stay bit for bit
+ * the same and worlds are not changed.
+ */
+
+static inline void latticeRow2D(float *out, u32 count, s32 x0, s32 y, s32 seed)
+{
+	const u32 base = NOISE_MAGIC_Y * (u32)y + NOISE_MAGIC_SEED * seed;
+	for (u32 i = 0; i < count; i++)
+		out[i] = noiseHash(NOISE_MAGIC_X * ((u32)x0 + i) + base);
+}
+
+static inline void latticeRow3D(float *out, u32 count, s32 x0, s32 y, s32 z, s32 seed)
+{
+	const u32 base = NOISE_MAGIC_Y * (u32)y + NOISE_MAGIC_Z * (u32)z
+			+ NOISE_MAGIC_SEED * seed;
+	for (u32 i = 0; i < count; i++)
+		out[i] = noiseHash(NOISE_MAGIC_X * ((u32)x0 + i) + base);
+}
+
+/*
+ * Points [cell_start[c], cell_start[c + 1]) of a row lie between the lattice
+ * points c and c + 1. frac_x holds their (eased) position in the cell.
+ */
+static inline void interpolateRow2D(float *out, const float *frac_x,
+	const u32 *cell_start, u32 num_cells,
+	const float *row0, const float *row1, float fy)
+{
+	for (u32 c = 0; c < num_cells; c++) {
+		const u32 begin = cell_start[c];
+		const u32 end = cell_start[c + 1];
+		if (begin == end)
+			continue;
+		const float v00 = row0[c], d0 = row0[c + 1] - v00;
+		const float v01 = row1[c], d1 = row1[c + 1] - v01;
+		for (u32 i = begin; i < end; i++) {
+			const float u = v00 + d0 * frac_x[i];
+			const float v = v01 + d1 * frac_x[i];
+			out[i] = u + (v - u) * fy;
+		}
+	}
+}
+
+// Rows are named after their y and z offset
+static inline void interpolateRow3D(float *out, const float *frac_x,
+	const u32 *cell_start, u32 num_cells,
+	const float *row00, const float *row10, const float *row01, const float *row11,
+	float fy, float fz)
+{
+	for (u32 c = 0; c < num_cells; c++) {
+		const u32 begin = cell_start[c];
+		const u32 end = cell_start[c + 1];
+		if (begin == end)
+			continue;
+		const float v000 = row00[c], d00 = row00[c + 1] - v000;
+		const float v010 = row10[c], d10 = row10[c + 1] - v010;
+		const float v001 = row01[c], d01 = row01[c + 1] - v001;
+		const float v011 = row11[c], d11 = row11[c + 1] - v011;
+		for (u32 i = begin; i < end; i++) {
+			const float x = frac_x[i];
+			const float u0 = v000 + d00 * x;
+			const float u1 = v010 + d10 * x;
+			const float w0 = v001 + d01 * x;
+			const float w1 = v011 + d11 * x;
+			const float u = u0 + (u1 - u0) * fy;
+			const float w = w0 + (w1 - w0) * fy;
+			out[i] = u + (w - u) * fz;
+		}
+	}
+}
+
+
 /*
  * NB:  This algorithm is not optimal in terms of space complexity.  The entire
  * integer lattice of noise points could be done as 2 lines instead, and for 3D,
@@ -492,57 +579,51 @@ void Noise::resizeNoiseBuf(bool is3d)
  * values from the previous noise lattice as midpoints in the new lattice for the
  * next octave.
  */
-#define idx(x, y) ((y) * nlx + (x))
+u32 Noise::setupRow(float u, float step_x, bool eased)
+{
+	// Steps through the row the same way as a point by point loop would,
+	// so that the fractions are exactly the same
+	u32 cell = 0;
+	cell_start_buf[0] = 0;
+	for (u32 i = 0; i != sx; i++) {
+		frac_x_buf[i] = eased ? easeCurve(u) : u;
+
+		u += step_x;
+		if (u >= 1.0) {
+			u -= 1.0;
+			cell++;
+			cell_start_buf[cell] = i + 1;
+		}
+	}
+	cell_start_buf[cell + 1] = sx;
+	return cell + 1;
+}
+
+
 void Noise::valueMap2D(
 		float x, float y,
 		float step_x, float step_y,
 		s32 seed)
 {
-	float v00, v01, v10, v11, u, v, orig_u;
-	u32 index, i, j, noisex, noisey;
-	u32 nlx, nly;
-	s32 x0, y0;
-
 	bool eased = np.flags & (NOISE_FLAG_DEFAULTS | NOISE_FLAG_EASED);
-	x0 = std::floor(x);
-	y0 = std::floor(y);
-	u = x - (float)x0;
-	v = y - (float)y0;
-	orig_u = u;
+	s32 x0 = std::floor(x);
+	s32 y0 = std::floor(y);
+	float u = x - (float)x0;
+	float v = y - (float)y0;
 
 	//calculate noise point lattice
-	nlx = (u32)(u + sx * step_x) + 2;
-	nly = (u32)(v + sy * step_y) + 2;
-	index = 0;
-	for (j = 0; j != nly; j++)
-		for (i = 0; i != nlx; i++)
-			noise_buf[index++] = noise2d(x0 + i, y0 + j, seed);
+	u32 nlx = (u32)(u + sx * step_x) + 2;
+	u32 nly = (u32)(v + sy * step_y) + 2;
+	for (u32 j = 0; j != nly; j++)
+		latticeRow2D(&noise_buf[j * nlx], nlx, x0, y0 + j, seed);
 
 	//calculate interpolations
-	index  = 0;
-	noisey = 0;
-	for (j = 0; j != sy; j++) {
-		v00 = noise_buf[idx(0, noisey)];
-		v10 = noise_buf[idx(1, noisey)];
-		v01 = noise_buf[idx(0, noisey + 1)];
-		v11 = noise_buf[idx(1, noisey + 1)];
-
-		u = orig_u;
-		noisex = 0;
-		for (i = 0; i != sx; i++) {
-			value_buf[index++] =
-				biLinearInterpolation(v00, v10, v01, v11, u, v, eased);
-
-			u += step_x;
-			if (u >= 1.0) {
-				u -= 1.0;
-				noisex++;
-				v00 = v10;
-				v01 = v11;
-				v10 = noise_buf[idx(noisex + 1, noisey)];
-				v11 = noise_buf[idx(noisex + 1, noisey + 1)];
-			}
-		}
+	u32 num_cells = setupRow(u, step_x, eased);
+	u32 noisey = 0;
+	for (u32 j = 0; j != sy; j++) {
+		const float *row0 = &noise_buf[noisey * nlx];
+		interpolateRow2D(&value_buf[j * sx], frac_x_buf, cell_start_buf,
+			num_cells, row0, row0 + nlx, eased ? easeCurve(v) : v);
 
 		v += step_y;
 		if (v >= 1.0) {
@@ -551,83 +632,47 @@ void Noise::valueMap2D(
 		}
 	}
 }
-#undef idx
 
 
-#define idx(x, y, z) ((z) * nly * nlx + (y) * nlx + (x))
 void Noise::valueMap3D(
 		float x, float y, float z,
 		float step_x, float step_y, float step_z,
 		s32 seed)
 {
-	float v000, v010, v100, v110;
-	float v001, v011, v101, v111;
-	float u, v, w, orig_u, orig_v;
-	u32 index, i, j, k, noisex, noisey, noisez;
-	u32 nlx, nly, nlz;
-	s32 x0, y0, z0;
-
 	bool eased = np.flags & NOISE_FLAG_EASED;
 
-	x0 = std::floor(x);
-	y0 = std::floor(y);
-	z0 = std::floor(z);
-	u = x - (float)x0;
-	v = y - (float)y0;
-	w = z - (float)z0;
-	orig_u = u;
-	orig_v = v;
+	s32 x0 = std::floor(x);
+	s32 y0 = std::floor(y);
+	s32 z0 = std::floor(z);
+	float u = x - (float)x0;
+	float v = y - (float)y0;
+	float w = z - (float)z0;
+	const float orig_v = v;
 
 	//calculate noise point lattice
-	nlx = (u32)(u + sx * step_x) + 2;
-	nly = (u32)(v + sy * step_y) + 2;
-	nlz = (u32)(w + sz * step_z) + 2;
-	index = 0;
-	for (k = 0; k != nlz; k++)
-		for (j = 0; j != nly; j++)
-			for (i = 0; i != nlx; i++)
-				noise_buf[index++] = noise3d(x0 + i, y0 + j, z0 + k, seed);
+	u32 nlx = (u32)(u + sx * step_x) + 2;
+	u32 nly = (u32)(v + sy * step_y) + 2;
+	u32 nlz = (u32)(w + sz * step_z) + 2;
+	for (u32 k = 0; k != nlz; k++)
+		for (u32 j = 0; j != nly; j++)
+			latticeRow3D(&noise_buf[(k * nly + j) * nlx], nlx,
+				x0, y0 + j, z0 + k, seed);
 
 	//calculate interpolations
-	index  = 0;
-	noisey = 0;
-	noisez = 0;
-	for (k = 0; k != sz; k++) {
+	u32 num_cells = setupRow(u, step_x, eased);
+	const size_t plane = nly * nlx;
+	u32 index = 0;
+	u32 noisez = 0;
+	for (u32 k = 0; k != sz; k++) {
+		const float fz = eased ? easeCurve(w) : w;
 		v = orig_v;
-		noisey = 0;
-		for (j = 0; j != sy; j++) {
-			v000 = noise_buf[idx(0, noisey,     noisez)];
-			v100 = noise_buf[idx(1, noisey,     noisez)];
-			v010 = noise_buf[idx(0, noisey + 1, noisez)];
-			v110 = noise_buf[idx(1, noisey + 1, noisez)];
-			v001 = noise_buf[idx(0, noisey,     noisez + 1)];
-			v101 = noise_buf[idx(1, noisey,     noisez + 1)];
-			v011 = noise_buf[idx(0, noisey + 1, noisez + 1)];
-			v111 = noise_buf[idx(1, noisey + 1, noisez + 1)];
-
-			u = orig_u;
-			noisex = 0;
-			for (i = 0; i != sx; i++) {
-				value_buf[index++] = triLinearInterpolation(
-					v000, v100, v010, v110,
-					v001, v101, v011, v111,
-					u, v, w,
-					eased);
-
-				u += step_x;
-				if (u >= 1.0) {
-					u -= 1.0;
-					noisex++;
-					v000 = v100;
-					v010 = v110;
-					v100 = noise_buf[idx(noisex + 1, noisey,     noisez)];
-					v110 = noise_buf[idx(noisex + 1, noisey + 1, noisez)];
-					v001 = v101;
-					v011 = v111;
-					v101 = noise_buf[idx(noisex + 1, noisey,     noisez + 1)];
-					v111 = noise_buf[idx(noisex + 1, noisey + 1, noisez + 1)];
-				}
-			}
+		u32 noisey = 0;
+		for (u32 j = 0; j != sy; j++) {
+			const float *row00 = &noise_buf[noisez * plane + noisey * nlx];
+			interpolateRow3D(&value_buf[index], frac_x_buf, cell_start_buf,
+				num_cells, row00, row00 + nlx, row00 + plane, row00 + plane + nlx,
+				eased ? easeCurve(v) : v, fz);
+			index += sx;
 
 			v += step_y;
 			if (v >= 1.0) {
@@ -643,7 +688,6 @@ void Noise::valueMap3D(
 		}
 	}
 }
-#undef idx
 
 
 float *Noise::noiseMap2D(float x, float y, float *persistence_map)
@@ -194,8 +194,15 @@ class Noise {
 	}
 
 private:
+	// Position of every point along x within its lattice cell,
+	// and the first point of every cell. The same for all rows.
+	float *frac_x_buf = nullptr;
+	u32 *cell_start_buf = nullptr;
+
 	void allocBuffers();
 	void resizeNoiseBuf(bool is3d);
+	// Returns the number of cells
+	u32 setupRow(float u, float step_x, bool eased);
 	void updateResults(float g, float *gmap, const float *persistence_map,
 			size_t bufsize);
 
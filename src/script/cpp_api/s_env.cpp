@@ -130,6 +130,17 @@ void ScriptApiEnv::environment_OnGenerated(v3s16 minp, v3s16 maxp,
 	runCallbacks(3, RUN_CALLBACKS_MODE_FIRST);
 }
 
+void ScriptApiEnv::readOnGenerated()
+{
+	SCRIPTAPI_PRECHECKHEADER
+
+	// Get core.registered_on_generateds
+	lua_getglobal(L, "core");
+	lua_getfield(L, -1, "registered_on_generateds");
+	luaL_checktype(L, -1, LUA_TTABLE);
+	m_has_on_generated = lua_objlen(L, -1) > 0;
+}
+
 void ScriptApiEnv::environment_Step(float dtime)
 {
 	SCRIPTAPI_PRECHECKHEADER
@@ -169,6 +180,7 @@ void ScriptApiEnv::initializeEnvironment(ServerEnvironment *env)
 
 	readABMs();
 	readLBMs();
+	readOnGenerated();
 }
 
 // Reads a single or a list of node names into a vector
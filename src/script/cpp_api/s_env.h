@@ -23,6 +23,10 @@ class ScriptApiEnv : virtual public ScriptApiBase
 	// Called after generating a piece of map
 	void environment_OnGenerated(v3s16 minp, v3s16 maxp, u32 blockseed);
 
+	// Whether there were any on_generated callbacks once the mods were
+	// loaded. Cached, so that the emerge threads don't need the script lock.
+	bool has_on_generated() const { return m_has_on_generated; }
+
 	// Called on player event
 	void player_event(ServerActiveObject *player, const std::string &type);
 
@@ -55,6 +59,10 @@ class ScriptApiEnv : virtual public ScriptApiBase
 
 	void readLBMs();
 
+	void readOnGenerated();
+
 	// Reads a single or a list of node names into a vector
 	static bool read_nodenames(lua_State *L, int idx, std::vector<std::string> &to);
+
+	bool m_has_on_generated = false;
 };
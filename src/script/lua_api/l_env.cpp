@@ -808,14 +808,13 @@ void ModApiEnvBase::collectNodeIds(lua_State *L, int idx, const NodeDefManager *
 
 template <typename F>
 int ModApiEnvBase::findNodeNear(lua_State *L, v3s16 pos, int radius,
-		const std::vector<content_t> &filter, int start_radius, F &&getNode)
+		int start_radius, F &&matches)
 {
 	for (int d = start_radius; d <= radius; d++) {
 		const std::vector<v3s16> &list = FacePositionCache::getFacePositions(d);
 		for (const v3s16 &i : list) {
 			v3s16 p = pos + i;
-			content_t c = getNode(p).getContent();
-			if (CONTAINS(filter, c)) {
+			if (matches(p)) {
 				push_v3s16(L, p);
 				return 1;
 			}
@@ -846,10 +845,28 @@ int ModApiEnv::l_find_node_near(lua_State *L)
 		radius = client->CSMClampRadius(pos, radius);
 #endif
 
-	auto getNode = [&map] (v3s16 p) -> MapNode {
-		return map.getNode(p);
+	// Blocks that cannot contain any of the nodes are not looked into.
+	// Consecutive positions are mostly in the same block.
+	v3s16 last_blockpos;
+	MapBlock *last_block = nullptr;
+	bool last_may_contain = false, have_last = false;
+	auto matches = [&] (v3s16 p) -> bool {
+		v3s16 blockpos = getNodeBlockPos(p);
+		if (!have_last || blockpos != last_blockpos) {
+			have_last = true;
+			last_blockpos = blockpos;
+			last_block = map.getBlockNoCreateNoEx(blockpos);
+			last_may_contain = last_block ? last_block->mayContainAny(filter) :
+					CONTAINS(filter, CONTENT_IGNORE);
+		}
+		if (!last_may_contain)
+			return false;
+		if (!last_block)
+			return true;
+		MapNode n = last_block->getNodeNoCheck(p - blockpos * MAP_BLOCKSIZE);
+		return CONTAINS(filter, n.getContent());
 	};
-	return findNodeNear(L, pos, radius, filter, start_radius, getNode);
+	return findNodeNear(L, pos, radius, start_radius, matches);
 }
 
 void ModApiEnvBase::checkArea(v3s16 &minp, v3s16 &maxp)
@@ -966,33 +983,26 @@ int ModApiEnv::l_find_nodes_in_area(lua_State *L)
 	bool grouped = lua_isboolean(L, 4) && readParam<bool>(L, 4);
 
 	auto iterate = [&] (auto &&callback) {
-		map.forEachNodeInArea(minp, maxp, callback);
+		map.forEachNodeInArea(minp, maxp, filter, callback);
 	};
 	return findNodesInArea(L, ndef, filter, grouped, iterate);
 }
 
-template <typename F>
-int ModApiEnvBase::findNodesInAreaUnderAir(lua_State *L, v3s16 minp, v3s16 maxp,
-	const std::vector<content_t> &filter, F &&getNode)
+template <typename F, typename G>
+int ModApiEnvBase::findNodesInAreaUnderAir(lua_State *L,
+	const std::vector<content_t> &filter, F &&iterate, G &&getNode)
 {
 	lua_newtable(L);
 	u32 i = 0;
-	v3s16 p;
-	for (p.X = minp.X; p.X <= maxp.X; p.X++)
-	for (p.Z = minp.Z; p.Z <= maxp.Z; p.Z++) {
-		p.Y = minp.Y;
-		content_t c = getNode(p).getContent();
-		for (; p.Y <= maxp.Y; p.Y++) {
-			v3s16 psurf(p.X, p.Y + 1, p.Z);
-			content_t csurf = getNode(psurf).getContent();
-			if (c != CONTENT_AIR && csurf == CONTENT_AIR &&
-					CONTAINS(filter, c)) {
-				push_v3s16(L, p);
-				lua_rawseti(L, -2, ++i);
-			}
-			c = csurf;
+	iterate([&](v3s16 p, MapNode n) -> bool {
+		content_t c = n.getContent();
+		if (c != CONTENT_AIR && CONTAINS(filter, c) &&
+				getNode(p + v3s16(0, 1, 0)).getContent() == CONTENT_AIR) {
+			push_v3s16(L, p);
+			lua_rawseti(L, -2, ++i);
 		}
-	}
+		return true;
+	});
 	return 1;
 }
 
@@ -1025,10 +1035,13 @@ int ModApiEnv::l_find_nodes_in_area_under_air(lua_State *L)
 	std::vector<content_t> filter;
 	collectNodeIds(L, 3, ndef, filter);
 
+	auto iterate = [&] (auto &&callback) {
+		map.forEachNodeInArea(minp, maxp, filter, callback);
+	};
 	auto getNode = [&map] (v3s16 p) -> MapNode {
 		return map.getNode(p);
 	};
-	return findNodesInAreaUnderAir(L, minp, maxp, filter, getNode);
+	return findNodesInAreaUnderAir(L, filter, iterate, getNode);
 }
 
 // get_value_noise(seeddiff, octaves, persistence, scale)
@@ -1535,10 +1548,10 @@ int ModApiEnvVM::l_find_node_near(lua_State *L)
 	collectNodeIds(L, 3, ndef, filter);
 	int start_radius = (lua_isboolean(L, 4) && readParam<bool>(L, 4)) ? 0 : 1;
 
-	auto getNode = [&vm] (v3s16 p) -> MapNode {
-		return vm->getNodeNoExNoEmerge(p);
+	auto matches = [&] (v3s16 p) -> bool {
+		return CONTAINS(filter, vm->getNodeNoExNoEmerge(p).getContent());
 	};
-	return findNodeNear(L, pos, radius, filter, start_radius, getNode);
+	return findNodeNear(L, pos, radius, start_radius, matches);
 }
 
 // find_nodes_in_area(minp, maxp, nodenames, [grouped])
@@ -1599,7 +1612,14 @@ int ModApiEnvVM::l_find_nodes_in_area_under_air(lua_State *L)
 	auto getNode = [&vm] (v3s16 p) -> MapNode {
 		return vm->getNodeNoExNoEmerge(p);
 	};
-	return findNodesInAreaUnderAir(L, minp, maxp, filter, getNode);
+	auto iterate = [&] (auto &&callback) {
+		v3s16 p;
+		for (p.X = minp.X; p.X <= maxp.X; p.X++)
+		for (p.Z = minp.Z; p.Z <= maxp.Z; p.Z++)
+		for (p.Y = minp.Y; p.Y <= maxp.Y; p.Y++)
+			callback(p, getNode(p));
+	};
+	return findNodesInAreaUnderAir(L, filter, iterate, getNode);
 }
 
 // spawn_tree(pos, treedef)
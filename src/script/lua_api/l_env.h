@@ -19,10 +19,10 @@ class ModApiEnvBase : public ModApiBase {
 
 	static void checkArea(v3s16 &minp, v3s16 &maxp);
 
-	// F must be (v3s16 pos) -> MapNode
+	// F must be (v3s16 pos) -> bool, telling whether the node is searched for
 	template <typename F>
 	static int findNodeNear(lua_State *L, v3s16 pos, int radius,
-		const std::vector<content_t> &filter, int start_radius, F &&getNode);
+		int start_radius, F &&matches);
 
 	// F must be (G callback) -> void
 	// with G being (v3s16 p, MapNode n) -> bool
@@ -31,10 +31,10 @@ class ModApiEnvBase : public ModApiBase {
 	static int findNodesInArea(lua_State *L,  const NodeDefManager *ndef,
 		const std::vector<content_t> &filter, bool grouped, F &&iterate);
 
-	// F must be (v3s16 pos) -> MapNode
-	template <typename F>
-	static int findNodesInAreaUnderAir(lua_State *L, v3s16 minp, v3s16 maxp,
-		const std::vector<content_t> &filter, F &&getNode);
+	// F like for findNodesInArea, G must be (v3s16 pos) -> MapNode
+	template <typename F, typename G>
+	static int findNodesInAreaUnderAir(lua_State *L,
+		const std::vector<content_t> &filter, F &&iterate, G &&getNode);
 
 	static const EnumString es_ClearObjectsMode[];
 	static const EnumString es_BlockStatusType[];
@@ -2,7 +2,9 @@
 // SPDX-License-Identifier: LGPL-2.1-or-later
 // Copyright (C) 2013 kwolekr, Ryan Kwolek <kwolekr@minetest.net>
 
+#include <algorithm>
 #include <map>
+#include <memory>
 #include "lua_api/l_vmanip.h"
 #include "lua_api/l_mapgen.h"
 #include "lua_api/l_internal.h"
@@ -90,6 +92,14 @@ int LuaVoxelManip::l_get_data(lua_State *L)
 	MMVManip *vm = o->vm;
 	const u32 volume = vm->m_area.getVolume();
 
+	if (LuaVoxelBuffer *buf = LuaVoxelBuffer::toObject(L, 2)) {
+		buf->data.resize(volume);
+		for (u32 i = 0; i != volume; i++)
+			buf->data[i] = (vm->m_flags[i] & VOXELFLAG_NO_DATA) ? CONTENT_IGNORE : vm->m_data[i].getContent();
+		lua_pushvalue(L, 2);
+		return 1;
+	}
+
 	if (use_buffer)
 		lua_pushvalue(L, 2);
 	else
@@ -112,17 +122,24 @@ int LuaVoxelManip::l_set_data(lua_State *L)
 	LuaVoxelManip *o = checkObject<LuaVoxelManip>(L, 1);
 	MMVManip *vm = o->vm;
 
-	if (!lua_istable(L, 2))
-		throw LuaError("VoxelManip:set_data called with missing parameter");
-
 	u32 volume = vm->m_area.getVolume();
-	for (u32 i = 0; i != volume; i++) {
-		lua_rawgeti(L, 2, i + 1);
-		content_t c = lua_tointeger(L, -1);
+	if (LuaVoxelBuffer *buf = LuaVoxelBuffer::toObject(L, 2)) {
+		if (buf->data.size() < volume)
+			throw LuaError("VoxelManip:set_data called with too small VoxelBuffer");
+		for (u32 i = 0; i != volume; i++)
+			vm->m_data[i].setContent(buf->data[i]);
+	} else {
+		if (!lua_istable(L, 2))
+			throw LuaError("VoxelManip:set_data called with missing parameter");
 
-		vm->m_data[i].setContent(c);
+		for (u32 i = 0; i != volume; i++) {
+			lua_rawgeti(L, 2, i + 1);
+			content_t c = lua_tointeger(L, -1);
 
-		lua_pop(L, 1);
+			vm->m_data[i].setContent(c);
+
+			lua_pop(L, 1);
+		}
 	}
 
 	// Mark all data as present, since we just got it from Lua
@@ -257,6 +274,14 @@ int LuaVoxelManip::l_get_light_data(lua_State *L)
 	MMVManip *vm = o->vm;
 	const u32 volume = vm->m_area.getVolume();
 
+	if (LuaVoxelBuffer *buf = LuaVoxelBuffer::toObject(L, 2)) {
+		buf->data.resize(volume);
+		for (u32 i = 0; i != volume; i++)
+			buf->data[i] = (vm->m_flags[i] & VOXELFLAG_NO_DATA) ? 0 : vm->m_data[i].getParam1();
+		lua_pushvalue(L, 2);
+		return 1;
+	}
+
 	if (use_buffer)
 		lua_pushvalue(L, 2);
 	else
@@ -279,11 +304,23 @@ int LuaVoxelManip::l_set_light_data(lua_State *L)
 	LuaVoxelManip *o = checkObject<LuaVoxelManip>(L, 1);
 	MMVManip *vm = o->vm;
 
+	u32 volume = vm->m_area.getVolume();
+	if (LuaVoxelBuffer *buf = LuaVoxelBuffer::toObject(L, 2)) {
+		if (buf->data.size() < volume)
+			throw LuaError("VoxelManip:set_light_data called with too small "
+					"VoxelBuffer");
+		if (!buf->fitsU8(volume))
+			throw LuaError("VoxelManip:set_light_data called with values "
+					"above 255");
+		for (u32 i = 0; i != volume; i++)
+			vm->m_data[i].param1 = buf->data[i];
+		return 0;
+	}
+
 	if (!lua_istable(L, 2))
 		throw LuaError("VoxelManip:set_light_data called with missing "
 				"parameter");
 
-	u32 volume = vm->m_area.getVolume();
 	for (u32 i = 0; i != volume; i++) {
 		lua_rawgeti(L, 2, i + 1);
 		u8 light = lua_tointeger(L, -1);
@@ -306,6 +343,14 @@ int LuaVoxelManip::l_get_param2_data(lua_State *L)
 	MMVManip *vm = o->vm;
 	const u32 volume = vm->m_area.getVolume();
 
+	if (LuaVoxelBuffer *buf = LuaVoxelBuffer::toObject(L, 2)) {
+		buf->data.resize(volume);
+		for (u32 i = 0; i != volume; i++)
+			buf->data[i] = (vm->m_flags[i] & VOXELFLAG_NO_DATA) ? 0 : vm->m_data[i].getParam2();
+		lua_pushvalue(L, 2);
+		return 1;
+	}
+
 	if (use_buffer)
 		lua_pushvalue(L, 2);
 	else
@@ -328,11 +373,23 @@ int LuaVoxelManip::l_set_param2_data(lua_State *L)
 	LuaVoxelManip *o = checkObject<LuaVoxelManip>(L, 1);
 	MMVManip *vm = o->vm;
 
+	u32 volume = vm->m_area.getVolume();
+	if (LuaVoxelBuffer *buf = LuaVoxelBuffer::toObject(L, 2)) {
+		if (buf->data.size() < volume)
+			throw LuaError("VoxelManip:set_param2_data called with too small "
+					"VoxelBuffer");
+		if (!buf->fitsU8(volume))
+			throw LuaError("VoxelManip:set_param2_data called with values "
+					"above 255");
+		for (u32 i = 0; i != volume; i++)
+			vm->m_data[i].param2 = buf->data[i];
+		return 0;
+	}
+
 	if (!lua_istable(L, 2))
 		throw LuaError("VoxelManip:set_param2_data called with missing "
 				"parameter");
 
-	u32 volume = vm->m_area.getVolume();
 	for (u32 i = 0; i != volume; i++) {
 		lua_rawgeti(L, 2, i + 1);
 		u8 param2 = lua_tointeger(L, -1);
@@ -501,3 +558,197 @@ const luaL_Reg LuaVoxelManip::methods[] = {
 	luamethod(LuaVoxelManip, close),
 	{0,0}
 };
+
+/*
+	LuaVoxelBuffer
+*/
+
+int LuaVoxelBuffer::gc_object(lua_State *L)
+{
+	LuaVoxelBuffer *o = *(LuaVoxelBuffer **)(lua_touserdata(L, 1));
+	delete o;
+
+	return 0;
+}
+
+// The metamethods can only be reached through the protected metatable, so
+// the type check of checkObject() is skipped for element access.
+
+int LuaVoxelBuffer::mt_index(lua_State *L)
+{
+	if (lua_type(L, 2) != LUA_TNUMBER) {
+		// Look up methods
+		lua_pushvalue(L, 2);
+		lua_rawget(L, lua_upvalueindex(1));
+		return 1;
+	}
+
+	LuaVoxelBuffer *o = *(LuaVoxelBuffer **)(lua_touserdata(L, 1));
+	lua_Integer i = lua_tointeger(L, 2);
+	if (i >= 1 && i <= (lua_Integer)o->data.size())
+		lua_pushinteger(L, o->data[i - 1]);
+	else
+		lua_pushnil(L);
+	return 1;
+}
+
+int LuaVoxelBuffer::mt_newindex(lua_State *L)
+{
+	LuaVoxelBuffer *o = *(LuaVoxelBuffer **)(lua_touserdata(L, 1));
+	lua_Integer i = luaL_checkinteger(L, 2);
+	if (i < 1 || i > (lua_Integer)o->data.size())
+		throw LuaError("VoxelBuffer index out of range");
+	o->data[i - 1] = checkValue(luaL_checkinteger(L, 3));
+	return 0;
+}
+
+int LuaVoxelBuffer::mt_len(lua_State *L)
+{
+	LuaVoxelBuffer *o = *(LuaVoxelBuffer **)(lua_touserdata(L, 1));
+	lua_pushinteger(L, o->data.size());
+	return 1;
+}
+
+// fill(self, value)
+int LuaVoxelBuffer::l_fill(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelBuffer *o = checkObject<LuaVoxelBuffer>(L, 1);
+	u16 value = checkValue(luaL_checkinteger(L, 2));
+
+	std::fill(o->data.begin(), o->data.end(), value);
+
+	return 0;
+}
+
+// replace(self, mapping)
+int LuaVoxelBuffer::l_replace(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelBuffer *o = checkObject<LuaVoxelBuffer>(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+
+	// Lookup table of all values, so the loop over the data is branch-free
+	std::vector<u16> lut(U16_MAX + 1);
+	for (u32 v = 0; v <= U16_MAX; v++)
+		lut[v] = v;
+	lua_pushnil(L);
+	while (lua_next(L, 2)) {
+		// key at index -2 and value at index -1
+		if (lua_type(L, -2) != LUA_TNUMBER || lua_type(L, -1) != LUA_TNUMBER)
+			throw LuaError("VoxelBuffer:replace called with non-integer mapping");
+		lut[checkValue(lua_tointeger(L, -2))] = checkValue(lua_tointeger(L, -1));
+		lua_pop(L, 1);
+	}
+
+	for (u16 &v : o->data)
+		v = lut[v];
+
+	return 0;
+}
+
+// to_table(self, [buffer])
+int LuaVoxelBuffer::l_to_table(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelBuffer *o = checkObject<LuaVoxelBuffer>(L, 1);
+	const u32 size = o->data.size();
+
+	if (lua_istable(L, 2))
+		lua_pushvalue(L, 2);
+	else
+		lua_createtable(L, size, 0);
+
+	for (u32 i = 0; i != size; i++) {
+		lua_pushinteger(L, o->data[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	return 1;
+}
+
+// VoxelBuffer([size or table])
+// Creates a LuaVoxelBuffer and leaves it on top of stack
+int LuaVoxelBuffer::create_object(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	auto o = std::make_unique<LuaVoxelBuffer>();
+
+	if (lua_istable(L, 1)) {
+		const u32 size = lua_objlen(L, 1);
+		o->data.resize(size);
+		for (u32 i = 0; i != size; i++) {
+			lua_rawgeti(L, 1, i + 1);
+			o->data[i] = checkValue(lua_tointeger(L, -1));
+			lua_pop(L, 1);
+		}
+	} else if (!lua_isnoneornil(L, 1)) {
+		lua_Integer size = luaL_checkinteger(L, 1);
+		if (size < 0 || size > U32_MAX)
+			throw LuaError("VoxelBuffer size out of range");
+		o->data.resize(size);
+	}
+
+	*(void **)(lua_newuserdata(L, sizeof(void *))) = o.release();
+	luaL_getmetatable(L, className);
+	lua_setmetatable(L, -2);
+	return 1;
+}
+
+u16 LuaVoxelBuffer::checkValue(lua_Integer value)
+{
+	if (value < 0 || value > U16_MAX)
+		throw LuaError("VoxelBuffer value out of range");
+	return value;
+}
+
+bool LuaVoxelBuffer::fitsU8(u32 count) const
+{
+	return std::all_of(data.begin(), data.begin() + count,
+		[] (u16 v) { return v <= U8_MAX; });
+}
+
+LuaVoxelBuffer *LuaVoxelBuffer::toObject(lua_State *L, int idx)
+{
+	if (!lua_isuserdata(L, idx) || !lua_getmetatable(L, idx))
+		return nullptr;
+	luaL_getmetatable(L, className);
+	bool is_buffer = lua_rawequal(L, -1, -2);
+	lua_pop(L, 2);
+	if (!is_buffer)
+		return nullptr;
+	return *(LuaVoxelBuffer **)(lua_touserdata(L, idx));
+}
+
+void LuaVoxelBuffer::Register(lua_State *L)
+{
+	static const luaL_Reg metamethods[] = {
+		{"__gc", gc_object},
+		{"__newindex", mt_newindex},
+		{"__len", mt_len},
+		{0, 0}
+	};
+	registerClass<LuaVoxelBuffer>(L, methods, metamethods);
+
+	// Integer keys are elements, the rest are looked up in the methods
+	luaL_getmetatable(L, className);
+	lua_getfield(L, -1, "__index");
+	lua_pushcclosure(L, mt_index, 1);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+
+	// Can be created from Lua (VoxelBuffer())
+	lua_register(L, className, create_object);
+}
+
+const char LuaVoxelBuffer::className[] = "VoxelBuffer";
+const luaL_Reg LuaVoxelBuffer::methods[] = {
+	luamethod(LuaVoxelBuffer, fill),
+	luamethod(LuaVoxelBuffer, replace),
+	luamethod(LuaVoxelBuffer, to_table),
+	{0,0}
+};
@@ -6,6 +6,7 @@
 
 #include "irr_v3d.h"
 #include "lua_api/l_base.h"
+#include <vector>
 
 class Map;
 class MMVManip;
@@ -67,3 +68,43 @@ class LuaVoxelManip : public ModApiBase
 
 	static const char className[];
 };
+
+/*
+  VoxelBuffer
+  Flat array of integers that VoxelManip can copy its data into and out of
+  without going through Lua tables.
+ */
+class LuaVoxelBuffer : public ModApiBase
+{
+private:
+	static const luaL_Reg methods[];
+
+	static int gc_object(lua_State *L);
+	static int mt_index(lua_State *L);
+	static int mt_newindex(lua_State *L);
+	static int mt_len(lua_State *L);
+
+	static int l_fill(lua_State *L);
+	static int l_replace(lua_State *L);
+	static int l_to_table(lua_State *L);
+
+	// Throws a LuaError if the value does not fit in the buffer
+	static u16 checkValue(lua_Integer value);
+
+public:
+	std::vector<u16> data;
+
+	// Whether the first count values fit in a u8
+	bool fitsU8(u32 count) const;
+
+	// VoxelBuffer([size or table])
+	// Creates a LuaVoxelBuffer and leaves it on top of stack
+	static int create_object(lua_State *L);
+
+	// Returns the object at idx, or nullptr if it is not a VoxelBuffer
+	static LuaVoxelBuffer *toObject(lua_State *L, int idx);
+
+	static void Register(lua_State *L);
+
+	static const char className[];
+};
@@ -65,6 +65,7 @@ void EmergeScripting::InitializeModApi(lua_State *L, int top)
 	LuaPseudoRandom::Register(L);
 	LuaPcgRandom::Register(L);
 	LuaSecureRandom::Register(L);
+	LuaVoxelBuffer::Register(L);
 	LuaVoxelManip::Register(L);
 	LuaSettings::Register(L);
 
@@ -132,6 +132,7 @@ void ServerScripting::InitializeModApi(lua_State *L, int top)
 	LuaPcgRandom::Register(L);
 	LuaRaycast::Register(L);
 	LuaSecureRandom::Register(L);
+	LuaVoxelBuffer::Register(L);
 	LuaVoxelManip::Register(L);
 	NodeMetaRef::Register(L);
 	NodeTimerRef::Register(L);
@@ -170,6 +171,7 @@ void ServerScripting::InitializeAsync(lua_State *L, int top)
 	LuaPseudoRandom::Register(L);
 	LuaPcgRandom::Register(L);
 	LuaSecureRandom::Register(L);
+	LuaVoxelBuffer::Register(L);
 	LuaVoxelManip::Register(L);
 	LuaSettings::Register(L);
 
@@ -3,11 +3,15 @@
 // Copyright (C) 2013 celeron55, Perttu Ahola <celeron55@gmail.com>
 
 #include "serialization.h"
+#include "debug.h"
 #include "log.h"
 #include "util/serialize.h"
+#include "util/stream.h"
 
 #include <zlib.h>
 #include <zstd.h>
+#include <zdict.h>
+#include <algorithm>
 #include <memory>
 
 /* report a zlib or i/o error */
@@ -186,13 +190,25 @@ struct ZSTD_Deleter {
 	}
 };
 
-void compressZstd(const u8 *data, size_t data_size, std::ostream &os, int level)
+// Reusing the contexts is recommended for performance,
+// they will be destroyed when the thread ends
+static ZSTD_CStream *get_zstd_cstream()
 {
-	// reusing the context is recommended for performance
-	// it will be destroyed when the thread ends
 	thread_local std::unique_ptr<ZSTD_CStream, ZSTD_Deleter> stream(ZSTD_createCStream());
+	return stream.get();
+}
+
+static ZSTD_DStream *get_zstd_dstream()
+{
+	thread_local std::unique_ptr<ZSTD_DStream, ZSTD_Deleter> stream(ZSTD_createDStream());
+	return stream.get();
+}
 
-	ZSTD_initCStream(stream.get(), level);
+void compressZstd(const u8 *data, size_t data_size, std::ostream &os, int level)
+{
+	ZSTD_CStream *stream = get_zstd_cstream();
+
+	ZSTD_initCStream(stream, level);
 
 	const size_t bufsize = 16384;
 	char output_buffer[bufsize];
@@ -201,7 +217,7 @@ void compressZstd(const u8 *data, size_t data_size, std::ostream &os, int level)
 	ZSTD_outBuffer output = { output_buffer, bufsize, 0 };
 
 	while (input.pos < input.size) {
-		size_t ret = ZSTD_compressStream(stream.get(), &output, &input);
+		size_t ret = ZSTD_compressStream(stream, &output, &input);
 		if (ZSTD_isError(ret)) {
 			dstream << ZSTD_getErrorName(ret) << std::endl;
 			throw SerializationError("compressZstd: failed");
@@ -214,7 +230,7 @@ void compressZstd(const u8 *data, size_t data_size, std::ostream &os, int level)
 
 	size_t ret;
 	do {
-		ret = ZSTD_endStream(stream.get(), &output);
+		ret = ZSTD_endStream(stream, &output);
 		if (ZSTD_isError(ret)) {
 			dstream << ZSTD_getErrorName(ret) << std::endl;
 			throw SerializationError("compressZstd: failed");
@@ -229,11 +245,9 @@ void compressZstd(const u8 *data, size_t data_size, std::ostream &os, int level)
 
 void decompressZstd(std::istream &is, std::ostream &os)
 {
-	// reusing the context is recommended for performance
-	// it will be destroyed when the thread ends
-	thread_local std::unique_ptr<ZSTD_DStream, ZSTD_Deleter> stream(ZSTD_createDStream());
+	ZSTD_DStream *stream = get_zstd_dstream();
 
-	ZSTD_initDStream(stream.get());
+	ZSTD_initDStream(stream);
 
 	const size_t bufsize = 16384;
 	char output_buffer[bufsize];
@@ -252,7 +266,7 @@ void decompressZstd(std::istream &is, std::ostream &os)
 				throw SerializationError("decompressZstd: data ended too early");
 		}
 
-		ret = ZSTD_decompressStream(stream.get(), &output, &input);
+		ret = ZSTD_decompressStream(stream, &output, &input);
 		if (ZSTD_isError(ret)) {
 			dstream << ZSTD_getErrorName(ret) << std::endl;
 			throw SerializationError("decompressZstd: failed");
@@ -272,6 +286,136 @@ void decompressZstd(std::istream &is, std::ostream &os)
 	}
 }
 
+ZstdDictionary::ZstdDictionary(std::string_view data) :
+	m_data(data)
+{
+	m_id = ZDICT_getDictID(m_data.data(), m_data.size());
+	if (m_id == 0)
+		throw SerializationError("ZstdDictionary: not a dictionary");
+	m_ddict = ZSTD_createDDict(m_data.data(), m_data.size());
+	if (!m_ddict)
+		throw SerializationError("ZstdDictionary: failed to load");
+}
+
+ZstdDictionary::~ZstdDictionary()
+{
+	for (auto &it : m_cdicts)
+		ZSTD_freeCDict(it.second);
+	ZSTD_freeDDict(m_ddict);
+}
+
+ZSTD_CDict *ZstdDictionary::getCDict(int level) const
+{
+	std::lock_guard lock(m_mutex);
+	ZSTD_CDict *&cdict = m_cdicts[level];
+	if (!cdict) {
+		cdict = ZSTD_createCDict(m_data.data(), m_data.size(), level);
+		if (!cdict)
+			throw SerializationError("ZstdDictionary: failed to load");
+	}
+	return cdict;
+}
+
+std::string trainZstdDictionary(const std::vector<std::string> &samples,
+		size_t max_size)
+{
+	std::string all;
+	std::vector<size_t> sizes;
+	sizes.reserve(samples.size());
+	for (const std::string &sample : samples) {
+		all += sample;
+		sizes.push_back(sample.size());
+	}
+
+	std::string dict(max_size, '\0');
+	size_t ret = ZDICT_trainFromBuffer(&dict[0], dict.size(), all.data(),
+		sizes.data(), sizes.size());
+	if (ZDICT_isError(ret)) {
+		throw SerializationError(std::string("trainZstdDictionary: ") +
+			ZDICT_getErrorName(ret));
+	}
+	dict.resize(ret);
+	return dict;
+}
+
+void compressZstd(const u8 *data, size_t data_size, std::string &out, int level,
+		const ZstdDictionary *dict)
+{
+	ZSTD_CStream *stream = get_zstd_cstream();
+
+	if (dict) {
+		// The level is the one of the digested dictionary
+		ZSTD_CCtx_reset(stream, ZSTD_reset_session_and_parameters);
+		ZSTD_CCtx_refCDict(stream, dict->getCDict(level));
+	} else {
+		ZSTD_initCStream(stream, level);
+	}
+
+	// Compress straight into the string, with room for the worst case
+	const size_t start = out.size();
+	out.resize(start + ZSTD_compressBound(data_size));
+
+	ZSTD_inBuffer input = { data, data_size, 0 };
+	ZSTD_outBuffer output = { &out[start], out.size() - start, 0 };
+
+	size_t ret = 0;
+	if (dict) {
+		ret = ZSTD_compressStream2(stream, &output, &input, ZSTD_e_end);
+	} else {
+		// Passing empty input would change the frame, the stream version never does
+		if (input.size > 0)
+			ret = ZSTD_compressStream(stream, &output, &input);
+		if (!ZSTD_isError(ret))
+			ret = ZSTD_endStream(stream, &output);
+	}
+	if (ZSTD_isError(ret)) {
+		dstream << ZSTD_getErrorName(ret) << std::endl;
+		throw SerializationError("compressZstd: failed");
+	}
+	if (ret != 0 || input.pos < input.size)
+		throw SerializationError("compressZstd: output buffer too small");
+
+	out.resize(start + output.pos);
+}
+
+size_t decompressZstd(std::string_view data, std::string &out,
+		const ZstdDictionary *dict)
+{
+	ZSTD_DStream *stream = get_zstd_dstream();
+
+	ZSTD_initDStream(stream);
+
+	const u32 dict_id = ZSTD_getDictID_fromFrame(data.data(), data.size());
+	if (dict_id != 0) {
+		if (!dict || dict->getId() != dict_id)
+			throw SerializationError("decompressZstd: data needs a different dictionary");
+		ZSTD_DCtx_refDDict(stream, dict->getDDict());
+	}
+
+	ZSTD_inBuffer input = { data.data(), data.size(), 0 };
+	size_t pos = out.size();
+	size_t ret;
+	do {
+		// Grow the string when full, starting with the memory it already has
+		if (pos == out.size())
+			out.resize(std::max(std::max(out.capacity(), 2 * pos), pos + 16384));
+
+		ZSTD_outBuffer output = { &out[0], out.size(), pos };
+		ret = ZSTD_decompressStream(stream, &output, &input);
+		if (ZSTD_isError(ret)) {
+			dstream << ZSTD_getErrorName(ret) << std::endl;
+			throw SerializationError("decompressZstd: failed");
+		}
+		pos = output.pos;
+
+		if (ret != 0 && input.pos == input.size && pos < out.size())
+			throw SerializationError("decompressZstd: data ended too early");
+	} while (ret != 0);
+
+	out.resize(pos);
+	return input.pos;
+}
+
 void compress(const u8 *data, u32 size, std::ostream &os, u8 version, int level)
 {
 	if(version >= 29)
@@ -322,6 +466,22 @@ void compress(const u8 *data, u32 size, std::ostream &os, u8 version, int level)
 	os.write((char*)&current_byte, 1);
 }
 
+void compress(std::string_view data, std::string &out, u8 version, int level,
+		const ZstdDictionary *dict)
+{
+	if (version >= 29) {
+		compressZstd(reinterpret_cast<const u8*>(data.data()), data.size(), out,
+			level + 1, dict);
+		return;
+	}
+
+	sanity_check(!dict);
+
+	StringAppendBuffer buf(out);
+	std::ostream os(&buf);
+	compress(data, os, version, level);
+}
+
 void decompress(std::istream &is, std::ostream &os, u8 version)
 {
 	if(version >= 29)
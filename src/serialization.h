@@ -5,8 +5,13 @@
 #pragma once
 
 #include "irrlichttypes.h"
+#include "util/basic_macros.h"
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
 #include <string_view>
+#include <vector>
 
 /*
 	Map format serialization version
@@ -77,6 +82,44 @@ inline bool ser_ver_supported_write(s32 v)
 	Compression functions
 */
 
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
+/*
+	A zstd dictionary, trained from samples of the data to compress with
+	trainZstdDictionary(). Data compressed with it records the dictionary ID,
+	so it can only be decompressed with the same dictionary.
+	This class is thread-safe.
+*/
+class ZstdDictionary
+{
+public:
+	// Throws SerializationError if data is not a dictionary
+	ZstdDictionary(std::string_view data);
+	~ZstdDictionary();
+
+	DISABLE_CLASS_COPY(ZstdDictionary)
+
+	u32 getId() const { return m_id; }
+	const std::string &getData() const { return m_data; }
+
+	// Digested for compressing at a level, made on first use
+	ZSTD_CDict_s *getCDict(int level) const;
+	ZSTD_DDict_s *getDDict() const { return m_ddict; }
+
+private:
+	std::string m_data;
+	u32 m_id;
+	ZSTD_DDict_s *m_ddict;
+	mutable std::mutex m_mutex;
+	mutable std::map<int, ZSTD_CDict_s *> m_cdicts;
+};
+
+// Returns a dictionary of at most max_size bytes for data like the samples.
+// Throws SerializationError if there are too few samples.
+std::string trainZstdDictionary(const std::vector<std::string> &samples,
+		size_t max_size);
+
 void compressZlib(const u8 *data, size_t data_size, std::ostream &os, int level = -1);
 inline void compressZlib(std::string_view data, std::ostream &os, int level = -1)
 {
@@ -90,6 +133,14 @@ inline void compressZstd(std::string_view data, std::ostream &os, int level = 0)
 	compressZstd(reinterpret_cast<const u8*>(data.data()), data.size(), os, level);
 }
 void decompressZstd(std::istream &is, std::ostream &os);
+// Same as above, but on memory: the output is appended to out.
+// Without a dictionary, these produce the same bytes as the stream versions.
+void compressZstd(const u8 *data, size_t data_size, std::string &out, int level = 0,
+		const ZstdDictionary *dict = nullptr);
+// Returns how many bytes of data were used, the rest is left over.
+// The dictionary is only used if the data was compressed with it.
+size_t decompressZstd(std::string_view data, std::string &out,
+		const ZstdDictionary *dict = nullptr);
 
 // These choose between zstd, zlib and a self-made one according to version
 void compress(const u8 *data, u32 size, std::ostream &os, u8 version, int level = -1);
@@ -97,4 +148,7 @@ inline void compress(std::string_view data, std::ostream &os, u8 version, int le
 {
 	compress(reinterpret_cast<const u8*>(data.data()), data.size(), os, version, level);
 }
+// Appends the compressed data to out, the dictionary needs version >= 29
+void compress(std::string_view data, std::string &out, u8 version, int level = -1,
+		const ZstdDictionary *dict = nullptr);
 void decompress(std::istream &is, std::ostream &os, u8 version);
@@ -23,6 +23,7 @@
 #include "profiler.h"
 #include "remoteplayer.h"
 #include "server/ban.h"
+#include "server/cached_media_file.h"
 #include "serverenvironment.h"
 #include "servermap.h"
 #include "server/player_sao.h"
@@ -31,6 +32,7 @@
 #include "server/serverinventorymgr.h"
 #include "server/serverlist.h"
 #include "settings.h"
+#include "threading/worker_pool.h"
 #include "translation.h"
 #include "util/base64.h"
 #include "util/hashing.h"
@@ -480,6 +482,10 @@ void Server::init()
 	// Create emerge manager
 	m_emerge = std::make_unique<EmergeManager>(this, m_metrics_backend.get());
 
+	m_block_send_pool = std::make_unique<WorkerPool>("BlockSend",
+		g_settings->getU16("block_send_threads"));
+	m_media_send_pool = std::make_unique<WorkerPool>("MediaSend", 1);
+
 	// Create ban manager
 	std::string ban_path = m_path_world + DIR_DELIM "ipban.txt";
 	m_banmanager = new BanManager(ban_path);
@@ -655,6 +661,32 @@ void Server::step()
 	}
 }
 
+static bool is_position_update(const ActiveObjectMessage &aom)
+{
+	return !aom.reliable && !aom.datastring.empty() &&
+		aom.datastring[0] == AO_CMD_UPDATE_POSITION;
+}
+
+static void append_object_message(std::string &buffer, u16 id, const std::string &data)
+{
+	char idbuf[2];
+	writeU16((u8*) idbuf, id);
+	// u16 id
+	// std::string data
+	buffer.append(idbuf, sizeof(idbuf));
+	buffer.append(serializeString16(data));
+}
+
+// Lower values are sent first, see RemoteClient::getObjectUpdatePriority()
+static f32 get_object_update_priority(ServerActiveObject *obj, PlayerSAO *player, u16 age)
+{
+	if (!obj)
+		return 0.0f;
+	f32 distance = obj->getBasePosition().getDistanceFrom(player->getBasePosition()) / BS;
+	return RemoteClient::getObjectUpdatePriority(distance,
+		obj->getType() == ACTIVEOBJECT_TYPE_PLAYER, age);
+}
+
 void Server::AsyncRunStep(float dtime, bool initial_step)
 {
 	ZoneScoped;
@@ -912,12 +944,26 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 			} else {
 				message_list = n->second;
 			}
+
+			// Only the latest position of an object needs to be sent
+			if (is_position_update(aom)) {
+				auto it = std::find_if(message_list->begin(), message_list->end(),
+					is_position_update);
+				if (it != message_list->end()) {
+					RemoteClient::mergePositionUpdate(it->datastring, aom.datastring);
+					*it = std::move(aom);
+					continue;
+				}
+			}
 			message_list->push_back(std::move(aom));
 		}
 
 		m_aom_buffer_counter[0]->increment(count_reliable);
 		m_aom_buffer_counter[1]->increment(count_unreliable);
 
+		// Read every step, so that changes apply right away
+		const u32 send_budget = g_settings->getU32("active_object_send_budget");
+
 		{
 			ClientInterface::AutoLock clientlock(m_clients);
 			const RemoteClientMap &clients = m_clients.getClientList();
@@ -953,16 +999,36 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 								continue;
 						}
 
+						// Position updates are sent within the budget below
+						if (send_budget > 0 && is_position_update(aom)) {
+							client->holdObjectUpdate(id, aom.datastring);
+							continue;
+						}
+
 						// Add full new data to appropriate buffer
 						std::string &buffer = aom.reliable ? reliable_data : unreliable_data;
-						char idbuf[2];
-						writeU16((u8*) idbuf, aom.id);
-						// u16 id
-						// std::string data
-						buffer.append(idbuf, sizeof(idbuf));
-						buffer.append(serializeString16(aom.datastring));
+						append_object_message(buffer, aom.id, aom.datastring);
 					}
 				}
+
+				/*
+					Send the position updates of the objects that matter
+					most to the player first. The others are held back for
+					later steps, the latest one of each object replaces the
+					earlier ones.
+				*/
+				if (player && !client->m_held_object_updates.empty()) {
+					// Updates held before the budget was turned off go at once
+					client->takeHeldObjectUpdates(send_budget > 0 ? send_budget : U32_MAX,
+						[&] (u16 id, u16 age) {
+							return get_object_update_priority(
+								m_env->getActiveObject(id), player, age);
+						},
+						[&] (u16 id, const std::string &data) {
+							append_object_message(unreliable_data, id, data);
+						});
+				}
+
 				/*
 					reliable_data and unreliable_data are now ready.
 					Send them.
@@ -1373,6 +1439,11 @@ void Server::setTimeOfDay(u32 time)
 
 void Server::onMapEditEvent(const MapEditEvent &event)
 {
+	// The modification counter already protects against stale data,
+	// but there is no point in keeping these around.
+	for (v3s16 blockpos : event.modified_blocks)
+		m_block_cache.invalidate(blockpos);
+
 	if (m_ignore_map_edit_events_area.contains(event.getArea()))
 		return;
 
@@ -1518,24 +1589,51 @@ void Server::SendAccessDenied(session_t peer_id, AccessDeniedCode reason,
 	Send(&pkt);
 }
 
-void Server::SendItemDef(session_t peer_id,
-		IItemDefManager *itemdef, u16 protocol_version)
+std::shared_ptr<const std::string> Server::getSerializedDefinitions(
+	std::vector<SerializedDefinitions> &cache, u32 change_counter,
+	u16 protocol_version, bool zstd,
+	const std::function<void(std::ostream &)> &serialize)
 {
-	auto *client = m_clients.getClientNoEx(peer_id, CS_Created);
-	assert(client);
-
-	NetworkPacket pkt(TOCLIENT_ITEMDEF, 0, peer_id);
+	for (auto it = cache.begin(); it != cache.end(); ) {
+		if (it->change_counter != change_counter) {
+			it = cache.erase(it);
+			continue;
+		}
+		if (it->protocol_version == protocol_version && it->zstd == zstd)
+			return it->data;
+		++it;
+	}
 
 	std::ostringstream tmp_os2(std::ios::binary);
 	{
 		std::ostringstream tmp_os(std::ios::binary);
-		itemdef->serialize(tmp_os, protocol_version);
-		if (client->net_proto_version >= 48)
+		serialize(tmp_os);
+		if (zstd)
 			compressZstd(tmp_os.str(), tmp_os2);
 		else
 			compressZlib(tmp_os.str(), tmp_os2);
 	}
-	pkt.putLongString(tmp_os2.str());
+	auto data = std::make_shared<const std::string>(tmp_os2.str());
+	cache.push_back({change_counter, protocol_version, zstd, data});
+	return data;
+}
+
+void Server::SendItemDef(session_t peer_id,
+		IItemDefManager *itemdef, u16 protocol_version)
+{
+	auto *client = m_clients.getClientNoEx(peer_id, CS_Created);
+	assert(client);
+
+	const auto data = getSerializedDefinitions(m_itemdef_cache,
+		itemdef->getChangeCounter(), protocol_version,
+		client->net_proto_version >= 48, [&] (std::ostream &os) {
+			itemdef->serialize(os, protocol_version);
+		});
+
+	// Same as putLongString(), but shared with the other clients
+	NetworkPacket pkt(TOCLIENT_ITEMDEF, 4, peer_id);
+	pkt << static_cast<u32>(data->size());
+	pkt.putSharedRawString(data);
 
 	// Make data buffer
 	verbosestream << "Server: Sending item definitions to id(" << peer_id
@@ -1550,18 +1648,16 @@ void Server::SendNodeDef(session_t peer_id,
 	auto *client = m_clients.getClientNoEx(peer_id, CS_Created);
 	assert(client);
 
-	NetworkPacket pkt(TOCLIENT_NODEDEF, 0, peer_id);
+	const auto data = getSerializedDefinitions(m_nodedef_cache,
+		nodedef->getChangeCounter(), protocol_version,
+		client->net_proto_version >= 48, [&] (std::ostream &os) {
+			nodedef->serialize(os, protocol_version);
+		});
 
-	std::ostringstream tmp_os2(std::ios::binary);
-	{
-		std::ostringstream tmp_os(std::ios::binary);
-		nodedef->serialize(tmp_os, protocol_version);
-		if (client->net_proto_version >= 48)
-			compressZstd(tmp_os.str(), tmp_os2);
-		else
-			compressZlib(tmp_os.str(), tmp_os2);
-	}
-	pkt.putLongString(tmp_os2.str());
+	// Same as putLongString(), but shared with the other clients
+	NetworkPacket pkt(TOCLIENT_NODEDEF, 4, peer_id);
+	pkt << static_cast<u32>(data->size());
+	pkt.putSharedRawString(data);
 
 	// Make data buffer
 	verbosestream << "Server: Sending node definitions to id(" << peer_id
@@ -2207,6 +2303,7 @@ void Server::SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersa
 
 		// Remove from known objects
 		client->m_known_objects.erase(id);
+		client->m_held_object_updates.erase(id);
 		if (obj && obj->m_known_by_count > 0)
 			obj->m_known_by_count--;
 	}
@@ -2500,102 +2597,190 @@ void Server::sendMetadataChanged(const std::unordered_set<v3s16> &positions, flo
 }
 
 void Server::SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver,
-		u16 net_proto_version, SerializedBlockCache *cache)
+		u16 net_proto_version, bool map_dictionary)
 {
 	thread_local const int net_compression_level = rangelim(g_settings->getS16("map_compression_level_net"), -1, 9);
-	std::string s, *sptr = nullptr;
 
-	if (cache) {
-		auto it = cache->find({block->getPos(), ver});
-		if (it != cache->end())
-			sptr = &it->second;
-	}
+	const v3s16 pos = block->getPos();
+	const u64 mod_counter = block->getModificationCounter();
+	const u16 format = SerializedBlockCache::getFormat(ver, map_dictionary);
+	SerializedBlockCache::Data data = m_block_cache.get(pos, format, mod_counter);
 
 	// Serialize the block in the right format
-	if (!sptr) {
+	if (!data) {
+		std::string result;
+		block->serialize(result, ver, false, net_compression_level,
+			map_dictionary ? m_env->getServerMap().getNetDictionary() : nullptr);
 		std::ostringstream os(std::ios_base::binary);
-		block->serialize(os, ver, false, net_compression_level);
 		block->serializeNetworkSpecific(os);
-		s = os.str();
-		sptr = &s;
+		result += os.str();
+		data = std::make_shared<const std::string>(std::move(result));
+		m_block_cache.put(pos, format, mod_counter, data);
 	}
 
-	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + sptr->size(), peer_id);
-	pkt << block->getPos();
-	pkt.putRawString(*sptr);
-	Send(&pkt);
+	SendSerializedBlock(peer_id, pos, data);
+}
 
-	// Store away in cache
-	if (cache && sptr == &s)
-		(*cache)[{block->getPos(), ver}] = std::move(s);
+void Server::SendSerializedBlock(session_t peer_id, v3s16 pos,
+		const SerializedBlockCache::Data &data)
+{
+	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2, peer_id);
+	pkt << pos;
+	pkt.putSharedRawString(data);
+	Send(&pkt);
 }
 
 void Server::SendBlocks(float dtime)
 {
-	EnvAutoLock envlock(this);
+	thread_local const int net_compression_level = rangelim(g_settings->getS16("map_compression_level_net"), -1, 9);
+
+	struct BlockToSend {
+		session_t peer_id;
+		v3s16 pos;
+		SerializedBlockCache::Data data;
+		// index of the BlockToSend that serializes the same block, if not cached
+		size_t source;
+	};
+
+	// Blocks that are not cached yet, snapshotted for compression
+	struct BlockSnapshot {
+		u8 ver;
+		u16 format;
+		const ZstdDictionary *dict;
+		u64 mod_counter;
+		std::string raw;
+		std::string tail;
+	};
 
-	std::vector<PrioritySortedBlockTransfer> queue;
+	std::vector<BlockToSend> to_send;
+	std::unordered_map<size_t, BlockSnapshot> snapshots;
 
-	u32 total_sending = 0, unique_clients = 0;
+	m_block_cache.step(dtime);
 
 	{
-		ScopeProfiler sp2(g_profiler, "Server::SendBlocks(): Collect list");
+		EnvAutoLock envlock(this);
 
-		std::vector<session_t> clients = m_clients.getClientIDs();
+		std::vector<PrioritySortedBlockTransfer> queue;
 
-		ClientInterface::AutoLock clientlock(m_clients);
-		for (const session_t client_id : clients) {
-			RemoteClient *client = m_clients.lockedGetClientNoEx(client_id, CS_Active);
+		u32 total_sending = 0;
 
-			if (!client)
-				continue;
+		{
+			ScopeProfiler sp2(g_profiler, "Server::SendBlocks(): Collect list");
 
-			total_sending += client->getSendingCount();
-			const auto old_count = queue.size();
-			client->GetNextBlocks(m_env, m_emerge.get(), dtime, queue);
-			unique_clients += queue.size() > old_count ? 1 : 0;
+			std::vector<session_t> clients = m_clients.getClientIDs();
+
+			ClientInterface::AutoLock clientlock(m_clients);
+			for (const session_t client_id : clients) {
+				RemoteClient *client = m_clients.lockedGetClientNoEx(client_id, CS_Active);
+
+				if (!client)
+					continue;
+
+				total_sending += client->getSendingCount();
+				client->GetNextBlocks(m_env, m_emerge.get(), dtime, queue);
+			}
 		}
-	}
 
-	// Sort.
-	// Lowest priority number comes first.
-	// Lowest is most important.
-	std::sort(queue.begin(), queue.end());
+		// Sort.
+		// Lowest priority number comes first.
+		// Lowest is most important.
+		std::sort(queue.begin(), queue.end());
 
-	ClientInterface::AutoLock clientlock(m_clients);
+		ClientInterface::AutoLock clientlock(m_clients);
 
-	// Maximal total count calculation
-	// The per-client block sends is halved with the maximal online users
-	u32 max_blocks_to_send = (m_env->getPlayerCount() + g_settings->getU32("max_users")) *
-		g_settings->getU32("max_simultaneous_block_sends_per_client") / 4 + 1;
+		// Maximal total count calculation
+		// The per-client block sends is halved with the maximal online users
+		u32 max_blocks_to_send = (m_env->getPlayerCount() + g_settings->getU32("max_users")) *
+			g_settings->getU32("max_simultaneous_block_sends_per_client") / 4 + 1;
 
-	ScopeProfiler sp(g_profiler, "Server::SendBlocks(): Send to clients");
-	Map &map = m_env->getMap();
+		ScopeProfiler sp(g_profiler, "Server::SendBlocks(): Snapshot blocks");
+		ServerMap &map = m_env->getServerMap();
 
-	SerializedBlockCache cache, *cache_ptr = nullptr;
-	if (unique_clients > 1) {
-		// caching is pointless with a single client
-		cache_ptr = &cache;
-	}
+		// (pos, format) -> index in to_send, for blocks requested by multiple clients
+		std::unordered_map<v3s16, std::vector<std::pair<u16, size_t>>> serialized_here;
 
-	for (const PrioritySortedBlockTransfer &block_to_send : queue) {
-		if (total_sending >= max_blocks_to_send)
-			break;
+		for (const PrioritySortedBlockTransfer &block_to_send : queue) {
+			if (total_sending >= max_blocks_to_send)
+				break;
 
-		MapBlock *block = map.getBlockNoCreateNoEx(block_to_send.pos);
-		if (!block)
-			continue;
+			MapBlock *block = map.getBlockNoCreateNoEx(block_to_send.pos);
+			if (!block)
+				continue;
 
-		RemoteClient *client = m_clients.lockedGetClientNoEx(block_to_send.peer_id,
-				CS_Active);
-		if (!client)
-			continue;
+			RemoteClient *client = m_clients.lockedGetClientNoEx(block_to_send.peer_id,
+					CS_Active);
+			if (!client)
+				continue;
+
+			const v3s16 pos = block_to_send.pos;
+			const u8 ver = client->serialization_version;
+			const u16 format = SerializedBlockCache::getFormat(ver, client->map_dictionary);
+			const u64 mod_counter = block->getModificationCounter();
+			BlockToSend item{block_to_send.peer_id, pos,
+				m_block_cache.get(pos, format, mod_counter), to_send.size()};
+
+			if (!item.data) {
+				auto &same_pos = serialized_here[pos];
+				for (auto &it : same_pos) {
+					if (it.first == format)
+						item.source = it.second;
+				}
+			}
+
+			if (!item.data && item.source == to_send.size()) {
+				serialized_here[pos].emplace_back(format, item.source);
+				if (ver >= 29) {
+					// Cheap part under the lock, compression happens later
+					BlockSnapshot snap{ver, format,
+						client->map_dictionary ? map.getNetDictionary() : nullptr,
+						mod_counter, {}, {}};
+					block->serializeUncompressed(snap.raw, ver, false);
+					std::ostringstream os(std::ios_base::binary);
+					block->serializeNetworkSpecific(os);
+					snap.tail = os.str();
+					snapshots.emplace(item.source, std::move(snap));
+				} else {
+					// Older formats compress parts individually
+					std::string result;
+					block->serialize(result, ver, false, net_compression_level);
+					std::ostringstream os(std::ios_base::binary);
+					block->serializeNetworkSpecific(os);
+					result += os.str();
+					item.data = std::make_shared<const std::string>(std::move(result));
+					m_block_cache.put(pos, format, mod_counter, item.data);
+				}
+			}
+
+			client->SentBlock(pos);
+			to_send.push_back(std::move(item));
+			total_sending++;
+		}
+	}
 
-		SendBlockNoLock(block_to_send.peer_id, block, client->serialization_version,
-				client->net_proto_version, cache_ptr);
+	ScopeProfiler sp(g_profiler, "Server::SendBlocks(): Send to clients");
+
+	// Compress the snapshots in parallel, without holding the env lock
+	const int compression_level = net_compression_level;
+	for (auto &it : snapshots) {
+		BlockToSend *item = &to_send[it.first];
+		BlockSnapshot *snap = &it.second;
+		m_block_send_pool->submit([item, snap, compression_level] () {
+			std::string result;
+			compress(snap->raw, result, snap->ver, compression_level, snap->dict);
+			result += snap->tail;
+			item->data = std::make_shared<const std::string>(std::move(result));
+		});
+	}
+	m_block_send_pool->waitIdle();
+
+	for (auto &it : snapshots) {
+		const BlockToSend &item = to_send[it.first];
+		m_block_cache.put(item.pos, it.second.format, it.second.mod_counter, item.data);
+	}
 
-		client->SentBlock(block_to_send.pos);
-		total_sending++;
+	for (const BlockToSend &item : to_send) {
+		const auto &data = item.data ? item.data : to_send[item.source].data;
+		SendSerializedBlock(item.peer_id, item.pos, data);
 	}
 }
 
@@ -2610,7 +2795,7 @@ bool Server::SendBlock(session_t peer_id, const v3s16 &blockpos)
 	if (!client || client->isBlockSent(blockpos))
 		return false;
 	SendBlockNoLock(peer_id, block, client->serialization_version,
-			client->net_proto_version);
+			client->net_proto_version, client->map_dictionary);
 
 	return true;
 }
@@ -2669,6 +2854,7 @@ bool Server::addMediaFile(const std::string &filename,
 
 	// Put in list
 	m_media[filename] = MediaInfo(filepath, sha1);
+	m_media[filename].file = std::make_shared<CachedMediaFile>(filepath);
 	verbosestream << "Server: " << sha1_hex << " is " << filename
 			<< " (" << (filedata.size() >> 10) << "KiB)" << std::endl;
 
@@ -2784,13 +2970,7 @@ namespace {
 struct SendableMedia
 {
 	const std::string &name;
-	const std::string &path;
-	std::string data;
-
-	SendableMedia(const std::string &name, const std::string &path,
-			std::string &&data):
-		name(name), path(path), data(std::move(data))
-	{}
+	CachedMediaFile::Data data;
 };
 
 }
@@ -2807,23 +2987,7 @@ void Server::sendRequestedMedia(session_t peer_id,
 		<< tosend.size() << " files to " << client->getName()
 		<< (compress ? " (compressed)" : "") << std::endl;
 
-	/* Read files and prepare bunches */
-
-	// Put 5KB in one bunch (this is not accurate)
-	// This is a tradeoff between burdening the network with too many packets
-	// and burdening it with too large split packets.
-	const u32 bytes_per_bunch = 5000;
-
-	std::vector<std::vector<SendableMedia>> file_bunches;
-	file_bunches.emplace_back();
-
-	// Note that applying a "real" bin packing algorithm here is not necessarily
-	// an improvement (might even perform worse) since games usually have lots
-	// of files larger than 5KB and the current algorithm already minimizes
-	// the amount of bunches quite well (at the expense of overshooting).
-
-	u32 file_size_bunch_total = 0;
-	size_t bytes_compressed = 0, bytes_uncompressed = 0;
+	std::vector<std::pair<std::string, std::shared_ptr<CachedMediaFile>>> files;
 	for (const std::string &name : tosend) {
 		auto it = m_media.find(name);
 
@@ -2844,25 +3008,51 @@ void Server::sendRequestedMedia(session_t peer_id,
 			}
 		}
 
-		// Read data
-		std::string data;
-		if (!fs::ReadFile(m.path, data, true)) {
+		files.emplace_back(name, m.file);
+	}
+
+	// Reading and compressing the files can take long, so do it (and the
+	// rest) without holding up the server thread
+	m_media_send_pool->submit([this, peer_id, compress, files = std::move(files)] () {
+		sendMediaBunches(peer_id, compress, files);
+	});
+}
+
+void Server::sendMediaBunches(session_t peer_id, bool compress,
+	const std::vector<std::pair<std::string, std::shared_ptr<CachedMediaFile>>> &files)
+{
+	// The client may have left in the meantime
+	if (!m_clients.getClientNoEx(peer_id, CS_DefinitionsSent))
+		return;
+
+	/* Read files and prepare bunches */
+
+	// Put 5KB in one bunch (this is not accurate)
+	// This is a tradeoff between burdening the network with too many packets
+	// and burdening it with too large split packets.
+	const u32 bytes_per_bunch = 5000;
+
+	std::vector<std::vector<SendableMedia>> file_bunches;
+	file_bunches.emplace_back();
+
+	// Note that applying a "real" bin packing algorithm here is not necessarily
+	// an improvement (might even perform worse) since games usually have lots
+	// of files larger than 5KB and the current algorithm already minimizes
+	// the amount of bunches quite well (at the expense of overshooting).
+
+	u32 file_size_bunch_total = 0;
+	size_t bytes_compressed = 0, bytes_uncompressed = 0;
+	for (const auto &[name, file] : files) {
+		// Read data, or get it from the previous clients
+		CachedMediaFile::Data data = file->get(compress);
+		if (!data)
 			continue;
-		}
-		bytes_uncompressed += data.size();
-		if (compress) {
-			// Zstd is very fast and can handle non-compressible data efficiently
-			// so we can just throw it at every file. Still we don't want to
-			// spend too much here, so we use the lowest compression level.
-			std::ostringstream oss(std::ios::binary);
-			compressZstd(data, oss, 1);
-			data = oss.str();
-		}
-		bytes_compressed += data.size();
+		bytes_uncompressed += file->getSize();
+		bytes_compressed += data->size();
 
 		// Put in list
-		file_size_bunch_total += data.size();
-		file_bunches.back().emplace_back(name, m.path, std::move(data));
+		file_size_bunch_total += data->size();
+		file_bunches.back().push_back({name, std::move(data)});
 
 		// Start next bunch if got enough data
 		if(file_size_bunch_total >= bytes_per_bunch) {
@@ -2881,9 +3071,16 @@ void Server::sendRequestedMedia(session_t peer_id,
 		const u32 bunch_size = bunch.size();
 		pkt << num_bunches << i << bunch_size;
 
-		for (auto &j : bunch) {
-			pkt << j.name;
-			pkt.putLongString(j.data);
+		for (u32 j = 0; j < bunch_size; j++) {
+			pkt << bunch[j].name;
+			if (j + 1 < bunch_size) {
+				pkt.putLongString(*bunch[j].data);
+			} else {
+				// The last file is usually the biggest one, it is shared
+				// with the packet instead of copied
+				pkt << static_cast<u32>(bunch[j].data->size());
+				pkt.putSharedRawString(bunch[j].data);
+			}
 		}
 		bunch.clear(); // free memory early
 
@@ -3053,6 +3250,9 @@ void Server::acceptAuth(session_t peer_id, bool forSudoMode)
 		resp_pkt << v3f() << (u64) m_env->getServerMap().getSeed()
 				<< g_settings->getFloat("dedicated_server_step")
 				<< client->allowed_auth_mechs;
+		// Only sent after authentication, it is derived from world data
+		if (client->map_dictionary)
+			resp_pkt.putLongString(m_env->getServerMap().getNetDictionary()->getData());
 
 		Send(&resp_pkt);
 		m_clients.event(peer_id, CSE_AuthAccept);
@@ -3087,6 +3287,9 @@ void Server::DeleteClient(session_t peer_id, ClientDeletionReason reason)
 		// clear formspec info so the next client can't abuse the current state
 		m_formspec_state_data.erase(peer_id);
 
+		// the blocks the client was waiting for are not needed anymore
+		m_emerge->cancelBlockEmerges(peer_id);
+
 		RemotePlayer *player = m_env->getPlayer(peer_id);
 
 		/* Run scripts and remove from environment */
@@ -3818,7 +4021,9 @@ bool Server::dynamicAddMedia(const DynamicMediaArgs &a)
 
 		media_it->second.no_announce = true;
 		media_it->second.ephemeral = true;
-		// stepPendingDynMediaCallbacks will clean the file up later
+		// stepPendingDynMediaCallbacks will clean the file up later,
+		// possibly while it is still being sent
+		media_it->second.file = std::make_shared<CachedMediaFile>(filepath, filedata);
 	} else if (a.data) {
 		// data is in a temporary file but not ephemeral, so the cleanup point
 		// is different.
@@ -14,13 +14,16 @@
 #include "util/basic_macros.h"
 #include "util/metricsbackend.h"
 #include "server/clientiface.h"
+#include "server/serialized_block_cache.h"
 #include "threading/ordered_mutex.h"
 #include "translation.h"
 #include "sound_spec.h"
 #include <atomic>
+#include <functional>
 #include <csignal>
 #include <string>
 #include <list>
+#include <memory>
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
@@ -30,6 +33,7 @@
 #include <condition_variable>
 
 class BanManager;
+class CachedMediaFile;
 class ChatEvent;
 class EmergeManager;
 class Inventory;
@@ -49,6 +53,7 @@ class ServerModManager;
 class ServerScripting;
 class ServerThread;
 class Settings;
+class WorkerPool;
 
 struct ChatEventChat;
 struct ChatInterface;
@@ -104,6 +109,8 @@ struct MediaInfo
 	bool ephemeral;
 	// does what it says. used by some cases of dynamic media.
 	bool delete_at_shutdown;
+	// contents for sending, shared with sends that are in progress
+	std::shared_ptr<CachedMediaFile> file;
 
 	MediaInfo(std::string_view path_ = "",
 	          std::string_view sha1_digest_ = ""):
@@ -517,15 +524,6 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 		std::unordered_set<session_t> waiting_players;
 	};
 
-	// The standard library does not implement std::hash for pairs so we have this:
-	struct SBCHash {
-		size_t operator() (const std::pair<v3s16, u16> &p) const {
-			return std::hash<v3s16>()(p.first) ^ p.second;
-		}
-	};
-
-	typedef std::unordered_map<std::pair<v3s16, u16>, std::string, SBCHash> SerializedBlockCache;
-
 	void init();
 
 	void SendMovement(session_t peer_id);
@@ -537,6 +535,20 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	void SendNodeDef(session_t peer_id, const NodeDefManager *nodedef,
 		u16 protocol_version);
 
+	// Definitions serialized and compressed for one kind of client
+	struct SerializedDefinitions {
+		u32 change_counter;
+		u16 protocol_version;
+		bool zstd;
+		std::shared_ptr<const std::string> data;
+	};
+	// @return data from the cache, made with `serialize` if there is none
+	//         for the current state of the definitions
+	static std::shared_ptr<const std::string> getSerializedDefinitions(
+		std::vector<SerializedDefinitions> &cache, u32 change_counter,
+		u16 protocol_version, bool zstd,
+		const std::function<void(std::ostream &)> &serialize);
+
 
 	virtual void SendChatMessage(session_t peer_id, const ChatMessage &message);
 	void SendTimeOfDay(session_t peer_id, u16 time, f32 time_speed);
@@ -583,9 +595,11 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 			float far_d_nodes = 100);
 
 	// Environment and Connection must be locked when called
-	// `cache` may only be very short lived! (invalidation not handeled)
 	void SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver,
-		u16 net_proto_version, SerializedBlockCache *cache = nullptr);
+		u16 net_proto_version, bool map_dictionary);
+	// The data is shared with the packet instead of copied
+	void SendSerializedBlock(session_t peer_id, v3s16 pos,
+		const SerializedBlockCache::Data &data);
 
 	// Sends blocks to clients (locks env and con on its own)
 	void SendBlocks(float dtime);
@@ -596,6 +610,9 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	void sendMediaAnnouncement(session_t peer_id, const std::string &lang_code);
 	void sendRequestedMedia(session_t peer_id,
 			const std::unordered_set<std::string> &tosend);
+	// Runs on m_media_send_pool
+	void sendMediaBunches(session_t peer_id, bool compress,
+		const std::vector<std::pair<std::string, std::shared_ptr<CachedMediaFile>>> &files);
 	void stepPendingDynMediaCallbacks(float dtime);
 
 	/// @brief send particle spawner to a selection of clients
@@ -773,8 +790,20 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	*/
 	VoxelArea m_ignore_map_edit_events_area;
 
+	// Network-serialized blocks shared by all clients
+	SerializedBlockCache m_block_cache;
+	// Compresses blocks for SendBlocks() outside of the env lock
+	std::unique_ptr<WorkerPool> m_block_send_pool;
+
+	// Definitions sent to joining clients, built once per kind of client
+	std::vector<SerializedDefinitions> m_itemdef_cache;
+	std::vector<SerializedDefinitions> m_nodedef_cache;
+
 	// media files known to server
 	std::unordered_map<std::string, MediaInfo> m_media;
+	// Reads, compresses and sends requested media, so that joining clients
+	// don't stall the server thread. One thread keeps the requests in order.
+	std::unique_ptr<WorkerPool> m_media_send_pool;
 
 	// pending dynamic media callbacks, clients inform the server when they have a file fetched
 	std::unordered_map<u32, PendingDynamicMediaCallback> m_pending_dyn_media;
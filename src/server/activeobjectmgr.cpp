@@ -2,14 +2,25 @@
 // SPDX-License-Identifier: LGPL-2.1-or-later
 // Copyright (C) 2010-2018 nerzhul, Loic BLOT <loic.blot@unix-experience.fr>
 
+#include <algorithm>
+#include <atomic>
 #include <log.h>
 #include "mapblock.h"
 #include "profiler.h"
 #include "activeobjectmgr.h"
+#include "threading/worker_pool.h"
 
 namespace server
 {
 
+// Shared by all managers so that revisions are never reused
+static std::atomic<u64> g_revision_counter;
+
+ActiveObjectMgr::ActiveObjectMgr()
+{
+	bumpRevision();
+}
+
 ActiveObjectMgr::~ActiveObjectMgr()
 {
 	if (!m_active_objects.empty()) {
@@ -31,6 +42,39 @@ void ActiveObjectMgr::clearIf(const std::function<bool(ServerActiveObject *, u16
 	}
 }
 
+void ActiveObjectMgr::bumpRevision()
+{
+	m_revision = ++g_revision_counter;
+}
+
+void ActiveObjectMgr::prepareStep(WorkerPool &pool, float dtime)
+{
+	// Without threads step() is just as fast on its own
+	if (pool.getThreadCount() == 0)
+		return;
+
+	// The map of objects must not be iterated from several threads
+	std::vector<ServerActiveObject *> objects;
+	objects.reserve(m_active_objects.size());
+	for (auto &ao_it : m_active_objects.iter()) {
+		if (ao_it.second && !ao_it.second->isGone())
+			objects.push_back(ao_it.second.get());
+	}
+
+	// A few tasks per thread even out objects that take longer than others
+	const size_t num_tasks = std::min<size_t>(objects.size(),
+			pool.getThreadCount() * 4);
+	for (size_t t = 0; t < num_tasks; t++) {
+		const size_t begin = objects.size() * t / num_tasks;
+		const size_t end = objects.size() * (t + 1) / num_tasks;
+		pool.submit([&objects, begin, end, dtime] {
+			for (size_t i = begin; i < end; i++)
+				objects[i]->prepareStep(dtime);
+		});
+	}
+	pool.waitIdle();
+}
+
 void ActiveObjectMgr::step(
 		float dtime, const std::function<void(ServerActiveObject *)> &f)
 {
@@ -77,8 +121,11 @@ bool ActiveObjectMgr::registerObject(std::unique_ptr<ServerActiveObject> obj)
 	}
 
 	auto obj_id = obj->getId();
+	if (obj->getType() == ACTIVEOBJECT_TYPE_PLAYER)
+		m_player_ids.insert(obj_id);
 	m_active_objects.put(obj_id, std::move(obj));
 	m_spatial_index.insert(pos.toArray(), obj_id);
+	bumpRevision();
 
 	auto new_size = m_active_objects.size();
 	verbosestream << "Server::ActiveObjectMgr::addActiveObjectRaw(): "
@@ -103,6 +150,8 @@ void ActiveObjectMgr::removeObject(u16 id)
 				<< "id=" << id << " not found" << std::endl;
 	} else {
 		m_spatial_index.remove(id);
+		m_player_ids.erase(id);
+		bumpRevision();
 	}
 }
 
@@ -121,8 +170,10 @@ void ActiveObjectMgr::updateObjectPos(u16 id, v3f pos)
 	// HACK defensively only update if we already know the object,
 	// otherwise we're still waiting to be inserted into the index
 	// (or have already been removed).
-	if (m_active_objects.get(id))
+	if (m_active_objects.get(id)) {
 		m_spatial_index.update(pos.toArray(), id);
+		bumpRevision();
+	}
 }
 
 void ActiveObjectMgr::getObjectsInsideRadius(v3f pos, float radius,
@@ -162,42 +213,50 @@ void ActiveObjectMgr::getAddedActiveObjectsAroundPos(
 		std::vector<u16> &added_objects)
 {
 	/*
-		Go through the object list,
+		Go through the objects within radius and the players,
 		- discard removed/deactivated objects,
 		- discard objects that are too far away,
 		- discard objects that are found in current_objects,
 		- discard objects that are not observed by the player.
 		- add remaining objects to added_objects
 	*/
-	for (auto &ao_it : m_active_objects.iter()) {
-		u16 id = ao_it.first;
-
-		// Get object
-		ServerActiveObject *object = ao_it.second.get();
-		if (!object)
-			continue;
-
-		if (object->isGone())
-			continue;
-
-		f32 distance_f = object->getBasePosition().getDistanceFrom(player_pos);
-		if (object->getType() == ACTIVEOBJECT_TYPE_PLAYER) {
-			// Discard if too far
-			if (distance_f > player_radius && player_radius != 0)
-				continue;
-		} else if (distance_f > radius)
-			continue;
+	auto add_object = [&] (u16 id, ServerActiveObject *object) {
+		if (!object || object->isGone())
+			return;
 
 		if (!object->isEffectivelyObservedBy(player_name))
-			continue;
+			return;
 
 		// Discard if already on current_objects
-		auto n = current_objects.find(id);
-		if (n != current_objects.end())
-			continue;
+		if (current_objects.find(id) != current_objects.end())
+			return;
 		// Add to added_objects
 		added_objects.push_back(id);
+	};
+
+	const size_t begin = added_objects.size();
+	const f32 r_squared = radius * radius;
+	m_spatial_index.rangeQuery((player_pos - v3f(radius)).toArray(),
+			(player_pos + v3f(radius)).toArray(), [&] (auto obj_pos, u16 id) {
+		if (v3f(obj_pos).getDistanceFromSQ(player_pos) > r_squared)
+			return;
+		// Players are handled below
+		if (m_player_ids.count(id))
+			return;
+		add_object(id, m_active_objects.get(id).get());
+	});
+
+	for (u16 id : m_player_ids) {
+		ServerActiveObject *object = m_active_objects.get(id).get();
+		// Discard if too far
+		if (!object || (player_radius != 0 &&
+				object->getBasePosition().getDistanceFrom(player_pos) > player_radius))
+			continue;
+		add_object(id, object);
 	}
+
+	// Sorted by ID, like when going through all objects
+	std::sort(added_objects.begin() + begin, added_objects.end());
 }
 
 } // namespace server
@@ -7,19 +7,25 @@
 #include <functional>
 #include <vector>
 #include <set>
+#include <unordered_set>
 #include "../activeobjectmgr.h"
 #include "serveractiveobject.h"
 #include "util/k_d_tree.h"
 
+class WorkerPool;
+
 namespace server
 {
 class ActiveObjectMgr final : public ::ActiveObjectMgr<ServerActiveObject>
 {
 public:
+	ActiveObjectMgr();
 	~ActiveObjectMgr() override;
 
 	// If cb returns true, the obj will be deleted
 	void clearIf(const std::function<bool(ServerActiveObject *, u16)> &cb);
+	// Runs ServerActiveObject::prepareStep() for all objects on the pool
+	void prepareStep(WorkerPool &pool, float dtime);
 	void step(float dtime,
 			const std::function<void(ServerActiveObject *)> &f) override;
 	bool registerObject(std::unique_ptr<ServerActiveObject> obj) override;
@@ -29,6 +35,12 @@ class ActiveObjectMgr final : public ::ActiveObjectMgr<ServerActiveObject>
 
 	void updateObjectPos(u16 id, v3f pos);
 
+	// Changes whenever an object is added, removed or moved. Values are
+	// never reused, not even by another manager.
+	u64 getRevision() const { return m_revision; }
+
+	size_t getObjectCount() const { return m_spatial_index.size(); }
+
 	void getObjectsInsideRadius(v3f pos, float radius,
 			std::vector<ServerActiveObject *> &result,
 			std::function<bool(ServerActiveObject *obj)> include_obj_cb);
@@ -42,6 +54,11 @@ class ActiveObjectMgr final : public ::ActiveObjectMgr<ServerActiveObject>
 			std::vector<u16> &added_objects);
 
 private:
+	void bumpRevision();
+
 	k_d_tree::DynamicKdTrees<3, f32, u16> m_spatial_index;
+	// Players can be known from further away than other objects
+	std::unordered_set<u16> m_player_ids;
+	u64 m_revision;
 };
 } // namespace server
@@ -3,6 +3,7 @@
 // Copyright (C) 2010-2017 celeron55, Perttu Ahola <celeron55@gmail.com>
 
 #include <algorithm>
+#include <atomic>
 #include "blockmodifier.h"
 #include "serverenvironment.h"
 #include "server.h"
@@ -10,6 +11,7 @@
 #include "mapblock.h"
 #include "nodedef.h"
 #include "gamedef.h"
+#include "noise.h"
 
 /*
 	ABMs
@@ -29,23 +31,84 @@ ABMWithState::ABMWithState(ActiveBlockModifier *abm_):
 struct ActiveABM
 {
 	ActiveBlockModifier *abm;
+	std::vector<content_t> trigger_contents;
 	std::vector<content_t> required_neighbors;
 	std::vector<content_t> without_neighbors;
-	int chance;
+	// 0 if the ABM does not run in this interval
+	int chance = 0;
 	s16 min_y, max_y;
 };
 
-#define CONTENT_TYPE_CACHE_MAX 64
+ABMHandler::ABMHandler(ServerEnvironment *env, unsigned int num_threads):
+	m_env(env),
+	m_pool("ABM", num_threads)
+{
+}
+
+ABMHandler::~ABMHandler() = default;
+
+void ABMHandler::rebuildTables(const std::vector<ABMWithState> &abms)
+{
+	const NodeDefManager *ndef = m_env->getGameDef()->ndef();
+
+	m_aabms.clear();
+	m_triggers.clear();
+	m_aabms.reserve(abms.size());
+	for (const ABMWithState &abmws : abms) {
+		ActiveBlockModifier *abm = abmws.abm;
+		const u32 index = m_aabms.size();
+
+		ActiveABM aabm;
+		aabm.abm = abm;
+		// y limits
+		aabm.min_y = abm->getMinY();
+		aabm.max_y = abm->getMaxY();
+
+		// Trigger neighbors
+		for (const auto &s : abm->getRequiredNeighbors())
+			ndef->getIds(s, aabm.required_neighbors);
+		SORT_AND_UNIQUE(aabm.required_neighbors);
+
+		for (const auto &s : abm->getWithoutNeighbors())
+			ndef->getIds(s, aabm.without_neighbors);
+		SORT_AND_UNIQUE(aabm.without_neighbors);
+
+		// Trigger contents
+		for (const auto &s : abm->getTriggerContents())
+			ndef->getIds(s, aabm.trigger_contents);
+		SORT_AND_UNIQUE(aabm.trigger_contents);
+		for (content_t c : aabm.trigger_contents) {
+			if (c >= m_triggers.size())
+				m_triggers.resize(c + 256);
+			m_triggers[c].push_back(index);
+		}
+
+		m_aabms.push_back(std::move(aabm));
+	}
+	m_content_active.assign(m_triggers.size(), false);
+
+	m_tables_valid = true;
+	m_abm_count = abms.size();
+	m_ndef_change_counter = ndef->getChangeCounter();
+}
 
-ABMHandler::ABMHandler(std::vector<ABMWithState> &abms,
-	float dtime_s, ServerEnvironment *env,
-	bool use_timers):
-	m_env(env)
+void ABMHandler::step(std::vector<ABMWithState> &abms, float dtime_s,
+	bool use_timers)
 {
+	if (!m_tables_valid || abms.size() != m_abm_count ||
+			m_env->getGameDef()->ndef()->getChangeCounter() != m_ndef_change_counter)
+		rebuildTables(abms);
+
+	m_any_active = false;
+	std::fill(m_content_active.begin(), m_content_active.end(), false);
+	for (ActiveABM &aabm : m_aabms)
+		aabm.chance = 0;
+
 	if (dtime_s < 0.001f)
 		return;
-	const NodeDefManager *ndef = env->getGameDef()->ndef();
-	for (ABMWithState &abmws : abms) {
+	for (size_t i = 0; i < abms.size(); i++) {
+		ABMWithState &abmws = abms[i];
+		ActiveABM &aabm = m_aabms[i];
 		ActiveBlockModifier *abm = abmws.abm;
 		float trigger_interval = abm->getTriggerInterval();
 		if (trigger_interval < 0.001f)
@@ -62,8 +125,6 @@ ABMHandler::ABMHandler(std::vector<ABMWithState> &abms,
 		if (chance == 0)
 			chance = 1;
 
-		ActiveABM aabm;
-		aabm.abm = abm;
 		if (abm->getSimpleCatchUp()) {
 			float intervals = actual_interval / trigger_interval;
 			if (intervals == 0)
@@ -74,38 +135,26 @@ ABMHandler::ABMHandler(std::vector<ABMWithState> &abms,
 		} else {
 			aabm.chance = chance;
 		}
-		// y limits
-		aabm.min_y = abm->getMinY();
-		aabm.max_y = abm->getMaxY();
-
-		// Trigger neighbors
-		for (const auto &s : abm->getRequiredNeighbors())
-			ndef->getIds(s, aabm.required_neighbors);
-		SORT_AND_UNIQUE(aabm.required_neighbors);
 
-		for (const auto &s : abm->getWithoutNeighbors())
-			ndef->getIds(s, aabm.without_neighbors);
-		SORT_AND_UNIQUE(aabm.without_neighbors);
-
-		// Trigger contents
-		std::vector<content_t> ids;
-		for (const auto &s : abm->getTriggerContents())
-			ndef->getIds(s, ids);
-		SORT_AND_UNIQUE(ids);
-		for (content_t c : ids) {
-			if (c >= m_aabms.size())
-				m_aabms.resize(c + 256, nullptr);
-			if (!m_aabms[c])
-				m_aabms[c] = new std::vector<ActiveABM>;
-			m_aabms[c]->push_back(aabm);
+		for (content_t c : aabm.trigger_contents) {
+			m_content_active[c] = true;
+			m_any_active = true;
 		}
 	}
-}
 
-ABMHandler::~ABMHandler()
-{
-	for (auto &aabms : m_aabms)
-		delete aabms;
+	// Shuffle to prevent persistent artifacts of ordering.
+	// All ABMs are put in one random order, like shuffling the ABM list
+	// did, and every trigger list follows it.
+	m_rank.resize(m_aabms.size());
+	for (u32 i = 0; i < m_rank.size(); i++)
+		m_rank[i] = i;
+	std::shuffle(m_rank.begin(), m_rank.end(), MyRandGenerator());
+	for (size_t c = 0; c < m_triggers.size(); c++) {
+		if (m_content_active[c] && m_triggers[c].size() > 1) {
+			std::sort(m_triggers[c].begin(), m_triggers[c].end(),
+				[this] (u32 a, u32 b) { return m_rank[a] < m_rank[b]; });
+		}
+	}
 }
 
 u32 ABMHandler::countObjects(MapBlock *block, ServerMap *map, u32 &wider)
@@ -131,20 +180,60 @@ u32 ABMHandler::countObjects(MapBlock *block, ServerMap *map, u32 &wider)
 	return active_object_count;
 }
 
-void ABMHandler::apply(MapBlock *block, int &blocks_scanned, int &abms_run, int &blocks_cached)
+void ABMHandler::scan(const std::vector<MapBlock *> &blocks,
+	int &blocks_scanned, int &blocks_cached)
 {
-	if (m_aabms.empty())
+	m_scanned.resize(blocks.size());
+	for (size_t i = 0; i < blocks.size(); i++) {
+		ScannedBlock &sb = m_scanned[i];
+		sb.block = blocks[i];
+		sb.pos = blocks[i]->getPos();
+		sb.candidates.clear();
+	}
+
+	if (!m_any_active || blocks.empty())
 		return;
 
+	// A few tasks per thread even out blocks that take longer than others
+	const size_t num_tasks = std::min<size_t>(blocks.size(),
+			std::max(1U, m_pool.getThreadCount() * 4));
+	std::atomic<int> total_scanned{0}, total_cached{0};
+	for (size_t t = 0; t < num_tasks; t++) {
+		const size_t begin = blocks.size() * t / num_tasks;
+		const size_t end = blocks.size() * (t + 1) / num_tasks;
+		// myrand() must only be used on this thread
+		const u64 seed = ((u64)myrand() << 32) | myrand();
+		m_pool.submit([this, begin, end, seed, &total_scanned, &total_cached] {
+			PcgRandom rand(seed);
+			int scanned = 0, cached = 0;
+			for (size_t i = begin; i < end; i++)
+				scanBlock(m_scanned[i], rand, scanned, cached);
+			total_scanned += scanned;
+			total_cached += cached;
+		});
+	}
+	m_pool.waitIdle();
+
+	blocks_scanned += total_scanned;
+	blocks_cached += total_cached;
+}
+
+void ABMHandler::scanBlock(ScannedBlock &sb, PcgRandom &rand,
+	int &blocks_scanned, int &blocks_cached) const
+{
+	MapBlock *block = sb.block;
+
 	// Check the content type cache first
 	// to see whether there are any ABMs
 	// to be run at all for this block.
+	// Filling it is much cheaper than the scan below, and setNode()
+	// keeps it valid afterwards.
+	block->cacheContents();
 	if (!block->contents.empty()) {
-		assert(!block->do_not_cache_contents); // invariant
 		blocks_cached++;
 		bool run_abms = false;
 		for (content_t c : block->contents) {
-			if (c < m_aabms.size() && m_aabms[c]) {
+			if (isActive(c)) {
 				run_abms = true;
 				break;
 			}
@@ -156,42 +245,27 @@ void ABMHandler::apply(MapBlock *block, int &blocks_scanned, int &abms_run, int
 
 	ServerMap *map = &m_env->getServerMap();
 
-	u32 active_object_count_wider;
-	u32 active_object_count = countObjects(block, map, active_object_count_wider);
-	m_env->m_added_objects = 0;
-
-	bool want_contents_cached = block->contents.empty() && !block->do_not_cache_contents;
-
+	u16 index = 0;
 	v3s16 p0;
 	for(p0.Z=0; p0.Z<MAP_BLOCKSIZE; p0.Z++)
 	for(p0.Y=0; p0.Y<MAP_BLOCKSIZE; p0.Y++)
-	for(p0.X=0; p0.X<MAP_BLOCKSIZE; p0.X++)
+	for(p0.X=0; p0.X<MAP_BLOCKSIZE; p0.X++, index++)
 	{
-		MapNode n = block->getNodeNoCheck(p0);
-		content_t c = n.getContent();
-
-		// Cache content types as we go
-		if (want_contents_cached && !CONTAINS(block->contents, c)) {
-			if (block->contents.size() >= CONTENT_TYPE_CACHE_MAX) {
-				// Too many different nodes... don't try to cache
-				want_contents_cached = false;
-				block->do_not_cache_contents = true;
-				decltype(block->contents) empty;
-				std::swap(block->contents, empty);
-			} else {
-				block->contents.push_back(c);
-			}
-		}
+		const content_t c = block->getNodeNoCheck(p0).getContent();
 
-		if (c >= m_aabms.size() || !m_aabms[c])
+		if (!isActive(c))
 			continue;
 
 		v3s16 p = p0 + block->getPosRelative();
-		for (ActiveABM &aabm : *m_aabms[c]) {
+		for (u32 i : m_triggers[c]) {
+			const ActiveABM &aabm = m_aabms[i];
+			if (aabm.chance == 0)
+				continue;
+
 			if (p.Y < aabm.min_y || p.Y > aabm.max_y)
 				continue;
 
-			if (myrand() % aabm.chance != 0)
+			if (rand.next() % aabm.chance != 0)
 				continue;
 
 			// Check neighbors
@@ -238,25 +312,53 @@ void ABMHandler::apply(MapBlock *block, int &blocks_scanned, int &abms_run, int
 
 neighbor_found:
 
-			abms_run++;
-			// Call all the trigger variations
-			aabm.abm->trigger(m_env, p, n);
-			aabm.abm->trigger(m_env, p, n,
-				active_object_count, active_object_count_wider);
+			sb.candidates.push_back(Candidate{i, c, index});
+		}
+	}
+}
 
-			if (block->isOrphan())
-				return;
+void ABMHandler::trigger(size_t i, int &abms_run)
+{
+	const ScannedBlock &sb = m_scanned[i];
+	if (sb.candidates.empty())
+		return;
 
-			// Count surrounding objects again if the abms added any
-			if (m_env->m_added_objects > 0) {
-				active_object_count = countObjects(block, map, active_object_count_wider);
-				m_env->m_added_objects = 0;
-			}
+	// Actions on earlier blocks may have removed this one
+	ServerMap *map = &m_env->getServerMap();
+	MapBlock *block = map->getBlockNoCreateNoEx(sb.pos);
+	if (block != sb.block || block->isOrphan())
+		return;
 
-			// Update and check node after possible modification
-			n = block->getNodeNoCheck(p0);
-			if (n.getContent() != c)
-				break;
+	u32 active_object_count_wider;
+	u32 active_object_count = countObjects(block, map, active_object_count_wider);
+	m_env->m_added_objects = 0;
+
+	for (const Candidate &cand : sb.candidates) {
+		const v3s16 p0(cand.index % MAP_BLOCKSIZE,
+				cand.index / MAP_BLOCKSIZE % MAP_BLOCKSIZE,
+				cand.index / (MAP_BLOCKSIZE * MAP_BLOCKSIZE));
+
+		// Check node after possible modification by previous actions
+		MapNode n = block->getNodeNoCheck(p0);
+		if (n.getContent() != cand.content)
+			continue;
+
+		const ActiveABM &aabm = m_aabms[cand.abm];
+		const v3s16 p = p0 + block->getPosRelative();
+
+		abms_run++;
+		// Call all the trigger variations
+		aabm.abm->trigger(m_env, p, n);
+		aabm.abm->trigger(m_env, p, n,
+			active_object_count, active_object_count_wider);
+
+		if (block->isOrphan())
+			return;
+
+		// Count surrounding objects again if the abms added any
+		if (m_env->m_added_objects > 0) {
+			active_object_count = countObjects(block, map, active_object_count_wider);
+			m_env->m_added_objects = 0;
 		}
 	}
 }
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <map>
@@ -12,11 +13,13 @@
 
 #include "irr_v3d.h"
 #include "mapnode.h"
+#include "threading/worker_pool.h"
 
 class ServerEnvironment;
 class ServerMap;
 class MapBlock;
 class IGameDef;
+class PcgRandom;
 
 /*
 	ABMs
@@ -62,17 +65,77 @@ struct ABMWithState
 
 struct ActiveABM; // hidden
 
+/*
+	Runs ABMs on blocks. The trigger tables are resolved once and only
+	rebuilt when the ABMs or the node definitions change.
+
+	Running them has two phases: scan() finds the nodes that ABMs trigger
+	on, spread over a worker pool since it only reads the map. trigger()
+	then calls the ABM actions on the server thread.
+*/
 class ABMHandler
 {
+	// A node that an ABM triggers on, found by scan()
+	struct Candidate
+	{
+		// index into m_aabms
+		u32 abm;
+		// content of the node when it was scanned
+		content_t content;
+		// node index within the block
+		u16 index;
+	};
+
+	struct ScannedBlock
+	{
+		MapBlock *block;
+		v3s16 pos;
+		std::vector<Candidate> candidates;
+	};
+
 	ServerEnvironment *m_env;
-	// vector index = content_t
-	std::vector<std::vector<ActiveABM>*> m_aabms;
+	// Resolved ABMs, same order as the list passed to step()
+	std::vector<ActiveABM> m_aabms;
+	// vector index = content_t, values are indices into m_aabms
+	std::vector<std::vector<u32>> m_triggers;
+	// vector index = index into m_aabms, position in this interval's order
+	std::vector<u32> m_rank;
+	// vector index = content_t, whether any of its ABMs runs in this interval
+	std::vector<bool> m_content_active;
+	bool m_any_active = false;
+
+	// To find out when the tables need to be rebuilt
+	bool m_tables_valid = false;
+	size_t m_abm_count = 0;
+	u32 m_ndef_change_counter = 0;
+
+	// Results of the last scan(), same order as the blocks passed to it
+	std::vector<ScannedBlock> m_scanned;
+	WorkerPool m_pool;
+
+	void rebuildTables(const std::vector<ABMWithState> &abms);
+
+	bool isActive(content_t c) const
+	{
+		return c < m_content_active.size() && m_content_active[c];
+	}
+
+	// Fills in the candidates of one block. Must not modify anything but
+	// the block's content cache, since it runs on the worker threads.
+	// Every block is given to exactly one worker, so no other thread
+	// touches that cache meanwhile.
+	void scanBlock(ScannedBlock &sb, PcgRandom &rand,
+			int &blocks_scanned, int &blocks_cached) const;
 
 public:
-	ABMHandler(std::vector<ABMWithState> &abms,
-		float dtime_s, ServerEnvironment *env,
-		bool use_timers);
+	// num_threads = 0 scans the blocks on the calling thread
+	ABMHandler(ServerEnvironment *env, unsigned int num_threads);
 	~ABMHandler();
+	DISABLE_CLASS_COPY(ABMHandler);
+
+	// Advances the ABM timers and decides which ABMs run on the following
+	// scan() calls. Without timers, all ABMs run as if dtime_s had passed.
+	void step(std::vector<ABMWithState> &abms, float dtime_s, bool use_timers);
 
 	// Find out how many objects the given block and its neighbors contain.
 	// Returns the number of objects in the block, and also in 'wider' the
@@ -80,7 +143,22 @@ class ABMHandler
 	// may be an estimate if any neighbors are unloaded.
 	static u32 countObjects(MapBlock *block, ServerMap * map, u32 &wider);
 
-	void apply(MapBlock *block, int &blocks_scanned, int &abms_run, int &blocks_cached);
+	// Finds the nodes that ABMs trigger on in the given blocks, including
+	// the chance and neighbor checks. The map must not be modified meanwhile.
+	// The blocks must all be different.
+	void scan(const std::vector<MapBlock *> &blocks,
+			int &blocks_scanned, int &blocks_cached);
+
+	// How many blocks to scan() at once, so that little scanning is wasted
+	// when the time budget ends the interval early
+	size_t getScanChunkSize() const
+	{
+		return std::max(1U, m_pool.getThreadCount()) * 32;
+	}
+
+	// Calls the ABM actions for the i-th block of the last scan().
+	// Nodes changed by earlier actions are skipped.
+	void trigger(size_t i, int &abms_run);
 };
 
 /*
@@ -0,0 +1,53 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#include "cached_media_file.h"
+#include "filesys.h"
+#include "serialization.h"
+
+CachedMediaFile::CachedMediaFile(const std::string &path, std::string data) :
+	m_path(path),
+	m_raw(std::make_shared<const std::string>(std::move(data)))
+{
+	m_size = m_raw->size();
+}
+
+CachedMediaFile::Data CachedMediaFile::get(bool compressed)
+{
+	std::lock_guard lock(m_mutex);
+	if (!compressed) {
+		if (!m_raw)
+			m_raw = readFile();
+		return m_raw;
+	}
+
+	if (m_compressed)
+		return m_compressed;
+
+	Data raw = m_raw ? m_raw : readFile();
+	if (!raw)
+		return nullptr;
+	// Zstd is very fast and can handle non-compressible data efficiently
+	// so we can just throw it at every file. Still we don't want to
+	// spend too much here, so we use the lowest compression level.
+	std::string result;
+	compressZstd(reinterpret_cast<const u8*>(raw->data()), raw->size(), result, 1);
+	m_compressed = std::make_shared<const std::string>(std::move(result));
+	return m_compressed;
+}
+
+size_t CachedMediaFile::getSize()
+{
+	std::lock_guard lock(m_mutex);
+	return m_size;
+}
+
+CachedMediaFile::Data CachedMediaFile::readFile()
+{
+	std::string data;
+	if (!fs::ReadFile(m_path, data, true))
+		return nullptr;
+	m_size = data.size();
+	return std::make_shared<const std::string>(std::move(data));
+}
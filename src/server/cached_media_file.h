@@ -0,0 +1,49 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include "util/basic_macros.h"
+
+/*
+	Contents of a media file in the forms it is sent to clients in.
+
+	The file is read when it is first requested, and compressed only once
+	for all clients that support compression, so that many clients joining
+	at the same time don't read and compress the same files over and over.
+	This class is thread-safe.
+*/
+class CachedMediaFile
+{
+public:
+	typedef std::shared_ptr<const std::string> Data;
+
+	CachedMediaFile(const std::string &path) : m_path(path) {}
+	/// For files whose contents were read already, or may go away
+	CachedMediaFile(const std::string &path, std::string data);
+
+	DISABLE_CLASS_COPY(CachedMediaFile)
+
+	/// @param compressed zstd-compressed, for protocol version 48 and newer
+	/// @return the data, or nullptr if the file can't be read
+	Data get(bool compressed);
+
+	/// @return size of the file, 0 if it was not read yet
+	size_t getSize();
+
+	const std::string &getPath() const { return m_path; }
+
+private:
+	Data readFile();
+
+	const std::string m_path;
+	std::mutex m_mutex;
+	// Only kept if clients without compression need it
+	Data m_raw;
+	Data m_compressed;
+	size_t m_size = 0;
+};
@@ -2,6 +2,8 @@
 // SPDX-License-Identifier: LGPL-2.1-or-later
 // Copyright (C) 2010-2014 celeron55, Perttu Ahola <celeron55@gmail.com>
 
+#include <algorithm>
+#include <cmath>
 #include <sstream>
 #include "clientiface.h"
 #include "debug.h"
@@ -189,6 +191,11 @@ void RemoteClient::GetNextBlocks (
 		Get the starting value of the block finder radius.
 	*/
 	if (m_last_center != center) {
+		// The blocks queued around the old position are of no use anymore
+		const v3s16 jump = center - m_last_center;
+		if (std::max({std::abs(jump.X), std::abs(jump.Y), std::abs(jump.Z)}) >
+				BLOCK_EMERGE_CANCEL_JUMP_D)
+			emerge->cancelBlockEmerges(peer_id);
 		m_nearest_unsent_d = 0;
 		m_last_center = center;
 		m_map_send_completion_timer = 0.0f;
@@ -291,8 +298,9 @@ void RemoteClient::GetNextBlocks (
 				(0.1 is about 5 degrees)
 			*/
 			f32 dist;
-			if (!(isBlockInSight(p, camera_pos, camera_dir, camera_fov,
-						d_blocks_in_sight, &dist) ||
+			const bool in_view = isBlockInSight(p, camera_pos, camera_dir,
+				camera_fov, d_blocks_in_sight, &dist);
+			if (!(in_view ||
 					(playerspeed.getLength() > 1.0f * BS &&
 					isBlockInSight(p, camera_pos, playerspeeddir, 0.1f,
 						d_blocks_in_sight)))) {
@@ -366,7 +374,14 @@ void RemoteClient::GetNextBlocks (
 			if (want_emerge) {
 				if (nearest_emerged_d == -1)
 					nearest_emerged_d = d;
-				if (emerge->enqueueBlockEmerge(peer_id, p, generate))
+				// Closest blocks first, those ahead of the camera before
+				// those only in the direction of movement
+				u32 priority = dist / (BS * MAP_BLOCKSIZE);
+				if (!in_view)
+					priority += BLOCK_EMERGE_OUT_OF_VIEW_PENALTY;
+				// Requeueing a block updates its priority and keeps the
+				// request alive
+				if (emerge->enqueueBlockEmerge(peer_id, p, generate, false, priority))
 					continue;
 				else
 					goto queue_full_break;
@@ -457,6 +472,57 @@ void RemoteClient::SetBlocksNotSent(const std::vector<v3s16> &blocks)
 	}
 }
 
+void RemoteClient::holdObjectUpdate(u16 id, std::string data)
+{
+	HeldObjectUpdate &held = m_held_object_updates[id];
+	if (!held.data.empty())
+		mergePositionUpdate(held.data, data);
+	held.data = std::move(data);
+}
+
+void RemoteClient::takeHeldObjectUpdates(u32 budget,
+	const std::function<f32(u16 id, u16 age)> &get_priority,
+	const std::function<void(u16 id, const std::string &data)> &send)
+{
+	m_held_object_order.clear();
+	for (const auto &[id, held] : m_held_object_updates)
+		m_held_object_order.emplace_back(get_priority(id, held.age), id);
+	std::sort(m_held_object_order.begin(), m_held_object_order.end());
+
+	for (const auto &[priority, id] : m_held_object_order) {
+		auto it = m_held_object_updates.find(id);
+		// u16 id, u16 length, data
+		const u32 size = 4 + it->second.data.size();
+		if (size > budget) {
+			if (it->second.age < U16_MAX)
+				it->second.age++;
+			// Smaller updates don't get ahead of more important ones
+			budget = 0;
+			continue;
+		}
+		budget -= size;
+		send(id, it->second.data);
+		m_held_object_updates.erase(it);
+	}
+}
+
+void RemoteClient::mergePositionUpdate(const std::string &earlier, std::string &later)
+{
+	// u8 command, v3f pos, v3f velocity, v3f acceleration, v3f rotation,
+	// u8 do_interpolate, ...
+	constexpr size_t DO_INTERPOLATE = 1 + 4 * 12;
+	if (earlier.size() > DO_INTERPOLATE && later.size() > DO_INTERPOLATE &&
+			earlier[DO_INTERPOLATE] == 0)
+		later[DO_INTERPOLATE] = 0;
+}
+
+f32 RemoteClient::getObjectUpdatePriority(f32 distance, bool is_player, u16 age)
+{
+	if (is_player)
+		distance /= 4.0f;
+	return distance / (1 + age);
+}
+
 void RemoteClient::notifyEvent(ClientStateEvent event)
 {
 	std::ostringstream myerror;
@@ -12,6 +12,7 @@
 #include "clientdynamicinfo.h"
 #include "constants.h" // PEER_ID_INEXISTENT
 
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <set>
@@ -220,6 +221,8 @@ class RemoteClient
 	u8 serialization_version;
 	//
 	u16 net_proto_version = 0;
+	// Whether map blocks are compressed with the map dictionary for this client
+	bool map_dictionary = false;
 
 	/* Authentication information */
 	std::string enc_pwd = "";
@@ -292,6 +295,43 @@ class RemoteClient
 	*/
 	std::set<u16> m_known_objects;
 
+	/*
+		Position updates of known objects that are held back to stay within
+		the object send budget. Only the latest one of each object is kept,
+		age counts the server steps it has been waiting for.
+	*/
+	struct HeldObjectUpdate {
+		std::string data;
+		u16 age = 0;
+	};
+	std::unordered_map<u16, HeldObjectUpdate> m_held_object_updates;
+
+	// Holds back a position update, it replaces the one held for the object
+	void holdObjectUpdate(u16 id, std::string data);
+
+	/*
+		Takes the held updates that fit into budget bytes, in order of
+		get_priority(id, age), lower values first. Once an update does not
+		fit, it and all that follow wait for the next call, one step older.
+		send is called for each update that is taken.
+	*/
+	void takeHeldObjectUpdates(u32 budget,
+		const std::function<f32(u16 id, u16 age)> &get_priority,
+		const std::function<void(u16 id, const std::string &data)> &send);
+
+	/*
+		Merges an earlier position update of an object into a later one,
+		which then replaces it. If the earlier one was a teleport the later
+		one must not be interpolated either.
+	*/
+	static void mergePositionUpdate(const std::string &earlier, std::string &later);
+
+	/*
+		Priority of a held update. Nearby objects and other players matter
+		most, updates become more urgent the longer they wait.
+	*/
+	static f32 getObjectUpdatePriority(f32 distance, bool is_player, u16 age);
+
 	ClientState getState() const { return m_state; }
 
 	const std::string &getName() const { return m_name; }
@@ -405,6 +445,9 @@ class RemoteClient
 	// measure how long it takes the server to send the complete map
 	float m_map_send_completion_timer = 0.0f;
 
+	// Reused by takeHeldObjectUpdates()
+	std::vector<std::pair<f32, u16>> m_held_object_order;
+
 	/*
 		name of player using this client
 	*/
@@ -134,6 +134,45 @@ void LuaEntitySAO::dispatchScriptDeactivate(bool removal)
 		m_env->getScriptIface()->luaentity_Deactivate(m_id, removal);
 }
 
+bool LuaEntitySAO::getMoveInput(float dtime, MoveInput &input) const
+{
+	if (!m_prop.physical)
+		return false;
+	input.dtime = dtime;
+	input.box = m_prop.collisionbox;
+	input.box.MinEdge *= BS;
+	input.box.MaxEdge *= BS;
+	input.stepheight = m_prop.stepheight;
+	input.collide_with_objects = m_prop.collideWithObjects;
+	input.pos = getBasePosition();
+	input.velocity = m_velocity;
+	input.acceleration = m_acceleration;
+	return true;
+}
+
+collisionMoveResult LuaEntitySAO::move(const MoveInput &input, v3f &pos, v3f &velocity)
+{
+	pos = input.pos;
+	velocity = input.velocity;
+	return collisionMoveSimple(m_env, m_env->getGameDef(),
+			input.box, input.stepheight, input.dtime,
+			&pos, &velocity, input.acceleration,
+			this, input.collide_with_objects);
+}
+
+void LuaEntitySAO::prepareStep(float dtime)
+{
+	m_prepared_move.valid = false;
+	// Attached objects follow their parent instead
+	if (m_attachment_parent_id)
+		return;
+	if (!getMoveInput(dtime, m_prepared_move.input))
+		return;
+	m_prepared_move.result = move(m_prepared_move.input,
+			m_prepared_move.pos, m_prepared_move.velocity);
+	m_prepared_move.valid = true;
+}
+
 void LuaEntitySAO::step(float dtime, bool send_recommended)
 {
 	if (!m_properties_sent) {
@@ -163,28 +202,27 @@ void LuaEntitySAO::step(float dtime, bool send_recommended)
 
 	// Each frame, parent position is copied if the object is attached, otherwise it's calculated normally
 	// If the object gets detached this comes into effect automatically from the last known origin
+	MoveInput move_input;
 	if (auto *parent = getParent()) {
 		setBasePosition(parent->getBasePosition());
 		m_velocity = v3f(0,0,0);
 		m_acceleration = v3f(0,0,0);
 	} else {
-		if(m_prop.physical){
-			aabb3f box = m_prop.collisionbox;
-			box.MinEdge *= BS;
-			box.MaxEdge *= BS;
-			v3f p_pos = getBasePosition();
-			v3f p_velocity = m_velocity;
-			v3f p_acceleration = m_acceleration;
-			moveresult = collisionMoveSimple(m_env, m_env->getGameDef(),
-					box, m_prop.stepheight, dtime,
-					&p_pos, &p_velocity, p_acceleration,
-					this, m_prop.collideWithObjects);
+		if (getMoveInput(dtime, move_input)) {
+			v3f p_pos, p_velocity;
+			if (m_prepared_move.valid && m_prepared_move.input == move_input) {
+				p_pos = m_prepared_move.pos;
+				p_velocity = m_prepared_move.velocity;
+				moveresult = std::move(m_prepared_move.result);
+			} else {
+				// Not prepared, or moved by a script since
+				moveresult = move(move_input, p_pos, p_velocity);
+			}
 			moveresult_p = &moveresult;
 
 			// Apply results
 			setBasePosition(p_pos);
 			m_velocity = p_velocity;
-			m_acceleration = p_acceleration;
 		} else {
 			addPos((m_velocity + m_acceleration * 0.5f * dtime) * dtime);
 			m_velocity += dtime * m_acceleration;
@@ -208,6 +246,8 @@ void LuaEntitySAO::step(float dtime, bool send_recommended)
 		}
 	}
 
+	m_prepared_move.valid = false;
+
 	if (std::abs(m_prop.automatic_rotate) > 0.001f) {
 		m_rotation_add_yaw = modulo360f(m_rotation_add_yaw + dtime * core::RADTODEG *
 				m_prop.automatic_rotate);
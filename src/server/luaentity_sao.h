@@ -6,6 +6,7 @@
 #pragma once
 
 #include "unit_sao.h"
+#include "collision.h"
 #include "util/guid.h"
 
 class LuaEntitySAO : public UnitSAO
@@ -22,6 +23,7 @@ class LuaEntitySAO : public UnitSAO
 	ActiveObjectType getType() const { return ACTIVEOBJECT_TYPE_LUAENTITY; }
 	ActiveObjectType getSendType() const { return ACTIVEOBJECT_TYPE_GENERIC; }
 	virtual void addedToEnvironment(u32 dtime_s);
+	void prepareStep(float dtime);
 	void step(float dtime, bool send_recommended);
 	std::string getClientInitializationData(u16 protocol_version);
 
@@ -74,6 +76,30 @@ class LuaEntitySAO : public UnitSAO
 	}
 
 private:
+	// Everything collisionMoveSimple() gets from this object
+	struct MoveInput {
+		float dtime = 0.0f;
+		aabb3f box{{0.0f, 0.0f, 0.0f}};
+		f32 stepheight = 0.0f;
+		bool collide_with_objects = false;
+		v3f pos;
+		v3f velocity;
+		v3f acceleration;
+
+		bool operator==(const MoveInput &other) const
+		{
+			return dtime == other.dtime && box == other.box &&
+				stepheight == other.stepheight &&
+				collide_with_objects == other.collide_with_objects &&
+				pos == other.pos && velocity == other.velocity &&
+				acceleration == other.acceleration;
+		}
+	};
+
+	// Returns false if the object does not move by collisionMoveSimple()
+	bool getMoveInput(float dtime, MoveInput &input) const;
+	collisionMoveResult move(const MoveInput &input, v3f &pos, v3f &velocity);
+
 	std::string getPropertyPacket();
 	void sendPosition(bool do_interpolate, bool is_movement_end);
 	std::string generateSetTextureModCommand() const;
@@ -89,6 +115,16 @@ class LuaEntitySAO : public UnitSAO
 	v3f m_velocity;
 	v3f m_acceleration;
 
+	// Movement computed by prepareStep(), used by step() if nothing that
+	// goes into it changed in between
+	struct {
+		bool valid = false;
+		MoveInput input;
+		v3f pos;
+		v3f velocity;
+		collisionMoveResult result;
+	} m_prepared_move;
+
 	v3f m_last_sent_position;
 	v3f m_last_sent_velocity;
 	v3f m_last_sent_rotation;
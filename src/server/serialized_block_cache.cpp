@@ -0,0 +1,86 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#include "serialized_block_cache.h"
+
+// Entries that were not used for this long are evicted (seconds)
+#define BLOCK_CACHE_TIMEOUT 10.0f
+// How often to look for entries to evict (seconds)
+#define BLOCK_CACHE_EVICT_INTERVAL 2.0f
+
+SerializedBlockCache::Data SerializedBlockCache::get(v3s16 pos, u16 format,
+	u64 mod_counter)
+{
+	std::lock_guard lock(m_mutex);
+	auto it = m_entries.find(pos);
+	if (it == m_entries.end())
+		return nullptr;
+
+	for (auto &entry : it->second) {
+		if (entry.format != format)
+			continue;
+		if (entry.mod_counter != mod_counter)
+			return nullptr;
+		entry.last_used = m_time;
+		return entry.data;
+	}
+	return nullptr;
+}
+
+void SerializedBlockCache::put(v3s16 pos, u16 format, u64 mod_counter, Data data)
+{
+	std::lock_guard lock(m_mutex);
+	auto &entries = m_entries[pos];
+	for (auto &entry : entries) {
+		if (entry.format == format) {
+			entry = Entry{format, mod_counter, m_time, std::move(data)};
+			return;
+		}
+	}
+	entries.push_back(Entry{format, mod_counter, m_time, std::move(data)});
+}
+
+void SerializedBlockCache::invalidate(v3s16 pos)
+{
+	std::lock_guard lock(m_mutex);
+	m_entries.erase(pos);
+}
+
+void SerializedBlockCache::step(float dtime)
+{
+	std::lock_guard lock(m_mutex);
+	m_time += dtime;
+	m_evict_timer += dtime;
+	if (m_evict_timer < BLOCK_CACHE_EVICT_INTERVAL)
+		return;
+	m_evict_timer = 0;
+
+	for (auto it = m_entries.begin(); it != m_entries.end(); ) {
+		auto &entries = it->second;
+		for (size_t i = 0; i < entries.size(); ) {
+			if (m_time - entries[i].last_used > BLOCK_CACHE_TIMEOUT) {
+				entries[i] = std::move(entries.back());
+				entries.pop_back();
+			} else {
+				i++;
+			}
+		}
+		if (entries.empty())
+			it = m_entries.erase(it);
+		else
+			++it;
+	}
+}
+
+void SerializedBlockCache::clear()
+{
+	std::lock_guard lock(m_mutex);
+	m_entries.clear();
+}
+
+size_t SerializedBlockCache::size()
+{
+	std::lock_guard lock(m_mutex);
+	return m_entries.size();
+}
@@ -0,0 +1,64 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "irr_v3d.h"
+
+/*
+	Cache of MapBlocks serialized in the network format, shared between
+	all clients.
+
+	Every entry is stamped with the modification counter of the block it was
+	made from (see MapBlock::getModificationCounter()), so a changed block is
+	never served from the cache. Entries that were not used for a while are
+	evicted by step().
+	This class is thread-safe.
+*/
+class SerializedBlockCache
+{
+public:
+	typedef std::shared_ptr<const std::string> Data;
+
+	/// Blocks compressed with the map dictionary are cached apart from the
+	/// ones without, the format combines it with the serialization version.
+	static u16 getFormat(u8 ver, bool map_dictionary)
+	{ return ver | (map_dictionary ? 0x100 : 0); }
+
+	/// @return cached data or nullptr if there is none for this state of the block
+	Data get(v3s16 pos, u16 format, u64 mod_counter);
+
+	void put(v3s16 pos, u16 format, u64 mod_counter, Data data);
+
+	/// Drop everything that is cached for a block position
+	void invalidate(v3s16 pos);
+
+	/// Advances time and evicts entries that were unused for too long
+	void step(float dtime);
+
+	void clear();
+
+	/// @return number of cached blocks (in any format)
+	size_t size();
+
+private:
+	struct Entry {
+		u16 format;
+		u64 mod_counter;
+		double last_used;
+		Data data;
+	};
+
+	std::mutex m_mutex;
+	// clients usually share the same format, so the vector
+	// rarely has more than one element
+	std::unordered_map<v3s16, std::vector<Entry>> m_entries;
+	double m_time = 0;
+	float m_evict_timer = 0;
+};
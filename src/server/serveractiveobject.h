@@ -95,6 +95,15 @@ class ServerActiveObject : public ActiveObject
 	*/
 	virtual void step(float dtime, bool send_recommended){}
 
+	/*
+		Prepare the next step() without side effects, e.g. by computing the
+		movement of the object.
+		Runs on worker threads for many objects at once, right before they
+		are stepped. It may read the map and other objects, but only write
+		state of this object that step() alone uses.
+	*/
+	virtual void prepareStep(float dtime) {}
+
 	/*
 		The return value of this is passed to the client-side object
 		when it is created
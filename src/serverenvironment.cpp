@@ -181,7 +181,9 @@ ServerEnvironment::ServerEnvironment(std::unique_ptr<ServerMap> map,
 	Environment(server),
 	m_map(std::move(map)),
 	m_script(server->getScriptIface()),
-	m_server(server)
+	m_server(server),
+	m_abm_handler(this, g_settings->getU16("abm_threads")),
+	m_object_step_pool("ObjectStep", g_settings->getU16("object_step_threads"))
 {
 	m_cache_active_block_mgmt_interval = g_settings->getFloat("active_block_mgmt_interval");
 	m_cache_abm_interval = rangelim(g_settings->getFloat("abm_interval"), 0.1f, 30);
@@ -993,6 +995,9 @@ void ServerEnvironment::step(float dtime)
 			// Reset block usage timer
 			block->resetUsageTimer();
 
+			// Active blocks are read a lot, keep their nodes in the full array
+			block->expandPalette();
+
 			// Set current time as timestamp
 			block->setTimestampNoChangedFlag(m_game_time);
 			// If the block timestamp has changed considerably, mark it to be
@@ -1015,12 +1020,8 @@ void ServerEnvironment::step(float dtime)
 		ScopeProfiler sp(g_profiler, "SEnv: modify in blocks avg per interval", SPT_AVG);
 		TimeTaker timer("modify in active blocks per interval");
 
-		// Shuffle to prevent persistent artifacts of ordering
-		std::shuffle(m_abms.begin(), m_abms.end(), MyRandGenerator());
-
-		// Initialize handling of ActiveBlockModifiers
-		// TODO: reinitializing this state every time is probably not efficient?
-		ABMHandler abmhandler(m_abms, m_cache_abm_interval, this, true);
+		// Decide which ActiveBlockModifiers run in this interval
+		m_abm_handler.step(m_abms, m_cache_abm_interval, true);
 
 		int blocks_scanned = 0;
 		int abms_run = 0;
@@ -1033,29 +1034,44 @@ void ServerEnvironment::step(float dtime)
 		std::copy(m_active_blocks.m_abm_list.begin(), m_active_blocks.m_abm_list.end(), output.begin());
 		std::shuffle(output.begin(), output.end(), MyRandGenerator());
 
-		int i = 0;
 		// determine the time budget for ABMs
 		u32 max_time_ms = m_cache_abm_interval * 1000 * m_cache_abm_time_budget;
-		for (const v3s16 &p : output) {
-			MapBlock *block = m_map->getBlockNoCreateNoEx(p);
-			if (!block)
-				continue;
-
-			i++;
+		const size_t chunk_size = m_abm_handler.getScanChunkSize();
+		std::vector<MapBlock *> blocks;
+		size_t processed = 0;
+		bool over_budget = false;
+		for (size_t begin = 0; begin < output.size() && !over_budget; begin += chunk_size) {
+			// The positions are unique, so are the blocks
+			blocks.clear();
+			const size_t end = std::min(output.size(), begin + chunk_size);
+			for (size_t i = begin; i < end; i++) {
+				MapBlock *block = m_map->getBlockNoCreateNoEx(output[i]);
+				if (!block)
+					continue;
+
+				// Set current time as timestamp
+				block->setTimestampNoChangedFlag(m_game_time);
+
+				blocks.push_back(block);
+			}
 
-			// Set current time as timestamp
-			block->setTimestampNoChangedFlag(m_game_time);
+			/* Find the nodes that ActiveBlockModifiers trigger on */
+			m_abm_handler.scan(blocks, blocks_scanned, blocks_cached);
 
-			/* Handle ActiveBlockModifiers */
-			abmhandler.apply(block, blocks_scanned, abms_run, blocks_cached);
+			for (size_t i = 0; i < blocks.size(); i++) {
+				/* Handle ActiveBlockModifiers */
+				m_abm_handler.trigger(i, abms_run);
+				processed++;
 
-			u32 time_ms = timer.getTimerTime();
+				u32 time_ms = timer.getTimerTime();
 
-			if (time_ms > max_time_ms) {
-				warningstream << "active block modifiers took "
-					  << time_ms << "ms (processed " << i << " of "
-					  << output.size() << " active blocks)" << std::endl;
-				break;
+				if (time_ms > max_time_ms) {
+					warningstream << "active block modifiers took "
+						  << time_ms << "ms (processed " << processed << " of "
+						  << output.size() << " active blocks)" << std::endl;
+					over_budget = true;
+					break;
+				}
 			}
 		}
 		g_profiler->avg("ServerEnv: active blocks", m_active_blocks.m_abm_list.size());
@@ -1089,6 +1105,9 @@ void ServerEnvironment::step(float dtime)
 
 		u32 object_count = 0;
 
+		// Move the objects in parallel first, their scripts run below
+		m_ao_manager.prepareStep(m_object_step_pool, dtime);
+
 		auto cb_state = [&](ServerActiveObject *obj) {
 			if (obj->isGone())
 				return;
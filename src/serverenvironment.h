@@ -15,6 +15,7 @@
 #include "map.h" // MapEventReceiver
 #include "server/activeobjectmgr.h"
 #include "server/blockmodifier.h"
+#include "threading/worker_pool.h"
 #include "util/numeric.h"
 #include "util/metricsbackend.h"
 
@@ -236,6 +237,17 @@ class ServerEnvironment final : public Environment
 		return m_ao_manager.updateObjectPos(id, pos);
 	}
 
+	// see server::ActiveObjectMgr::getRevision()
+	u64 getActiveObjectRevision() const
+	{
+		return m_ao_manager.getRevision();
+	}
+
+	size_t getActiveObjectCount() const
+	{
+		return m_ao_manager.getObjectCount();
+	}
+
 	// Find all active objects inside a radius around a point
 	void getObjectsInsideRadius(std::vector<ServerActiveObject *> &objects, const v3f &pos, float radius,
 			std::function<bool(ServerActiveObject *obj)> include_obj_cb)
@@ -397,6 +409,9 @@ class ServerEnvironment final : public Environment
 	u32 m_last_clear_objects_time = 0;
 	// Active block modifiers
 	std::vector<ABMWithState> m_abms;
+	ABMHandler m_abm_handler;
+	// Runs the movement of active objects
+	WorkerPool m_object_step_pool;
 	LBMManager m_lbm_mgr;
 	// An interval for generally sending object positions and stuff
 	float m_recommended_send_interval = 0.1f;
@@ -5,6 +5,7 @@
 #include "servermap.h"
 
 #include "map.h"
+#include "map_save_queue.h"
 #include "mapsector.h"
 #include "filesys.h"
 #include "voxel.h"
@@ -45,6 +46,8 @@
 void MapDatabaseAccessor::loadBlock(v3s16 blockpos, std::string &ret)
 {
 	ret.clear();
+	if (save_queue && save_queue->getPending(blockpos, ret))
+		return;
 	dbase->loadBlock(blockpos, &ret);
 	if (ret.empty() && dbase_ro)
 		dbase_ro->loadBlock(blockpos, &ret);
@@ -87,6 +90,18 @@ ServerMap::ServerMap(const std::string &savedir, IGameDef *gamedef,
 	m_savedir = savedir;
 	m_map_saving_enabled = false;
 
+	m_dictionary = loadDictionary(savedir);
+	m_db.dictionary = m_dictionary.get();
+	if (m_dictionary) {
+		infostream << "ServerMap: Using map dictionary " << m_dictionary->getId()
+			<< std::endl;
+	}
+	m_net_dictionary = loadDictionary(savedir, false);
+	if (m_net_dictionary) {
+		infostream << "ServerMap: Using network map dictionary "
+			<< m_net_dictionary->getId() << std::endl;
+	}
+
 	// Inform EmergeManager of db handles
 	m_emerge->initMap(&m_db);
 
@@ -99,6 +114,12 @@ ServerMap::ServerMap(const std::string &savedir, IGameDef *gamedef,
 
 	m_map_compression_level = rangelim(g_settings->getS16("map_compression_level_disk"), -1, 9);
 
+	if (u16 save_threads = g_settings->getU16("map_save_threads")) {
+		m_save_queue = std::make_unique<MapSaveQueue>(&m_db,
+			m_map_compression_level, save_threads, mb);
+		m_db.save_queue = m_save_queue.get();
+	}
+
 	try {
 		// If directory exists, check contents and load if possible
 		if (fs::PathExists(m_savedir)) {
@@ -159,6 +180,10 @@ ServerMap::~ServerMap()
 				 << ", exception: " << e.what() << std::endl;
 	}
 
+	// Waits for all pending writes
+	m_save_queue.reset();
+	m_db.save_queue = nullptr;
+
 	m_emerge->resetMap();
 
 	{
@@ -533,38 +558,8 @@ void ServerMap::save(ModifiedState save_level)
 	// Profile modified reasons
 	Profiler modprofiler;
 
-	u32 block_count = 0;
-	u32 block_count_all = 0; // Number of blocks in memory
-
-	// Don't do anything with sqlite unless something is really saved
-	bool save_started = false;
-
-	for (auto &sector_it : m_sectors) {
-		MapSector *sector = sector_it.second;
-
-		MapBlockVect blocks;
-		sector->getBlocks(blocks);
-
-		for (MapBlock *block : blocks) {
-			block_count_all++;
-
-			if(block->getModified() >= (u32)save_level) {
-				// Lazy beginSave()
-				if(!save_started) {
-					beginSave();
-					save_started = true;
-				}
-
-				modprofiler.add(block->getModifiedReasonString(), 1);
-
-				saveBlock(block);
-				block_count++;
-			}
-		}
-	}
-
-	if(save_started)
-		endSave();
+	u32 block_count = saveModifiedBlocks(save_level, modprofiler);
+	u32 block_count_all = getBlockCount();
 
 	/*
 		Only print if something happened or saved whole map
@@ -586,6 +581,10 @@ void ServerMap::save(ModifiedState save_level)
 
 void ServerMap::listAllLoadableBlocks(std::vector<v3s16> &dst)
 {
+	// New blocks may not be in the database yet
+	if (m_save_queue)
+		m_save_queue->flush();
+
 	MutexAutoLock dblock(m_db.mutex);
 	m_db.dbase->listAllLoadableBlocks(dst);
 	if (m_db.dbase_ro)
@@ -671,24 +670,37 @@ MapDatabase *ServerMap::createDatabase(
 
 void ServerMap::beginSave()
 {
+	// The save queue manages transactions by itself
+	if (m_save_queue)
+		return;
 	MutexAutoLock dblock(m_db.mutex);
 	m_db.dbase->beginSave();
 }
 
 void ServerMap::endSave()
 {
+	if (m_save_queue)
+		return;
 	MutexAutoLock dblock(m_db.mutex);
 	m_db.dbase->endSave();
 }
 
 bool ServerMap::saveBlock(MapBlock *block)
 {
+	if (m_save_queue) {
+		m_save_queue->enqueue(block);
+		// The snapshot is what will end up on disk
+		block->resetModified();
+		return true;
+	}
+
 	// FIXME: serialization happens under mutex
 	MutexAutoLock dblock(m_db.mutex);
-	return saveBlock(block, m_db.dbase, m_map_compression_level);
+	return saveBlock(block, m_db.dbase, m_map_compression_level, m_db.dictionary);
 }
 
-bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, int compression_level)
+bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, int compression_level,
+	const ZstdDictionary *dict)
 {
 	v3s16 p3d = block->getPos();
 
@@ -699,12 +711,10 @@ bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, int compression_leve
 		[0] u8 serialization version
 		[1] data
 	*/
-	std::ostringstream o(std::ios_base::binary);
-	o.write((char*) &version, 1);
-	block->serialize(o, version, true, compression_level);
+	std::string data(1, version);
+	block->serialize(data, version, true, compression_level, dict);
 
-	// FIXME: zero copy possible in c++20 or with custom rdbuf
-	bool ret = db->saveBlock(p3d, o.str());
+	bool ret = db->saveBlock(p3d, data);
 	if (ret) {
 		// We just wrote it to the disk so clear modified flag
 		block->resetModified();
@@ -712,15 +722,83 @@ bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, int compression_leve
 	return ret;
 }
 
-void ServerMap::deSerializeBlock(MapBlock *block, std::istream &is)
+void ServerMap::deSerializeBlock(MapBlock *block, std::string_view blob,
+	const ZstdDictionary *dict)
 {
 	ScopeProfiler sp(g_profiler, "ServerMap: deSer block", SPT_AVG, PRECISION_MICRO);
 
-	u8 version = readU8(is);
-	if (is.fail())
+	if (blob.empty())
 		throw SerializationError("Failed to read MapBlock version");
 
-	block->deSerialize(is, version, true);
+	block->deSerialize(blob.substr(1), static_cast<u8>(blob[0]), true, dict);
+}
+
+std::string ServerMap::getDictionaryPath(const std::string &savedir, bool disk)
+{
+	return savedir + DIR_DELIM + (disk ? "map_dictionary.bin" : "map_dictionary_net.bin");
+}
+
+std::unique_ptr<ZstdDictionary> ServerMap::loadDictionary(const std::string &savedir,
+	bool disk)
+{
+	const std::string path = getDictionaryPath(savedir, disk);
+	if (!fs::PathExists(path))
+		return nullptr;
+
+	std::string data;
+	if (!fs::ReadFile(path, data))
+		throw SerializationError("Failed to read map dictionary " + path);
+	return std::make_unique<ZstdDictionary>(data);
+}
+
+std::string ServerMap::trainDictionary(std::vector<std::string> samples,
+	int compression_level)
+{
+	// Every fifth block is held back to check how well a dictionary works
+	std::vector<std::string> train, check;
+	for (size_t i = 0; i < samples.size(); i++)
+		(i % 5 == 4 ? check : train).push_back(std::move(samples[i]));
+
+	auto compressed_size = [&] (const ZstdDictionary *dict) {
+		size_t size = 0;
+		std::string out;
+		for (const std::string &s : check) {
+			out.clear();
+			compress(s, out, SER_FMT_VER_HIGHEST_WRITE, compression_level, dict);
+			size += out.size();
+		}
+		return size;
+	};
+
+	// How well training works on map blocks varies a lot with the size
+	// and a bad dictionary is worse than none, so a few sizes are tried
+	const size_t plain_size = compressed_size(nullptr);
+	std::string best;
+	size_t best_size = plain_size;
+	for (size_t max_size : {16 * 1024, 32 * 1024, 64 * 1024, 110 * 1024}) {
+		std::string data;
+		try {
+			data = trainZstdDictionary(train, max_size);
+		} catch (SerializationError &e) {
+			infostream << "ServerMap: Training a dictionary of " << max_size
+				<< " bytes failed: " << e.what() << std::endl;
+			continue;
+		}
+		const ZstdDictionary dict(data);
+		const size_t size = compressed_size(&dict);
+		infostream << "ServerMap: Dictionary of " << data.size() << " bytes: "
+			<< size << " instead of " << plain_size << " bytes" << std::endl;
+		if (size < best_size) {
+			best = std::move(data);
+			best_size = size;
+		}
+	}
+
+	if (!best.empty()) {
+		actionstream << "ServerMap: Map dictionary makes blocks "
+			<< (100 - 100 * best_size / plain_size) << "% smaller" << std::endl;
+	}
+	return best;
 }
 
 MapBlock *ServerMap::loadBlock(const std::string &blob, v3s16 p3d, bool save_after_load)
@@ -740,10 +818,7 @@ MapBlock *ServerMap::loadBlock(const std::string &blob, v3s16 p3d, bool save_aft
 			block = block_created_new.get();
 		}
 
-		{
-			std::istringstream iss(blob, std::ios_base::binary);
-			deSerializeBlock(block, iss);
-		}
+		deSerializeBlock(block, blob, m_db.dictionary);
 
 		// If it's a new block, insert it to the map
 		if (block_created_new) {
@@ -809,6 +884,8 @@ MapBlock* ServerMap::loadBlock(v3s16 blockpos)
 bool ServerMap::deleteBlock(v3s16 blockpos)
 {
 	MutexAutoLock dblock(m_db.mutex);
+	if (m_save_queue)
+		m_save_queue->cancel(blockpos);
 	if (!m_db.dbase->deleteBlock(blockpos))
 		return false;
 
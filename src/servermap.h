@@ -18,6 +18,8 @@ class EmergeManager;
 class ServerEnvironment;
 struct BlockMakeData;
 class MetricsBackend;
+class MapSaveQueue;
+class ZstdDictionary;
 
 // TODO: this could wrap all calls to MapDatabase, including locking
 struct MapDatabaseAccessor {
@@ -27,8 +29,12 @@ struct MapDatabaseAccessor {
 	MapDatabase *dbase = nullptr;
 	/// Fallback database for read operations
 	MapDatabase *dbase_ro = nullptr;
+	/// Blocks that are about to be written to dbase (optional)
+	MapSaveQueue *save_queue = nullptr;
+	/// Dictionary that blocks are compressed with (optional)
+	const ZstdDictionary *dictionary = nullptr;
 
-	/// Load a block, taking dbase_ro into account.
+	/// Load a block, taking save_queue and dbase_ro into account.
 	/// @note call locked
 	void loadBlock(v3s16 blockpos, std::string &ret);
 };
@@ -116,7 +122,8 @@ class ServerMap : public Map
 	MapgenParams *getMapgenParams();
 
 	bool saveBlock(MapBlock *block) override;
-	static bool saveBlock(MapBlock *block, MapDatabase *db, int compression_level = -1);
+	static bool saveBlock(MapBlock *block, MapDatabase *db, int compression_level = -1,
+		const ZstdDictionary *dict = nullptr);
 
 	// Load block in a synchronous fashion
 	MapBlock *loadBlock(v3s16 p);
@@ -126,7 +133,26 @@ class ServerMap : public Map
 
 	// Helper for deserializing blocks from disk
 	// @throws SerializationError
-	static void deSerializeBlock(MapBlock *block, std::istream &is);
+	static void deSerializeBlock(MapBlock *block, std::string_view blob,
+		const ZstdDictionary *dict = nullptr);
+
+	/*
+		Blocks can be compressed with zstd dictionaries trained from the
+		world (see --train-map-dictionary), which are stored next to
+		map_meta.txt. The one of the disk format stays on the server, the one
+		of the network format is sent to clients.
+	*/
+	static std::string getDictionaryPath(const std::string &savedir, bool disk = true);
+	// @return nullptr if the world has no dictionary
+	// @throws SerializationError if it is broken
+	static std::unique_ptr<ZstdDictionary> loadDictionary(const std::string &savedir,
+		bool disk = true);
+	// Trains a dictionary from uncompressed blocks of the world
+	// @return the dictionary, or empty if none makes the blocks smaller
+	static std::string trainDictionary(std::vector<std::string> samples,
+		int compression_level);
+	const ZstdDictionary *getDictionary() const { return m_dictionary.get(); }
+	const ZstdDictionary *getNetDictionary() const { return m_net_dictionary.get(); }
 
 	// Blocks are removed from the map but not deleted from memory until
 	// deleteDetachedBlocks() is called, since pointers to them may still exist
@@ -200,7 +226,11 @@ class ServerMap : public Map
 	*/
 	bool m_map_metadata_changed = true;
 
+	std::unique_ptr<ZstdDictionary> m_dictionary;
+	std::unique_ptr<ZstdDictionary> m_net_dictionary;
 	MapDatabaseAccessor m_db;
+	// Asynchronous saving, null if disabled
+	std::unique_ptr<MapSaveQueue> m_save_queue;
 
 	// Map metrics
 	MetricGaugePtr m_loaded_blocks_gauge;
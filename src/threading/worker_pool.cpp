@@ -0,0 +1,109 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#include "threading/worker_pool.h"
+#include "threading/thread.h"
+#include "debug.h"
+#include "log.h"
+
+class WorkerPool::WorkerThread : public Thread
+{
+public:
+	WorkerThread(WorkerPool *pool, const std::string &name) :
+		Thread(name), m_pool(pool)
+	{}
+
+	void *run() override
+	{
+		BEGIN_DEBUG_EXCEPTION_HANDLER
+
+		while (m_pool->runOne())
+			;
+
+		END_DEBUG_EXCEPTION_HANDLER
+
+		return nullptr;
+	}
+
+private:
+	WorkerPool *m_pool;
+};
+
+WorkerPool::WorkerPool(const std::string &name, unsigned int num_threads)
+{
+	m_threads.reserve(num_threads);
+	for (unsigned int i = 0; i < num_threads; i++) {
+		m_threads.emplace_back(std::make_unique<WorkerThread>(this,
+			name + std::to_string(i)));
+		m_threads.back()->start();
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard lock(m_mutex);
+		m_stopping = true;
+	}
+	m_task_cv.notify_all();
+
+	for (auto &thread : m_threads)
+		thread->wait();
+}
+
+void WorkerPool::submit(std::function<void()> task)
+{
+	if (m_threads.empty()) {
+		task();
+		return;
+	}
+
+	{
+		std::lock_guard lock(m_mutex);
+		sanity_check(!m_stopping);
+		m_tasks.push_back(std::move(task));
+	}
+	m_task_cv.notify_one();
+}
+
+void WorkerPool::waitIdle()
+{
+	std::unique_lock lock(m_mutex);
+	m_idle_cv.wait(lock, [this] {
+		return m_tasks.empty() && m_active == 0;
+	});
+}
+
+size_t WorkerPool::getQueueSize()
+{
+	std::lock_guard lock(m_mutex);
+	return m_tasks.size();
+}
+
+bool WorkerPool::runOne()
+{
+	std::function<void()> task;
+	{
+		std::unique_lock lock(m_mutex);
+		m_task_cv.wait(lock, [this] {
+			return !m_tasks.empty() || m_stopping;
+		});
+		// queued tasks are drained before shutting down
+		if (m_tasks.empty())
+			return false;
+		task = std::move(m_tasks.front());
+		m_tasks.pop_front();
+		m_active++;
+	}
+
+	task();
+
+	{
+		std::lock_guard lock(m_mutex);
+		m_active--;
+		if (m_tasks.empty() && m_active == 0)
+			m_idle_cv.notify_all();
+	}
+	return true;
+}
@@ -0,0 +1,56 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "util/basic_macros.h"
+
+/**
+ * A fixed set of threads executing queued tasks.
+ *
+ * Tasks are run in the order they were submitted, but may finish in any order.
+ * A pool created with zero threads runs every task synchronously in submit().
+ */
+class WorkerPool
+{
+public:
+	WorkerPool(const std::string &name, unsigned int num_threads);
+	/// Finishes all queued tasks, then stops the threads.
+	~WorkerPool();
+	DISABLE_CLASS_COPY(WorkerPool)
+
+	/// Queue a task to be run on one of the workers.
+	void submit(std::function<void()> task);
+
+	/// Block until every task submitted so far has finished.
+	void waitIdle();
+
+	/// @return number of tasks that were not started yet
+	size_t getQueueSize();
+
+	unsigned int getThreadCount() const { return m_threads.size(); }
+
+private:
+	class WorkerThread;
+
+	/// @return false if the pool is shutting down and there is nothing left to do
+	bool runOne();
+
+	std::mutex m_mutex;
+	std::condition_variable m_task_cv;
+	std::condition_variable m_idle_cv;
+	std::deque<std::function<void()>> m_tasks;
+	// number of tasks that are currently executing
+	size_t m_active = 0;
+	bool m_stopping = false;
+
+	std::vector<std::unique_ptr<WorkerThread>> m_threads;
+};
@@ -0,0 +1,82 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#include "test.h"
+
+#include "filesys.h"
+#include "serialization.h"
+#include "server/cached_media_file.h"
+
+class TestCachedMediaFile : public TestBase
+{
+public:
+	TestCachedMediaFile() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestCachedMediaFile"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testReadOnce();
+	void testMissingFile();
+	void testKnownData();
+};
+
+static TestCachedMediaFile g_test_instance;
+
+void TestCachedMediaFile::runTests(IGameDef *gamedef)
+{
+	TEST(testReadOnce);
+	TEST(testMissingFile);
+	TEST(testKnownData);
+}
+
+static std::string decompress(const CachedMediaFile::Data &data)
+{
+	std::string result;
+	decompressZstd(*data, result);
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestCachedMediaFile::testReadOnce()
+{
+	const std::string path = getTestTempFile();
+	const std::string content(10000, 'x');
+	UASSERT(fs::safeWriteToFile(path, content));
+
+	CachedMediaFile file(path);
+	UASSERTEQ(size_t, file.getSize(), 0);
+	const CachedMediaFile::Data compressed = file.get(true);
+	UASSERT(compressed);
+	UASSERT(compressed->size() < content.size());
+	UASSERT(decompress(compressed) == content);
+	UASSERTEQ(size_t, file.getSize(), content.size());
+
+	// Later clients get the same data, even if the file is gone
+	fs::DeleteSingleFileOrEmptyDirectory(path);
+	UASSERT(file.get(true) == compressed);
+}
+
+void TestCachedMediaFile::testMissingFile()
+{
+	const std::string path = getTestTempFile();
+	CachedMediaFile file(path);
+	UASSERT(!file.get(false));
+	UASSERT(!file.get(true));
+
+	// Nothing is remembered about the failure
+	UASSERT(fs::safeWriteToFile(path, "abc"));
+	UASSERT(*file.get(false) == "abc");
+	UASSERT(decompress(file.get(true)) == "abc");
+	fs::DeleteSingleFileOrEmptyDirectory(path);
+}
+
+void TestCachedMediaFile::testKnownData()
+{
+	// Never read, like a temporary file that was deleted already
+	CachedMediaFile file(getTestTempFile(), "abc");
+	UASSERTEQ(size_t, file.getSize(), 3);
+	UASSERT(*file.get(false) == "abc");
+	UASSERT(decompress(file.get(true)) == "abc");
+}
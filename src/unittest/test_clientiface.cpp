@@ -0,0 +1,151 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#include "test.h"
+
+#include <map>
+#include "server/clientiface.h"
+#include "server/unit_sao.h"
+#include "util/serialize.h"
+
+class TestClientIface : public TestBase
+{
+public:
+	TestClientIface() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestClientIface"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testMergeTeleport();
+	void testBudget();
+	void testAge();
+};
+
+static TestClientIface g_test_instance;
+
+void TestClientIface::runTests(IGameDef *gamedef)
+{
+	TEST(testMergeTeleport);
+	TEST(testBudget);
+	TEST(testAge);
+}
+
+namespace {
+
+std::string positionUpdate(f32 x, bool do_interpolate = true)
+{
+	return UnitSAO::generateUpdatePositionCommand(v3f(x, 0, 0), v3f(), v3f(),
+		v3f(), do_interpolate, false, 0.1f);
+}
+
+// Whether the client would interpolate to the position of the update
+bool interpolates(const std::string &data)
+{
+	return data[1 + 4 * 12] != 0;
+}
+
+f32 position(const std::string &data)
+{
+	return readF32((const u8 *)data.data() + 1);
+}
+
+// Takes the held updates with priorities given by id, in the order sent
+std::vector<u16> take(RemoteClient &client, u32 budget,
+	const std::map<u16, f32> &priorities)
+{
+	std::vector<u16> sent;
+	client.takeHeldObjectUpdates(budget,
+		[&] (u16 id, u16 age) { return priorities.at(id); },
+		[&] (u16 id, const std::string &data) { sent.push_back(id); });
+	return sent;
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestClientIface::testMergeTeleport()
+{
+	RemoteClient client;
+
+	// Only the latest position is kept
+	client.holdObjectUpdate(1, positionUpdate(1));
+	client.holdObjectUpdate(1, positionUpdate(2));
+	UASSERTEQ(size_t, client.m_held_object_updates.size(), 1);
+	const std::string &held = client.m_held_object_updates[1].data;
+	UASSERTEQ(f32, position(held), 2);
+	UASSERT(interpolates(held));
+
+	// A teleport that was merged away still stops the interpolation
+	client.holdObjectUpdate(1, positionUpdate(3, false));
+	client.holdObjectUpdate(1, positionUpdate(4));
+	UASSERTEQ(f32, position(client.m_held_object_updates[1].data), 4);
+	UASSERT(!interpolates(client.m_held_object_updates[1].data));
+
+	// Also when merged before the updates are held
+	std::string later = positionUpdate(6);
+	RemoteClient::mergePositionUpdate(positionUpdate(5, false), later);
+	UASSERT(!interpolates(later));
+	later = positionUpdate(6);
+	RemoteClient::mergePositionUpdate(positionUpdate(5), later);
+	UASSERT(interpolates(later));
+}
+
+void TestClientIface::testBudget()
+{
+	RemoteClient client;
+	const u32 size = 4 + positionUpdate(0).size();
+	for (u16 id = 1; id <= 4; id++)
+		client.holdObjectUpdate(id, positionUpdate(id));
+	// The big update of object 3 is more important than 4
+	client.m_held_object_updates[3].data.append(size, '\0');
+	const std::map<u16, f32> priorities = {{1, 2.0f}, {2, 1.0f}, {3, 3.0f}, {4, 4.0f}};
+
+	// In order of priority, and the small update of 4 that would still fit
+	// doesn't get ahead of 3
+	std::vector<u16> sent = take(client, 3 * size, priorities);
+	UASSERT(sent == std::vector<u16>({2, 1}));
+	UASSERTEQ(size_t, client.m_held_object_updates.size(), 2);
+	UASSERTEQ(u16, client.m_held_object_updates[3].age, 1);
+	UASSERTEQ(u16, client.m_held_object_updates[4].age, 1);
+
+	// Nothing fits
+	UASSERT(take(client, size - 1, priorities).empty());
+	UASSERTEQ(u16, client.m_held_object_updates[3].age, 2);
+
+	sent = take(client, 3 * size, priorities);
+	UASSERT(sent == std::vector<u16>({3, 4}));
+	UASSERT(client.m_held_object_updates.empty());
+}
+
+void TestClientIface::testAge()
+{
+	// Other players count as closer
+	UASSERT(RemoteClient::getObjectUpdatePriority(8.0f, true, 0) <
+		RemoteClient::getObjectUpdatePriority(4.0f, false, 0));
+	UASSERT(RemoteClient::getObjectUpdatePriority(4.0f, false, 1) <
+		RemoteClient::getObjectUpdatePriority(4.0f, false, 0));
+
+	/*
+		A near object moves all the time, but the budget only fits one update
+		per step. The update of a far object has to get through anyway.
+	*/
+	RemoteClient client;
+	const std::map<u16, f32> distances = {{1, 1.0f}, {2, 40.0f}};
+	const u32 budget = 4 + positionUpdate(0).size();
+	client.holdObjectUpdate(2, positionUpdate(0));
+	int step = 0;
+	for (; step < 100 && client.m_held_object_updates.count(2); step++) {
+		client.holdObjectUpdate(1, positionUpdate(step));
+		client.takeHeldObjectUpdates(budget,
+			[&] (u16 id, u16 age) {
+				return RemoteClient::getObjectUpdatePriority(distances.at(id),
+					false, age);
+			},
+			[] (u16 id, const std::string &data) {});
+	}
+	UASSERT(!client.m_held_object_updates.count(2));
+	// After about distance / near distance steps
+	UASSERT(step > 30 && step < 50);
+}
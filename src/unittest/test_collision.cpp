@@ -18,6 +18,7 @@ class TestCollision : public TestBase {
 
 	void testAxisAlignedCollision();
 	void testCollisionMoveSimple(IGameDef *gamedef);
+	void testCollisionBoxCache(IGameDef *gamedef);
 };
 
 static TestCollision g_test_instance;
@@ -26,6 +27,7 @@ void TestCollision::runTests(IGameDef *gamedef)
 {
 	TEST(testAxisAlignedCollision);
 	TEST(testCollisionMoveSimple, gamedef);
+	TEST(testCollisionBoxCache, gamedef);
 }
 
 namespace {
@@ -377,3 +379,32 @@ void TestCollision::testCollisionMoveSimple(IGameDef *gamedef)
 	// No warnings should have been raised during our test.
 	UASSERT(!g_collision_problems_encountered);
 }
+
+void TestCollision::testCollisionBoxCache(IGameDef *gamedef)
+{
+	auto env = std::make_unique<TestEnvironment>(gamedef);
+	Map &map = env->getMap();
+	map.setNode({2, 0, 2}, MapNode(t_CONTENT_STONE));
+
+	const aabb3f box(fpos(-0.1f, 0, -0.1f), fpos(0.1f, 1.4f, 0.1f));
+	auto fall = [&] () {
+		v3f pos = fpos(2, 0.5f, 2);
+		v3f speed = fpos(0, 0, 0);
+		return collisionMoveSimple(env.get(), gamedef, box, 0.0f, 0.05f,
+			&pos, &speed, fpos(0, -9.81f, 0));
+	};
+
+	// The same area is looked at again, it's cached after the second time
+	for (int i = 0; i < 3; i++)
+		UASSERT(fall().touching_ground);
+
+	// Map edits are seen right away
+	map.setNode({2, 0, 2}, MapNode(CONTENT_AIR));
+	UASSERT(!fall().collides);
+	map.setNode({2, 0, 2}, MapNode(t_CONTENT_STONE));
+	UASSERT(fall().touching_ground);
+
+	// So is a new map with the same block positions
+	env = std::make_unique<TestEnvironment>(gamedef);
+	UASSERT(!fall().collides);
+}
@@ -22,6 +22,8 @@ class TestCompression : public TestBase {
 	void testZlibCompression();
 	void testZlibLargeData();
 	void testZstdLargeData();
+	void testZstdBuffers();
+	void testZstdDictionary();
 	void testZlibLimit();
 	void _testZlibLimit(u32 size, u32 limit);
 };
@@ -34,6 +36,8 @@ void TestCompression::runTests(IGameDef *gamedef)
 	TEST(testZlibCompression);
 	TEST(testZlibLargeData);
 	TEST(testZstdLargeData);
+	TEST(testZstdBuffers);
+	TEST(testZstdDictionary);
 	TEST(testZlibLimit);
 }
 
@@ -196,6 +200,88 @@ void TestCompression::testZstdLargeData()
 	}
 }
 
+void TestCompression::testZstdBuffers()
+{
+	PseudoRandom pseudorandom(9420);
+	for (u32 size : {0, 100, 20000, 500000}) {
+		// Runs of bytes, compressible like map blocks
+		std::string data_in;
+		while (data_in.size() < size)
+			data_in.append(pseudorandom.range(1, 50), pseudorandom.range(0, 255));
+		data_in.resize(size);
+
+		for (int level : {0, 1, 10}) {
+			std::ostringstream os_compressed(std::ios::binary);
+			compressZstd(data_in, os_compressed, level);
+
+			// Same bytes as the stream version, appended
+			std::string compressed = "prefix";
+			compressZstd(reinterpret_cast<const u8*>(data_in.data()), data_in.size(),
+				compressed, level);
+			UASSERT(compressed == "prefix" + os_compressed.str());
+
+			// Data after the compressed data is left over
+			compressed = os_compressed.str() + "rest";
+			std::string decompressed = "prefix";
+			UASSERTEQ(size_t, decompressZstd(compressed, decompressed),
+				compressed.size() - 4);
+			UASSERT(decompressed == "prefix" + data_in);
+		}
+
+		std::ostringstream os_compressed(std::ios::binary);
+		compressZstd(data_in, os_compressed, 0);
+		std::string truncated = os_compressed.str();
+		truncated.pop_back();
+		std::string decompressed;
+		EXCEPTION_CHECK(SerializationError, decompressZstd(truncated, decompressed));
+	}
+}
+
+void TestCompression::testZstdDictionary()
+{
+	// Samples made of the same few pieces, like map blocks of one world
+	PseudoRandom pseudorandom(1234);
+	std::vector<std::string> pieces(20);
+	for (std::string &piece : pieces) {
+		for (int i = 0; i < 40; i++)
+			piece.push_back(pseudorandom.range(0, 255));
+	}
+	auto make_sample = [&] () {
+		std::string sample;
+		while (sample.size() < 2000)
+			sample += pieces[pseudorandom.range(0, pieces.size() - 1)];
+		return sample;
+	};
+	std::vector<std::string> samples;
+	for (int i = 0; i < 300; i++)
+		samples.push_back(make_sample());
+
+	const ZstdDictionary dict(trainZstdDictionary(samples, 4096));
+	UASSERT(dict.getId() != 0);
+	EXCEPTION_CHECK(SerializationError, ZstdDictionary("not a dictionary"));
+
+	const std::string data_in = make_sample();
+	std::string plain, with_dict;
+	compressZstd(reinterpret_cast<const u8*>(data_in.data()), data_in.size(),
+		plain, 1);
+	compressZstd(reinterpret_cast<const u8*>(data_in.data()), data_in.size(),
+		with_dict, 1, &dict);
+	UASSERT(with_dict.size() < plain.size());
+
+	std::string decompressed;
+	UASSERTEQ(size_t, decompressZstd(with_dict, decompressed, &dict), with_dict.size());
+	UASSERT(decompressed == data_in);
+
+	// Data compressed without a dictionary stays readable
+	decompressed.clear();
+	decompressZstd(plain, decompressed, &dict);
+	UASSERT(decompressed == data_in);
+
+	// But data that needs one can't be read without it
+	decompressed.clear();
+	EXCEPTION_CHECK(SerializationError, decompressZstd(with_dict, decompressed));
+}
+
 void TestCompression::testZlibLimit()
 {
 	// edge cases
@@ -7,12 +7,16 @@
 #include "log.h"
 #include "porting.h"
 #include "settings.h"
+#include "util/numeric.h"
 #include "util/serialize.h"
 #include "network/peerhandler.h"
 #include "network/mtp/internal.h"
 #include "network/networkexceptions.h"
 #include "network/networkpacket.h"
 
+#include <map>
+#include <memory>
+
 class TestConnection : public TestBase {
 public:
 	TestConnection()
@@ -27,7 +31,11 @@ class TestConnection : public TestBase {
 
 	void testNetworkPacketSerialize();
 	void testHelpers();
+	void testSharedPayload();
+	void testReliablePacketBuffer();
+	void testIncomingSplitBuffer();
 	void testConnectSendReceive();
+	void testShardedReceive();
 };
 
 static TestConnection g_test_instance;
@@ -36,7 +44,11 @@ void TestConnection::runTests(IGameDef *gamedef)
 {
 	TEST(testNetworkPacketSerialize);
 	TEST(testHelpers);
+	TEST(testSharedPayload);
+	TEST(testReliablePacketBuffer);
+	TEST(testIncomingSplitBuffer);
 	TEST(testConnectSendReceive);
+	TEST(testShardedReceive);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -82,7 +94,7 @@ void TestConnection::testNetworkPacketSerialize()
 		// serializing wide strings should do surrogate encoding, we test that here
 		pkt << std::wstring(L"\U00020b9a");
 
-		auto buf = pkt.oldForgePacket();
+		auto buf = pkt.forgeHead();
 		UASSERTEQ(int, buf.getSize(), sizeof(expected));
 		UASSERT(!memcmp(expected, &buf[0], buf.getSize()));
 	}
@@ -142,6 +154,163 @@ void TestConnection::testHelpers()
 	UASSERT(readU8(&p2[3]) == data1[0]);
 }
 
+void TestConnection::testSharedPayload()
+{
+	auto payload = std::make_shared<const std::string>(200, 'x');
+	NetworkPacket pkt(0x1234, 4);
+	pkt << (u32)0xdeadbeef;
+	pkt.putSharedRawString(payload);
+	UASSERTEQ(u32, pkt.getSize(), 4 + 200);
+
+	// The payload is referenced by the command, not copied
+	auto c = con::ConnectionCommand::send(123, 0, &pkt, true);
+	UASSERT(c->payload == payload);
+	const con::PacketData data = c->getData();
+	UASSERTEQ(u32, data.getSize(), 2 + 4 + 200);
+
+	// Split into reliable packets that hold the whole data in order
+	u16 split_seqnum = 65535;
+	con::PacketSplitter splitter(data, 60, split_seqnum);
+	UASSERTEQ(u16, split_seqnum, 0);
+	UASSERTEQ(u32, splitter.getCount(), 4);
+	std::string joined;
+	for (u32 i = 0; i < splitter.getCount(); i++) {
+		con::BufferedPacketPtr p = con::makeReliablePacket(Address(), splitter,
+			i, 1000 + i, 0x12345678, 123, 2);
+		const u8 *split = &p->data[BASE_HEADER_SIZE + RELIABLE_HEADER_SIZE];
+		UASSERTEQ(u32, readU32(&p->data[0]), 0x12345678);
+		UASSERTEQ(u16, p->getSeqnum(), 1000 + i);
+		UASSERTEQ(int, readU8(&split[0]), con::PACKET_TYPE_SPLIT);
+		UASSERTEQ(u16, readU16(&split[1]), 65535);
+		UASSERTEQ(u16, readU16(&split[3]), 4);
+		UASSERTEQ(u16, readU16(&split[5]), i);
+		joined.append((const char *)&split[7],
+			p->size() - BASE_HEADER_SIZE - RELIABLE_HEADER_SIZE - 7);
+	}
+	UASSERT(joined == std::string("\x12\x34\xde\xad\xbe\xef", 6) + *payload);
+
+	// Small data fits into a single packet
+	con::PacketSplitter original(con::PacketData(*c->data, c->data.getSize()),
+		60, split_seqnum);
+	UASSERTEQ(u16, split_seqnum, 0);
+	UASSERTEQ(u32, original.getCount(), 1);
+	UASSERTEQ(u32, original.getSize(0), 1 + 6);
+}
+
+static con::BufferedPacketPtr makeReliable(u16 seqnum)
+{
+	SharedBuffer<u8> data(1);
+	data[0] = seqnum & 0xff;
+	return con::makePacket(Address(127, 0, 0, 1, 10),
+		con::makeReliablePacket(data, seqnum), 0x12345678, 123, 0);
+}
+
+void TestConnection::testReliablePacketBuffer()
+{
+	con::ReliablePacketBuffer buf;
+	u16 seqnum;
+	UASSERT(buf.empty());
+	UASSERT(!buf.getFirstSeqnum(seqnum));
+
+	// Sorted by the distance from the next expected one, across the wrap around
+	const u16 next = 65500;
+	auto seq = [&] (u32 i) -> u16 { return next + i; };
+	for (u32 i : {3, 40, 1, 100, 37, 2}) {
+		auto p = makeReliable(seq(i));
+		buf.insert(p, next);
+	}
+	// A resent packet is ignored
+	auto p = makeReliable(seq(40));
+	buf.insert(p, next);
+	// Out of the window
+	p = makeReliable(next);
+	buf.insert(p, next);
+	p = makeReliable(next - 1);
+	buf.insert(p, next);
+	UASSERTEQ(u32, buf.size(), 6);
+
+	UASSERT(buf.getFirstSeqnum(seqnum));
+	UASSERTEQ(u16, seqnum, seq(1));
+	UASSERTEQ(u16, buf.popSeqnum(seq(40))->getSeqnum(), seq(40));
+	EXCEPTION_CHECK(con::NotFoundException, buf.popSeqnum(seq(40)));
+	EXCEPTION_CHECK(con::NotFoundException, buf.popSeqnum(seq(4)));
+	for (u32 i : {1, 2, 3, 37, 100})
+		UASSERTEQ(u16, buf.popFirst()->getSeqnum(), seq(i));
+	UASSERT(buf.empty());
+	EXCEPTION_CHECK(con::NotFoundException, buf.popFirst());
+
+	// The buffer grows to hold a wide window
+	for (u32 i = 1; i < 5000; i += 3) {
+		p = makeReliable(i);
+		buf.insert(p, 0);
+	}
+	UASSERTEQ(u32, buf.size(), 1667);
+	for (u32 i = 4999; i > 1; i -= 3)
+		UASSERTEQ(u16, buf.popSeqnum(i)->getSeqnum(), i);
+	UASSERT(buf.getFirstSeqnum(seqnum));
+	UASSERTEQ(u16, seqnum, 1);
+
+	// Resends are in order of seqnum and limited
+	buf.incrementTimeouts(1.0f);
+	p = makeReliable(6);
+	buf.insert(p, 0);
+	buf.incrementTimeouts(0.5f);
+	UASSERTEQ(u32, buf.getTimedOuts(1.0f), 1);
+	auto resend = buf.getResend(0.5f, 1);
+	UASSERTEQ(size_t, resend.size(), 1);
+	UASSERTEQ(u16, resend[0]->getSeqnum(), 1);
+	resend = buf.getResend(0.5f, 10);
+	UASSERTEQ(size_t, resend.size(), 1);
+	UASSERTEQ(u16, resend[0]->getSeqnum(), 6);
+	UASSERTEQ(size_t, buf.getResend(0.5f, 10).size(), 0);
+}
+
+void TestConnection::testIncomingSplitBuffer()
+{
+	con::IncomingSplitBuffer buf;
+	const Address address(127, 0, 0, 1, 10);
+
+	// Chunks of interleaved split packets arrive in any order
+	std::vector<std::vector<con::BufferedPacketPtr>> packets;
+	std::vector<std::string> contents;
+	for (u16 i = 0; i < 300; i++) {
+		std::string str(100 + i, 'a' + i % 26);
+		SharedBuffer<u8> data((const u8 *)str.data(), str.size());
+		// The seqnums collide in a small buffer
+		u16 split_seqnum = i * 64;
+		con::PacketSplitter splitter(con::PacketData(*data, data.getSize()),
+			60, split_seqnum);
+		packets.emplace_back();
+		for (u32 j = 0; j < splitter.getCount(); j++) {
+			SharedBuffer<u8> chunk(splitter.getSize(j));
+			splitter.write(j, *chunk);
+			packets.back().push_back(con::makePacket(address, chunk, 0x12345678, 123, 0));
+		}
+		contents.push_back(str);
+	}
+	for (size_t i = 0; i < packets.size(); i++) {
+		for (size_t j = 1; j < packets[i].size(); j++)
+			UASSERTEQ(size_t, buf.insert(packets[i][j], true).getSize(), 0);
+	}
+	UASSERTEQ(u32, buf.size(), 300);
+	// Duplicates are ignored
+	UASSERTEQ(size_t, buf.insert(packets[0][1], true).getSize(), 0);
+	for (size_t i = 0; i < packets.size(); i++) {
+		SharedBuffer<u8> result = buf.insert(packets[i][0], true);
+		UASSERT(std::string((const char *)*result, result.getSize()) == contents[i]);
+	}
+	UASSERTEQ(u32, buf.size(), 0);
+
+	// Only unreliable ones time out
+	UASSERTEQ(size_t, buf.insert(packets[0][1], true).getSize(), 0);
+	UASSERTEQ(size_t, buf.insert(packets[1][1], false).getSize(), 0);
+	buf.removeUnreliableTimedOuts(1.0f, 2.0f);
+	UASSERTEQ(u32, buf.size(), 2);
+	buf.removeUnreliableTimedOuts(1.0f, 2.0f);
+	UASSERTEQ(u32, buf.size(), 1);
+	UASSERT(buf.insert(packets[0][0], true).getSize() > 0);
+}
+
 
 void TestConnection::testConnectSendReceive()
 {
@@ -261,7 +430,7 @@ void TestConnection::testConnectSendReceive()
 		NetworkPacket pkt(0x4b, 0);
 		pkt.putRawString("Hello World !", 14);
 
-		auto sentdata = pkt.oldForgePacket();
+		auto sentdata = pkt.forgeHead();
 
 		infostream<<"** running client.Send()"<<std::endl;
 		client.Send(PEER_ID_SERVER, 0, &pkt, true);
@@ -276,7 +445,7 @@ void TestConnection::testConnectSendReceive()
 				<< ", data=" << pkt.getString(0)
 				<< std::endl;
 
-		auto recvdata = pkt.oldForgePacket();
+		auto recvdata = pkt.forgeHead();
 
 		UASSERT(memcmp(*sentdata, *recvdata, recvdata.getSize()) == 0);
 	}
@@ -305,7 +474,7 @@ void TestConnection::testConnectSendReceive()
 			infostream << "...";
 		infostream << std::endl;
 
-		auto sentdata = pkt.oldForgePacket();
+		auto sentdata = pkt.forgeHead();
 
 		server.Send(peer_id_client, 0, &pkt, true);
 
@@ -324,7 +493,7 @@ void TestConnection::testConnectSendReceive()
 			if (client.ReceiveTimeoutMs(&pkt, timeout_ms)) {
 				size = pkt.getSize();
 				peer_id = pkt.getPeerId();
-				recvdata = pkt.oldForgePacket();
+				recvdata = pkt.forgeHead();
 				received = true;
 			}
 			sleep_ms(10);
@@ -355,3 +524,88 @@ void TestConnection::testConnectSendReceive()
 	UASSERT(hand_server.count == 1);
 	UASSERT(hand_server.last_id >= 2);
 }
+
+void TestConnection::testShardedReceive()
+{
+	constexpr int num_clients = 4;
+	constexpr u16 packets_per_client = 50;
+
+	Handler hand_server("server");
+
+	// The threads are set up when the connection is created
+	const std::string old_threads = g_settings->get("network_process_threads");
+	g_settings->setU16("network_process_threads", 2);
+	con::Connection server(512, 5.0f, false, &hand_server);
+	g_settings->set("network_process_threads", old_threads);
+
+	// A random port, so that this can't clash with other tests or servers
+	const u16 port = myrand_range(30010, 39999);
+	Address address(0, 0, 0, 0, port);
+	Address server_address(127, 0, 0, 1, port);
+	// Use the bind_address for servers with no localhost address,
+	// see testConnectSendReceive()
+	try {
+		Address bind_addr(0, 0, 0, 0, port);
+		bind_addr.Resolve(g_settings->get("bind_address").c_str());
+		if (!bind_addr.isIPv6() && bind_addr != Address(0, 0, 0, 0, port)) {
+			address = bind_addr;
+			server_address = bind_addr;
+		}
+	} catch (ResolveError &e) {
+	}
+	server.Serve(address);
+
+	std::vector<std::unique_ptr<Handler>> hand_clients;
+	std::vector<std::unique_ptr<con::Connection>> clients;
+	for (int i = 0; i < num_clients; i++) {
+		hand_clients.push_back(std::make_unique<Handler>("client"));
+		clients.push_back(std::make_unique<con::Connection>(512, 5.0f, false,
+			hand_clients.back().get()));
+		clients.back()->Connect(server_address);
+	}
+
+	NetworkPacket pkt;
+	auto all_connected = [&] {
+		for (auto &client : clients) {
+			if (!client->Connected())
+				return false;
+		}
+		return true;
+	};
+	u64 start_ms = porting::getTimeMs();
+	while (!all_connected() || hand_server.count < num_clients) {
+		UASSERT(porting::getTimeMs() - start_ms < 5000);
+		server.TryReceive(&pkt);
+		for (auto &client : clients)
+			client->TryReceive(&pkt);
+		sleep_ms(10);
+	}
+
+	// Every client sends numbered packets, some of them large enough to be split
+	for (u16 n = 0; n < packets_per_client; n++) {
+		for (auto &client : clients) {
+			NetworkPacket out(0x4b, 0);
+			out << n;
+			if (n % 5 == 0)
+				out.putRawString(std::string(2000, 'x'));
+			client->Send(PEER_ID_SERVER, 0, &out, true);
+		}
+	}
+
+	// The packets of every peer arrive complete and in order
+	std::map<session_t, u16> next;
+	int received = 0;
+	start_ms = porting::getTimeMs();
+	while (received < num_clients * packets_per_client) {
+		UASSERT(porting::getTimeMs() - start_ms < 10000);
+		NetworkPacket pkt;
+		if (!server.ReceiveTimeoutMs(&pkt, 100))
+			continue;
+		u16 n;
+		pkt >> n;
+		UASSERTEQ(u16, n, next[pkt.getPeerId()]++);
+		UASSERTEQ(u32, pkt.getSize(), n % 5 == 0 ? 2002 : 2);
+		received++;
+	}
+	UASSERTEQ(size_t, next.size(), num_clients);
+}
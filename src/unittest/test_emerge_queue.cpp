@@ -0,0 +1,312 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#include "test.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <unordered_set>
+#include "emerge.h"
+
+class TestEmergeQueue : public TestBase
+{
+public:
+	TestEmergeQueue() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestEmergeQueue"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testMerge();
+	void testLimits();
+	void testStealing();
+	void testPriority();
+	void testCancel();
+	void testCancelShared();
+	void testConcurrent();
+};
+
+static TestEmergeQueue g_test_instance;
+
+void TestEmergeQueue::runTests(IGameDef *gamedef)
+{
+	TEST(testMerge);
+	TEST(testLimits);
+	TEST(testStealing);
+	TEST(testPriority);
+	TEST(testCancel);
+	TEST(testCancelShared);
+	TEST(testConcurrent);
+}
+
+namespace {
+
+void countCallback(v3s16 blockpos, EmergeAction action, void *param)
+{
+	(*reinterpret_cast<int *>(param))++;
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestEmergeQueue::testMerge()
+{
+	EmergeQueue queue(2, 100, 10, 10);
+	int worker = -2, calls = 0;
+
+	UASSERT(queue.push({1, 2, 3}, 5, 0, countCallback, &calls, EMERGE_PRIORITY_SERVER, &worker));
+	UASSERT(worker >= 0);
+	UASSERT(queue.contains({1, 2, 3}));
+
+	// A second request only adds its flags and callbacks
+	UASSERT(queue.push({1, 2, 3}, 6, BLOCK_EMERGE_ALLOW_GEN, countCallback, &calls, EMERGE_PRIORITY_SERVER, &worker));
+	UASSERTEQ(int, worker, -1);
+	UASSERTEQ(size_t, queue.size(), 1);
+
+	v3s16 pos;
+	BlockEmergeData bedata;
+	UASSERT(queue.pop(0, true, &pos, &bedata));
+	UASSERT(pos == v3s16(1, 2, 3));
+	UASSERTEQ(int, bedata.peer_requested, 5);
+	UASSERTEQ(int, bedata.flags, BLOCK_EMERGE_ALLOW_GEN);
+	UASSERTEQ(size_t, bedata.callbacks.size(), 2);
+	UASSERTEQ(size_t, queue.size(), 0);
+	UASSERT(!queue.contains({1, 2, 3}));
+	UASSERT(!queue.pop(0, true, &pos, &bedata));
+	UASSERT(!queue.pop(1, true, &pos, &bedata));
+
+	// Can be queued again once taken
+	UASSERT(queue.push({1, 2, 3}, 5, 0, nullptr, nullptr, EMERGE_PRIORITY_SERVER, &worker));
+	UASSERT(worker >= 0);
+}
+
+void TestEmergeQueue::testLimits()
+{
+	EmergeQueue queue(1, 12, 2, 3);
+	int worker;
+	s16 x = 0;
+	auto push = [&] (u16 peer, u16 flags) {
+		return queue.push({x++, 0, 0}, peer, flags, nullptr, nullptr, EMERGE_PRIORITY_SERVER, &worker);
+	};
+
+	// per peer, depending on whether generating is allowed
+	UASSERT(push(1, 0));
+	UASSERT(push(1, 0));
+	UASSERT(!push(1, 0));
+	UASSERT(push(1, BLOCK_EMERGE_ALLOW_GEN));
+	UASSERT(!push(1, BLOCK_EMERGE_ALLOW_GEN));
+	// other peers are not affected
+	UASSERT(push(2, 0));
+	// requests without a peer get half of the total
+	for (int i = 0; i < 6; i++)
+		UASSERT(push(PEER_ID_INEXISTENT, 0));
+	UASSERT(!push(PEER_ID_INEXISTENT, 0));
+	UASSERTEQ(size_t, queue.size(), 10);
+	// total limit
+	UASSERT(push(3, 0));
+	UASSERT(push(3, 0));
+	UASSERT(!push(4, 0));
+	// unless forced
+	UASSERT(push(4, BLOCK_EMERGE_FORCE_QUEUE));
+	UASSERTEQ(size_t, queue.size(), 13);
+
+	// taking blocks frees the peer's share
+	v3s16 pos;
+	BlockEmergeData bedata;
+	UASSERT(queue.pop(0, false, &pos, &bedata));
+	UASSERTEQ(int, bedata.peer_requested, 1);
+	UASSERT(queue.pop(0, false, &pos, &bedata));
+	UASSERT(push(1, 0));
+}
+
+void TestEmergeQueue::testStealing()
+{
+	EmergeQueue queue(3, 100, 100, 100);
+	int worker;
+	v3s16 pos;
+	BlockEmergeData bedata;
+
+	// Blocks are handed to idle workers first
+	std::unordered_set<int> workers;
+	for (s16 i = 0; i < 3; i++) {
+		UASSERT(queue.push({i, 0, 0}, 1, 0, nullptr, nullptr, EMERGE_PRIORITY_SERVER, &worker));
+		workers.insert(worker);
+	}
+	UASSERTEQ(size_t, workers.size(), 3);
+
+	// Keep worker 1 busy with its block
+	UASSERT(queue.pop(1, false, &pos, &bedata));
+	for (s16 i = 3; i < 6; i++)
+		UASSERT(queue.push({i, 0, 0}, 1, 0, nullptr, nullptr, EMERGE_PRIORITY_SERVER, &worker));
+
+	// Worker 2 can do all of the work
+	std::unordered_set<v3s16> seen;
+	while (queue.pop(2, true, &pos, &bedata))
+		seen.insert(pos);
+	UASSERTEQ(size_t, seen.size(), 5);
+	UASSERTEQ(size_t, queue.size(), 0);
+
+	// Without stealing only the own list is used
+	for (s16 i = 0; i < 3; i++)
+		UASSERT(queue.push({i, 1, 0}, 1, 0, nullptr, nullptr, EMERGE_PRIORITY_SERVER, &worker));
+	size_t own = 0;
+	while (queue.pop(0, false, &pos, &bedata))
+		own++;
+	UASSERT(own < 3);
+}
+
+void TestEmergeQueue::testPriority()
+{
+	EmergeQueue queue(1, 100, 100, 100);
+	int worker;
+	v3s16 pos;
+	BlockEmergeData bedata;
+
+	// Lowest value first, equal values in order of request
+	UASSERT(queue.push({0, 0, 0}, 1, 0, nullptr, nullptr, 5, &worker));
+	UASSERT(queue.push({1, 0, 0}, 1, 0, nullptr, nullptr, 2, &worker));
+	UASSERT(queue.push({2, 0, 0}, 1, 0, nullptr, nullptr, 5, &worker));
+	UASSERT(queue.push({3, 0, 0}, 1, 0, nullptr, nullptr, 9, &worker));
+
+	// The player moved: its own request replaces the priority
+	UASSERT(queue.push({3, 0, 0}, 1, 0, nullptr, nullptr, 1, &worker));
+	UASSERT(queue.push({1, 0, 0}, 1, 0, nullptr, nullptr, 7, &worker));
+	// Another player can only make it more urgent
+	UASSERT(queue.push({2, 0, 0}, 2, 0, nullptr, nullptr, 8, &worker));
+	UASSERTEQ(int, worker, -1);
+	UASSERT(queue.push({2, 0, 0}, 2, 0, nullptr, nullptr, 3, &worker));
+
+	// The server and the API wait for the blocks players look at,
+	// interacting players don't
+	UASSERT(queue.push({4, 0, 0}, PEER_ID_INEXISTENT, 0, nullptr, nullptr,
+		EMERGE_PRIORITY_SERVER, &worker));
+	UASSERT(queue.push({5, 0, 0}, 1, 0, nullptr, nullptr,
+		EMERGE_PRIORITY_INTERACT, &worker));
+	UASSERTEQ(size_t, queue.size(), 6);
+
+	const s16 expected[] = {5, 3, 2, 0, 1, 4};
+	for (s16 x : expected) {
+		UASSERT(queue.pop(0, false, &pos, &bedata));
+		UASSERTEQ(int, pos.X, x);
+	}
+	// Outdated heap items are skipped
+	UASSERT(!queue.pop(0, false, &pos, &bedata));
+	UASSERTEQ(size_t, queue.size(), 0);
+}
+
+void TestEmergeQueue::testCancel()
+{
+	EmergeQueue queue(2, 100, 100, 3, 20);
+	int worker, calls = 0;
+	v3s16 pos;
+	BlockEmergeData bedata;
+	bool expired;
+
+	UASSERT(queue.push({0, 0, 0}, 1, BLOCK_EMERGE_ALLOW_GEN, nullptr, nullptr, 0, &worker));
+	UASSERT(queue.push({1, 0, 0}, 1, BLOCK_EMERGE_ALLOW_GEN, nullptr, nullptr, 0, &worker));
+	UASSERT(queue.push({2, 0, 0}, 1, BLOCK_EMERGE_ALLOW_GEN, nullptr, nullptr, 0, &worker));
+	UASSERT(!queue.push({3, 0, 0}, 1, BLOCK_EMERGE_ALLOW_GEN, nullptr, nullptr, 0, &worker));
+	// Blocks also wanted by the server or a callback, or forced, are kept
+	UASSERT(queue.push({1, 0, 0}, PEER_ID_INEXISTENT, 0, nullptr, nullptr, 0, &worker));
+	UASSERT(queue.push({2, 0, 0}, 2, 0, countCallback, &calls, 0, &worker));
+	UASSERT(queue.push({4, 0, 0}, 2, 0, nullptr, nullptr, 0, &worker));
+	UASSERT(queue.push({5, 0, 0}, 2, BLOCK_EMERGE_FORCE_QUEUE, nullptr, nullptr, 0, &worker));
+
+	// Frees the share of the player right away
+	UASSERTEQ(size_t, queue.cancelPeer(1), 1);
+	UASSERTEQ(size_t, queue.size(), 4);
+	UASSERT(!queue.contains({0, 0, 0}));
+	UASSERT(queue.push({3, 0, 0}, 1, BLOCK_EMERGE_ALLOW_GEN, nullptr, nullptr, 0, &worker));
+
+	// Requests that are not repeated time out
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	UASSERT(queue.push({3, 0, 0}, 1, BLOCK_EMERGE_ALLOW_GEN, nullptr, nullptr, 0, &worker));
+	std::unordered_set<s16> taken, dropped;
+	while (queue.pop(0, true, &pos, &bedata, &expired))
+		(expired ? dropped : taken).insert(pos.X);
+	UASSERT(taken == std::unordered_set<s16>({1, 2, 3, 5}));
+	UASSERT(dropped == std::unordered_set<s16>({4}));
+	UASSERTEQ(size_t, queue.size(), 0);
+}
+
+void TestEmergeQueue::testCancelShared()
+{
+	EmergeQueue queue(1, 100, 100, 100, 20);
+	int worker;
+	v3s16 pos;
+	BlockEmergeData bedata;
+	bool expired;
+
+	// Player 2 also waits for a block that player 1 requested first
+	UASSERT(queue.push({0, 0, 0}, 1, BLOCK_EMERGE_ALLOW_GEN, nullptr, nullptr, 0, &worker));
+	UASSERT(queue.push({0, 0, 0}, 2, BLOCK_EMERGE_ALLOW_GEN, nullptr, nullptr, 0, &worker));
+	UASSERT(queue.push({1, 0, 0}, 1, BLOCK_EMERGE_ALLOW_GEN, nullptr, nullptr, 0, &worker));
+
+	// Player 1 leaves, the shared block stays
+	UASSERTEQ(size_t, queue.cancelPeer(1), 1);
+	UASSERT(queue.contains({0, 0, 0}));
+	UASSERT(!queue.contains({1, 0, 0}));
+
+	// and does not time out either
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	UASSERT(queue.pop(0, true, &pos, &bedata, &expired));
+	UASSERT(pos == v3s16(0, 0, 0));
+	UASSERT(!expired);
+	UASSERTEQ(size_t, queue.size(), 0);
+}
+
+void TestEmergeQueue::testConcurrent()
+{
+	constexpr int num_producers = 4;
+	constexpr int num_workers = 3;
+	constexpr s16 per_producer = 2000;
+	EmergeQueue queue(num_workers, 1000000, 1000000, 1000000);
+
+	std::atomic<int> taken{0}, callbacks{0};
+	std::atomic<bool> done{false};
+	std::vector<std::thread> threads;
+	for (int w = 0; w < num_workers; w++) {
+		threads.emplace_back([&, w] {
+			v3s16 pos;
+			BlockEmergeData bedata;
+			while (true) {
+				if (queue.pop(w, true, &pos, &bedata)) {
+					taken++;
+					callbacks += bedata.callbacks.size();
+				} else if (done) {
+					break;
+				} else {
+					std::this_thread::yield();
+				}
+			}
+		});
+	}
+
+	std::vector<std::thread> producers;
+	for (int p = 0; p < num_producers; p++) {
+		producers.emplace_back([&, p] {
+			int worker;
+			for (s16 i = 0; i < per_producer; i++) {
+				// Every position is requested by two producers
+				v3s16 pos(i, (p / 2) * 100, 0);
+				queue.push(pos, p + 1, BLOCK_EMERGE_FORCE_QUEUE,
+					countCallback, nullptr, EMERGE_PRIORITY_SERVER, &worker);
+			}
+		});
+	}
+	for (auto &t : producers)
+		t.join();
+	// wait for the workers to drain the queue
+	while (queue.size() > 0)
+		std::this_thread::yield();
+	done = true;
+	for (auto &t : threads)
+		t.join();
+
+	// Each request ends up in exactly one taken entry
+	UASSERTEQ(int, callbacks, num_producers * per_producer);
+	UASSERT(taken >= num_producers / 2 * per_producer);
+	UASSERT(taken <= num_producers * per_producer);
+}
@@ -23,6 +23,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <unordered_map>
 #include "mapblock.h"
 #include "dummymap.h"
+#include "map_block_index.h"
+#include "profiler.h"
 
 class TestMap : public TestBase
 {
@@ -36,16 +38,54 @@ class TestMap : public TestBase
 	void testForEachNodeInArea(IGameDef *gamedef);
 	void testForEachNodeInAreaBlank(IGameDef *gamedef);
 	void testForEachNodeInAreaEmpty(IGameDef *gamedef);
+	void testForEachNodeInAreaFiltered(IGameDef *gamedef);
+	void testTimerUpdate(IGameDef *gamedef);
+	void testTimerUpdateLimit(IGameDef *gamedef);
+	void testSaveModified(IGameDef *gamedef);
+	void testBlockIndex();
+	void testBlockNeighborhood(IGameDef *gamedef);
 };
 
 static TestMap g_test_instance;
 
+namespace {
+
+class SaveRecordingMap : public DummyMap
+{
+public:
+	using DummyMap::DummyMap;
+
+	bool saveBlock(MapBlock *block) override
+	{
+		saved.push_back(block->getPos());
+		block->resetModified();
+		return true;
+	}
+
+	u32 saveTest(ModifiedState save_level)
+	{
+		saved.clear();
+		Profiler modprofiler;
+		return saveModifiedBlocks(save_level, modprofiler);
+	}
+
+	std::vector<v3s16> saved;
+};
+
+}
+
 void TestMap::runTests(IGameDef *gamedef)
 {
 	TEST(testMaxMapgenLimit);
 	TEST(testForEachNodeInArea, gamedef);
 	TEST(testForEachNodeInAreaBlank, gamedef);
 	TEST(testForEachNodeInAreaEmpty, gamedef);
+	TEST(testForEachNodeInAreaFiltered, gamedef);
+	TEST(testTimerUpdate, gamedef);
+	TEST(testTimerUpdateLimit, gamedef);
+	TEST(testSaveModified, gamedef);
+	TEST(testBlockIndex);
+	TEST(testBlockNeighborhood, gamedef);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -169,3 +209,191 @@ void TestMap::testForEachNodeInAreaEmpty(IGameDef *gamedef)
 		return true;
 	});
 }
+
+void TestMap::testForEachNodeInAreaFiltered(IGameDef *gamedef)
+{
+	DummyMap map(gamedef, v3s16(0, 0, 0), v3s16(2, 0, 0));
+	map.fill(v3s16(0, 0, 0), v3s16(2, 0, 0), MapNode(CONTENT_AIR));
+	v3s16 p_stone(20, 3, 3);
+	map.setNode(p_stone, MapNode(t_CONTENT_STONE));
+
+	// Only the block with the stone is visited
+	const std::vector<content_t> stone{t_CONTENT_STONE};
+	s32 n_visited = 0;
+	std::vector<v3s16> found;
+	map.forEachNodeInArea(v3s16(0, 0, 0), v3s16(47, 15, 15), stone,
+			[&](v3s16 p, MapNode n) -> bool {
+		n_visited++;
+		UASSERT(getNodeBlockPos(p) == v3s16(1, 0, 0));
+		if (n.getContent() == t_CONTENT_STONE)
+			found.push_back(p);
+		return true;
+	});
+	UASSERTEQ(s32, n_visited, MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE);
+	UASSERT(found == std::vector<v3s16>{p_stone});
+
+	// Missing blocks are made of ignore
+	const std::vector<content_t> ignore{CONTENT_IGNORE};
+	n_visited = 0;
+	map.forEachNodeInArea(v3s16(40, 0, 0), v3s16(50, 0, 0), ignore,
+			[&](v3s16 p, MapNode n) -> bool {
+		n_visited++;
+		UASSERTEQ(content_t, n.getContent(), CONTENT_IGNORE);
+		return true;
+	});
+	UASSERTEQ(s32, n_visited, 3);
+
+	// Nothing is visited if nothing can match
+	const std::vector<content_t> water{t_CONTENT_WATER};
+	map.forEachNodeInArea(v3s16(0, 0, 0), v3s16(47, 15, 15), water,
+			[&](v3s16 p, MapNode n) -> bool {
+		UASSERT(false); // Should be unreachable
+		return true;
+	});
+}
+
+void TestMap::testTimerUpdate(IGameDef *gamedef)
+{
+	DummyMap map(gamedef, {0, 0, 0}, {3, 3, 3});
+	UASSERTEQ(size_t, map.getBlockCount(), 64);
+
+	std::vector<v3s16> unloaded;
+	map.timerUpdate(1.0f, 5.0f, -1, &unloaded);
+	UASSERTEQ(size_t, unloaded.size(), 0);
+
+	MapBlock *used = map.getBlockNoCreateNoEx({1, 2, 3});
+	used->resetUsageTimer();
+	UASSERT(used->getUsageTimer() == 0);
+	map.timerUpdate(4.5f, 5.0f, -1, &unloaded);
+	UASSERTEQ(size_t, unloaded.size(), 63);
+	UASSERTEQ(size_t, map.getBlockCount(), 1);
+	UASSERT(map.getBlockNoCreateNoEx({1, 2, 3}) == used);
+	UASSERT(std::abs(used->getUsageTimer() - 4.5f) < 0.01f);
+	// emptied sectors are gone
+	UASSERT(!map.getSectorNoGenerate({0, 0}));
+	UASSERT(map.getSectorNoGenerate({1, 3}));
+
+	// referenced blocks stay
+	used->refGrab();
+	map.timerUpdate(10.0f, 5.0f, -1, &unloaded);
+	UASSERTEQ(size_t, map.getBlockCount(), 1);
+	used->refDrop();
+
+	map.unloadUnreferencedBlocks(&unloaded);
+	UASSERTEQ(size_t, unloaded.size(), 64);
+	UASSERTEQ(size_t, map.getBlockCount(), 0);
+	UASSERT(!map.getSectorNoGenerate({1, 3}));
+}
+
+void TestMap::testTimerUpdateLimit(IGameDef *gamedef)
+{
+	DummyMap map(gamedef, {0, 0, 0}, {3, 3, 3});
+
+	map.timerUpdate(1.0f, 100.0f, -1);
+	// the most recently used blocks are kept
+	std::vector<MapBlock*> used;
+	for (s16 i = 0; i < 4; i++) {
+		used.push_back(map.getBlockNoCreateNoEx({i, i, i}));
+		used.back()->resetUsageTimer();
+	}
+
+	std::vector<v3s16> unloaded;
+	map.timerUpdate(1.0f, 100.0f, 4, &unloaded);
+	UASSERTEQ(size_t, unloaded.size(), 60);
+	UASSERTEQ(size_t, map.getBlockCount(), 4);
+	for (s16 i = 0; i < 4; i++)
+		UASSERT(map.getBlockNoCreateNoEx({i, i, i}) == used[i]);
+}
+
+void TestMap::testSaveModified(IGameDef *gamedef)
+{
+	SaveRecordingMap map(gamedef, {0, 0, 0}, {3, 3, 3});
+	UASSERTEQ(u32, map.saveTest(MOD_STATE_WRITE_AT_UNLOAD), 0);
+
+	const v3s16 a(1, 0, 0), b(0, 2, 3);
+	map.getBlockNoCreateNoEx(a)->raiseModified(MOD_STATE_WRITE_AT_UNLOAD);
+	map.getBlockNoCreateNoEx(b)->raiseModified(MOD_STATE_WRITE_NEEDED);
+	map.getBlockNoCreateNoEx(b)->raiseModified(MOD_STATE_WRITE_NEEDED);
+
+	UASSERTEQ(u32, map.saveTest(MOD_STATE_WRITE_NEEDED), 1);
+	UASSERT(map.saved == std::vector<v3s16>{b});
+
+	// a was not forgotten
+	UASSERTEQ(u32, map.saveTest(MOD_STATE_WRITE_AT_UNLOAD), 1);
+	UASSERT(map.saved == std::vector<v3s16>{a});
+	UASSERTEQ(u32, map.saveTest(MOD_STATE_WRITE_AT_UNLOAD), 0);
+
+	// modified again after saving
+	map.getBlockNoCreateNoEx(a)->raiseModified(MOD_STATE_WRITE_NEEDED);
+	UASSERTEQ(u32, map.saveTest(MOD_STATE_WRITE_NEEDED), 1);
+	UASSERT(map.saved == std::vector<v3s16>{a});
+}
+
+void TestMap::testBlockIndex()
+{
+	// The index never dereferences the blocks
+	const auto fake_block = [] (v3s16 p) {
+		return reinterpret_cast<MapBlock*>(
+			((uintptr_t)(u16)p.X << 33) + ((uintptr_t)(u16)p.Y << 17) + ((u16)p.Z << 1) + 2);
+	};
+
+	MapBlockIndex index;
+	std::unordered_set<v3s16> reference;
+	UASSERT(!index.get(v3s16(0, 0, 0)));
+
+	// Clustered positions lead to many collisions and long probe sequences
+	for (int i = 0; i < 20000; i++) {
+		v3s16 p(myrand_range(-12, 12), myrand_range(-12, 12), myrand_range(-12, 12));
+		if (i % 100 == 0)
+			p = v3s16(myrand_range(-30000, 30000), 0, myrand_range(-30000, 30000)) / 16;
+		if (reference.count(p)) {
+			UASSERT(index.get(p) == fake_block(p));
+			if (myrand_range(0, 1)) {
+				UASSERT(index.erase(p));
+				reference.erase(p);
+				UASSERT(!index.get(p));
+				UASSERT(!index.erase(p));
+			}
+		} else {
+			UASSERT(!index.get(p));
+			index.insert(p, fake_block(p));
+			reference.insert(p);
+		}
+	}
+	UASSERTEQ(size_t, index.size(), reference.size());
+
+	std::vector<v3s16> positions;
+	for (v3s16 p : reference) {
+		UASSERT(index.get(p) == fake_block(p));
+		positions.push_back(p);
+		positions.push_back(p + v3s16(0, 100, 0));
+	}
+	std::vector<MapBlock*> found(positions.size());
+	index.get(positions.data(), positions.size(), found.data());
+	for (size_t i = 0; i < positions.size(); i++)
+		UASSERT(found[i] == (i % 2 ? nullptr : fake_block(positions[i])));
+
+	for (v3s16 p : reference)
+		UASSERT(index.erase(p));
+	UASSERTEQ(size_t, index.size(), 0);
+}
+
+void TestMap::testBlockNeighborhood(IGameDef *gamedef)
+{
+	DummyMap map(gamedef, {-1, -1, -1}, {1, 1, 0});
+
+	MapBlock *blocks[27];
+	map.getBlockNeighborhood(v3s16(0, 0, 0), blocks);
+	int i = 0;
+	for (s16 z = -1; z <= 1; z++)
+	for (s16 y = -1; y <= 1; y++)
+	for (s16 x = -1; x <= 1; x++) {
+		MapBlock *block = blocks[i++];
+		if (z == 1) {
+			UASSERT(!block);
+		} else {
+			UASSERT(block);
+			UASSERT(block->getPos() == v3s16(x, y, z));
+		}
+	}
+}
@@ -0,0 +1,140 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#include "test.h"
+
+#include "database/database-dummy.h"
+#include "map_save_queue.h"
+#include "mapblock.h"
+#include "servermap.h"
+#include "util/metricsbackend.h"
+
+class TestMapSaveQueue : public TestBase
+{
+public:
+	TestMapSaveQueue() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMapSaveQueue"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testSameAsSynchronous(IGameDef *gamedef, unsigned int threads);
+	void testPendingAndCancel(IGameDef *gamedef);
+	void testSupersede(IGameDef *gamedef);
+};
+
+static TestMapSaveQueue g_test_instance;
+
+void TestMapSaveQueue::runTests(IGameDef *gamedef)
+{
+	TEST(testSameAsSynchronous, gamedef, 0);
+	TEST(testSameAsSynchronous, gamedef, 3);
+	TEST(testPendingAndCancel, gamedef);
+	TEST(testSupersede, gamedef);
+}
+
+namespace {
+
+void fillBlock(MapBlock &block, content_t c)
+{
+	for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+	for (s16 y = 0; y < MAP_BLOCKSIZE; y++)
+	for (s16 x = 0; x < MAP_BLOCKSIZE; x++)
+		block.setNodeNoCheck(x, y, z, MapNode((x + y + z) % 3 ? c : CONTENT_AIR));
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestMapSaveQueue::testSameAsSynchronous(IGameDef *gamedef, unsigned int threads)
+{
+	MetricsBackend mb;
+	Database_Dummy db, db_sync;
+	MapDatabaseAccessor acc;
+	acc.dbase = &db;
+
+	std::vector<std::unique_ptr<MapBlock>> blocks;
+	for (s16 i = 0; i < 20; i++) {
+		blocks.emplace_back(std::make_unique<MapBlock>(v3s16(i, -i, 3), gamedef));
+		fillBlock(*blocks.back(), CONTENT_AIR + 1 + i % 2);
+	}
+
+	{
+		MapSaveQueue queue(&acc, -1, threads, &mb);
+		for (auto &block : blocks) {
+			queue.enqueue(block.get());
+			UASSERT(ServerMap::saveBlock(block.get(), &db_sync));
+		}
+		queue.flush();
+		UASSERTEQ(size_t, queue.size(), 0);
+	}
+
+	for (auto &block : blocks) {
+		std::string a, b;
+		db.loadBlock(block->getPos(), &a);
+		db_sync.loadBlock(block->getPos(), &b);
+		UASSERT(!a.empty());
+		UASSERT(a == b);
+	}
+}
+
+void TestMapSaveQueue::testPendingAndCancel(IGameDef *gamedef)
+{
+	MetricsBackend mb;
+	Database_Dummy db, db_sync;
+	MapDatabaseAccessor acc;
+	acc.dbase = &db;
+	const v3s16 pos(1, 2, 3);
+
+	MapBlock block(pos, gamedef);
+	fillBlock(block, CONTENT_AIR + 1);
+	UASSERT(ServerMap::saveBlock(&block, &db_sync));
+	std::string expected;
+	db_sync.loadBlock(pos, &expected);
+
+	MapSaveQueue queue(&acc, -1, 1, &mb);
+	{
+		// keep the writer from finishing while we look at the queue
+		MutexAutoLock dblock(acc.mutex);
+		queue.enqueue(&block);
+		acc.save_queue = &queue;
+
+		std::string data;
+		acc.loadBlock(pos, data);
+		UASSERT(data == expected);
+
+		queue.cancel(pos);
+		UASSERT(!queue.getPending(pos, data));
+	}
+	queue.flush();
+
+	std::string data;
+	db.loadBlock(pos, &data);
+	UASSERT(data.empty());
+}
+
+void TestMapSaveQueue::testSupersede(IGameDef *gamedef)
+{
+	MetricsBackend mb;
+	Database_Dummy db, db_sync;
+	MapDatabaseAccessor acc;
+	acc.dbase = &db;
+	const v3s16 pos(-4, 0, 9);
+
+	MapBlock block(pos, gamedef);
+	{
+		MapSaveQueue queue(&acc, -1, 2, &mb);
+		for (content_t c = CONTENT_AIR + 1; c < CONTENT_AIR + 6; c++) {
+			fillBlock(block, c);
+			queue.enqueue(&block);
+		}
+		// destructor flushes
+	}
+
+	UASSERT(ServerMap::saveBlock(&block, &db_sync));
+	std::string a, b;
+	db.loadBlock(pos, &a);
+	db_sync.loadBlock(pos, &b);
+	UASSERT(a == b);
+}
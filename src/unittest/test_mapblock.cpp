@@ -3,6 +3,7 @@
 
 #include "test.h"
 
+#include <algorithm>
 #include <sstream>
 #include "gamedef.h"
 #include "nodedef.h"
@@ -28,6 +29,15 @@ class TestMapBlock : public TestBase
 
 	void testSave29(IGameDef *gamedef);
 
+	// Tests that compressing an uncompressed snapshot gives the regular format
+	void testSerializeUncompressed(IGameDef *gamedef);
+
+	// Tests that every modification changes the modification counter
+	void testModificationCounter(IGameDef *gamedef);
+
+	// Tests that the cached list of contents is kept up to date
+	void testContentsCache(IGameDef *gamedef);
+
 	void testLoad29(IGameDef *gamedef);
 
 	// Tests loading a MapBlock from Minetest-c55 0.3
@@ -38,6 +48,9 @@ class TestMapBlock : public TestBase
 
 	// Tests blocks with a single recurring node
 	void testMonoblock(IGameDef *gamedef);
+
+	// Tests blocks with few different nodes
+	void testPaletteBlock(IGameDef *gamedef);
 };
 
 static TestMapBlock g_test_instance;
@@ -47,10 +60,14 @@ void TestMapBlock::runTests(IGameDef *gamedef)
 	TEST(testSaveLoad, gamedef, SER_FMT_VER_HIGHEST_WRITE);
 	TEST(testSaveLoadLowest, gamedef);
 	TEST(testSave29, gamedef);
+	TEST(testSerializeUncompressed, gamedef);
+	TEST(testModificationCounter, gamedef);
+	TEST(testContentsCache, gamedef);
 	TEST(testLoad29, gamedef);
 	TEST(testLoad20, gamedef);
 	TEST(testLoadNonStd, gamedef);
 	TEST(testMonoblock, gamedef);
+	TEST(testPaletteBlock, gamedef);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -99,6 +116,7 @@ void TestMapBlock::testMonoblock(IGameDef *gamedef)
 	UASSERT(!block.m_is_mono_block);
 
 	// set all nodes to 42
+	block.expandNodesIfNeeded();
 	for (size_t i = 0; i < MapBlock::nodecount; ++i) {
 		block.data[i] = MapNode(42);
 	}
@@ -154,6 +172,90 @@ void TestMapBlock::testMonoblock(IGameDef *gamedef)
 	UASSERT(block.m_is_mono_block);
 }
 
+void TestMapBlock::testPaletteBlock(IGameDef *gamedef)
+{
+	MapBlock block({}, gamedef);
+	block.expandNodesIfNeeded();
+	for (size_t i = 0; i < MapBlock::nodecount; ++i)
+		block.data[i] = i % 3 ? MapNode(CONTENT_AIR) : MapNode(t_CONTENT_STONE, i % 5 ? 0 : 15);
+	std::vector<MapNode> expected(block.data, block.data + MapBlock::nodecount);
+
+	// 3 different nodes need 2 bits each
+	block.tryShrinkNodes();
+	UASSERT(!block.m_is_mono_block);
+	UASSERT(block.m_indices);
+	UASSERT(block.m_index_bits == 2);
+	UASSERT(block.getNodeStorageSize() < sizeof(MapNode) * MapBlock::nodecount / 8);
+
+	auto check_nodes = [&] () {
+		v3s16 p;
+		for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++)
+		for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++)
+		for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++) {
+			const u32 i = p.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE + p.Y * MAP_BLOCKSIZE + p.X;
+			UASSERT(block.getNodeNoCheck(p) == expected[i]);
+		}
+	};
+	check_nodes();
+
+	// Nodes in the palette are set in place
+	block.setNode(1, 2, 3, MapNode(t_CONTENT_STONE));
+	expected[3 * 256 + 2 * 16 + 1] = MapNode(t_CONTENT_STONE);
+	UASSERT(block.m_indices);
+	check_nodes();
+
+	// So is a new one while the palette has room, the contents cache too
+	block.setNode(4, 5, 6, MapNode(CONTENT_AIR, 15));
+	expected[6 * 256 + 5 * 16 + 4] = MapNode(CONTENT_AIR, 15);
+	UASSERT(block.m_indices);
+	check_nodes();
+
+	// Copying to a VoxelManipulator and back gives the same nodes
+	VoxelManipulator vmm;
+	vmm.addArea(VoxelArea(v3s16(0), v3s16(MAP_BLOCKSIZE - 1)));
+	block.copyTo(vmm);
+	block.copyFrom(vmm);
+	UASSERT(block.m_indices);
+	check_nodes();
+
+	// The storage is expanded when the palette is full
+	block.setNode(7, 8, 9, MapNode(t_CONTENT_BRICK));
+	expected[9 * 256 + 8 * 16 + 7] = MapNode(t_CONTENT_BRICK);
+	UASSERT(!block.m_indices);
+	check_nodes();
+
+	// Shrinks to a larger palette
+	block.tryShrinkNodes();
+	UASSERT(block.m_index_bits == 4);
+	check_nodes();
+
+	// Serialization sees the same nodes
+	std::string data;
+	block.serialize(data, SER_FMT_VER_HIGHEST_WRITE, true, -1);
+	MapBlock block2({}, gamedef);
+	block2.deSerialize(data, SER_FMT_VER_HIGHEST_WRITE, true);
+	UASSERT(block2.m_indices);
+	for (u32 i = 0; i < MapBlock::nodecount; i++)
+		UASSERT(block2.getNodeAt(i) == expected[i]);
+
+	// Expanding keeps the nodes, monoblocks stay as they are
+	block.expandPalette();
+	UASSERT(!block.m_indices);
+	check_nodes();
+	MapBlock mono({}, gamedef);
+	mono.tryShrinkNodes();
+	mono.expandPalette();
+	UASSERT(mono.m_is_mono_block);
+
+	// Too many different nodes stay in the full array
+	block.expandNodesIfNeeded();
+	for (size_t i = 0; i < MapBlock::nodecount; ++i)
+		block.data[i] = MapNode(i % 17);
+	block.tryShrinkNodes();
+	UASSERT(!block.m_is_mono_block);
+	UASSERT(!block.m_indices);
+}
+
 void TestMapBlock::testSaveLoad(IGameDef *gamedef, const u8 version)
 {
 	// Use the bottom node ids for this test
@@ -168,7 +270,7 @@ void TestMapBlock::testSaveLoad(IGameDef *gamedef, const u8 version)
 	UASSERT(max <= CONTENT_UNKNOWN);
 
 	constexpr u64 seed = 0x207366616e3520ULL;
-	std::stringstream ss;
+	std::string data;
 	{
 		MapBlock block({}, gamedef);
 		// Fill with data
@@ -182,13 +284,17 @@ void TestMapBlock::testSaveLoad(IGameDef *gamedef, const u8 version)
 		}
 
 		// Serialize
-		block.serialize(ss, version, true, -1);
+		block.serialize(data, version, true, -1);
 	}
 
+	// Data after the block is left alone
+	data += "rest";
+
 	{
 		MapBlock block({}, gamedef);
 		// Deserialize
-		block.deSerialize(ss, version, true);
+		UASSERTEQ(size_t, block.deSerialize(data, version, true),
+			data.size() - 4);
 
 		// Check data
 		PcgRandom r(seed);
@@ -205,10 +311,115 @@ void TestMapBlock::testSaveLoad(IGameDef *gamedef, const u8 version)
 
 #define SS2_CHECK() UASSERT(!ss2.fail())
 
+void TestMapBlock::testSerializeUncompressed(IGameDef *gamedef)
+{
+	MapBlock block({1, 2, 3}, gamedef);
+	for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+	for (s16 y = 0; y < MAP_BLOCKSIZE; y++)
+	for (s16 x = 0; x < MAP_BLOCKSIZE; x++)
+		block.setNodeNoCheck(x, y, z, MapNode(z > 7 ? t_CONTENT_STONE : CONTENT_AIR));
+
+	for (bool disk : {true, false}) {
+		std::string expected;
+		block.serialize(expected, 29, disk, -1);
+
+		std::string raw, actual;
+		block.serializeUncompressed(raw, 29, disk);
+		compress(raw, actual, 29, -1);
+
+		UASSERT(actual == expected);
+	}
+
+	std::string raw;
+	EXCEPTION_CHECK(VersionMismatchException,
+		block.serializeUncompressed(raw, 28, true));
+}
+
+void TestMapBlock::testModificationCounter(IGameDef *gamedef)
+{
+	MapBlock block({}, gamedef), block2({}, gamedef);
+	// never the same for different instances
+	UASSERT(block.getModificationCounter() != block2.getModificationCounter());
+
+	u64 counter = block.getModificationCounter();
+	block.setNode({1, 1, 1}, MapNode(t_CONTENT_STONE));
+	UASSERT(block.getModificationCounter() != counter);
+
+	counter = block.getModificationCounter();
+	block.raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_REPORT_META_CHANGE);
+	UASSERT(block.getModificationCounter() != counter);
+
+	counter = block.getModificationCounter();
+	block.resetModified();
+	UASSERT(block.getModificationCounter() == counter);
+}
+
+void TestMapBlock::testContentsCache(IGameDef *gamedef)
+{
+	auto sorted = [] (std::vector<content_t> v) {
+		std::sort(v.begin(), v.end());
+		return v;
+	};
+
+	MapBlock block({}, gamedef);
+	UASSERT(block.contents.empty());
+
+	for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+	for (s16 y = 0; y < MAP_BLOCKSIZE; y++)
+	for (s16 x = 0; x < MAP_BLOCKSIZE; x++)
+		block.setNodeNoCheck(x, y, z, MapNode(z > 7 ? t_CONTENT_STONE : CONTENT_AIR));
+
+	block.cacheContents();
+	UASSERT(sorted(block.contents) ==
+		sorted({CONTENT_AIR, t_CONTENT_STONE}));
+	UASSERT(block.mayContainAny({t_CONTENT_WATER, t_CONTENT_STONE}));
+	UASSERT(!block.mayContainAny({t_CONTENT_WATER, t_CONTENT_GRASS}));
+
+	// Setting a node adds its content to the cache
+	block.setNode({1, 1, 1}, MapNode(t_CONTENT_GRASS));
+	UASSERT(sorted(block.contents) ==
+		sorted({CONTENT_AIR, t_CONTENT_STONE, t_CONTENT_GRASS}));
+
+	// Other modifications drop the cache
+	block.raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_REPORT_META_CHANGE);
+	UASSERT(block.contents.empty());
+
+	// Including copying from a VoxelManipulator
+	{
+		block.cacheContents();
+		VoxelManipulator vm;
+		vm.addArea(VoxelArea(v3s16(0), v3s16(MAP_BLOCKSIZE - 1)));
+		block.copyTo(vm);
+		vm.setNode(v3s16(2, 2, 2), MapNode(t_CONTENT_WATER));
+		block.copyFrom(vm);
+		UASSERT(block.mayContainAny({t_CONTENT_WATER}));
+		vm.setNode(v3s16(2, 2, 2), MapNode(CONTENT_AIR));
+		block.copyFrom(vm);
+	}
+
+	// The loaded block knows its contents from the name-id mapping
+	std::string data;
+	block.serialize(data, SER_FMT_VER_HIGHEST_WRITE, true, -1);
+	{
+		MapBlock block2({}, gamedef);
+		block2.deSerialize(data, SER_FMT_VER_HIGHEST_WRITE, true);
+		UASSERT(!block2.do_not_cache_contents);
+		UASSERT(sorted(block2.contents) ==
+			sorted({CONTENT_AIR, t_CONTENT_STONE, t_CONTENT_GRASS}));
+	}
+
+	// Too many different contents are not cached
+	for (content_t c = 0; c <= CONTENT_TYPE_CACHE_MAX; c++)
+		block.setNodeNoCheck(c % MAP_BLOCKSIZE, c / MAP_BLOCKSIZE, 0, MapNode(c));
+	block.cacheContents();
+	UASSERT(block.do_not_cache_contents);
+	UASSERT(block.contents.empty());
+}
+
 void TestMapBlock::testSave29(IGameDef *gamedef)
 {
 	auto *ndef = gamedef->getNodeDefManager();
-	std::stringstream ss;
+	std::string data;
 
 	{
 		// Prepare test block
@@ -220,10 +431,11 @@ void TestMapBlock::testSave29(IGameDef *gamedef)
 		}
 		block.setNode({0, 0, 0}, MapNode(t_CONTENT_STONE));
 
-		block.serialize(ss, 29, true, -1);
+		block.serialize(data, 29, true, -1);
 	}
 
 	// Pick it apart a bit:
+	std::istringstream ss(data, std::ios_base::binary);
 	std::stringstream ss2;
 	decompressZstd(ss, ss2); // first zstd
 
@@ -309,12 +521,10 @@ void TestMapBlock::testLoad29(IGameDef *gamedef)
 	auto *ndef = gamedef->getNodeDefManager();
 	UASSERT(ndef->getId("default:chest") == CONTENT_IGNORE);
 
-	std::istringstream iss;
-	iss.str(std::string(buf));
-	u8 version = readU8(iss);
+	u8 version = buf[0];
 	UASSERTEQ(int, version, 29);
 	MapBlock block({}, gamedef);
-	block.deSerialize(iss, version, true);
+	block.deSerialize(buf.substr(1), version, true);
 
 	auto content_chest = ndef->getId("default:chest");
 	UASSERT(content_chest != CONTENT_IGNORE);
@@ -385,12 +595,10 @@ void TestMapBlock::testLoad20(IGameDef *gamedef)
 	gamedef->allocateUnknownNodeId("default:stone_with_coal");
 	gamedef->allocateUnknownNodeId("default:stone_with_iron");
 
-	std::istringstream iss;
-	iss.str(std::string(buf));
-	u8 version = readU8(iss);
+	u8 version = buf[0];
 	UASSERTEQ(int, version, 20);
 	MapBlock block({}, gamedef);
-	block.deSerialize(iss, version, true);
+	block.deSerialize(buf.substr(1), version, true);
 
 	auto *ndef = gamedef->getNodeDefManager();
 	auto get_node = [&] (s16 x, s16 y, s16 z) -> std::string_view {
@@ -452,12 +660,10 @@ void TestMapBlock::testLoadNonStd(IGameDef *gamedef)
 	UASSERT(MAP_BLOCKSIZE == 16);
 	const std::string_view buf(reinterpret_cast<const char*>(coded_mapblock_nonstd), sizeof(coded_mapblock_nonstd));
 
-	std::istringstream iss;
-	iss.str(std::string(buf));
-	u8 version = readU8(iss);
+	u8 version = buf[0];
 	UASSERT(version > 24);
 	MapBlock block({}, gamedef);
-	block.deSerialize(iss, version, true);
+	block.deSerialize(buf.substr(1), version, true);
 
 	auto *ndef = gamedef->getNodeDefManager();
 	UASSERTEQ(int, block.getNodeNoEx({0, 0, 0}).getContent(), ndef->getId("test:one"));
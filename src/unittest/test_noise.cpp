@@ -25,6 +25,7 @@ class TestNoise : public TestBase {
 	void testNoise3dWithFunPrimes();
 	void testNoise3dPoint();
 	void testNoise3dBulk();
+	void testNoiseMapsMatchPoints();
 	void testNoiseInvalidParams();
 
 	static const float expected_2d_results[10 * 10];
@@ -45,6 +46,7 @@ void TestNoise::runTests(IGameDef *gamedef)
 	TEST(testNoise3dWithFunPrimes);
 	TEST(testNoise3dPoint);
 	TEST(testNoise3dBulk);
+	TEST(testNoiseMapsMatchPoints);
 	TEST(testNoiseInvalidParams);
 }
 
@@ -145,6 +147,39 @@ void TestNoise::testNoise3dBulk()
 	}
 }
 
+void TestNoise::testNoiseMapsMatchPoints()
+{
+	// Odd sizes and offsets, small spreads so that rows cross many lattice cells
+	const u32 flagsets[] = {0, NOISE_FLAG_EASED, NOISE_FLAG_ABSVALUE,
+		NOISE_FLAG_EASED | NOISE_FLAG_ABSVALUE};
+	for (u32 flags : flagsets)
+	for (float spread : {3.0f, 17.0f, 250.0f}) {
+		NoiseParams np(0.5, 2, v3f(spread, spread * 1.5f, spread * 0.75f),
+			42, 3, 0.6, 1.5, flags);
+		const v3f origin(-123.25f, 57.5f, 1000.0f);
+
+		Noise noise2d(&np, 7, 37, 11);
+		float *values = noise2d.noiseMap2D(origin.X, origin.Y);
+		u32 i = 0;
+		for (u32 y = 0; y != 11; y++)
+		for (u32 x = 0; x != 37; x++, i++) {
+			float expected = NoiseFractal2D(&np, origin.X + x, origin.Y + y, 7);
+			UASSERT(std::fabs(values[i] - expected) <= 0.001f);
+		}
+
+		Noise noise3d(&np, 7, 13, 7, 5);
+		values = noise3d.noiseMap3D(origin.X, origin.Y, origin.Z);
+		i = 0;
+		for (u32 z = 0; z != 5; z++)
+		for (u32 y = 0; y != 7; y++)
+		for (u32 x = 0; x != 13; x++, i++) {
+			float expected = NoiseFractal3D(&np, origin.X + x, origin.Y + y,
+				origin.Z + z, 7);
+			UASSERT(std::fabs(values[i] - expected) <= 0.001f);
+		}
+	}
+}
+
 void TestNoise::testNoiseInvalidParams()
 {
 	bool exception_thrown = false;
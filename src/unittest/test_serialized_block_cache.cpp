@@ -0,0 +1,88 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2024 Luanti developers
+
+#include "test.h"
+
+#include "server/serialized_block_cache.h"
+
+class TestSerializedBlockCache : public TestBase
+{
+public:
+	TestSerializedBlockCache() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestSerializedBlockCache"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testGetPut();
+	void testInvalidate();
+	void testEviction();
+};
+
+static TestSerializedBlockCache g_test_instance;
+
+void TestSerializedBlockCache::runTests(IGameDef *gamedef)
+{
+	TEST(testGetPut);
+	TEST(testInvalidate);
+	TEST(testEviction);
+}
+
+static SerializedBlockCache::Data make_data(const char *str)
+{
+	return std::make_shared<const std::string>(str);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestSerializedBlockCache::testGetPut()
+{
+	SerializedBlockCache cache;
+	const v3s16 pos(1, 2, 3);
+
+	UASSERT(!cache.get(pos, 29, 5));
+	cache.put(pos, 29, 5, make_data("a"));
+	cache.put(pos, 28, 5, make_data("b"));
+	UASSERTEQ(size_t, cache.size(), 1);
+
+	UASSERT(*cache.get(pos, 29, 5) == "a");
+	UASSERT(*cache.get(pos, 28, 5) == "b");
+	// stale entries are not returned
+	UASSERT(!cache.get(pos, 29, 6));
+	UASSERT(!cache.get(pos, 27, 5));
+	UASSERT(!cache.get(v3s16(3, 2, 1), 29, 5));
+
+	cache.put(pos, 29, 6, make_data("c"));
+	UASSERT(*cache.get(pos, 29, 6) == "c");
+	UASSERT(!cache.get(pos, 29, 5));
+}
+
+void TestSerializedBlockCache::testInvalidate()
+{
+	SerializedBlockCache cache;
+	cache.put(v3s16(1, 1, 1), 29, 1, make_data("a"));
+	cache.put(v3s16(2, 2, 2), 29, 1, make_data("b"));
+
+	cache.invalidate(v3s16(1, 1, 1));
+	UASSERT(!cache.get(v3s16(1, 1, 1), 29, 1));
+	UASSERT(cache.get(v3s16(2, 2, 2), 29, 1));
+
+	cache.clear();
+	UASSERTEQ(size_t, cache.size(), 0);
+}
+
+void TestSerializedBlockCache::testEviction()
+{
+	SerializedBlockCache cache;
+	cache.put(v3s16(1, 1, 1), 29, 1, make_data("a"));
+	cache.put(v3s16(2, 2, 2), 29, 1, make_data("b"));
+
+	for (int i = 0; i < 20; i++) {
+		cache.step(1.0f);
+		// keep one of them alive
+		UASSERT(cache.get(v3s16(2, 2, 2), 29, 1));
+	}
+
+	UASSERT(!cache.get(v3s16(1, 1, 1), 29, 1));
+	UASSERTEQ(size_t, cache.size(), 1);
+}
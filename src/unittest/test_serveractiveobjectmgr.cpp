@@ -14,6 +14,7 @@
 
 #include "server/activeobjectmgr.h"
 #include "server/serveractiveobject.h"
+#include "threading/worker_pool.h"
 
 class TestServerActiveObjectMgr {
 	server::ActiveObjectMgr saomgr;
@@ -148,6 +149,22 @@ class TestServerActiveObjectMgr {
 	}
 };
 
+class PreparedMockServerActiveObject : public MockServerActiveObject
+{
+public:
+	void prepareStep(float dtime) override { prepared_dtime = dtime; }
+
+	float prepared_dtime = 0.0f;
+};
+
+class PlayerMockServerActiveObject : public MockServerActiveObject
+{
+public:
+	using MockServerActiveObject::MockServerActiveObject;
+
+	ActiveObjectType getType() const override { return ACTIVEOBJECT_TYPE_PLAYER; }
+};
+
 
 TEST_CASE("server active object manager") {
 
@@ -273,6 +290,46 @@ SECTION("get added active objects around pos") {
 	cur_objects.clear();
 	saomgr.getAddedActiveObjectsAroundPos(v3f(), "singleplayer", 740, 50, cur_objects, result);
 	CHECK(result.size() == 2);
+	CHECK(std::is_sorted(result.begin(), result.end()));
+
+	// Already known objects aren't added again
+	cur_objects.insert(result.begin(), result.end());
+	result.clear();
+	saomgr.getAddedActiveObjectsAroundPos(v3f(), "singleplayer", 740, 50, cur_objects, result);
+	CHECK(result.empty());
+
+	// Players use their own range, 0 is unlimited
+	auto player = std::make_unique<PlayerMockServerActiveObject>(nullptr, v3f(60, 0, 0));
+	REQUIRE(saomgr.registerObject(std::move(player)));
+	result.clear();
+	saomgr.getAddedActiveObjectsAroundPos(v3f(), "singleplayer", 740, 50, cur_objects, result);
+	CHECK(result.empty());
+	saomgr.getAddedActiveObjectsAroundPos(v3f(), "singleplayer", 10, 0, cur_objects, result);
+	CHECK(result.size() == 1);
+
+	saomgr.clear();
+}
+
+SECTION("prepare step") {
+	server::ActiveObjectMgr saomgr;
+	std::vector<PreparedMockServerActiveObject *> saos;
+	for (u32 i = 0; i < 100; i++) {
+		auto sao_u = std::make_unique<PreparedMockServerActiveObject>();
+		saos.push_back(sao_u.get());
+		saomgr.registerObject(std::move(sao_u));
+	}
+	saos[7]->markForRemoval();
+
+	// Nothing to gain without threads, step() does it all
+	WorkerPool serial("test", 0);
+	saomgr.prepareStep(serial, 0.5f);
+	for (auto *sao : saos)
+		CHECK(sao->prepared_dtime == 0.0f);
+
+	WorkerPool pool("test", 2);
+	saomgr.prepareStep(pool, 0.5f);
+	for (size_t i = 0; i < saos.size(); i++)
+		CHECK(saos[i]->prepared_dtime == (i == 7 ? 0.0f : 0.5f));
 
 	saomgr.clear();
 }
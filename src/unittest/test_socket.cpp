@@ -25,6 +25,7 @@ class TestSocket : public TestBase {
 
 	void testIPv4Socket();
 	void testIPv6Socket();
+	void testBatch();
 
 	static const int port = 30003;
 };
@@ -34,6 +35,7 @@ static TestSocket g_test_instance;
 void TestSocket::runTests(IGameDef *gamedef)
 {
 	TEST(testIPv4Socket);
+	TEST(testBatch);
 
 	if (g_settings->getBool("enable_ipv6"))
 		TEST(testIPv6Socket);
@@ -135,3 +137,62 @@ void TestSocket::testIPv6Socket()
 				Address(&bytes, 0).getAddress6().s6_addr, 16) == 0);
 	}
 }
+
+void TestSocket::testBatch()
+{
+	UDPSocket socket(false);
+	socket.Bind(Address(0, 0, 0, 0, port + 1));
+	const Address loopback(127, 0, 0, 1, port + 1);
+
+	// Datagrams of different sizes keep their boundaries and order
+	const int sizes[] = {100, 37, 1};
+	u8 sendbuffers[3][100];
+	UDPSocket::Datagram datagrams[3];
+	for (int i = 0; i < 3; i++) {
+		memset(sendbuffers[i], 'a' + i, sizeof(sendbuffers[i]));
+		datagrams[i].address = loopback;
+		datagrams[i].data = sendbuffers[i];
+		datagrams[i].size = sizes[i];
+	}
+	UASSERTEQ(int, socket.SendBatch(datagrams, 3), 3);
+
+	sleep_ms(50);
+
+	u8 rcvbuffers[3][256];
+	int received = 0;
+	while (received < 3) {
+		for (int i = received; i < 3; i++) {
+			datagrams[i].data = rcvbuffers[i];
+			datagrams[i].size = sizeof(rcvbuffers[i]);
+		}
+		int count = socket.ReceiveBatch(&datagrams[received], 3 - received);
+		if (count == 0)
+			break;
+		received += count;
+	}
+	UASSERTEQ(int, received, 3);
+
+	for (int i = 0; i < 3; i++) {
+		UASSERTEQ(int, datagrams[i].size, sizes[i]);
+		UASSERT(memcmp(rcvbuffers[i], sendbuffers[i], sizes[i]) == 0);
+		UASSERT(datagrams[i].address == loopback);
+	}
+
+	// Nothing left
+	UASSERTEQ(int, socket.ReceiveBatch(datagrams, 3), 0);
+
+	// A datagram that can't be sent doesn't stop the others
+	IPv6AddressBytes bytes;
+	memset(bytes.bytes, 0, sizeof(bytes.bytes));
+	bytes.bytes[15] = 1;
+	for (int i = 0; i < 3; i++) {
+		datagrams[i].address = loopback;
+		datagrams[i].data = sendbuffers[i];
+		datagrams[i].size = sizes[i];
+	}
+	datagrams[1].address = Address(&bytes, port + 1);
+	UASSERTEQ(int, socket.SendBatch(datagrams, 3), 2);
+	UASSERT(!datagrams[0].error);
+	UASSERT(datagrams[1].error);
+	UASSERT(!datagrams[2].error);
+}
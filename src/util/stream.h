@@ -5,6 +5,7 @@
 #pragma once
 
 #include <iostream>
+#include <string>
 #include <string_view>
 #include <functional>
 
@@ -60,3 +61,51 @@ class DummyStreamBuffer : public std::streambuf {
 		return n;
 	}
 };
+
+// Appends everything written to it to a string, without buffering
+class StringAppendBuffer : public std::streambuf {
+public:
+	StringAppendBuffer(std::string &target) : m_target(target) {}
+
+	int overflow(int c) override {
+		if (c != traits_type::eof())
+			m_target.push_back(c);
+		return 0;
+	}
+
+	std::streamsize xsputn(const char *s, std::streamsize n) override {
+		m_target.append(s, n);
+		return n;
+	}
+
+private:
+	std::string &m_target;
+};
+
+// Reads from a string_view without copying it
+class StringViewBuffer : public std::streambuf {
+public:
+	StringViewBuffer(std::string_view data) {
+		char *p = const_cast<char *>(data.data());
+		setg(p, p, p + data.size());
+	}
+
+	pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+			std::ios_base::openmode which) override {
+		if (!(which & std::ios_base::in))
+			return pos_type(off_type(-1));
+		off_type pos = off;
+		if (dir == std::ios_base::cur)
+			pos += gptr() - eback();
+		else if (dir == std::ios_base::end)
+			pos += egptr() - eback();
+		if (pos < 0 || pos > egptr() - eback())
+			return pos_type(off_type(-1));
+		setg(eback(), eback() + pos, egptr());
+		return pos_type(pos);
+	}
+
+	pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+		return seekoff(off_type(pos), std::ios_base::beg, which);
+	}
+};
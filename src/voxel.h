@@ -480,7 +480,7 @@ class VoxelManipulator
 		Copy data and set flags to 0
 		dst_area.getExtent() <= src_area.getExtent()
 	*/
-	void copyFrom(MapNode *src, bool is_mono_block, const VoxelArea& src_area,
+	void copyFrom(const MapNode *src, bool is_mono_block, const VoxelArea& src_area,
 			v3s16 from_pos, v3s16 to_pos, const v3s16 &size);
 
 	// Copy data